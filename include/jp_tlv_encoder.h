@@ -10,17 +10,29 @@
 
 #include <stdio.h>
 
+typedef struct jp_string_table jp_string_table_t;
+
 typedef struct jp_TLV_records
 {
 
   apr_hash_t         *key_index;
   apr_array_header_t *record_list;
 
+  int                 block_filters;     /* attach a Bloom filter to every block written */
+  apr_array_header_t *filter_value_keys; /* the keys whose string values also go to the filters */
+
+  jp_string_table_t  *string_values;     /* the string values interned, NULL if they are not */
+
+  uint32_t            cluster_window;    /* records grouped by shape, this many at a time, when exported; 0 to keep them in order */
+  const char         *cluster_key;       /* within a shape, the records are sorted by the value of this key, NULL for none */
+  int                 keep_order;        /* the arrival order of the clustered records is written along with them */
+
 } jp_TLV_records_t;
 
 typedef struct jp_TLV_string
 {
   uint32_t value_length;
+  uint32_t value_hash;   /* the hash of an interned value, 0 if it was not computed */
   char*    value_buffer;
 } jp_TLV_string_t;
 
@@ -120,6 +132,26 @@ int jp_add_string_kv_pair_to_record(jp_TLV_record_t *record,
                                     size_t           key_index,
                                     const char*      value);
 
+/**
+ * Adds a key-value pair to a TLV record with a string value, interned in the strings of the collection
+ *
+ * @param record_collection  The collection the record is added to
+ * @param record             The record that owns the key-value pair
+ * @param key_index          The index of the key in the key index of the collection
+ * @param value              A string value, it may be released once the call returns
+ * @param length             The length of the value
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ * @remarks Identical values share a single copy along with their hash, which the block writer reuses to
+ *          find them in its dictionaries. Without jp_enable_string_interning, the value is copied.
+ */
+int jp_add_interned_string_kv_pair_to_record(jp_TLV_records_t *record_collection,
+                                             jp_TLV_record_t  *record,
+                                             size_t            key_index,
+                                             const char       *value,
+                                             uint32_t          length);
+
 /**
  * Adds a key-value pair to a TLV record with an integer value
  *
@@ -283,6 +315,61 @@ apr_hash_t* jp_import_key_index_from_file(apr_pool_t *pool,
                                           FILE       *input);
 
 
+typedef struct jp_key_index_map jp_key_index_map_t;
+
+/**
+ *  Opens a key index file in place: the file is memory mapped (or read in memory when it
+ *  can not be mapped) from the current position, and no hash is rebuilt
+ *
+ *  @param pool   A memory pool, the mapping is released with the pool
+ *  @param input  The input TLV key index file
+ *
+ * @returns the key index map, NULL if the file is not a key index
+ */
+jp_key_index_map_t* jp_key_index_map_open(apr_pool_t *pool,
+                                          FILE       *input);
+
+/**
+ *  Releases the mapping of a key index before its pool is destroyed
+ *
+ *  @param map  The key index map
+ */
+void jp_key_index_map_close(jp_key_index_map_t *map);
+
+/**
+ *  Counts the keys of a key index map
+ *
+ *  @param map  The key index map
+ *
+ * @returns the number of keys, indices go from 1 to this number
+ */
+uint32_t jp_key_index_map_count(const jp_key_index_map_t *map);
+
+/**
+ *  Looks up a key by its index
+ *
+ *  @param map         The key index map
+ *  @param index       The key index
+ *  @param key_length  Set to the key length if not NULL
+ *
+ * @returns the NUL terminated key, which lives as long as the map, NULL if the index is unknown
+ */
+const char* jp_key_index_map_key(const jp_key_index_map_t *map,
+                                       uint32_t            index,
+                                       uint32_t           *key_length);
+
+/**
+ *  Looks up the index of a key
+ *
+ *  @param map  The key index map
+ *  @param key  The key
+ *
+ * @returns the key index, 0 if the key is unknown
+ */
+uint32_t jp_key_index_map_find(const jp_key_index_map_t *map,
+                               const char               *key);
+
+
 /**
  *  Builds The inverse key array from a key index map
  *
@@ -307,15 +394,197 @@ int jp_update_records_from_json_file(apr_pool_t       *pool,
                                      jp_TLV_records_t *record_collection,
                                      FILE             *input);
 
+typedef struct jp_json_line_reader jp_json_line_reader_t;
+
+/**
+ * Creates an incremental JSON lines reader, which keeps its partial line and parser state between chunks
+ *
+ * @param pool  A memory pool, the reader is released with the pool
+ *
+ * @returns the reader
+ */
+jp_json_line_reader_t* jp_json_line_reader_make(apr_pool_t *pool);
+
+/**
+ * Updates the TLV records from a chunk of JSON lines
+ *
+ * @param reader            The JSON lines reader
+ * @param pool              A memory pool for the new records
+ * @param record_collection The TLV record collection
+ * @param data              The chunk
+ * @param size              The chunk size
+ * @param max_records       Stops before a line once the collection holds that many records, 0 for no limit
+ * @param consumed          Set to the number of bytes of the chunk consumed
+ *
+ * @returns zero if succeeded, non-zero if a line could not be parsed; the reader then skips that line
+ *          and consumed tells where to resume
+ *
+ * @remarks An incomplete line at the end of the chunk is kept, and completed by the next chunks
+ */
+int jp_json_line_reader_feed(jp_json_line_reader_t *reader,
+                             apr_pool_t            *pool,
+                             jp_TLV_records_t      *record_collection,
+                             const char            *data,
+                             size_t                 size,
+                             size_t                 max_records,
+                             size_t                *consumed);
+
+/**
+ * Parses the last line when the input ends without a line terminator
+ *
+ * @param reader            The JSON lines reader
+ * @param pool              A memory pool for the new record
+ * @param record_collection The TLV record collection
+ *
+ * @returns zero if succeeded, non-zero if the line could not be parsed
+ */
+int jp_json_line_reader_finish(jp_json_line_reader_t *reader,
+                               apr_pool_t            *pool,
+                               jp_TLV_records_t      *record_collection);
+
+typedef struct jp_json_line_writer jp_json_line_writer_t;
+
+/**
+ * Creates a JSON lines writer, which assembles the lines in a large buffer written to the output once full
+ *
+ * @param pool    A memory pool, the writer is released with the pool
+ * @param output  An output file stream, written through its descriptor
+ *
+ * @returns the writer
+ */
+jp_json_line_writer_t* jp_json_line_writer_make(apr_pool_t *pool,
+                                                FILE       *output);
+
+/**
+ * Writes a TLV record as a JSON object on its own line
+ *
+ * @param writer     The JSON lines writer
+ * @param record     The record
+ * @param key_index  The key index of the record key indices
+ *
+ * @returns zero if succeeded, non-zero if a key index is unknown or the buffer cannot grow
+ *
+ * @remarks doubles are written with the fewest digits that read back as the same value,
+ *          infinities and NaN as null
+ */
+int jp_json_line_writer_add_record(      jp_json_line_writer_t *writer,
+                                   const jp_TLV_record_t       *record,
+                                   const jp_key_index_map_t    *key_index);
+
+/**
+ * Writes out the buffered lines
+ *
+ * @param writer  The JSON lines writer
+ */
+void jp_json_line_writer_flush(jp_json_line_writer_t *writer);
+
+typedef struct jp_writer jp_writer_t;
+
+/**
+ * Starts a file set written record by record from typed fields, without building TLV records or JSON text
+ *
+ * @param pool              A memory pool, the writer is released with the pool
+ * @param kv_pair_output    The kv-pair output file
+ * @param key_index_output  The key index output file, written by jp_writer_close
+ *
+ * @returns the writer, NULL if the output cannot be started
+ *
+ * @remarks a writer is not thread safe; fields go straight into the block being assembled,
+ *          and once the keys are known a steady stream of records needs no allocation
+ */
+jp_writer_t* jp_writer_open(apr_pool_t *pool,
+                            FILE       *kv_pair_output,
+                            FILE       *key_index_output);
+
+/**
+ * Interns a key, to be done once for every key before the records are written
+ *
+ * @param writer  The writer
+ * @param key     The key
+ *
+ * @returns the key id to pass to the jp_writer_add_* functions
+ */
+uint32_t jp_writer_key(      jp_writer_t *writer,
+                       const char        *key);
+
+/**
+ * Starts a record, whose fields are then added with the jp_writer_add_* functions
+ *
+ * @param writer  The writer
+ *
+ * @returns zero if succeeded, non-zero if a record is already started or the writer failed
+ */
+int jp_writer_begin_record(jp_writer_t *writer);
+
+/**
+ * Adds a boolean field to the current record
+ *
+ * @returns zero if succeeded, non-zero if no record is started, the key id is unknown or the writer failed
+ */
+int jp_writer_add_boolean(jp_writer_t *writer,
+                          uint32_t     key_id,
+                          int          value);
+
+/**
+ * Adds an integer field to the current record
+ *
+ * @returns zero if succeeded, non-zero if no record is started, the key id is unknown or the writer failed
+ */
+int jp_writer_add_int(jp_writer_t *writer,
+                      uint32_t     key_id,
+                      int32_t      value);
+
+/**
+ * Adds a double field to the current record
+ *
+ * @returns zero if succeeded, non-zero if no record is started, the key id is unknown or the writer failed
+ */
+int jp_writer_add_double(jp_writer_t *writer,
+                         uint32_t     key_id,
+                         double       value);
+
+/**
+ * Adds a string field to the current record
+ *
+ * @param value   The string, copied before returning, it needs no NUL terminator
+ * @param length  The length of the string
+ *
+ * @returns zero if succeeded, non-zero if no record is started, the key id is unknown or the writer failed
+ */
+int jp_writer_add_string(      jp_writer_t *writer,
+                               uint32_t     key_id,
+                         const char        *value,
+                               uint32_t     length);
+
+/**
+ * Ends the current record
+ *
+ * @param writer  The writer
+ *
+ * @returns zero if succeeded, non-zero if no record is started or the writer failed
+ */
+int jp_writer_end_record(jp_writer_t *writer);
+
+/**
+ * Writes the last block, the footer and the key index; a record left open is dropped
+ *
+ * @param writer  The writer
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred at any point
+ */
+int jp_writer_close(jp_writer_t *writer);
+
 
 /**
  *  Exports a TLV record to a file set
  *
  *  @param record_collection The TLV record to export
  *  @param kv_pair_output    The output TLV key-value records file
- *  @param key_index_output  The output key index file
+ *  @param key_index_output  The output key index file, NULL to write a single-file container to kv_pair_output
  *
  *  @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ *  @remarks A single-file container holds the key index and the kv-pair records as two sections of one file
  */
 int jp_export_records_to_file_set(jp_TLV_records_t *record_collection,
                                   FILE             *kv_pair_output,
@@ -327,15 +596,547 @@ int jp_export_records_to_file_set(jp_TLV_records_t *record_collection,
  *
  *  @param record_collection The TLV record collection to append to
  *  @param kv_pair_input     The input TLV key-value records file
- *  @param key_index_input   The input key index file
+ *  @param key_index_input   The input key index file, NULL if kv_pair_input is a single-file container
  *
  * @returns zero if succeeded, non-zero if an error condition occurred
  *
- * @remarks More than one set of kv-pairs/key index files can be used to update the same record collection
+ * @remarks More than one set of kv-pairs/key index files can be used to update the same record collection.
+ *          The records clustered with their arrival order kept are imported in that order.
  */
 int jp_import_records_from_file_set(jp_TLV_records_t *record_collection,
                                     FILE             *kv_pair_input,
                                     FILE             *key_index_input);
 
+/**
+ *  Imports the records of several file sets, decoding them on a pool of threads
+ *
+ *  @param record_collection The TLV record collection to append to
+ *  @param kv_pair_inputs    The input TLV key-value records files
+ *  @param key_index_inputs  The input key index files, NULL if the inputs are single-file containers
+ *  @param nb_inputs         The number of file sets
+ *  @param nb_workers        The number of file sets decoded at the same time
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ * @remarks The records are added in the order of the inputs, as with jp_import_records_from_file_set on every
+ *          input in turn. Every file set is decoded to a collection of its own first, whose pool lives as long
+ *          as the pool of record_collection.
+ */
+int jp_import_file_sets(jp_TLV_records_t *record_collection,
+                        FILE* const      *kv_pair_inputs,
+                        FILE* const      *key_index_inputs,
+                        int               nb_inputs,
+                        unsigned int      nb_workers);
+
+/**
+ *  Exports the records of a collection to several file sets, routing every record by the hash of the value of a key
+ *
+ *  @param record_collection  The TLV records to export
+ *  @param partition_key      The key whose value picks the file set of a record
+ *  @param kv_pair_outputs    The TLV key-value records output files, one for every partition
+ *  @param key_index_outputs  The key index output files, NULL to write single-file containers
+ *  @param nb_partitions      The number of partitions
+ *  @param nb_workers         The number of partitions written at the same time
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ * @remarks A record goes to the partition numbered by the hash of its value (as value indices hash the strings and
+ *          the integers) modulo nb_partitions, so the records with the same value end up in the same file set
+ *          whatever the input. The records without the key, or with a double or boolean value, go to partition 0.
+ *          Every partition is written with the key index of the collection, keeps the order of its records
+ *          and the settings of the collection (filters, clustering).
+ */
+int jp_export_records_to_partitions(      jp_TLV_records_t *record_collection,
+                                    const char             *partition_key,
+                                          FILE* const      *kv_pair_outputs,
+                                          FILE* const      *key_index_outputs,
+                                          uint32_t          nb_partitions,
+                                          unsigned int      nb_workers);
+
+/**
+ *  Appends the records of a collection to an existing file set
+ *
+ *  @param record_collection The TLV records to append
+ *  @param kv_pair_file      The TLV key-value records file, opened for reading and writing
+ *  @param key_index_file    The key index file, opened for reading and writing
+ *
+ *  @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ *  @remarks Empty files start a new file set. Only the new records are written, the footer of the kv-pair
+ *           file is rewritten and the key index is extended with the new keys. The records of the collection
+ *           are renumbered and its key index is replaced by the key index of the file set.
+ *           Single-file containers cannot be appended to.
+ */
+int jp_append_records_to_file_set(jp_TLV_records_t *record_collection,
+                                  FILE             *kv_pair_file,
+                                  FILE             *key_index_file);
+
+#define JP_SORT_DEFAULT_MEMORY  ((size_t) 256 * 1024 * 1024)
+
+/**
+ *  Merges file sets into a single file set whose records are sorted by the value of a key, in a bounded
+ *  amount of memory: the records are read in runs which fit in the budget, every run is sorted and written
+ *  to a temporary file, and the runs are then merged together
+ *
+ *  @param record_collection    The collection whose block filter settings apply, the keys written are added to its key index
+ *  @param kv_pair_inputs       The input kv-pair files, or the single-file containers
+ *  @param key_index_inputs     The input key index files, NULL if the inputs are single-file containers
+ *  @param nb_inputs            The number of input file sets
+ *  @param sort_key             The key the records are sorted by
+ *  @param memory_budget        The approximate number of bytes of records and read buffers held at once
+ *  @param temporary_directory  The directory the runs are written to, NULL for the one of tmpfile
+ *  @param kv_pair_output       The kv-pair output file
+ *  @param key_index_output     The key index output file, NULL to write a single-file container
+ *
+ *  @returns zero if succeeded, non-zero if an error condition occurred
+ *
+ *  @remarks Numbers come first, by value, then booleans and strings, byte by byte, and the records without
+ *           the key last; the records with the same value stay in the order of the inputs. The runs are
+ *           removed from the directory as soon as they are created. The records of the collection and its
+ *           clustering settings are left aside.
+ */
+int jp_sort_file_sets(jp_TLV_records_t *record_collection,
+                      FILE* const      *kv_pair_inputs,
+                      FILE* const      *key_index_inputs,
+                      int               nb_inputs,
+                      const char       *sort_key,
+                      size_t            memory_budget,
+                      const char       *temporary_directory,
+                      FILE             *kv_pair_output,
+                      FILE             *key_index_output);
+
+typedef struct jp_concurrent_records jp_concurrent_records_t;
+
+/**
+ *  Creates a record collection filled by several threads, each through a segment of its own
+ *
+ *  @param pool  A memory pool, only used by the collection from now on
+ *
+ *  @returns the collection, NULL if it cannot be created
+ */
+jp_concurrent_records_t* jp_concurrent_records_make(apr_pool_t *pool);
+
+/**
+ *  Attaches a Bloom filter to every block exported from a concurrent collection, as jp_enable_block_filters
+ */
+void jp_concurrent_records_enable_block_filters(      jp_concurrent_records_t *records,
+                                                const char* const             *value_keys,
+                                                      int                      nb_value_keys);
+
+/**
+ *  Adds a segment to a concurrent collection, can be called from any thread
+ *
+ *  @param records  The concurrent collection
+ *
+ *  @returns the segment, NULL if it cannot be created
+ *
+ *  @remarks A segment is an ordinary record collection, with a key index of its own, for a single thread
+ *           at a time: records are added to it with jp_update_records_from_json, jp_json_line_reader_feed
+ *           or jp_find_or_add_key and jp_add_record_to_TLV_collection, without any lock. Its records are
+ *           allocated from its pool, apr_hash_pool_get(segment->key_index).
+ */
+jp_TLV_records_t* jp_concurrent_records_segment_make(jp_concurrent_records_t *records);
+
+/**
+ *  Exports the records of all the segments, in the order the segments were created, as a single file set
+ *
+ *  @param records           The concurrent collection, with no thread adding records to it
+ *  @param kv_pair_output    The TLV key-value records output file
+ *  @param key_index_output  The key index output file, NULL to write a single-file container
+ *
+ *  @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_export_concurrent_records_to_file_set(jp_concurrent_records_t *records,
+                                             FILE                    *kv_pair_output,
+                                             FILE                    *key_index_output);
+
+/**
+ *  Numbers the keys of a collection as a key dictionary shared by many writers does, appending to the
+ *  dictionary the keys it does not hold yet
+ *
+ *  @param record_collection  A collection of records, renumbered along with its key index
+ *  @param dictionary_path    The dictionary file, created if it does not exist
+ *  @param version            Set to the version of the dictionary the keys are numbered by, its number of keys, unless NULL
+ *
+ *  @returns zero if succeeded, non-zero if the dictionary cannot be read or appended to
+ *
+ *  @remarks The dictionary is locked with flock while it is read and appended to, and a key keeps its number
+ *           for good: the file sets exported after binding their collection to the same dictionary number their
+ *           keys alike, and jp_concatenate_file_sets merges them without decoding. Every key of the dictionary
+ *           goes to the key index of the collection, binding an empty collection loads the dictionary.
+ */
+int jp_bind_key_dictionary(jp_TLV_records_t *record_collection,
+                           const char       *dictionary_path,
+                           uint32_t         *version);
+
+/**
+ *  Merges file sets whose keys are numbered alike by copying their blocks, without decoding them
+ *
+ *  @param pool              A memory pool
+ *  @param kv_pair_inputs    The input TLV key-value records files
+ *  @param key_index_inputs  The input key index files, NULL if the inputs are single-file containers
+ *  @param nb_inputs         The number of file sets
+ *  @param kv_pair_output    The TLV key-value records output file
+ *  @param key_index_output  The key index output file, NULL to write a single-file container
+ *
+ *  @returns zero if succeeded, 1 if the file sets cannot be copied and nothing was written, -1 on error
+ *
+ *  @remarks The key index of every input must be a prefix of the longest one, as with the file sets bound to
+ *           the same key dictionary. Their blocks are checked against their checksums and written as they are,
+ *           in the order of the inputs; the file sets predating the block framing, or whose blocks carry their
+ *           arrival order, cannot be copied.
+ */
+int jp_concatenate_file_sets(apr_pool_t   *pool,
+                             FILE* const  *kv_pair_inputs,
+                             FILE* const  *key_index_inputs,
+                             int           nb_inputs,
+                             FILE         *kv_pair_output,
+                             FILE         *key_index_output);
+
+/**
+ *  Merges file sets by copying their blocks with their keys renumbered, without decoding their values
+ *
+ *  @param pool              A memory pool
+ *  @param kv_pair_inputs    The input TLV key-value records files
+ *  @param key_index_inputs  The input key index files, NULL if the inputs are single-file containers
+ *  @param nb_inputs         The number of file sets
+ *  @param kv_pair_output    The TLV key-value records output file
+ *  @param key_index_output  The key index output file, NULL to write a single-file container
+ *
+ *  @returns zero if succeeded, 1 if the file sets cannot be transcoded and nothing was written, -1 on error
+ *
+ *  @remarks The keys are numbered in the order of the inputs, then of their key index. Only the framing of the
+ *           records is read: the value bytes are copied as they are, and the checksums of the blocks recomputed.
+ *           The Bloom filters of the blocks are dropped; the file sets predating the block framing, or whose
+ *           blocks carry their arrival order, cannot be transcoded.
+ */
+int jp_transcode_file_sets(apr_pool_t   *pool,
+                           FILE* const  *kv_pair_inputs,
+                           FILE* const  *key_index_inputs,
+                           int           nb_inputs,
+                           FILE         *kv_pair_output,
+                           FILE         *key_index_output);
+
+typedef struct jp_verify_report
+{
+  uint64_t nb_records;
+  uint32_t nb_blocks;
+  uint32_t nb_unchecked_blocks;
+  uint32_t nb_keys;
+  int      legacy;
+} jp_verify_report_t;
+
+/**
+ *  Checks the integrity of a file set without decoding any value: the framing and the checksum of
+ *  every block, the footer and the trailer of the kv-pair file, and the tables of the key index
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param report           Filled with what was checked, may be NULL
+ *
+ *  @returns zero if the file set is sound, non-zero otherwise, the reason is printed on stderr
+ *
+ *  @remarks blocks written before the checksums (format version 2) are only checked for framing,
+ *           and kv-pair files written before the block framing (legacy) only for their key index
+ */
+int jp_verify_file_set(apr_pool_t         *pool,
+                       FILE               *kv_pair_input,
+                       FILE               *key_index_input,
+                       jp_verify_report_t *report);
+
+/**
+ *  Attaches a Bloom filter to every block exported from a collection, so that scans for a key, or
+ *  for a string value of a key, skip the blocks which cannot hold it
+ *
+ *  @param record_collection  A collection of records
+ *  @param value_keys         The keys whose string values are also added to the filters
+ *  @param nb_value_keys      The number of value keys, 0 to only filter on key presence
+ */
+void jp_enable_block_filters(      jp_TLV_records_t *record_collection,
+                             const char* const      *value_keys,
+                                   int               nb_value_keys);
+
+/**
+ *  Interns the string values of the records added from JSON, imported from file sets, or added with
+ *  jp_add_interned_string_kv_pair_to_record: identical values share a single copy, and carry the hash of the value
+ *
+ *  @param record_collection  A collection of records
+ *  @param pool               The pool the values are copied to, it must live as long as the records
+ *
+ *  @remarks The values of the keys which hardly ever repeat are copied as they are after a few values.
+ *           When the pool of the records is cleared, the interning is enabled again with the new pool.
+ */
+void jp_enable_string_interning(jp_TLV_records_t *record_collection,
+                                apr_pool_t       *pool);
+
+#define JP_CLUSTER_DEFAULT_WINDOW  16384
+#define JP_CLUSTER_MAX_WINDOW      (1 << 24)
+
+/**
+ *  Groups the records by shape, the sequence of their keys, when they are exported: the records of the
+ *  same shape follow each other, in the order the first of them arrived, so that blocks hold runs of
+ *  homogeneous records, which compress better and scan faster
+ *
+ *  @param record_collection  A collection of records
+ *  @param window             The number of consecutive records regrouped at a time, at most JP_CLUSTER_MAX_WINDOW
+ *  @param sort_key           Within a shape, the records are sorted by the value of this key, NULL to keep them in order
+ *  @param keep_order         Non-zero to write the arrival order of every record along with the blocks, and
+ *                            jp_import_records_from_file_set then restores it
+ *
+ *  @remarks Records are only moved within a window, the larger the window the longer the runs and the
+ *           more records held in memory at once. Appends and exports are clustered alike.
+ */
+void jp_enable_record_clustering(      jp_TLV_records_t *record_collection,
+                                       uint32_t          window,
+                                 const char             *sort_key,
+                                       int               keep_order);
+
+typedef struct jp_scan_report
+{
+  uint64_t nb_blocks;
+  uint64_t nb_blocks_skipped;
+  uint64_t nb_records;
+  uint64_t nb_records_matched;
+} jp_scan_report_t;
+
+/**
+ *  A function receiving the records matched by jp_scan_file_set
+ *
+ *  @param context        The context given to jp_scan_file_set
+ *  @param record_number  The position of the record in the file, from 0, its arrival ordinal if the
+ *                        records were clustered with their order kept
+ *  @param record         The record, with the key indices of the file set
+ *  @param key_index      The key index of the file set
+ *
+ *  @returns zero to go on, non-zero to stop the scan
+ */
+typedef int (*jp_scan_record_fn)(      void               *context,
+                                       uint64_t            record_number,
+                                 const jp_TLV_record_t    *record,
+                                 const jp_key_index_map_t *key_index);
+
+/**
+ *  Scans a file set for the records holding a key, or a key with a given string value, skipping
+ *  the blocks whose Bloom filter rules the probe out without decoding them
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param key              The key the records must hold, NULL to match every record
+ *  @param string_value     The string value the key must have, NULL to only require the key
+ *  @param record_fn        The function receiving the matching records
+ *  @param context          The context handed to record_fn
+ *  @param report           Filled with the number of blocks skipped and records matched, may be NULL
+ *
+ *  @returns zero if succeeded, non-zero if the file set is corrupted
+ *
+ *  @remarks the records handed to record_fn are released once their block is scanned,
+ *           and blocks without a filter are always decoded. The records clustered with their
+ *           order kept are handed over in that order, those of a cluster window held until
+ *           it is read through
+ */
+int jp_scan_file_set(apr_pool_t        *pool,
+                     FILE              *kv_pair_input,
+                     FILE              *key_index_input,
+                     const char        *key,
+                     const char        *string_value,
+                     jp_scan_record_fn  record_fn,
+                     void              *context,
+                     jp_scan_report_t  *report);
+
+/**
+ *  Scans a file set for the records where a key has an integer or double value within a range,
+ *  skipping the blocks whose zone map puts every value of the key outside of it
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param key              The numeric key
+ *  @param min              The lowest value matched, -INFINITY for no lower bound
+ *  @param max              The highest value matched, INFINITY for no upper bound
+ *  @param record_fn        The function receiving the matching records
+ *  @param context          The context handed to record_fn
+ *  @param report           Filled with the number of blocks skipped and records matched, may be NULL
+ *
+ *  @returns zero if succeeded, non-zero if the file set is corrupted
+ *
+ *  @remarks both bounds are inclusive, and blocks without a zone map are always decoded.
+ *           The records are handed over in their arrival order, as by jp_scan_file_set
+ */
+int jp_scan_file_set_range(apr_pool_t        *pool,
+                           FILE              *kv_pair_input,
+                           FILE              *key_index_input,
+                           const char        *key,
+                           double             min,
+                           double             max,
+                           jp_scan_record_fn  record_fn,
+                           void              *context,
+                           jp_scan_report_t  *report);
+
+typedef struct jp_value_index jp_value_index_t;
+
+/**
+ *  Builds the value index of a file set: a sidecar file listing, for every string or integer value
+ *  of the keys indexed, the blocks holding it, so that looking the value up only decodes those
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param keys             The keys indexed
+ *  @param nb_keys          The number of keys
+ *  @param index_output     The value index output file
+ *
+ *  @returns zero if succeeded, non-zero otherwise
+ *
+ *  @remarks the index is only valid as long as the file set is not appended to, or rewritten
+ */
+int jp_build_value_index(      apr_pool_t  *pool,
+                               FILE        *kv_pair_input,
+                               FILE        *key_index_input,
+                         const char* const *keys,
+                               int          nb_keys,
+                               FILE        *index_output);
+
+/**
+ *  Opens a value index written by jp_build_value_index
+ *
+ *  @param pool   A memory pool, the index is mapped until it is cleared
+ *  @param input  The value index file
+ *
+ *  @returns the value index, NULL if it is corrupted
+ */
+jp_value_index_t* jp_value_index_open(apr_pool_t *pool,
+                                      FILE       *input);
+
+/**
+ *  Looks up the records where a key has a value, through the value index of the file set: only
+ *  the blocks the index lists for the value are read and decoded
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param index            The value index of the file set
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param key              The key, one of the keys indexed
+ *  @param value            The string value looked up, or the decimal text of an integer
+ *  @param record_fn        The function receiving the matching records
+ *  @param context          The context handed to record_fn
+ *  @param report           Filled with the number of blocks skipped and records matched, may be NULL
+ *
+ *  @returns zero if succeeded, non-zero if the key is not indexed, the index was built from another
+ *           file set, or either of them is corrupted
+ *
+ *  @remarks the matches of the records clustered with their order kept are held until every
+ *           block listed is read, and handed over in that order
+ */
+int jp_lookup_file_set(      apr_pool_t        *pool,
+                       const jp_value_index_t  *index,
+                             FILE              *kv_pair_input,
+                             FILE              *key_index_input,
+                       const char              *key,
+                       const char              *value,
+                             jp_scan_record_fn  record_fn,
+                             void              *context,
+                             jp_scan_report_t  *report);
+
+typedef struct jp_aggregate
+{
+  uint64_t count;  /* the number of numeric values, integers and doubles */
+  double   sum;
+  double   min;    /* INFINITY without values */
+  double   max;    /* -INFINITY without values */
+} jp_aggregate_t;
+
+typedef struct jp_aggregation jp_aggregation_t;
+
+#define JP_AGGREGATE_DEFAULT_WORKERS  4
+
+/**
+ *  Creates an aggregation: the count of the records, and the count, sum, minimum and maximum of the
+ *  numeric values of a few keys, over all the records or for every value of a group key
+ *
+ *  @param pool       A memory pool
+ *  @param group_key  The key whose values form the groups, NULL for a single group
+ *  @param keys       The keys whose values are aggregated
+ *  @param nb_keys    The number of keys
+ *
+ *  @returns the aggregation, without any record yet
+ */
+jp_aggregation_t* jp_aggregation_make(      apr_pool_t  *pool,
+                                      const char        *group_key,
+                                      const char* const *keys,
+                                            int          nb_keys);
+
+/**
+ *  Adds the records of file sets to an aggregation, decoding their blocks on several threads
+ *
+ *  @param aggregation       The aggregation
+ *  @param kv_pair_inputs    The kv-pair files, or the single-file containers
+ *  @param key_index_inputs  The key index files, NULL if the inputs are single-file containers
+ *  @param nb_inputs         The number of file sets
+ *  @param nb_workers        The maximum number of threads decoding blocks at the same time
+ *
+ *  @returns zero if succeeded, non-zero if a file set is corrupted, the aggregation is then unchanged
+ */
+int jp_aggregate_file_sets(      jp_aggregation_t *aggregation,
+                           FILE* const            *kv_pair_inputs,
+                           FILE* const            *key_index_inputs,
+                                 int               nb_inputs,
+                                 unsigned int      nb_workers);
+
+/**
+ *  @returns the number of groups of an aggregation, in the order they first appeared in
+ */
+uint32_t jp_aggregation_count_groups(const jp_aggregation_t *aggregation);
+
+/**
+ *  Reads a group of an aggregation
+ *
+ *  @param aggregation  The aggregation
+ *  @param group        The group, from 0
+ *  @param nb_records   Set to the number of records in the group, may be NULL
+ *
+ *  @returns the text of the group value (integers and doubles as JSON numbers), NULL for the
+ *           records without the group key, or for the single group without group key
+ */
+const char* jp_aggregation_group(const jp_aggregation_t *aggregation,
+                                       uint32_t          group,
+                                       uint64_t         *nb_records);
+
+/**
+ *  @returns the aggregates of a group, one for each key in the order they were given
+ */
+const jp_aggregate_t* jp_aggregation_values(const jp_aggregation_t *aggregation,
+                                                  uint32_t          group);
+
+/**
+ *  A task run by jp_worker_pool_run
+ *
+ *  @param context  The context given to jp_worker_pool_run
+ *  @param task     The task number, from 0 to the number of tasks - 1
+ *
+ *  @returns zero if succeeded, non-zero if the task failed
+ */
+typedef int (*jp_worker_task_fn)(void   *context,
+                                 size_t  task);
+
+/**
+ *  Runs independent tasks on a bounded number of threads, and waits for all of them
+ *
+ *  @param pool        A memory pool
+ *  @param nb_workers  The maximum number of tasks running at the same time, the calling thread included
+ *  @param nb_tasks    The number of tasks
+ *  @param task_fn     The function running a task
+ *  @param context     The context handed to every task
+ *
+ *  @returns the number of tasks which failed
+ *
+ *  @remarks APR pools are not thread safe: tasks should allocate from their own pools
+ */
+size_t jp_worker_pool_run(apr_pool_t        *pool,
+                          unsigned int       nb_workers,
+                          size_t             nb_tasks,
+                          jp_worker_task_fn  task_fn,
+                          void              *context);
 
 #endif /* JP_TLV_ENCODER */
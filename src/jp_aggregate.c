@@ -0,0 +1,564 @@
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <inttypes.h>
+#include <math.h>
+
+/*
+ *  Aggregations run over the mapped file sets in tasks of JP_AGGREGATE_TASK_BLOCKS blocks, which
+ *  decode on their own and run on the worker pool. Every task gathers, from the records it
+ *  decodes, the group of every record and the numeric values of the keys aggregated into typed
+ *  batches of JP_AGGREGATE_BATCH_RECORDS, then folds every batch into its own table of groups:
+ *  one pass per key over a flat array of doubles, a plain reduction when the whole batch is in a
+ *  single group, as in ungrouped aggregations or sorted and clustered file sets.
+ *
+ *  Groups are keyed by the type and the text of their value, the records without the group key
+ *  forming a group of their own. The tables of the tasks are merged in the order of the tasks,
+ *  so the groups are listed in the order they first appear in the file sets.
+ */
+
+#define JP_AGGREGATE_TASK_BLOCKS    16
+#define JP_AGGREGATE_BATCH_RECORDS  1024
+
+/* the typed text of the group of the records without the group key */
+#define JP_AGGREGATE_NO_GROUP       "-"
+
+typedef struct jp_aggregate_table
+{
+  apr_pool_t         *pool;
+  int                 nb_keys;
+  apr_hash_t         *groups;      /* typed text of a group -> its position + 1 */
+  apr_array_header_t *texts;       /* const char*, the typed text of every group */
+  apr_array_header_t *counts;      /* uint64_t, the records of every group */
+  apr_array_header_t *aggregates;  /* jp_aggregate_t, nb_keys per group */
+} jp_aggregate_table_t;
+
+struct jp_aggregation
+{
+  apr_pool_t           *pool;
+  const char           *group_key;
+  int                   nb_keys;
+  const char          **keys;
+  jp_aggregate_table_t *table;
+};
+
+typedef struct jp_aggregate_input
+{
+  const uint8_t      *data;
+  size_t              size;
+  uint64_t            offset;
+  uint64_t            footer_offset;
+  int                 framed;
+  jp_key_index_map_t *map;
+  uint32_t            group_index;
+  uint32_t           *key_indices;
+} jp_aggregate_input_t;
+
+typedef struct jp_aggregate_task
+{
+  jp_aggregate_input_t *input;
+  uint32_t              first_block;
+  uint32_t              nb_blocks;
+  apr_pool_t           *pool;
+  jp_aggregate_table_t *table;
+} jp_aggregate_task_t;
+
+typedef struct jp_aggregate_run
+{
+  int                  nb_keys;
+  jp_aggregate_task_t *tasks;
+} jp_aggregate_run_t;
+
+typedef struct jp_aggregate_batch
+{
+  jp_aggregate_table_t       *table;
+  const jp_aggregate_input_t *input;
+
+  uint32_t                    nb_records;
+  uint32_t                   *groups;
+  int                         single_group;
+
+  /* for every key, its values and the group of each, flushed between records only */
+  uint32_t                   *nb_values;
+  uint32_t                   *values_capacity;
+  int                         values_full;
+  double                    **values;
+  uint32_t                  **value_groups;
+
+  /* the group of the previous record, which most records share */
+  const char                 *last_text;
+  size_t                      last_length;
+  uint32_t                    last_group;
+
+  char                       *text;
+  size_t                      text_capacity;
+} jp_aggregate_batch_t;
+
+static void jp_aggregate_reset(jp_aggregate_t *aggregate)
+{
+  aggregate->count = 0;
+  aggregate->sum   = 0;
+  aggregate->min   = INFINITY;
+  aggregate->max   = -INFINITY;
+}
+
+static void jp_aggregate_merge(      jp_aggregate_t *aggregate,
+                               const jp_aggregate_t *other)
+{
+  aggregate->count += other->count;
+  aggregate->sum   += other->sum;
+
+  if (other->min < aggregate->min)
+    aggregate->min = other->min;
+
+  if (other->max > aggregate->max)
+    aggregate->max = other->max;
+}
+
+static jp_aggregate_table_t* jp_aggregate_table_make(apr_pool_t *pool,
+                                                     int         nb_keys)
+{
+  jp_aggregate_table_t* table = apr_palloc(pool, sizeof(jp_aggregate_table_t));
+
+  table->pool       = pool;
+  table->nb_keys    = nb_keys;
+  table->groups     = apr_hash_make(pool);
+  table->texts      = apr_array_make(pool, 16, sizeof(const char*));
+  table->counts     = apr_array_make(pool, 16, sizeof(uint64_t));
+  table->aggregates = apr_array_make(pool, 16 * (nb_keys > 0 ? nb_keys : 1), sizeof(jp_aggregate_t));
+
+  return table;
+}
+
+static uint32_t jp_aggregate_table_group(      jp_aggregate_table_t *table,
+                                         const char                 *text,
+                                               size_t                length,
+                                         const char                **stored_text)
+{
+  void* found = apr_hash_get(table->groups, text, length);
+
+  if (found) {
+    uint32_t group = (uint32_t)(uintptr_t) found - 1;
+
+    if (stored_text)
+      *stored_text = ((const char**) table->texts->elts)[group];
+
+    return group;
+  }
+
+  /* the texts are NUL terminated */
+  char* copy = apr_pmemdup(table->pool, text, length + 1);
+
+  *(const char**) apr_array_push(table->texts) = copy;
+  *(uint64_t*) apr_array_push(table->counts)   = 0;
+
+  for (int key = 0; key < table->nb_keys; key++)
+    jp_aggregate_reset(apr_array_push(table->aggregates));
+
+  apr_hash_set(table->groups, copy, length, (void*)(uintptr_t) table->texts->nelts);
+
+  if (stored_text)
+    *stored_text = copy;
+
+  return table->texts->nelts - 1;
+}
+
+static void jp_aggregate_table_merge(      jp_aggregate_table_t *table,
+                                     const jp_aggregate_table_t *other)
+{
+  for (int i = 0; i < other->texts->nelts; i++) {
+    const char* text  = ((const char**) other->texts->elts)[i];
+    uint32_t    group = jp_aggregate_table_group(table, text, strlen(text), NULL);
+
+    ((uint64_t*) table->counts->elts)[group] += ((uint64_t*) other->counts->elts)[i];
+
+    for (int key = 0; key < table->nb_keys; key++)
+      jp_aggregate_merge(& ((jp_aggregate_t*) table->aggregates->elts)[(size_t) group * table->nb_keys + key],
+                         & ((const jp_aggregate_t*) other->aggregates->elts)[(size_t) i * table->nb_keys + key]);
+  }
+}
+
+static jp_aggregate_batch_t* jp_aggregate_batch_make(      apr_pool_t           *pool,
+                                                           jp_aggregate_table_t *table,
+                                                     const jp_aggregate_input_t *input)
+{
+  jp_aggregate_batch_t* batch = apr_pcalloc(pool, sizeof(jp_aggregate_batch_t));
+
+  batch->table           = table;
+  batch->input           = input;
+  batch->groups          = apr_palloc(pool, JP_AGGREGATE_BATCH_RECORDS * sizeof(uint32_t));
+  batch->nb_values       = apr_pcalloc(pool, table->nb_keys * sizeof(uint32_t));
+  batch->values_capacity = apr_palloc(pool, table->nb_keys * sizeof(uint32_t));
+  batch->values          = apr_palloc(pool, table->nb_keys * sizeof(double*));
+  batch->value_groups    = apr_palloc(pool, table->nb_keys * sizeof(uint32_t*));
+  batch->text_capacity   = 256;
+  batch->text            = apr_palloc(pool, batch->text_capacity);
+
+  for (int key = 0; key < table->nb_keys; key++) {
+    batch->values[key]       = apr_palloc(pool, JP_AGGREGATE_BATCH_RECORDS * sizeof(double));
+    batch->value_groups[key] = apr_palloc(pool, JP_AGGREGATE_BATCH_RECORDS * sizeof(uint32_t));
+
+    batch->values_capacity[key] = JP_AGGREGATE_BATCH_RECORDS;
+  }
+
+  return batch;
+}
+
+/* folds the batch into the table, the loops over the values of a single group vectorize */
+static void jp_aggregate_batch_flush(jp_aggregate_batch_t *batch)
+{
+  jp_aggregate_table_t* table      = batch->table;
+  uint64_t*             counts     = (uint64_t*) table->counts->elts;
+  jp_aggregate_t*       aggregates = (jp_aggregate_t*) table->aggregates->elts;
+
+  if (batch->single_group && batch->nb_records > 0)
+    counts[batch->groups[0]] += batch->nb_records;
+  else
+    for (uint32_t i = 0; i < batch->nb_records; i++)
+      counts[batch->groups[i]]++;
+
+  for (int key = 0; key < table->nb_keys; key++) {
+    uint32_t        nb_values = batch->nb_values[key];
+    const double*   values    = batch->values[key];
+    const uint32_t* groups    = batch->value_groups[key];
+
+    if (0 == nb_values)
+      continue;
+
+    if (batch->single_group) {
+      double sum = 0, min = INFINITY, max = -INFINITY;
+
+      for (uint32_t i = 0; i < nb_values; i++) {
+        sum += values[i];
+        min  = (values[i] < min) ? values[i] : min;
+        max  = (values[i] > max) ? values[i] : max;
+      }
+
+      jp_aggregate_t batch_aggregate = { nb_values, sum, min, max };
+
+      jp_aggregate_merge(& aggregates[(size_t) groups[0] * table->nb_keys + key], & batch_aggregate);
+    } else {
+      for (uint32_t i = 0; i < nb_values; i++) {
+        jp_aggregate_t* aggregate = & aggregates[(size_t) groups[i] * table->nb_keys + key];
+
+        aggregate->count++;
+        aggregate->sum += values[i];
+        aggregate->min  = (values[i] < aggregate->min) ? values[i] : aggregate->min;
+        aggregate->max  = (values[i] > aggregate->max) ? values[i] : aggregate->max;
+      }
+    }
+
+    batch->nb_values[key] = 0;
+  }
+
+  batch->nb_records   = 0;
+  batch->single_group = 1;
+  batch->values_full  = 0;
+}
+
+/* a record holding a key more than once may hold more values than a batch, the group of its values must not change */
+static void jp_aggregate_batch_grow(jp_aggregate_batch_t *batch,
+                                    int                   key)
+{
+  uint32_t  capacity = 2 * batch->values_capacity[key];
+  double*   values   = apr_palloc(batch->table->pool, capacity * sizeof(double));
+  uint32_t* groups   = apr_palloc(batch->table->pool, capacity * sizeof(uint32_t));
+
+  memcpy(values, batch->values[key], batch->nb_values[key] * sizeof(double));
+  memcpy(groups, batch->value_groups[key], batch->nb_values[key] * sizeof(uint32_t));
+
+  batch->values[key]          = values;
+  batch->value_groups[key]    = groups;
+  batch->values_capacity[key] = capacity;
+}
+
+/* the typed text of the group value, the type first so that "7" and 7 are different groups */
+static size_t jp_aggregate_group_text(      jp_aggregate_batch_t *batch,
+                                      const jp_TLV_kv_pair_t     *kv_pair)
+{
+  char* text = batch->text;
+
+  if (NULL == kv_pair)
+    return strlen(strcpy(text, JP_AGGREGATE_NO_GROUP));
+
+  switch (kv_pair->value_type) {
+    case JP_TYPE_STRING:
+    {
+      uint32_t length = kv_pair->union_v.string_value.value_length;
+
+      if (length + 2 > batch->text_capacity) {
+        batch->text_capacity = 2 * (length + 2);
+        batch->text          = text = apr_palloc(batch->table->pool, batch->text_capacity);
+      }
+
+      text[0] = 's';
+      memcpy(text + 1, kv_pair->union_v.string_value.value_buffer, length);
+      text[length + 1] = '\0';
+
+      return length + 1;
+    }
+
+    case JP_TYPE_INTEGER:
+    return (size_t) snprintf(text, batch->text_capacity, "i%" PRId32, kv_pair->union_v.integer_value);
+
+    case JP_TYPE_DOUBLE:
+    {
+      size_t length = jp_format_double(text + 1, kv_pair->union_v.double_value);
+
+      text[0]          = 'd';
+      text[length + 1] = '\0';
+
+      return length + 1;
+    }
+
+    case JP_TYPE_BOOLEAN:
+    {
+      int value;
+      jp_read_boolean_from_kv_pair(kv_pair, & value);
+
+      return strlen(strcpy(text, value ? "btrue" : "bfalse"));
+    }
+
+    default:
+    return strlen(strcpy(text, JP_AGGREGATE_NO_GROUP));
+  }
+}
+
+static uint32_t jp_aggregate_batch_group(      jp_aggregate_batch_t *batch,
+                                         const jp_TLV_kv_pair_t     *kv_pair)
+{
+  size_t length = jp_aggregate_group_text(batch, kv_pair);
+
+  if (batch->last_text && length == batch->last_length && 0 == memcmp(batch->text, batch->last_text, length))
+    return batch->last_group;
+
+  batch->last_group  = jp_aggregate_table_group(batch->table, batch->text, length, & batch->last_text);
+  batch->last_length = length;
+
+  return batch->last_group;
+}
+
+static int jp_aggregate_value(const jp_TLV_kv_pair_t *kv_pair,
+                              double                 *value)
+{
+  int32_t integer;
+
+  if (0 == jp_read_integer_from_kv_pair(kv_pair, & integer)) {
+    *value = integer;
+    return 1;
+  }
+
+  /* NaN can neither be summed nor compared */
+  return 0 == jp_read_double_from_kv_pair(kv_pair, value) && *value == *value;
+}
+
+static int jp_aggregate_record(      void               *context,
+                                     uint64_t            record_number,
+                               const jp_TLV_record_t    *record,
+                               const jp_key_index_map_t *key_index)
+{
+  jp_aggregate_batch_t*       batch    = context;
+  const jp_aggregate_input_t* input    = batch->input;
+  apr_array_header_t*         kv_array = record->kv_pairs_array;
+  const jp_TLV_kv_pair_t*     kv_pairs = (const jp_TLV_kv_pair_t*) kv_array->elts;
+  const jp_TLV_kv_pair_t*     group    = NULL;
+
+  for (int i = 0; i < kv_array->nelts && NULL == group; i++)
+    if (kv_pairs[i].key_index == input->group_index)
+      group = & kv_pairs[i];
+
+  uint32_t group_number = jp_aggregate_batch_group(batch, group);
+
+  if (batch->nb_records > 0 && group_number != batch->groups[0])
+    batch->single_group = 0;
+
+  batch->groups[batch->nb_records++] = group_number;
+
+  for (int i = 0; i < kv_array->nelts; i++) {
+    for (int key = 0; key < batch->table->nb_keys; key++) {
+      double value;
+
+      if (kv_pairs[i].key_index != input->key_indices[key] || !jp_aggregate_value(& kv_pairs[i], & value))
+        continue;
+
+      if (batch->nb_values[key] == batch->values_capacity[key])
+        jp_aggregate_batch_grow(batch, key);
+
+      uint32_t position = batch->nb_values[key]++;
+
+      batch->values[key][position]       = value;
+      batch->value_groups[key][position] = group_number;
+
+      if (batch->nb_values[key] >= JP_AGGREGATE_BATCH_RECORDS)
+        batch->values_full = 1;
+    }
+  }
+
+  if (JP_AGGREGATE_BATCH_RECORDS == batch->nb_records || batch->values_full)
+    jp_aggregate_batch_flush(batch);
+
+  return 0;
+}
+
+/* APR pools are not thread safe, every task allocates its table from a pool of its own */
+static int jp_aggregate_task(void   *context,
+                             size_t  task_number)
+{
+  jp_aggregate_run_t*   run   = context;
+  jp_aggregate_task_t*  task  = & run->tasks[task_number];
+  jp_aggregate_input_t* input = task->input;
+
+  if (APR_SUCCESS != apr_pool_create(& task->pool, NULL))
+    return -1;
+
+  task->table = jp_aggregate_table_make(task->pool, run->nb_keys);
+
+  jp_aggregate_batch_t* batch = jp_aggregate_batch_make(task->pool, task->table, input);
+  int                   ret;
+
+  batch->single_group = 1;
+
+  if (input->framed)
+    ret = jp_scan_block_range(task->pool, input->data, input->size, input->offset, input->footer_offset, task->first_block,
+                              task->nb_blocks, input->map, jp_aggregate_record, batch);
+  else
+    ret = jp_scan_mapped_file_set(task->pool, input->data, input->size, input->offset, input->map, jp_aggregate_record, batch);
+
+  jp_aggregate_batch_flush(batch);
+
+  return ret;
+}
+
+jp_aggregation_t* jp_aggregation_make(      apr_pool_t  *pool,
+                                      const char        *group_key,
+                                      const char* const *keys,
+                                            int          nb_keys)
+{
+  jp_aggregation_t* aggregation = apr_palloc(pool, sizeof(jp_aggregation_t));
+
+  aggregation->pool      = pool;
+  aggregation->group_key = group_key ? apr_pstrdup(pool, group_key) : NULL;
+  aggregation->nb_keys   = nb_keys;
+  aggregation->keys      = apr_palloc(pool, (nb_keys + 1) * sizeof(const char*));
+  aggregation->table     = jp_aggregate_table_make(pool, nb_keys);
+
+  for (int key = 0; key < nb_keys; key++)
+    aggregation->keys[key] = apr_pstrdup(pool, keys[key]);
+
+  /* without group key, every record is in the one group, even if there are none */
+  if (NULL == group_key)
+    jp_aggregate_table_group(aggregation->table, JP_AGGREGATE_NO_GROUP, strlen(JP_AGGREGATE_NO_GROUP), NULL);
+
+  return aggregation;
+}
+
+int jp_aggregate_file_sets(      jp_aggregation_t *aggregation,
+                           FILE* const            *kv_pair_inputs,
+                           FILE* const            *key_index_inputs,
+                                 int               nb_inputs,
+                                 unsigned int      nb_workers)
+{
+  apr_pool_t* pool;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, aggregation->pool))
+    return -1;
+
+  jp_aggregate_input_t* inputs = apr_pcalloc(pool, (nb_inputs + 1) * sizeof(jp_aggregate_input_t));
+  apr_array_header_t*   tasks  = apr_array_make(pool, 64, sizeof(jp_aggregate_task_t));
+  int                   ret    = 0;
+  int                   nb_maps;
+
+  for (nb_maps = 0; nb_maps < nb_inputs && 0 == ret; nb_maps++) {
+    jp_aggregate_input_t* input = & inputs[nb_maps];
+    uint64_t              nb_records;
+    uint32_t              nb_blocks = 0, magic = 0;
+
+    if (0 != jp_map_file_set(pool, kv_pair_inputs[nb_maps], key_index_inputs ? key_index_inputs[nb_maps] : NULL, & input->data,
+                             & input->size, & input->offset, & input->map, 1)) {
+      ret = -1;
+      break;
+    }
+
+    /* a key the file set has never seen is never matched */
+    input->group_index = aggregation->group_key ? jp_key_index_map_find(input->map, aggregation->group_key) : UINT32_MAX;
+    input->key_indices = apr_palloc(pool, (aggregation->nb_keys + 1) * sizeof(uint32_t));
+
+    for (int key = 0; key < aggregation->nb_keys; key++)
+      input->key_indices[key] = jp_key_index_map_find(input->map, aggregation->keys[key]);
+
+    if (input->size - input->offset >= sizeof(uint32_t))
+      memcpy(& magic, input->data + input->offset, sizeof(uint32_t));
+
+    input->framed = (JP_KV_PAIR_MAGIC == magic);
+
+    if (input->framed && 0 != jp_scan_read_footer(input->data, input->size, input->offset, & input->footer_offset, & nb_records, & nb_blocks))
+      ret = -1;
+
+    /* the files written before the blocks are scanned by a single task */
+    for (uint32_t block = 0; 0 == ret && (block < nb_blocks || (!input->framed && 0 == block)); block += JP_AGGREGATE_TASK_BLOCKS) {
+      jp_aggregate_task_t* task = apr_array_push(tasks);
+
+      memset(task, 0, sizeof(jp_aggregate_task_t));
+
+      task->input       = input;
+      task->first_block = block;
+      task->nb_blocks   = (nb_blocks - block < JP_AGGREGATE_TASK_BLOCKS) ? nb_blocks - block : JP_AGGREGATE_TASK_BLOCKS;
+    }
+  }
+
+  if (0 == ret) {
+    jp_aggregate_run_t run;
+
+    run.nb_keys = aggregation->nb_keys;
+    run.tasks   = (jp_aggregate_task_t*) tasks->elts;
+
+    if (0 != jp_worker_pool_run(pool, nb_workers, tasks->nelts, jp_aggregate_task, & run))
+      ret = -1;
+  }
+
+  for (int i = 0; i < tasks->nelts; i++) {
+    jp_aggregate_task_t* task = & ((jp_aggregate_task_t*) tasks->elts)[i];
+
+    if (0 == ret)
+      jp_aggregate_table_merge(aggregation->table, task->table);
+
+    if (task->pool)
+      apr_pool_destroy(task->pool);
+  }
+
+  for (int i = 0; i < nb_maps; i++)
+    if (inputs[i].map)
+      jp_key_index_map_close(inputs[i].map);
+
+  apr_pool_destroy(pool);
+
+  return ret;
+}
+
+uint32_t jp_aggregation_count_groups(const jp_aggregation_t *aggregation)
+{
+  return aggregation->table->texts->nelts;
+}
+
+const char* jp_aggregation_group(const jp_aggregation_t *aggregation,
+                                       uint32_t          group,
+                                       uint64_t         *nb_records)
+{
+  const char* text = ((const char**) aggregation->table->texts->elts)[group];
+
+  if (nb_records)
+    *nb_records = ((const uint64_t*) aggregation->table->counts->elts)[group];
+
+  return (0 == strcmp(text, JP_AGGREGATE_NO_GROUP)) ? NULL : text + 1;
+}
+
+const jp_aggregate_t* jp_aggregation_values(const jp_aggregation_t *aggregation,
+                                                  uint32_t          group)
+{
+  return & ((const jp_aggregate_t*) aggregation->table->aggregates->elts)[(size_t) group * aggregation->nb_keys];
+}
@@ -0,0 +1,1050 @@
+
+#include <apr_strings.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ *  kv-pair file layout:
+ *
+ *  - file header: uint32 JP_KV_PAIR_MAGIC and uint32 format version
+ *
+ *  - any number of blocks, each one self-delimiting:
+ *
+ *    uint32 JP_BLOCK_TAG, uint32 flags, uint32 number of records, uint32 payload length,
+ *    followed by the payload: the records, encoded as in jp_export_record_to_buffer (the doubles
+ *    relative to the previous double of their key in the block from version 4 on), and with
+ *    JP_BLOCK_FLAG_CRC32C (always set from version 3 on) by the uint32 CRC32C of the payload,
+ *    with JP_BLOCK_FLAG_ORDER by the arrival order of its records (see jp_record_order.c),
+ *    with JP_BLOCK_FLAG_ENCODINGS by the encodings of its keys (see jp_key_codecs.c, from version 5 on),
+ *    with JP_BLOCK_FLAG_FILTER by the Bloom filter of the block (see jp_block_filter.c), and
+ *    with JP_BLOCK_FLAG_ZONE_MAP (always set from version 3 on) by the smallest and largest value
+ *    of every numeric key of the block (see jp_block_zone_map.c)
+ *
+ *  - a footer, rewritten every time the file is closed:
+ *
+ *    uint32 JP_FOOTER_TAG, uint32 flags, uint64 total number of records, uint32 number of blocks,
+ *    and for every block its uint64 file offset, uint32 number of records and uint32 length
+ *
+ *  - a fixed size trailer: uint64 offset of the footer and uint32 JP_KV_PAIR_MAGIC
+ *
+ *  Sequential readers never need to seek: they read blocks until they meet the footer tag,
+ *  and check every payload against its checksum before decoding it.
+ *  Appending seeks to the footer through the trailer, writes new blocks over the old footer
+ *  and writes an extended footer after them.
+ *
+ *  Files written before the block framing start with a uint32 record count instead of the
+ *  magic, and are still readable, but cannot be appended to.
+ */
+
+static uint64_t jp_block_writer_position(const jp_block_writer_t *writer)
+{
+  return writer->base_offset + writer->buffer.flushed_bytes + writer->buffer.used;
+}
+
+static int jp_block_writer_begin_block(jp_block_writer_t *writer)
+{
+  /* every block starts on an empty segment chain, so the position is exact */
+  writer->block_offset  = jp_block_writer_position(writer);
+  writer->header_offset = writer->buffer.used;
+  writer->block_records = 0;
+  writer->block_length  = 0;
+  writer->block_open    = 1;
+
+  writer->buffer.defer_flush = 1;
+
+  uint32_t flags = JP_BLOCK_FLAG_CRC32C | JP_BLOCK_FLAG_ZONE_MAP;
+
+  jp_block_zone_map_reset(writer->zones, writer->zone_slots);
+  jp_double_history_reset(writer->buffer.doubles);
+
+  /* the encodings are chosen once the first records of the block are in */
+  if (writer->buffer.codecs) {
+    jp_key_codecs_reset(writer->buffer.codecs);
+    writer->sampling = 1;
+  }
+
+  if (writer->filters) {
+    flags |= JP_BLOCK_FLAG_FILTER;
+    writer->filter_items->nelts = 0;
+  }
+
+  if (writer->ordinals) {
+    flags |= JP_BLOCK_FLAG_ORDER;
+    writer->ordinals->nelts = 0;
+  }
+
+  if (0 == jp_export_uint32_to_buffer(JP_BLOCK_TAG, & writer->buffer) ||
+      0 == jp_export_uint32_to_buffer(flags, & writer->buffer) ||
+      0 == jp_export_uint32_to_buffer(0, & writer->buffer) ||
+      0 == jp_export_uint32_to_buffer(0, & writer->buffer))
+    return -1;
+
+  return 0;
+}
+
+/* the payload is spread over the buffer segments and the zero-copy strings referenced between them */
+static uint32_t jp_block_writer_payload_crc(jp_block_writer_t *writer)
+{
+  jp_buffer_io_t* buffer        = & writer->buffer;
+  size_t          payload_start = writer->header_offset + JP_BLOCK_HEADER_SIZE;
+  uint32_t        crc           = 0;
+
+  for (int i = 0; i < buffer->nb_segments; i++) {
+    jp_buffer_io_segment_t* segment = & buffer->segments[i];
+
+    if (segment->external) {
+      crc = jp_crc32c(crc, segment->external, segment->length);
+      continue;
+    }
+
+    size_t start = (segment->offset > payload_start) ? segment->offset : payload_start;
+    size_t end   = segment->offset + segment->length;
+
+    if (end > start)
+      crc = jp_crc32c(crc, buffer->current_buffer + start, end - start);
+  }
+
+  size_t start = (buffer->segment_start > payload_start) ? buffer->segment_start : payload_start;
+
+  if (buffer->used > start)
+    crc = jp_crc32c(crc, buffer->current_buffer + start, buffer->used - start);
+
+  return crc;
+}
+
+static int jp_block_writer_end_block(jp_block_writer_t *writer)
+{
+  /* the header is complete before the trailer is written, which may move the buffer */
+  uint8_t* header    = writer->buffer.current_buffer + writer->header_offset;
+  int      encodings = writer->buffer.codecs && jp_key_codecs_active(writer->buffer.codecs);
+
+  memcpy(header + 2 * sizeof(uint32_t), & writer->block_records, sizeof(uint32_t));
+  memcpy(header + 3 * sizeof(uint32_t), & writer->block_length, sizeof(uint32_t));
+
+  if (encodings) {
+    uint32_t flags;
+
+    memcpy(& flags, header + sizeof(uint32_t), sizeof(uint32_t));
+    flags |= JP_BLOCK_FLAG_ENCODINGS;
+    memcpy(header + sizeof(uint32_t), & flags, sizeof(uint32_t));
+  }
+
+  if (0 == jp_export_uint32_to_buffer(jp_block_writer_payload_crc(writer), & writer->buffer))
+    return -1;
+
+  uint32_t order_length = 0;
+
+  if (writer->ordinals && 0 == (order_length = jp_block_order_write(& writer->buffer, writer->ordinals)))
+    return -1;
+
+  uint32_t encodings_length = 0;
+
+  if (encodings && 0 == (encodings_length = jp_key_codecs_write(& writer->buffer, writer->buffer.codecs)))
+    return -1;
+
+  uint32_t filter_length = 0;
+
+  if (writer->filters && 0 == (filter_length = jp_block_filter_write(& writer->buffer, writer->filter_items, writer->filter_value_keys)))
+    return -1;
+
+  uint32_t zone_map_length = jp_block_zone_map_write(& writer->buffer, writer->zones);
+
+  if (0 == zone_map_length)
+    return -1;
+
+  jp_block_index_entry_t* entry = apr_array_push(writer->block_index);
+
+  entry->offset     = writer->block_offset;
+  entry->nb_records = writer->block_records;
+  entry->length     = JP_BLOCK_HEADER_SIZE + writer->block_length + JP_BLOCK_CRC_SIZE + order_length + encodings_length +
+                      filter_length + zone_map_length;
+
+  writer->block_open         = 0;
+  writer->buffer.defer_flush = 0;
+
+  jp_buffer_io_flush_writes(& writer->buffer);
+
+  return 0;
+}
+
+static void jp_block_writer_initialize(jp_block_writer_t *writer,
+                                       apr_pool_t        *pool,
+                                       FILE              *stream)
+{
+  jp_buffer_io_write_initialize(& writer->buffer, pool, stream);
+
+  /* a whole block is assembled before it is written */
+  writer->buffer.current_buffer = apr_palloc(pool, 2 * JP_BLOCK_TARGET_SIZE);
+  writer->buffer.current_size   = 2 * JP_BLOCK_TARGET_SIZE;
+
+  writer->pool        = pool;
+  writer->block_index = apr_array_make(pool, 16, sizeof(jp_block_index_entry_t));
+  writer->base_offset = 0;
+  writer->nb_records  = 0;
+  writer->block_open  = 0;
+  writer->appending   = 0;
+
+  writer->filters           = 0;
+  writer->filter_value_keys = NULL;
+  writer->filter_items      = NULL;
+
+  writer->zones      = apr_array_make(pool, 16, sizeof(jp_block_zone_t));
+  writer->zone_slots = apr_array_make(pool, 64, sizeof(uint32_t));
+
+  writer->saved_used         = 0;
+  writer->saved_filter_items = 0;
+  writer->saved_zones        = apr_array_make(pool, 16, sizeof(jp_block_zone_t));
+
+  writer->ordinals       = NULL;
+  writer->record_ordinal = 0;
+
+  writer->buffer.doubles = jp_double_history_make(pool);
+  writer->buffer.codecs  = jp_key_codecs_make(pool);
+
+  writer->pending          = apr_palloc(pool, JP_ENCODING_SAMPLE_RECORDS * sizeof(jp_TLV_record_t*));
+  writer->pending_ordinals = apr_palloc(pool, JP_ENCODING_SAMPLE_RECORDS * sizeof(uint64_t));
+  writer->nb_pending       = 0;
+  writer->sampling         = 0;
+
+  for (int i = 0; i < JP_ENCODING_SAMPLE_RECORDS; i++)
+    writer->pending[i] = jp_TLV_record_make(pool);
+}
+
+void jp_block_writer_enable_filters(jp_block_writer_t  *writer,
+                                    apr_array_header_t *value_keys)
+{
+  writer->filters           = 1;
+  writer->filter_value_keys = value_keys;
+  writer->filter_items      = apr_array_make(writer->pool, 1024, sizeof(uint64_t));
+}
+
+void jp_block_writer_keep_order(jp_block_writer_t *writer)
+{
+  writer->ordinals = apr_array_make(writer->pool, 1024, sizeof(uint64_t));
+}
+
+uint64_t jp_block_writer_nb_records_added(const jp_block_writer_t *writer)
+{
+  return writer->nb_records + writer->nb_pending;
+}
+
+static void jp_block_writer_add_filter_items(      jp_block_writer_t *writer,
+                                             const jp_TLV_kv_pair_t  *kv_pair)
+{
+  *(uint64_t*) apr_array_push(writer->filter_items) = jp_block_filter_key_hash(kv_pair->key_index);
+
+  if (JP_TYPE_STRING != kv_pair->value_type || NULL == writer->filter_value_keys)
+    return;
+
+  for (int j = 0; j < writer->filter_value_keys->nelts; j++) {
+    if (((uint32_t*) writer->filter_value_keys->elts)[j] == kv_pair->key_index) {
+      const jp_TLV_string_t* string_value = & kv_pair->union_v.string_value;
+
+      *(uint64_t*) apr_array_push(writer->filter_items) =
+        jp_block_filter_value_hash(kv_pair->key_index, string_value->value_buffer, string_value->value_length);
+      break;
+    }
+  }
+}
+
+void jp_block_writer_index_kv_pair(      jp_block_writer_t *writer,
+                                   const jp_TLV_kv_pair_t  *kv_pair)
+{
+  if (writer->filters)
+    jp_block_writer_add_filter_items(writer, kv_pair);
+
+  if (JP_TYPE_INTEGER == kv_pair->value_type)
+    jp_block_zone_map_add(writer->zones, writer->zone_slots, kv_pair->key_index, kv_pair->union_v.integer_value);
+  else if (JP_TYPE_DOUBLE == kv_pair->value_type)
+    jp_block_zone_map_add(writer->zones, writer->zone_slots, kv_pair->key_index, kv_pair->union_v.double_value);
+}
+
+int jp_block_writer_open(jp_block_writer_t *writer,
+                         apr_pool_t        *pool,
+                         FILE              *stream,
+                         uint64_t           base_offset)
+{
+  jp_block_writer_initialize(writer, pool, stream);
+
+  writer->base_offset = base_offset;
+
+  if (0 == jp_export_uint32_to_buffer(JP_KV_PAIR_MAGIC, & writer->buffer) ||
+      0 == jp_export_uint32_to_buffer(JP_KV_PAIR_FORMAT_VERSION, & writer->buffer))
+    return -1;
+
+  return 0;
+}
+
+static int jp_fread_uint32(FILE *stream, uint32_t *value)
+{
+  return 1 != fread(value, sizeof(uint32_t), 1, stream);
+}
+
+static int jp_fread_uint64(FILE *stream, uint64_t *value)
+{
+  return 1 != fread(value, sizeof(uint64_t), 1, stream);
+}
+
+int jp_block_writer_reopen(jp_block_writer_t *writer,
+                           apr_pool_t        *pool,
+                           FILE              *stream)
+{
+  uint32_t magic, version, tag, flags, nb_blocks;
+  uint64_t footer_offset, nb_records;
+
+  jp_block_writer_initialize(writer, pool, stream);
+
+  if (0 != fseeko(stream, 0, SEEK_SET) ||
+      0 != jp_fread_uint32(stream, & magic) ||
+      0 != jp_fread_uint32(stream, & version) ||
+      JP_KV_PAIR_MAGIC != magic) {
+    fprintf(stderr, "jp_block_writer_reopen: not a block framed kv-pair file, it cannot be appended to \n");
+    return -1;
+  }
+
+  if (version > JP_KV_PAIR_FORMAT_VERSION) {
+    fprintf(stderr, "jp_block_writer_reopen: unsupported format version %u \n", version);
+    return -1;
+  }
+
+  if (0 != fseeko(stream, -(off_t) JP_TRAILER_SIZE, SEEK_END) ||
+      0 != jp_fread_uint64(stream, & footer_offset) ||
+      0 != jp_fread_uint32(stream, & magic) ||
+      JP_KV_PAIR_MAGIC != magic) {
+    fprintf(stderr, "jp_block_writer_reopen: missing trailer, the file was not closed properly \n");
+    return -1;
+  }
+
+  if (0 != fseeko(stream, footer_offset, SEEK_SET) ||
+      0 != jp_fread_uint32(stream, & tag) ||
+      0 != jp_fread_uint32(stream, & flags) ||
+      0 != jp_fread_uint64(stream, & nb_records) ||
+      0 != jp_fread_uint32(stream, & nb_blocks) ||
+      JP_FOOTER_TAG != tag) {
+    fprintf(stderr, "jp_block_writer_reopen: corrupted footer \n");
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < nb_blocks; i++) {
+    jp_block_index_entry_t* entry = apr_array_push(writer->block_index);
+
+    if (0 != jp_fread_uint64(stream, & entry->offset) ||
+        0 != jp_fread_uint32(stream, & entry->nb_records) ||
+        0 != jp_fread_uint32(stream, & entry->length)) {
+      fprintf(stderr, "jp_block_writer_reopen: truncated footer \n");
+      return -1;
+    }
+  }
+
+  /*
+   *  the appended blocks carry checksums, which readers of the older versions would take for records.
+   *  The version is only bumped once the trailer and the footer are read, a refused append leaves the file as it was
+   */
+  if (version < JP_KV_PAIR_FORMAT_VERSION) {
+    uint32_t new_version = JP_KV_PAIR_FORMAT_VERSION;
+
+    if (0 != fflush(stream) ||
+        sizeof(uint32_t) != pwrite(fileno(stream), & new_version, sizeof(uint32_t), sizeof(uint32_t)))
+      return -1;
+  }
+
+  /* new blocks overwrite the old footer; the descriptor is repositioned since writes bypass stdio */
+  if (0 != fseeko(stream, footer_offset, SEEK_SET) ||
+      0 != fflush(stream) ||
+      (off_t) footer_offset != lseek(fileno(stream), footer_offset, SEEK_SET))
+    return -1;
+
+  writer->base_offset = footer_offset;
+  writer->nb_records  = nb_records;
+  writer->appending   = 1;
+
+  return 0;
+}
+
+int jp_block_writer_begin_record(jp_block_writer_t *writer)
+{
+  if (!writer->block_open && 0 != jp_block_writer_begin_block(writer))
+    return -1;
+
+  return 0;
+}
+
+void jp_block_writer_save_record(jp_block_writer_t *writer)
+{
+  writer->saved_used         = writer->buffer.used;
+  writer->saved_filter_items = writer->filters ? writer->filter_items->nelts : 0;
+
+  /* the ranges are widened in place, they are copied rather than counted */
+  writer->saved_zones->nelts = 0;
+  apr_array_cat(writer->saved_zones, writer->zones);
+}
+
+void jp_block_writer_drop_record(jp_block_writer_t *writer)
+{
+  writer->buffer.used = writer->saved_used;
+
+  if (writer->filters)
+    writer->filter_items->nelts = writer->saved_filter_items;
+
+  /* the keys first seen in the record leave the zone map */
+  for (int i = writer->saved_zones->nelts; i < writer->zones->nelts; i++)
+    ((uint32_t*) writer->zone_slots->elts)[((jp_block_zone_t*) writer->zones->elts)[i].key_index] = 0;
+
+  writer->zones->nelts = 0;
+  apr_array_cat(writer->zones, writer->saved_zones);
+}
+
+int jp_block_writer_end_record(jp_block_writer_t *writer,
+                               uint32_t           written)
+{
+  writer->block_length  += written;
+  writer->block_records += 1;
+  writer->nb_records    += 1;
+
+  if (writer->ordinals)
+    *(uint64_t*) apr_array_push(writer->ordinals) = writer->record_ordinal;
+
+  if (writer->block_length >= JP_BLOCK_TARGET_SIZE)
+    return jp_block_writer_end_block(writer);
+
+  return 0;
+}
+
+static int jp_block_writer_write_record(      jp_block_writer_t *writer,
+                                        const jp_TLV_record_t   *record)
+{
+  if (0 != jp_block_writer_begin_record(writer))
+    return -1;
+
+  uint32_t written = jp_export_record_to_buffer(record, & writer->buffer);
+
+  if (0 == written)
+    return -1;
+
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+
+  for (int i = 0; i < kv_array->nelts; i++)
+    jp_block_writer_index_kv_pair(writer, & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i]);
+
+  return jp_block_writer_end_record(writer, written);
+}
+
+/* writes the records held back, the ones left when a block fills up wait for the sample of the next one unless all is set */
+static int jp_block_writer_flush_pending(jp_block_writer_t *writer,
+                                         int                all)
+{
+  uint32_t next = 0;
+  int      ret  = 0;
+
+  while (0 == ret && next < writer->nb_pending) {
+    if (!writer->block_open) {
+      if (next > 0 && !all)
+        break;
+
+      if (0 != jp_block_writer_begin_block(writer))
+        return -1;
+    }
+
+    if (writer->sampling) {
+      jp_key_codecs_choose(writer->buffer.codecs, (const jp_TLV_record_t* const*) writer->pending + next,
+                           writer->nb_pending - next);
+      writer->sampling = 0;
+    }
+
+    writer->record_ordinal = writer->pending_ordinals[next];
+
+    ret = jp_block_writer_write_record(writer, writer->pending[next]);
+    next++;
+  }
+
+  /* the copies are swapped rather than overwritten, their kv-pair arrays are reused */
+  for (uint32_t i = next; i < writer->nb_pending; i++) {
+    jp_TLV_record_t* record = writer->pending[i - next];
+
+    writer->pending[i - next]          = writer->pending[i];
+    writer->pending[i]                 = record;
+    writer->pending_ordinals[i - next] = writer->pending_ordinals[i];
+  }
+
+  writer->nb_pending -= next;
+
+  return ret;
+}
+
+int jp_block_writer_add_record(      jp_block_writer_t *writer,
+                               const jp_TLV_record_t   *record)
+{
+  if (NULL == writer->buffer.codecs || (writer->block_open && !writer->sampling && 0 == writer->nb_pending))
+    return jp_block_writer_write_record(writer, record);
+
+  /* the kv-pairs may be a scratch record, reused as soon as this returns */
+  jp_TLV_record_t* copy = writer->pending[writer->nb_pending];
+
+  copy->kv_pairs_array->nelts = 0;
+  apr_array_cat(copy->kv_pairs_array, record->kv_pairs_array);
+
+  writer->pending_ordinals[writer->nb_pending++] = writer->record_ordinal;
+
+  if (writer->nb_pending < JP_ENCODING_SAMPLE_RECORDS)
+    return 0;
+
+  return jp_block_writer_flush_pending(writer, 0);
+}
+
+int jp_block_footer_write(jp_buffer_io_t     *buffer,
+                          apr_array_header_t *block_index,
+                          uint64_t            nb_records,
+                          uint64_t            footer_offset)
+{
+  if (0 == jp_export_uint32_to_buffer(JP_FOOTER_TAG, buffer) ||
+      0 == jp_export_uint32_to_buffer(0, buffer) ||
+      0 == jp_export_uint64_to_buffer(nb_records, buffer) ||
+      0 == jp_export_uint32_to_buffer(block_index->nelts, buffer))
+    return -1;
+
+  for (int i = 0; i < block_index->nelts; i++) {
+    jp_block_index_entry_t* entry = & ((jp_block_index_entry_t*) block_index->elts)[i];
+
+    if (0 == jp_export_uint64_to_buffer(entry->offset, buffer) ||
+        0 == jp_export_uint32_to_buffer(entry->nb_records, buffer) ||
+        0 == jp_export_uint32_to_buffer(entry->length, buffer))
+      return -1;
+  }
+
+  if (0 == jp_export_uint64_to_buffer(footer_offset, buffer) ||
+      0 == jp_export_uint32_to_buffer(JP_KV_PAIR_MAGIC, buffer))
+    return -1;
+
+  return 0;
+}
+
+int jp_block_writer_close(jp_block_writer_t *writer)
+{
+  if (0 != jp_block_writer_flush_pending(writer, 1))
+    return -1;
+
+  /* a block whose only record was dropped is not written */
+  if (writer->block_open && 0 == writer->block_records) {
+    writer->buffer.used        = writer->header_offset;
+    writer->block_open         = 0;
+    writer->buffer.defer_flush = 0;
+  }
+
+  if (writer->block_open && 0 != jp_block_writer_end_block(writer))
+    return -1;
+
+  jp_buffer_io_t* buffer = & writer->buffer;
+
+  if (0 != jp_block_footer_write(buffer, writer->block_index, writer->nb_records, jp_block_writer_position(writer)))
+    return -1;
+
+  jp_buffer_io_flush_writes(buffer);
+
+  if (buffer->write_error)
+    return -1;
+
+  /* an extended footer is never shorter than the old one, but drop anything left behind anyway */
+  if (writer->appending) {
+    struct stat file_stat;
+    int         fd = fileno(buffer->stream);
+
+    if (0 == fstat(fd, & file_stat) && S_ISREG(file_stat.st_mode))
+      if (0 != ftruncate(fd, jp_block_writer_position(writer)))
+        return -1;
+  }
+
+  return 0;
+}
+
+
+int jp_block_reader_open(jp_block_reader_t *reader,
+                         apr_pool_t        *pool,
+                         FILE              *stream)
+{
+  uint32_t first_word, version;
+
+  jp_buffer_io_read_initialize_prefetch(& reader->buffer, pool, stream);
+
+  reader->legacy             = 0;
+  reader->records_left       = 0;
+  reader->block_records_left = 0;
+  reader->block_flags        = 0;
+  reader->nb_records         = 0;
+  reader->finished           = 0;
+  reader->block_records      = 0;
+  reader->ordered            = 0;
+  reader->order_base         = 0;
+  reader->ordinals           = apr_array_make(pool, 0, sizeof(uint32_t));
+  reader->record_ordinal     = 0;
+  reader->encodings          = 0;
+
+  reader->buffer.doubles = jp_double_history_make(pool);
+  reader->buffer.codecs  = jp_key_codecs_make(pool);
+
+  if (0 == jp_import_uint32_from_buffer(& first_word, & reader->buffer))
+    return -1;
+
+  if (JP_KV_PAIR_MAGIC != first_word) {
+    reader->legacy       = 1;
+    reader->records_left = first_word;
+
+    return 0;
+  }
+
+  if (0 == jp_import_uint32_from_buffer(& version, & reader->buffer))
+    return -1;
+
+  if (version > JP_KV_PAIR_FORMAT_VERSION) {
+    fprintf(stderr, "jp_block_reader_open: unsupported format version %u \n", version);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int jp_block_reader_read_footer(jp_block_reader_t *reader)
+{
+  uint32_t flags, nb_blocks;
+  uint64_t nb_records;
+
+  if (0 == jp_import_uint32_from_buffer(& flags, & reader->buffer) ||
+      0 == jp_import_uint64_from_buffer(& nb_records, & reader->buffer) ||
+      0 == jp_import_uint32_from_buffer(& nb_blocks, & reader->buffer))
+    return -1;
+
+  if (nb_records != reader->nb_records) {
+    fprintf(stderr, "jp_block_reader_read_footer: footer declares %" PRIu64 " records, %" PRIu64 " were read \n", nb_records, reader->nb_records);
+    return -1;
+  }
+
+  if (0 != jp_buffer_io_skip_bytes(& reader->buffer, (size_t) nb_blocks * JP_BLOCK_INDEX_ENTRY_SIZE + JP_TRAILER_SIZE))
+    return -1;
+
+  reader->finished = 1;
+
+  return 0;
+}
+
+static int jp_block_reader_skip_block_end(jp_block_reader_t *reader)
+{
+  uint32_t flags = reader->block_flags;
+
+  reader->block_flags = 0;
+
+  if ((flags & JP_BLOCK_FLAG_CRC32C) && 0 != jp_buffer_io_skip_bytes(& reader->buffer, JP_BLOCK_CRC_SIZE))
+    return -1;
+
+  if ((flags & JP_BLOCK_FLAG_ORDER) && 0 != jp_buffer_io_skip_bytes(& reader->buffer, JP_ORDER_SECTION_SIZE(reader->block_records)))
+    return -1;
+
+  if ((flags & JP_BLOCK_FLAG_ENCODINGS) && 0 != jp_buffer_io_skip_bytes(& reader->buffer, reader->encodings))
+    return -1;
+
+  if (flags & JP_BLOCK_FLAG_FILTER) {
+    uint32_t nb_words, nb_hashes, nb_value_keys;
+
+    if (0 == jp_import_uint32_from_buffer(& nb_words, & reader->buffer) ||
+        0 == jp_import_uint32_from_buffer(& nb_hashes, & reader->buffer) ||
+        0 == jp_import_uint32_from_buffer(& nb_value_keys, & reader->buffer))
+      return -1;
+
+    if (0 != jp_buffer_io_skip_bytes(& reader->buffer, (size_t) nb_value_keys * sizeof(uint32_t) +
+                                                       (size_t) nb_words * sizeof(uint64_t) + JP_BLOCK_CRC_SIZE))
+      return -1;
+  }
+
+  if (flags & JP_BLOCK_FLAG_ZONE_MAP) {
+    uint32_t nb_entries;
+
+    if (0 == jp_import_uint32_from_buffer(& nb_entries, & reader->buffer) ||
+        0 != jp_buffer_io_skip_bytes(& reader->buffer, (size_t) nb_entries * JP_ZONE_MAP_ENTRY_SIZE + JP_BLOCK_CRC_SIZE))
+      return -1;
+  }
+
+  return 0;
+}
+
+/* the arrival order of the records of the block, read along with the payload before any record is decoded */
+static int jp_block_reader_read_order(jp_block_reader_t *reader,
+                                      uint32_t           flags,
+                                      uint32_t           nb_records,
+                                      uint32_t           payload_length)
+{
+  size_t section_offset = (size_t) payload_length + ((flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0);
+  size_t section_length = JP_ORDER_SECTION_SIZE(nb_records);
+
+  if (0 != jp_buffer_io_ensure_readable(& reader->buffer, section_offset + section_length)) {
+    fprintf(stderr, "jp_block_reader_next_record: truncated block after record %" PRIu64 " \n", reader->nb_records);
+    return -1;
+  }
+
+  const uint8_t* offsets;
+
+  if (0 == jp_block_order_read(reader->buffer.current_buffer + reader->buffer.used + section_offset, section_length,
+                               nb_records, & reader->order_base, & offsets)) {
+    fprintf(stderr, "jp_block_reader_next_record: corrupted record order in the block after record %" PRIu64 " \n", reader->nb_records);
+    return -1;
+  }
+
+  reader->ordinals->nelts = 0;
+
+  for (uint32_t i = 0; i < nb_records; i++)
+    memcpy(apr_array_push(reader->ordinals), offsets + (size_t) i * sizeof(uint32_t), sizeof(uint32_t));
+
+  reader->ordered = 1;
+
+  return 0;
+}
+
+/* the encodings of the keys of the block, after the arrival order, read before any record is decoded */
+static int jp_block_reader_read_encodings(jp_block_reader_t *reader,
+                                          uint32_t           flags,
+                                          uint32_t           nb_records,
+                                          uint32_t           payload_length)
+{
+  size_t   section_offset = (size_t) payload_length + ((flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0) +
+                            ((flags & JP_BLOCK_FLAG_ORDER) ? JP_ORDER_SECTION_SIZE(nb_records) : 0);
+  uint32_t nb_keys;
+
+  if (0 != jp_buffer_io_ensure_readable(& reader->buffer, section_offset + sizeof(uint32_t))) {
+    fprintf(stderr, "jp_block_reader_next_record: truncated block after record %" PRIu64 " \n", reader->nb_records);
+    return -1;
+  }
+
+  memcpy(& nb_keys, reader->buffer.current_buffer + reader->buffer.used + section_offset, sizeof(uint32_t));
+
+  size_t section_length = JP_ENCODINGS_SECTION_SIZE((size_t) nb_keys);
+
+  if (0 != jp_buffer_io_ensure_readable(& reader->buffer, section_offset + section_length)) {
+    fprintf(stderr, "jp_block_reader_next_record: truncated block after record %" PRIu64 " \n", reader->nb_records);
+    return -1;
+  }
+
+  if (0 == jp_key_codecs_read(reader->buffer.current_buffer + reader->buffer.used + section_offset, section_length,
+                              reader->buffer.codecs)) {
+    fprintf(stderr, "jp_block_reader_next_record: corrupted encodings in the block after record %" PRIu64 " \n", reader->nb_records);
+    return -1;
+  }
+
+  reader->encodings = section_length;
+
+  return 0;
+}
+
+int jp_block_reader_next_record(jp_block_reader_t  *reader,
+                                apr_pool_t         *pool,
+                                jp_TLV_record_t   **record)
+{
+  if (reader->finished)
+    return 0;
+
+  if (reader->legacy) {
+    if (0 == reader->records_left) {
+      reader->finished = 1;
+      return 0;
+    }
+
+    if (0 == jp_import_record_from_buffer(pool, record, & reader->buffer))
+      return -1;
+
+    reader->record_ordinal = reader->nb_records;
+    reader->records_left--;
+    reader->nb_records++;
+
+    return 1;
+  }
+
+  while (0 == reader->block_records_left) {
+    uint32_t tag, flags, nb_records, payload_length;
+
+    /* the checksum of the previous block, checked before its records were decoded, its filter and zone map */
+    if (0 != jp_block_reader_skip_block_end(reader))
+      return -1;
+
+    if (0 == jp_import_uint32_from_buffer(& tag, & reader->buffer))
+      return -1;
+
+    if (JP_FOOTER_TAG == tag)
+      return (0 == jp_block_reader_read_footer(reader)) ? 0 : -1;
+
+    if (JP_BLOCK_TAG != tag) {
+      fprintf(stderr, "jp_block_reader_next_record: expected a block after record %" PRIu64 " \n", reader->nb_records);
+      return -1;
+    }
+
+    if (0 == jp_import_uint32_from_buffer(& flags, & reader->buffer) ||
+        0 == jp_import_uint32_from_buffer(& nb_records, & reader->buffer) ||
+        0 == jp_import_uint32_from_buffer(& payload_length, & reader->buffer))
+      return -1;
+
+    if (flags & JP_BLOCK_FLAG_CRC32C) {
+      uint32_t stored_crc;
+
+      if (0 != jp_buffer_io_ensure_readable(& reader->buffer, (size_t) payload_length + JP_BLOCK_CRC_SIZE)) {
+        fprintf(stderr, "jp_block_reader_next_record: truncated block after record %" PRIu64 " \n", reader->nb_records);
+        return -1;
+      }
+
+      const uint8_t* payload = reader->buffer.current_buffer + reader->buffer.used;
+
+      memcpy(& stored_crc, payload + payload_length, sizeof(uint32_t));
+
+      if (stored_crc != jp_crc32c(0, payload, payload_length)) {
+        fprintf(stderr, "jp_block_reader_next_record: checksum mismatch in the block after record %" PRIu64 " \n", reader->nb_records);
+        return -1;
+      }
+
+    }
+
+    if ((flags & JP_BLOCK_FLAG_ORDER) && 0 != jp_block_reader_read_order(reader, flags, nb_records, payload_length))
+      return -1;
+
+    jp_key_codecs_reset(reader->buffer.codecs);
+
+    if ((flags & JP_BLOCK_FLAG_ENCODINGS) && 0 != jp_block_reader_read_encodings(reader, flags, nb_records, payload_length))
+      return -1;
+
+    reader->block_flags        = flags;
+    reader->block_records      = nb_records;
+    reader->block_records_left = nb_records;
+
+    jp_double_history_reset(reader->buffer.doubles);
+  }
+
+  if (0 == jp_import_record_from_buffer(pool, record, & reader->buffer))
+    return -1;
+
+  if (reader->block_flags & JP_BLOCK_FLAG_ORDER)
+    reader->record_ordinal = reader->order_base +
+                             ((uint32_t*) reader->ordinals->elts)[reader->block_records - reader->block_records_left];
+  else
+    reader->record_ordinal = reader->nb_records;
+
+  reader->block_records_left--;
+  reader->nb_records++;
+
+  return 1;
+}
+
+void jp_block_reader_close(jp_block_reader_t *reader)
+{
+  jp_buffer_io_release(& reader->buffer);
+}
+
+static inline uint32_t jp_verify_read_uint32(const uint8_t *data, uint64_t offset)
+{
+  uint32_t value;
+  memcpy(& value, data + offset, sizeof(uint32_t));
+
+  return value;
+}
+
+static inline uint64_t jp_verify_read_uint64(const uint8_t *data, uint64_t offset)
+{
+  uint64_t value;
+  memcpy(& value, data + offset, sizeof(uint64_t));
+
+  return value;
+}
+
+/* the record order, the encodings, the filter and the zone map following the checksum of a block, returns -1 if any is corrupted */
+static int jp_verify_block_sections(const uint8_t *data,
+                                    uint64_t       size,
+                                    uint32_t       flags,
+                                    uint32_t       nb_records,
+                                    uint64_t      *length)
+{
+  *length = 0;
+
+  if (flags & JP_BLOCK_FLAG_ORDER) {
+    uint64_t       base;
+    const uint8_t* offsets;
+    uint64_t       order_length = jp_block_order_read(data, size, nb_records, & base, & offsets);
+
+    if (0 == order_length)
+      return -1;
+
+    *length += order_length;
+  }
+
+  if (flags & JP_BLOCK_FLAG_ENCODINGS) {
+    uint64_t encodings_length = jp_key_codecs_read(data + *length, size - *length, NULL);
+
+    if (0 == encodings_length)
+      return -1;
+
+    *length += encodings_length;
+  }
+
+  if (flags & JP_BLOCK_FLAG_FILTER) {
+    jp_block_filter_t filter;
+    uint64_t          filter_length = jp_block_filter_read(data + *length, size - *length, & filter);
+
+    if (0 == filter_length)
+      return -1;
+
+    *length += filter_length;
+  }
+
+  if (flags & JP_BLOCK_FLAG_ZONE_MAP) {
+    jp_block_zone_map_t zone_map;
+    uint64_t            zone_map_length = jp_block_zone_map_read(data + *length, size - *length, & zone_map);
+
+    if (0 == zone_map_length)
+      return -1;
+
+    *length += zone_map_length;
+  }
+
+  return 0;
+}
+
+int jp_block_verify(const uint8_t *data,
+                    uint64_t       size,
+                    uint64_t       offset,
+                    uint64_t      *nb_records,
+                    uint32_t      *nb_blocks,
+                    uint32_t      *nb_unchecked)
+{
+  uint64_t position = offset;
+
+  *nb_records   = 0;
+  *nb_blocks    = 0;
+  *nb_unchecked = 0;
+
+  if (size < offset || size - offset < sizeof(uint32_t)) {
+    fprintf(stderr, "jp_block_verify: truncated file header \n");
+    return -1;
+  }
+
+  if (JP_KV_PAIR_MAGIC != jp_verify_read_uint32(data, position))
+    return 1;
+
+  if (size - position < 2 * sizeof(uint32_t) || jp_verify_read_uint32(data, position + 4) > JP_KV_PAIR_FORMAT_VERSION) {
+    fprintf(stderr, "jp_block_verify: unsupported format version \n");
+    return -1;
+  }
+
+  position += 2 * sizeof(uint32_t);
+
+  /* the blocks, up to the footer tag */
+  while (1) {
+    if (size - position < sizeof(uint32_t)) {
+      fprintf(stderr, "jp_block_verify: truncated after block %u, at offset %" PRIu64 " \n", *nb_blocks, position);
+      return -1;
+    }
+
+    uint32_t tag = jp_verify_read_uint32(data, position);
+
+    if (JP_FOOTER_TAG == tag)
+      break;
+
+    if (JP_BLOCK_TAG != tag || size - position < JP_BLOCK_HEADER_SIZE) {
+      fprintf(stderr, "jp_block_verify: expected block %u at offset %" PRIu64 " \n", *nb_blocks, position);
+      return -1;
+    }
+
+    uint32_t flags          = jp_verify_read_uint32(data, position + 4);
+    uint32_t block_records  = jp_verify_read_uint32(data, position + 8);
+    uint32_t payload_length = jp_verify_read_uint32(data, position + 12);
+    uint64_t payload        = position + JP_BLOCK_HEADER_SIZE;
+    uint64_t crc_size       = (flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0;
+
+    if (size - payload < (uint64_t) payload_length + crc_size) {
+      fprintf(stderr, "jp_block_verify: block %u at offset %" PRIu64 " is truncated \n", *nb_blocks, position);
+      return -1;
+    }
+
+    if (crc_size > 0) {
+      if (jp_verify_read_uint32(data, payload + payload_length) != jp_crc32c(0, data + payload, payload_length)) {
+        fprintf(stderr, "jp_block_verify: checksum mismatch in block %u at offset %" PRIu64 " \n", *nb_blocks, position);
+        return -1;
+      }
+    } else {
+      *nb_unchecked += 1;
+    }
+
+    position = payload + payload_length + crc_size;
+
+    uint64_t sections_length;
+
+    if (0 != jp_verify_block_sections(data + position, size - position, flags, block_records, & sections_length)) {
+      fprintf(stderr, "jp_block_verify: corrupted record order, filter or zone map in block %u at offset %" PRIu64 " \n", *nb_blocks, position);
+      return -1;
+    }
+
+    position += sections_length;
+
+    *nb_records += block_records;
+    *nb_blocks  += 1;
+  }
+
+  /* the footer must describe exactly the blocks met, and be followed by the trailer at the end of the file */
+  uint64_t footer_offset = position;
+
+  if (size - position < 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t)) {
+    fprintf(stderr, "jp_block_verify: truncated footer \n");
+    return -1;
+  }
+
+  uint64_t footer_records = jp_verify_read_uint64(data, position + 8);
+  uint32_t footer_blocks  = jp_verify_read_uint32(data, position + 16);
+
+  position += 2 * sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t);
+
+  if (footer_records != *nb_records || footer_blocks != *nb_blocks) {
+    fprintf(stderr, "jp_block_verify: footer declares %" PRIu64 " records in %u blocks, the file holds %" PRIu64 " in %u \n",
+            footer_records, footer_blocks, *nb_records, *nb_blocks);
+    return -1;
+  }
+
+  if ((size - position) / JP_BLOCK_INDEX_ENTRY_SIZE < footer_blocks) {
+    fprintf(stderr, "jp_block_verify: truncated footer \n");
+    return -1;
+  }
+
+  uint64_t block_offset = offset + 2 * sizeof(uint32_t);
+
+  for (uint32_t i = 0; i < footer_blocks; i++, position += JP_BLOCK_INDEX_ENTRY_SIZE) {
+    uint64_t entry_offset = jp_verify_read_uint64(data, position);
+    uint32_t entry_length = jp_verify_read_uint32(data, position + 12);
+
+    /* the blocks were walked up to the footer, so the block offset always starts a sound block */
+    uint32_t flags        = jp_verify_read_uint32(data, block_offset + 4);
+    uint64_t block_length = JP_BLOCK_HEADER_SIZE + (uint64_t) jp_verify_read_uint32(data, block_offset + 12) +
+                            ((flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0);
+    uint64_t sections_length;
+
+    jp_verify_block_sections(data + block_offset + block_length, footer_offset - block_offset - block_length, flags,
+                             jp_verify_read_uint32(data, block_offset + 8), & sections_length);
+
+    block_length += sections_length;
+
+    if (entry_offset != block_offset || entry_length != block_length ||
+        jp_verify_read_uint32(data, block_offset + 8) != jp_verify_read_uint32(data, position + 8)) {
+      fprintf(stderr, "jp_block_verify: footer entry %u does not match the blocks \n", i);
+      return -1;
+    }
+
+    block_offset += entry_length;
+  }
+
+  if (block_offset != footer_offset) {
+    fprintf(stderr, "jp_block_verify: footer entries do not cover the blocks \n");
+    return -1;
+  }
+
+  if (size - position != JP_TRAILER_SIZE ||
+      jp_verify_read_uint64(data, position) != footer_offset ||
+      JP_KV_PAIR_MAGIC != jp_verify_read_uint32(data, position + 8)) {
+    fprintf(stderr, "jp_block_verify: missing or misplaced trailer \n");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,196 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <stdlib.h>
+
+/*
+ *  Block filter layout, written after the checksum (the record order and the encodings) of the blocks flagged JP_BLOCK_FLAG_FILTER:
+ *
+ *  - uint32 number of 64-bit words, uint32 number of hash functions, uint32 number of value keys
+ *
+ *  - the uint32 key indices whose string values were added, on top of the presence of every key
+ *
+ *  - the words of the Bloom filter, sized for JP_FILTER_BITS_PER_ITEM bits per distinct item
+ *    (about 1% of false positives with JP_FILTER_NB_HASHES hash functions)
+ *
+ *  - the uint32 CRC32C of all of the above
+ *
+ *  Items are 64-bit hashes of a key index, or of a key index and a string value. The bits of an
+ *  item are derived from its two 32-bit halves (double hashing).
+ */
+
+#define JP_FILTER_FNV_OFFSET  0xCBF29CE484222325ULL
+#define JP_FILTER_FNV_PRIME   0x100000001B3ULL
+
+static inline uint64_t jp_filter_fnv(uint64_t hash, const void *data, size_t length)
+{
+  const uint8_t* bytes = data;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= JP_FILTER_FNV_PRIME;
+  }
+
+  return hash;
+}
+
+/* FNV mixes the high bits poorly, the murmur finalizer spreads them */
+static inline uint64_t jp_filter_mix(uint64_t hash)
+{
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ULL;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+uint64_t jp_block_filter_key_hash(uint32_t key_index)
+{
+  return jp_filter_mix(jp_filter_fnv(JP_FILTER_FNV_OFFSET, & key_index, sizeof(uint32_t)));
+}
+
+uint64_t jp_block_filter_value_hash(      uint32_t  key_index,
+                                    const char     *value,
+                                          uint32_t  value_length)
+{
+  /* a different seed, so that no value hashes like the bare key */
+  uint64_t hash = jp_filter_fnv(~JP_FILTER_FNV_OFFSET, & key_index, sizeof(uint32_t));
+
+  return jp_filter_mix(jp_filter_fnv(hash, value, value_length));
+}
+
+static inline uint32_t jp_filter_bit(uint64_t item, uint32_t i, uint64_t nb_bits)
+{
+  uint32_t hash = (uint32_t) item + i * ((uint32_t) (item >> 32) | 1);
+
+  return (uint32_t) (((uint64_t) hash * nb_bits) >> 32);
+}
+
+static int jp_filter_compare_items(const void *a, const void *b)
+{
+  uint64_t left  = *(const uint64_t*) a;
+  uint64_t right = *(const uint64_t*) b;
+
+  return (left > right) - (left < right);
+}
+
+uint32_t jp_block_filter_write(jp_buffer_io_t     *buffer,
+                               apr_array_header_t *items,
+                               apr_array_header_t *value_keys)
+{
+  uint64_t* item_array     = (uint64_t*) items->elts;
+  uint32_t  nb_distinct    = 0;
+  uint32_t  nb_value_keys  = value_keys ? value_keys->nelts : 0;
+
+  /* records repeat the same keys, the filter is sized for the distinct items */
+  qsort(item_array, items->nelts, sizeof(uint64_t), jp_filter_compare_items);
+
+  for (int i = 0; i < items->nelts; i++)
+    if (0 == i || item_array[i] != item_array[nb_distinct - 1])
+      item_array[nb_distinct++] = item_array[i];
+
+  uint32_t nb_words = ((uint64_t) nb_distinct * JP_FILTER_BITS_PER_ITEM + 63) / 64;
+
+  if (0 == nb_words)
+    nb_words = 1;
+
+  size_t start = buffer->used;
+
+  if (0 == jp_export_uint32_to_buffer(nb_words, buffer) ||
+      0 == jp_export_uint32_to_buffer(JP_FILTER_NB_HASHES, buffer) ||
+      0 == jp_export_uint32_to_buffer(nb_value_keys, buffer))
+    return 0;
+
+  for (uint32_t i = 0; i < nb_value_keys; i++)
+    if (0 == jp_export_uint32_to_buffer(((uint32_t*) value_keys->elts)[i], buffer))
+      return 0;
+
+  if (0 != jp_buffer_io_reserve(buffer, (size_t) nb_words * sizeof(uint64_t)))
+    return 0;
+
+  uint8_t* words   = buffer->current_buffer + buffer->used;
+  uint64_t nb_bits = (uint64_t) nb_words * 64;
+
+  memset(words, 0, (size_t) nb_words * sizeof(uint64_t));
+
+  for (uint32_t i = 0; i < nb_distinct; i++) {
+    for (uint32_t j = 0; j < JP_FILTER_NB_HASHES; j++) {
+      uint32_t bit = jp_filter_bit(item_array[i], j, nb_bits);
+
+      words[bit / 8] |= (uint8_t) (1 << (bit % 8));
+    }
+  }
+
+  buffer->used += (size_t) nb_words * sizeof(uint64_t);
+
+  /* the reserve above may have moved the buffer, the section is found again by its offset */
+  uint32_t crc = jp_crc32c(0, buffer->current_buffer + start, buffer->used - start);
+
+  if (0 == jp_export_uint32_to_buffer(crc, buffer))
+    return 0;
+
+  return buffer->used - start;
+}
+
+uint64_t jp_block_filter_read(const uint8_t           *data,
+                                    uint64_t           size,
+                                    jp_block_filter_t *filter)
+{
+  if (size < JP_FILTER_HEADER_SIZE)
+    return 0;
+
+  memcpy(& filter->nb_words, data, sizeof(uint32_t));
+  memcpy(& filter->nb_hashes, data + 4, sizeof(uint32_t));
+  memcpy(& filter->nb_value_keys, data + 8, sizeof(uint32_t));
+
+  uint64_t section = JP_FILTER_HEADER_SIZE + (uint64_t) filter->nb_value_keys * sizeof(uint32_t) +
+                     (uint64_t) filter->nb_words * sizeof(uint64_t);
+
+  if (0 == filter->nb_words || section + JP_BLOCK_CRC_SIZE > size)
+    return 0;
+
+  uint32_t stored_crc;
+  memcpy(& stored_crc, data + section, sizeof(uint32_t));
+
+  if (stored_crc != jp_crc32c(0, data, section))
+    return 0;
+
+  filter->value_keys = data + JP_FILTER_HEADER_SIZE;
+  filter->words      = filter->value_keys + (size_t) filter->nb_value_keys * sizeof(uint32_t);
+
+  return section + JP_BLOCK_CRC_SIZE;
+}
+
+int jp_block_filter_has_values(const jp_block_filter_t *filter,
+                                     uint32_t           key_index)
+{
+  for (uint32_t i = 0; i < filter->nb_value_keys; i++) {
+    uint32_t value_key;
+    memcpy(& value_key, filter->value_keys + (size_t) i * sizeof(uint32_t), sizeof(uint32_t));
+
+    if (value_key == key_index)
+      return 1;
+  }
+
+  return 0;
+}
+
+int jp_block_filter_may_contain(const jp_block_filter_t *filter,
+                                      uint64_t           item)
+{
+  uint64_t nb_bits = (uint64_t) filter->nb_words * 64;
+
+  for (uint32_t j = 0; j < filter->nb_hashes; j++) {
+    uint32_t bit = jp_filter_bit(item, j, nb_bits);
+
+    if (0 == (filter->words[bit / 8] & (1 << (bit % 8))))
+      return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,1008 @@
+
+#include <apr_pools.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+/*
+ *  Scans work on the mapped kv-pair file: the block headers are walked without reading the
+ *  payloads, and a block is only decoded if its filter and its zone map let the probe through.
+ *  The pages of the skipped payloads are never touched.
+ *
+ *  Lookups through a value index, see jp_value_index.c, go straight to the blocks it lists
+ *  through the footer of the file, and do not even walk the headers of the others.
+ *
+ *  The records of the blocks carrying their arrival order, see jp_record_order.c, are handed
+ *  over in that order: the matches are held, with the run of blocks they were decoded in, until
+ *  every record of a smaller ordinal has been read. Records only move within a cluster window,
+ *  so a full scan holds at most a window and a block. Lookups, which skip blocks, hold their
+ *  matches until the end.
+ */
+
+typedef struct jp_scan_probe
+{
+  uint32_t     key_index;
+  const char  *value;
+  uint32_t     value_length;
+  uint64_t     key_item;
+  uint64_t     value_item;
+  int          integers;
+  int          range;
+  double       min;
+  double       max;
+} jp_scan_probe_t;
+
+typedef struct jp_scan_pending
+{
+  uint64_t         ordinal;
+  jp_TLV_record_t *record;
+} jp_scan_pending_t;
+
+typedef struct jp_scan_order
+{
+  apr_pool_t         *pool;          /* the records of the run, cleared once they are all handed over */
+  apr_array_header_t *pending;       /* the jp_scan_pending_t matched and not handed over yet */
+  apr_array_header_t *seen;          /* a char per ordinal from next_ordinal, set once its record is read */
+  uint64_t            next_ordinal;  /* the smallest ordinal not read yet */
+  int                 hold;          /* blocks are left out of the scan, the matches are handed over at its end */
+} jp_scan_order_t;
+
+static jp_scan_order_t* jp_scan_order_make(apr_pool_t *pool,
+                                           int         hold)
+{
+  jp_scan_order_t* order = apr_pcalloc(pool, sizeof(jp_scan_order_t));
+
+  if (APR_SUCCESS != apr_pool_create(& order->pool, pool))
+    return NULL;
+
+  order->pending = apr_array_make(pool, 1024, sizeof(jp_scan_pending_t));
+  order->seen    = apr_array_make(pool, 1024, sizeof(char));
+  order->hold    = hold;
+
+  return order;
+}
+
+/* the records of a block go through the order while a run is open, or if the block carries its order */
+static inline int jp_scan_order_routes(const jp_scan_order_t *order,
+                                             uint32_t         flags)
+{
+  return order && ((flags & JP_BLOCK_FLAG_ORDER) || order->pending->nelts > 0 || order->seen->nelts > 0);
+}
+
+/* the ordinal of a record of the block, its position in the file for the blocks without an order */
+static inline uint64_t jp_scan_ordinal(const uint8_t *offsets,
+                                       uint64_t       base,
+                                       uint32_t       i)
+{
+  uint32_t offset;
+
+  if (NULL == offsets)
+    return base + i;
+
+  memcpy(& offset, offsets + (size_t) i * sizeof(uint32_t), sizeof(uint32_t));
+
+  return base + offset;
+}
+
+/* returns -1 for an ordinal out of any window */
+static int jp_scan_order_mark(jp_scan_order_t *order,
+                              uint64_t         ordinal,
+                              uint64_t         nb_records_max)
+{
+  if (order->hold || ordinal < order->next_ordinal)
+    return 0;
+
+  uint64_t slot = ordinal - order->next_ordinal;
+
+  if (slot > nb_records_max)
+    return -1;
+
+  while ((uint64_t) order->seen->nelts <= slot)
+    *(char*) apr_array_push(order->seen) = 0;
+
+  order->seen->elts[slot] = 1;
+
+  return 0;
+}
+
+static int jp_scan_compare_pending(const void *a,
+                                   const void *b)
+{
+  uint64_t ordinal_a = ((const jp_scan_pending_t*) a)->ordinal;
+  uint64_t ordinal_b = ((const jp_scan_pending_t*) b)->ordinal;
+
+  return (ordinal_a < ordinal_b) ? -1 : (ordinal_a > ordinal_b);
+}
+
+/* hands over the matches every smaller ordinal of which was read, all of them at the end of the scan, returns 1 if the record function stopped the scan */
+static int jp_scan_order_release(jp_scan_order_t    *order,
+                                 int                 end,
+                                 jp_scan_record_fn   record_fn,
+                                 void               *context,
+                                 jp_key_index_map_t *map)
+{
+  int nb_read = 0;
+
+  while (nb_read < order->seen->nelts && order->seen->elts[nb_read])
+    nb_read++;
+
+  if (nb_read > 0) {
+    memmove(order->seen->elts, order->seen->elts + nb_read, order->seen->nelts - nb_read);
+    order->seen->nelts  -= nb_read;
+    order->next_ordinal += nb_read;
+  }
+
+  if (order->hold && !end) {
+    if (0 == order->pending->nelts)
+      apr_pool_clear(order->pool);
+
+    return 0;
+  }
+
+  jp_scan_pending_t* pending = (jp_scan_pending_t*) order->pending->elts;
+  int                nb_released;
+
+  qsort(pending, order->pending->nelts, sizeof(jp_scan_pending_t), jp_scan_compare_pending);
+
+  for (nb_released = 0; nb_released < order->pending->nelts; nb_released++) {
+    if (!end && pending[nb_released].ordinal >= order->next_ordinal)
+      break;
+
+    if (0 != record_fn(context, pending[nb_released].ordinal, pending[nb_released].record, map))
+      return 1;
+  }
+
+  memmove(pending, pending + nb_released, (order->pending->nelts - nb_released) * sizeof(jp_scan_pending_t));
+  order->pending->nelts -= nb_released;
+
+  if (end)
+    order->seen->nelts = 0;
+
+  if (0 == order->pending->nelts && 0 == order->seen->nelts)
+    apr_pool_clear(order->pool);
+
+  return 0;
+}
+
+static int jp_scan_value_matches(const jp_scan_probe_t  *probe,
+                                 const jp_TLV_kv_pair_t *kv_pair)
+{
+  if (probe->range) {
+    double value;
+
+    if (JP_TYPE_INTEGER == kv_pair->value_type)
+      value = kv_pair->union_v.integer_value;
+    else if (JP_TYPE_DOUBLE == kv_pair->value_type)
+      value = kv_pair->union_v.double_value;
+    else
+      return 0;
+
+    return value >= probe->min && value <= probe->max;
+  }
+
+  if (NULL == probe->value)
+    return 1;
+
+  /* value indices look integers up by their decimal text */
+  if (probe->integers && JP_TYPE_INTEGER == kv_pair->value_type) {
+    char text[16];
+    int  length = snprintf(text, sizeof(text), "%" PRId32, kv_pair->union_v.integer_value);
+
+    return (uint32_t) length == probe->value_length && 0 == memcmp(text, probe->value, length);
+  }
+
+  return JP_TYPE_STRING == kv_pair->value_type &&
+         kv_pair->union_v.string_value.value_length == probe->value_length &&
+         0 == memcmp(kv_pair->union_v.string_value.value_buffer, probe->value, probe->value_length);
+}
+
+static int jp_scan_record_matches(const jp_scan_probe_t *probe,
+                                  const jp_TLV_record_t *record)
+{
+  if (0 == probe->key_index)
+    return 1;
+
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+
+  for (int i = 0; i < kv_array->nelts; i++) {
+    const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i];
+
+    if (kv_pair->key_index == probe->key_index && jp_scan_value_matches(probe, kv_pair))
+      return 1;
+  }
+
+  return 0;
+}
+
+static int jp_scan_filter_rules_out(const jp_scan_probe_t   *probe,
+                                    const jp_block_filter_t *filter)
+{
+  if (0 == probe->key_index)
+    return 0;
+
+  if (!jp_block_filter_may_contain(filter, probe->key_item))
+    return 1;
+
+  return probe->value && jp_block_filter_has_values(filter, probe->key_index) &&
+         !jp_block_filter_may_contain(filter, probe->value_item);
+}
+
+static int jp_scan_zone_map_rules_out(const jp_scan_probe_t     *probe,
+                                      const jp_block_zone_map_t *zone_map)
+{
+  double min, max;
+
+  if (!probe->range || 0 == probe->key_index)
+    return 0;
+
+  /* every numeric key of a block is in its zone map */
+  if (!jp_block_zone_map_find(zone_map, probe->key_index, & min, & max))
+    return 1;
+
+  return max < probe->min || min > probe->max;
+}
+
+/* decodes records from memory, returns -1 on corruption, 1 if the record function stopped the scan */
+static int jp_scan_records(apr_pool_t            *pool,
+                           const uint8_t         *data,
+                           size_t                 size,
+                           uint64_t               nb_records,
+                           const jp_scan_probe_t *probe,
+                           jp_double_history_t   *doubles,
+                           jp_key_codecs_t       *codecs,
+                           jp_scan_record_fn      record_fn,
+                           void                  *context,
+                           jp_key_index_map_t    *map,
+                           jp_scan_report_t      *report)
+{
+  jp_buffer_io_t buffer;
+
+  /* static buffers are only read from */
+  jp_buffer_io_initialize_static(& buffer, (uint8_t*) data, size);
+
+  /* every block decodes on its own */
+  if (doubles) {
+    jp_double_history_reset(doubles);
+    buffer.doubles = doubles;
+  }
+
+  buffer.codecs = codecs;
+
+  for (uint64_t i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record;
+
+    if (0 == jp_import_record_from_buffer(pool, & record, & buffer)) {
+      fprintf(stderr, "jp_scan_file_set: cannot decode record %" PRIu64 " \n", report->nb_records);
+      return -1;
+    }
+
+    if (jp_scan_record_matches(probe, record)) {
+      report->nb_records_matched++;
+
+      if (0 != record_fn(context, report->nb_records, record, map)) {
+        report->nb_records++;
+        return 1;
+      }
+    }
+
+    report->nb_records++;
+  }
+
+  return 0;
+}
+
+/* decodes the records of a block into the run of the order, holding the matches, returns -1 on corruption */
+static int jp_scan_ordered_records(jp_scan_order_t       *order,
+                                   const uint8_t         *data,
+                                   size_t                 size,
+                                   uint32_t               nb_records,
+                                   uint64_t               base,
+                                   const uint8_t         *offsets,
+                                   uint64_t               nb_records_max,
+                                   const jp_scan_probe_t *probe,
+                                   jp_double_history_t   *doubles,
+                                   jp_key_codecs_t       *codecs,
+                                   jp_scan_report_t      *report)
+{
+  jp_buffer_io_t buffer;
+
+  jp_buffer_io_initialize_static(& buffer, (uint8_t*) data, size);
+
+  jp_double_history_reset(doubles);
+  buffer.doubles = doubles;
+  buffer.codecs  = codecs;
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record;
+    uint64_t         ordinal = jp_scan_ordinal(offsets, base, i);
+
+    if (0 == jp_import_record_from_buffer(order->pool, & record, & buffer)) {
+      fprintf(stderr, "jp_scan_file_set: cannot decode record %" PRIu64 " \n", report->nb_records);
+      return -1;
+    }
+
+    if (0 != jp_scan_order_mark(order, ordinal, nb_records_max)) {
+      fprintf(stderr, "jp_scan_file_set: corrupted record order in the block after record %" PRIu64 " \n", report->nb_records);
+      return -1;
+    }
+
+    if (jp_scan_record_matches(probe, record)) {
+      jp_scan_pending_t* pending = apr_array_push(order->pending);
+
+      pending->ordinal = ordinal;
+      pending->record  = record;
+
+      report->nb_records_matched++;
+    }
+
+    report->nb_records++;
+  }
+
+  return 0;
+}
+
+static int jp_scan_corrupted(const jp_scan_report_t *report)
+{
+  fprintf(stderr, "jp_scan_file_set: truncated or corrupted block after record %" PRIu64 " \n", report->nb_records);
+
+  return -1;
+}
+
+/* scans the block at position and moves past it, returns 1 if the record function stopped the scan, 2 at the footer */
+static int jp_scan_block(apr_pool_t            *pool,
+                         const uint8_t         *data,
+                         size_t                 size,
+                         uint64_t              *position,
+                         const jp_scan_probe_t *probe,
+                         jp_scan_order_t       *order,
+                         jp_double_history_t   *doubles,
+                         jp_key_codecs_t       *codecs,
+                         jp_scan_record_fn      record_fn,
+                         void                  *context,
+                         jp_key_index_map_t    *map,
+                         jp_scan_report_t      *report)
+{
+  uint32_t tag, flags, nb_records, payload_length;
+
+  if (size - *position < sizeof(uint32_t))
+    return jp_scan_corrupted(report);
+
+  memcpy(& tag, data + *position, sizeof(uint32_t));
+
+  if (JP_FOOTER_TAG == tag)
+    return 2;
+
+  if (JP_BLOCK_TAG != tag || size - *position < JP_BLOCK_HEADER_SIZE)
+    return jp_scan_corrupted(report);
+
+  memcpy(& flags, data + *position + 4, sizeof(uint32_t));
+  memcpy(& nb_records, data + *position + 8, sizeof(uint32_t));
+  memcpy(& payload_length, data + *position + 12, sizeof(uint32_t));
+
+  uint64_t payload   = *position + JP_BLOCK_HEADER_SIZE;
+  uint64_t crc_size  = (flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0;
+  uint64_t block_end = payload + payload_length + crc_size;
+
+  if (size - payload < (uint64_t) payload_length + crc_size)
+    return jp_scan_corrupted(report);
+
+  *position = block_end;
+
+  report->nb_blocks++;
+
+  int            ruled_out = 0;
+  uint64_t       base      = report->nb_records;
+  const uint8_t* offsets   = NULL;
+
+  if (flags & JP_BLOCK_FLAG_ORDER) {
+    uint64_t order_length = jp_block_order_read(data + *position, size - *position, nb_records, & base, & offsets);
+
+    if (0 == order_length)
+      return jp_scan_corrupted(report);
+
+    *position += order_length;
+  }
+
+  jp_key_codecs_reset(codecs);
+
+  if (flags & JP_BLOCK_FLAG_ENCODINGS) {
+    uint64_t encodings_length = jp_key_codecs_read(data + *position, size - *position, codecs);
+
+    if (0 == encodings_length)
+      return jp_scan_corrupted(report);
+
+    *position += encodings_length;
+  }
+
+  if (flags & JP_BLOCK_FLAG_FILTER) {
+    jp_block_filter_t filter;
+    uint64_t          filter_length = jp_block_filter_read(data + *position, size - *position, & filter);
+
+    if (0 == filter_length)
+      return jp_scan_corrupted(report);
+
+    *position += filter_length;
+    ruled_out |= jp_scan_filter_rules_out(probe, & filter);
+  }
+
+  if (flags & JP_BLOCK_FLAG_ZONE_MAP) {
+    jp_block_zone_map_t zone_map;
+    uint64_t            zone_map_length = jp_block_zone_map_read(data + *position, size - *position, & zone_map);
+
+    if (0 == zone_map_length)
+      return jp_scan_corrupted(report);
+
+    *position += zone_map_length;
+    ruled_out |= jp_scan_zone_map_rules_out(probe, & zone_map);
+  }
+
+  int routed = jp_scan_order_routes(order, flags);
+
+  if (ruled_out) {
+    report->nb_blocks_skipped++;
+    report->nb_records += nb_records;
+
+    if (!routed) {
+      if (order)
+        order->next_ordinal = report->nb_records;
+
+      return 0;
+    }
+
+    /* the records of a skipped block are read too, as far as the order goes */
+    for (uint32_t i = 0; i < nb_records; i++)
+      if (0 != jp_scan_order_mark(order, jp_scan_ordinal(offsets, base, i), size))
+        return jp_scan_corrupted(report);
+
+    return jp_scan_order_release(order, 0, record_fn, context, map);
+  }
+
+  if (crc_size > 0) {
+    uint32_t stored_crc;
+    memcpy(& stored_crc, data + payload + payload_length, sizeof(uint32_t));
+
+    if (stored_crc != jp_crc32c(0, data + payload, payload_length)) {
+      fprintf(stderr, "jp_scan_file_set: checksum mismatch in the block after record %" PRIu64 " \n", report->nb_records);
+      return -1;
+    }
+  }
+
+  int ret;
+
+  if (routed) {
+    ret = jp_scan_ordered_records(order, data + payload, payload_length, nb_records, base, offsets, size, probe, doubles,
+                                  codecs, report);
+
+    if (0 == ret)
+      ret = jp_scan_order_release(order, 0, record_fn, context, map);
+  } else {
+    ret = jp_scan_records(pool, data + payload, payload_length, nb_records, probe, doubles, codecs, record_fn, context,
+                          map, report);
+
+    if (order)
+      order->next_ordinal = report->nb_records;
+  }
+
+  apr_pool_clear(pool);
+
+  return ret;
+}
+
+/* order is NULL to hand the records over in the order they are stored */
+static int jp_scan_blocks(apr_pool_t            *pool,
+                          const uint8_t         *data,
+                          size_t                 size,
+                          uint64_t               position,
+                          const jp_scan_probe_t *probe,
+                          jp_scan_order_t       *order,
+                          jp_double_history_t   *doubles,
+                          jp_key_codecs_t       *codecs,
+                          jp_scan_record_fn      record_fn,
+                          void                  *context,
+                          jp_key_index_map_t    *map,
+                          jp_scan_report_t      *report)
+{
+  int ret;
+
+  while (0 == (ret = jp_scan_block(pool, data, size, & position, probe, order, doubles, codecs, record_fn, context, map,
+                                   report)))
+    ;
+
+  /* the footer is reached, what is left of a run is handed over */
+  if (2 == ret && order)
+    jp_scan_order_release(order, 1, record_fn, context, map);
+
+  return (ret > 0) ? 0 : -1;
+}
+
+/* scans a mapped file set, block framed or written before the blocks */
+static int jp_scan_mapped(apr_pool_t            *pool,
+                          const uint8_t         *data,
+                          size_t                 size,
+                          uint64_t               offset,
+                          jp_key_index_map_t    *map,
+                          const jp_scan_probe_t *probe,
+                          int                    arrival_order,
+                          jp_scan_record_fn      record_fn,
+                          void                  *context,
+                          jp_scan_report_t      *report)
+{
+  apr_pool_t* records_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& records_pool, pool))
+    return -1;
+
+  int      ret        = -1;
+  uint32_t first_word = 0;
+  uint32_t version    = 0;
+
+  if (size - offset >= sizeof(uint32_t))
+    memcpy(& first_word, data + offset, sizeof(uint32_t));
+
+  if (size - offset >= 2 * sizeof(uint32_t))
+    memcpy(& version, data + offset + 4, sizeof(uint32_t));
+
+  if (size - offset < sizeof(uint32_t)) {
+    fprintf(stderr, "jp_scan_file_set: truncated file header \n");
+  } else if (JP_KV_PAIR_MAGIC != first_word) {
+    /* written before the block framing, every record is decoded */
+    ret = jp_scan_records(records_pool, data + offset + sizeof(uint32_t), size - offset - sizeof(uint32_t), first_word,
+                          probe, NULL, NULL, record_fn, context, map, report);
+
+    if (1 == ret)
+      ret = 0;
+  } else if (size - offset < 2 * sizeof(uint32_t) || version > JP_KV_PAIR_FORMAT_VERSION) {
+    fprintf(stderr, "jp_scan_file_set: unsupported format version %u \n", version);
+  } else {
+    /* the records pool is cleared after every block, the order outlives it */
+    jp_scan_order_t* order = arrival_order ? jp_scan_order_make(pool, 0) : NULL;
+
+    if (NULL == order && arrival_order)
+      fprintf(stderr, "jp_scan_file_set: cannot create the record order \n");
+    else
+      ret = jp_scan_blocks(records_pool, data, size, offset + 2 * sizeof(uint32_t), probe, order, jp_double_history_make(pool),
+                           jp_key_codecs_make(pool), record_fn, context, map, report);
+
+    if (order)
+      apr_pool_destroy(order->pool);
+  }
+
+  apr_pool_destroy(records_pool);
+
+  return ret;
+}
+
+/* the probe holds the value or the range looked for, its key is resolved against the file set here */
+static int jp_scan_probe_file_set(apr_pool_t        *pool,
+                                  FILE              *kv_pair_input,
+                                  FILE              *key_index_input,
+                                  const char        *key,
+                                  jp_scan_probe_t   *probe,
+                                  jp_scan_record_fn  record_fn,
+                                  void              *context,
+                                  jp_scan_report_t  *report)
+{
+  jp_scan_report_t    local_report;
+  jp_key_index_map_t* map;
+  const uint8_t*      data;
+  size_t              size;
+  uint64_t            offset;
+
+  if (NULL == report)
+    report = & local_report;
+
+  memset(report, 0, sizeof(jp_scan_report_t));
+
+  if (0 != jp_map_file_set(pool, kv_pair_input, key_index_input, & data, & size, & offset, & map, 1))
+    return -1;
+
+  if (key) {
+    probe->key_index = jp_key_index_map_find(map, key);
+
+    /* a key the file set has never seen */
+    if (0 == probe->key_index) {
+      jp_key_index_map_close(map);
+      return 0;
+    }
+
+    probe->key_item = jp_block_filter_key_hash(probe->key_index);
+
+    if (probe->value)
+      probe->value_item = jp_block_filter_value_hash(probe->key_index, probe->value, probe->value_length);
+  }
+
+  int ret = jp_scan_mapped(pool, data, size, offset, map, probe, 1, record_fn, context, report);
+
+  jp_key_index_map_close(map);
+
+  return ret;
+}
+
+int jp_scan_mapped_file_set(apr_pool_t         *pool,
+                            const uint8_t      *data,
+                            size_t              size,
+                            uint64_t            offset,
+                            jp_key_index_map_t *map,
+                            jp_scan_record_fn   record_fn,
+                            void               *context)
+{
+  jp_scan_probe_t  probe;
+  jp_scan_report_t report;
+
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+  memset(& report, 0, sizeof(jp_scan_report_t));
+
+  return jp_scan_mapped(pool, data, size, offset, map, & probe, 0, record_fn, context, & report);
+}
+
+int jp_scan_file_set(apr_pool_t        *pool,
+                     FILE              *kv_pair_input,
+                     FILE              *key_index_input,
+                     const char        *key,
+                     const char        *string_value,
+                     jp_scan_record_fn  record_fn,
+                     void              *context,
+                     jp_scan_report_t  *report)
+{
+  jp_scan_probe_t probe;
+
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+
+  if (key && string_value) {
+    probe.value        = string_value;
+    probe.value_length = strlen(string_value);
+  }
+
+  return jp_scan_probe_file_set(pool, kv_pair_input, key_index_input, key, & probe, record_fn, context, report);
+}
+
+int jp_scan_file_set_range(apr_pool_t        *pool,
+                           FILE              *kv_pair_input,
+                           FILE              *key_index_input,
+                           const char        *key,
+                           double             min,
+                           double             max,
+                           jp_scan_record_fn  record_fn,
+                           void              *context,
+                           jp_scan_report_t  *report)
+{
+  jp_scan_probe_t probe;
+
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+
+  probe.range = 1;
+  probe.min   = min;
+  probe.max   = max;
+
+  return jp_scan_probe_file_set(pool, kv_pair_input, key_index_input, key, & probe, record_fn, context, report);
+}
+
+/* the footer is found through the trailer at the end of the kv-pair stream */
+int jp_scan_read_footer(const uint8_t *data,
+                        size_t         size,
+                        uint64_t       offset,
+                        uint64_t      *footer_offset,
+                        uint64_t      *nb_records,
+                        uint32_t      *nb_blocks)
+{
+  uint32_t magic = 0, version = 0, tag;
+
+  if (size - offset >= 2 * sizeof(uint32_t)) {
+    memcpy(& magic, data + offset, sizeof(uint32_t));
+    memcpy(& version, data + offset + 4, sizeof(uint32_t));
+  }
+
+  if (JP_KV_PAIR_MAGIC != magic || version > JP_KV_PAIR_FORMAT_VERSION) {
+    fprintf(stderr, "jp_scan_read_footer: not a block framed kv-pair file, or an unsupported one \n");
+    return -1;
+  }
+
+  if (size - offset < 2 * sizeof(uint32_t) + JP_TRAILER_SIZE) {
+    fprintf(stderr, "jp_scan_read_footer: missing trailer \n");
+    return -1;
+  }
+
+  memcpy(footer_offset, data + size - JP_TRAILER_SIZE, sizeof(uint64_t));
+  memcpy(& magic, data + size - sizeof(uint32_t), sizeof(uint32_t));
+
+  if (JP_KV_PAIR_MAGIC != magic || *footer_offset < offset + 2 * sizeof(uint32_t) ||
+      *footer_offset > size - JP_TRAILER_SIZE - 3 * sizeof(uint32_t) - sizeof(uint64_t)) {
+    fprintf(stderr, "jp_scan_read_footer: missing or misplaced trailer \n");
+    return -1;
+  }
+
+  memcpy(& tag, data + *footer_offset, sizeof(uint32_t));
+  memcpy(nb_records, data + *footer_offset + 8, sizeof(uint64_t));
+  memcpy(nb_blocks, data + *footer_offset + 16, sizeof(uint32_t));
+
+  uint64_t entries = size - JP_TRAILER_SIZE - *footer_offset - 3 * sizeof(uint32_t) - sizeof(uint64_t);
+
+  if (JP_FOOTER_TAG != tag || entries / JP_BLOCK_INDEX_ENTRY_SIZE < *nb_blocks) {
+    fprintf(stderr, "jp_scan_read_footer: corrupted footer \n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static inline uint64_t jp_scan_footer_entry(uint64_t footer_offset,
+                                            uint32_t block)
+{
+  return footer_offset + 3 * sizeof(uint32_t) + sizeof(uint64_t) + (uint64_t) block * JP_BLOCK_INDEX_ENTRY_SIZE;
+}
+
+/* scans a block found through its footer entry */
+static int jp_scan_footer_block(apr_pool_t            *pool,
+                                const uint8_t         *data,
+                                size_t                 size,
+                                uint64_t               offset,
+                                uint64_t               footer_offset,
+                                uint32_t               block,
+                                const jp_scan_probe_t *probe,
+                                jp_scan_order_t       *order,
+                                jp_double_history_t   *doubles,
+                                jp_key_codecs_t       *codecs,
+                                jp_scan_record_fn      record_fn,
+                                void                  *context,
+                                jp_key_index_map_t    *map,
+                                jp_scan_report_t      *report)
+{
+  uint64_t position;
+
+  memcpy(& position, data + jp_scan_footer_entry(footer_offset, block), sizeof(uint64_t));
+
+  if (position < offset + 2 * sizeof(uint32_t) || position >= footer_offset) {
+    fprintf(stderr, "jp_scan_file_set: footer entry %u is out of the blocks \n", block);
+    return -1;
+  }
+
+  int ret = jp_scan_block(pool, data, size, & position, probe, order, doubles, codecs, record_fn, context, map, report);
+
+  /* the footer offsets always start a block */
+  return (2 == ret) ? jp_scan_corrupted(report) : ret;
+}
+
+int jp_scan_block_range(apr_pool_t         *pool,
+                        const uint8_t      *data,
+                        size_t              size,
+                        uint64_t            offset,
+                        uint64_t            footer_offset,
+                        uint32_t            first_block,
+                        uint32_t            nb_blocks,
+                        jp_key_index_map_t *map,
+                        jp_scan_record_fn   record_fn,
+                        void               *context)
+{
+  jp_scan_probe_t  probe;
+  jp_scan_report_t report;
+  apr_pool_t*      records_pool;
+
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+  memset(& report, 0, sizeof(jp_scan_report_t));
+
+  if (APR_SUCCESS != apr_pool_create(& records_pool, pool))
+    return -1;
+
+  jp_double_history_t* doubles = jp_double_history_make(pool);
+  jp_key_codecs_t*     codecs  = jp_key_codecs_make(pool);
+
+  int ret = 0;
+
+  /* the records of the blocks before are only counted, for the record numbers */
+  for (uint32_t block = 0; block < first_block; block++) {
+    uint32_t block_records;
+
+    memcpy(& block_records, data + jp_scan_footer_entry(footer_offset, block) + 8, sizeof(uint32_t));
+
+    report.nb_records += block_records;
+  }
+
+  for (uint32_t block = first_block; block < first_block + nb_blocks && 0 == ret; block++)
+    ret = jp_scan_footer_block(records_pool, data, size, offset, footer_offset, block, & probe, NULL, doubles, codecs,
+                               record_fn, context, map, & report);
+
+  apr_pool_destroy(records_pool);
+
+  return (ret < 0) ? -1 : 0;
+}
+
+typedef struct jp_index_build
+{
+  jp_value_index_builder_t *builder;
+  const uint32_t           *key_indices;
+  int                       nb_keys;
+  const uint64_t           *block_records;
+  uint32_t                  nb_blocks;
+  uint32_t                  block;
+} jp_index_build_t;
+
+static int jp_index_record(      void               *context,
+                                 uint64_t            record_number,
+                           const jp_TLV_record_t    *record,
+                           const jp_key_index_map_t *key_index)
+{
+  jp_index_build_t* build = context;
+
+  while (build->block + 1 < build->nb_blocks && record_number >= build->block_records[build->block + 1])
+    build->block++;
+
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+
+  for (int i = 0; i < kv_array->nelts; i++) {
+    const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i];
+    uint32_t                hash;
+
+    for (int key = 0; key < build->nb_keys; key++)
+      if (kv_pair->key_index == build->key_indices[key] && jp_value_index_hash(kv_pair, & hash))
+        jp_value_index_builder_add(build->builder, key, hash, build->block);
+  }
+
+  return 0;
+}
+
+int jp_build_value_index(      apr_pool_t  *pool,
+                               FILE        *kv_pair_input,
+                               FILE        *key_index_input,
+                         const char* const *keys,
+                               int          nb_keys,
+                               FILE        *index_output)
+{
+  jp_key_index_map_t* map;
+  const uint8_t*      data;
+  size_t              size;
+  uint64_t            offset, footer_offset, nb_records;
+  uint32_t            nb_blocks;
+  apr_pool_t*         records_pool;
+
+  if (0 != jp_map_file_set(pool, kv_pair_input, key_index_input, & data, & size, & offset, & map, 1))
+    return -1;
+
+  if (0 != jp_scan_read_footer(data, size, offset, & footer_offset, & nb_records, & nb_blocks) ||
+      APR_SUCCESS != apr_pool_create(& records_pool, pool)) {
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  jp_index_build_t build;
+  jp_scan_probe_t  probe;
+  jp_scan_report_t report;
+
+  memset(& build, 0, sizeof(jp_index_build_t));
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+  memset(& report, 0, sizeof(jp_scan_report_t));
+
+  uint32_t* key_indices   = apr_palloc(pool, (nb_keys + 1) * sizeof(uint32_t));
+  uint64_t* block_records = apr_palloc(pool, ((size_t) nb_blocks + 1) * sizeof(uint64_t));
+  uint64_t  first_record  = 0;
+
+  /* a key the file set has never seen has no values */
+  for (int key = 0; key < nb_keys; key++)
+    key_indices[key] = jp_key_index_map_find(map, keys[key]);
+
+  for (uint32_t block = 0; block < nb_blocks; block++) {
+    uint32_t block_length;
+
+    memcpy(& block_length, data + jp_scan_footer_entry(footer_offset, block) + 8, sizeof(uint32_t));
+
+    block_records[block] = first_record;
+    first_record        += block_length;
+  }
+
+  build.builder       = jp_value_index_builder_make(pool, keys, nb_keys);
+  build.key_indices   = key_indices;
+  build.nb_keys       = nb_keys;
+  build.block_records = block_records;
+  build.nb_blocks     = nb_blocks;
+
+  /* the blocks of the records are indexed, in the order they are stored */
+  int ret = jp_scan_blocks(records_pool, data, size, offset + 2 * sizeof(uint32_t), & probe, NULL,
+                           jp_double_history_make(pool), jp_key_codecs_make(pool), jp_index_record, & build, map, & report);
+
+  if (0 == ret && (report.nb_records != nb_records || first_record != nb_records || report.nb_blocks != nb_blocks)) {
+    fprintf(stderr, "jp_build_value_index: the footer does not match the blocks \n");
+    ret = -1;
+  }
+
+  if (0 == ret)
+    ret = jp_value_index_write(build.builder, block_records, nb_blocks, nb_records, footer_offset, index_output);
+
+  apr_pool_destroy(records_pool);
+  jp_key_index_map_close(map);
+
+  return ret;
+}
+
+int jp_lookup_file_set(      apr_pool_t        *pool,
+                       const jp_value_index_t  *index,
+                             FILE              *kv_pair_input,
+                             FILE              *key_index_input,
+                       const char              *key,
+                       const char              *value,
+                             jp_scan_record_fn  record_fn,
+                             void              *context,
+                             jp_scan_report_t  *report)
+{
+  jp_scan_report_t    local_report;
+  jp_key_index_map_t* map;
+  const uint8_t*      data;
+  size_t              size;
+  uint64_t            offset, footer_offset, nb_records;
+  uint32_t            nb_blocks;
+  apr_pool_t*         records_pool;
+
+  if (NULL == report)
+    report = & local_report;
+
+  memset(report, 0, sizeof(jp_scan_report_t));
+
+  if (0 != jp_map_file_set(pool, kv_pair_input, key_index_input, & data, & size, & offset, & map, 0))
+    return -1;
+
+  if (0 != jp_scan_read_footer(data, size, offset, & footer_offset, & nb_records, & nb_blocks)) {
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  if (!jp_value_index_matches(index, nb_records, nb_blocks, footer_offset)) {
+    fprintf(stderr, "jp_lookup_file_set: the value index was built from another file set, or before it changed \n");
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  apr_array_header_t* blocks = apr_array_make(pool, 16, sizeof(uint32_t));
+
+  if (0 != jp_value_index_find(index, key, value, blocks) || APR_SUCCESS != apr_pool_create(& records_pool, pool)) {
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  jp_scan_probe_t probe;
+
+  memset(& probe, 0, sizeof(jp_scan_probe_t));
+
+  probe.key_index    = jp_key_index_map_find(map, key);
+  probe.key_item     = jp_block_filter_key_hash(probe.key_index);
+  probe.value        = value;
+  probe.value_length = strlen(value);
+  probe.value_item   = jp_block_filter_value_hash(probe.key_index, value, probe.value_length);
+  probe.integers     = 1;
+
+  /* a key the file set has never seen matches no record */
+  if (0 == probe.key_index)
+    blocks->nelts = 0;
+
+  jp_double_history_t* doubles = jp_double_history_make(pool);
+  jp_key_codecs_t*     codecs  = jp_key_codecs_make(pool);
+  jp_scan_order_t*     order   = jp_scan_order_make(pool, 1);
+
+  int ret = order ? 0 : -1;
+
+  for (int i = 0; i < blocks->nelts && 0 == ret; i++) {
+    uint32_t block = ((uint32_t*) blocks->elts)[i];
+
+    report->nb_records = jp_value_index_block_record(index, block);
+
+    ret = jp_scan_footer_block(records_pool, data, size, offset, footer_offset, block, & probe, order, doubles, codecs,
+                               record_fn, context, map, report);
+  }
+
+  if (0 == ret)
+    jp_scan_order_release(order, 1, record_fn, context, map);
+
+  if (order)
+    apr_pool_destroy(order->pool);
+
+  uint64_t nb_blocks_decoded = report->nb_blocks - report->nb_blocks_skipped;
+
+  report->nb_blocks         = nb_blocks;
+  report->nb_blocks_skipped = nb_blocks - nb_blocks_decoded;
+  report->nb_records        = nb_records;
+
+  apr_pool_destroy(records_pool);
+  jp_key_index_map_close(map);
+
+  return (ret < 0) ? -1 : 0;
+}
@@ -0,0 +1,136 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  Block zone map layout, written after the filter of the blocks flagged JP_BLOCK_FLAG_ZONE_MAP:
+ *
+ *  - uint32 number of entries
+ *
+ *  - for every key with integer or double values in the block: its uint32 key index, and the
+ *    smallest and the largest of its values as doubles (exact for the 32-bit integers)
+ *
+ *  - the uint32 CRC32C of all of the above
+ *
+ *  A key missing from the zone map has no numeric value in the block.
+ */
+
+void jp_block_zone_map_add(apr_array_header_t *zones,
+                           apr_array_header_t *slots,
+                           uint32_t            key_index,
+                           double              value)
+{
+  /* NaN compares false against everything, it can neither widen nor match a range */
+  if (value != value)
+    return;
+
+  while (slots->nelts <= key_index)
+    *(uint32_t*) apr_array_push(slots) = 0;
+
+  uint32_t* slot = & ((uint32_t*) slots->elts)[key_index];
+
+  if (0 == *slot) {
+    jp_block_zone_t* zone = apr_array_push(zones);
+
+    zone->key_index = key_index;
+    zone->min       = value;
+    zone->max       = value;
+
+    *slot = zones->nelts;
+
+    return;
+  }
+
+  jp_block_zone_t* zone = & ((jp_block_zone_t*) zones->elts)[*slot - 1];
+
+  if (value < zone->min)
+    zone->min = value;
+
+  if (value > zone->max)
+    zone->max = value;
+}
+
+void jp_block_zone_map_reset(apr_array_header_t *zones,
+                             apr_array_header_t *slots)
+{
+  for (int i = 0; i < zones->nelts; i++)
+    ((uint32_t*) slots->elts)[((jp_block_zone_t*) zones->elts)[i].key_index] = 0;
+
+  zones->nelts = 0;
+}
+
+uint32_t jp_block_zone_map_write(jp_buffer_io_t     *buffer,
+                                 apr_array_header_t *zones)
+{
+  uint32_t nb_entries = zones->nelts;
+
+  if (0 != jp_buffer_io_reserve(buffer, sizeof(uint32_t) + (size_t) nb_entries * JP_ZONE_MAP_ENTRY_SIZE))
+    return 0;
+
+  size_t start = buffer->used;
+
+  jp_buffer_io_memcpy_to(buffer, & nb_entries, sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < nb_entries; i++) {
+    const jp_block_zone_t* zone = & ((const jp_block_zone_t*) zones->elts)[i];
+
+    jp_buffer_io_memcpy_to(buffer, & zone->key_index, sizeof(uint32_t));
+    jp_buffer_io_memcpy_to(buffer, & zone->min, sizeof(double));
+    jp_buffer_io_memcpy_to(buffer, & zone->max, sizeof(double));
+  }
+
+  uint32_t crc = jp_crc32c(0, buffer->current_buffer + start, buffer->used - start);
+
+  if (0 == jp_export_uint32_to_buffer(crc, buffer))
+    return 0;
+
+  return buffer->used - start;
+}
+
+uint64_t jp_block_zone_map_read(const uint8_t             *data,
+                                      uint64_t             size,
+                                      jp_block_zone_map_t *zone_map)
+{
+  if (size < sizeof(uint32_t))
+    return 0;
+
+  memcpy(& zone_map->nb_entries, data, sizeof(uint32_t));
+
+  uint64_t section = sizeof(uint32_t) + (uint64_t) zone_map->nb_entries * JP_ZONE_MAP_ENTRY_SIZE;
+
+  if (section + JP_BLOCK_CRC_SIZE > size)
+    return 0;
+
+  uint32_t stored_crc;
+  memcpy(& stored_crc, data + section, sizeof(uint32_t));
+
+  if (stored_crc != jp_crc32c(0, data, section))
+    return 0;
+
+  zone_map->entries = data + sizeof(uint32_t);
+
+  return section + JP_BLOCK_CRC_SIZE;
+}
+
+int jp_block_zone_map_find(const jp_block_zone_map_t *zone_map,
+                                 uint32_t             key_index,
+                                 double              *min,
+                                 double              *max)
+{
+  for (uint32_t i = 0; i < zone_map->nb_entries; i++) {
+    const uint8_t* entry = zone_map->entries + (size_t) i * JP_ZONE_MAP_ENTRY_SIZE;
+    uint32_t       entry_key;
+
+    memcpy(& entry_key, entry, sizeof(uint32_t));
+
+    if (entry_key == key_index) {
+      memcpy(min, entry + sizeof(uint32_t), sizeof(double));
+      memcpy(max, entry + sizeof(uint32_t) + sizeof(double), sizeof(double));
+      return 1;
+    }
+  }
+
+  return 0;
+}
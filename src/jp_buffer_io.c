@@ -1,6 +1,10 @@
 
 #include <apr_pools.h>
 
+#include <errno.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include "jp_tlv_encoder_private.h"
 
 
@@ -13,6 +17,17 @@ static void jp_buffer_io_initialize(jp_buffer_io_t* buffer, apr_pool_t *pool, FI
   buffer->stream         = file;
   buffer->pool           = pool;
   buffer->read_mode      = read_mode;
+  buffer->eof            = 0;
+  buffer->prefetch       = NULL;
+  buffer->nb_segments    = 0;
+  buffer->segment_start  = 0;
+  buffer->defer_flush    = 0;
+  buffer->no_references  = 0;
+  buffer->doubles        = NULL;
+  buffer->strings        = NULL;
+  buffer->codecs         = NULL;
+  buffer->flushed_bytes  = 0;
+  buffer->write_error    = 0;
 }
 
 void
@@ -21,6 +36,30 @@ jp_buffer_io_read_initialize(jp_buffer_io_t* buffer, apr_pool_t *pool, FILE* fil
   jp_buffer_io_initialize(buffer, pool, file, 1);
 }
 
+void
+jp_buffer_io_read_initialize_prefetch(jp_buffer_io_t* buffer, apr_pool_t *pool, FILE* file)
+{
+  jp_buffer_io_initialize(buffer, pool, file, 1);
+
+  buffer->prefetch = jp_prefetch_reader_start(pool, file);
+
+  if (NULL == buffer->prefetch)
+    return;
+
+  /* a larger window keeps the leftover memmove in jp_buffer_io_read rare */
+  buffer->current_buffer = apr_palloc(pool, JP_PREFETCH_WINDOW_SIZE);
+  buffer->current_size   = JP_PREFETCH_WINDOW_SIZE;
+}
+
+void
+jp_buffer_io_release(jp_buffer_io_t* buffer)
+{
+  if (buffer->prefetch) {
+    jp_prefetch_reader_stop(buffer->prefetch);
+    buffer->prefetch = NULL;
+  }
+}
+
 void
 jp_buffer_io_write_initialize(jp_buffer_io_t* buffer, apr_pool_t *pool, FILE* file)
 {
@@ -37,6 +76,17 @@ jp_buffer_io_initialize_static(jp_buffer_io_t *buffer, uint8_t* memory, size_t s
   buffer->stream         = NULL;
   buffer->pool           = NULL;
   buffer->read_mode      = 0;
+  buffer->eof            = 0;
+  buffer->prefetch       = NULL;
+  buffer->nb_segments    = 0;
+  buffer->segment_start  = 0;
+  buffer->defer_flush    = 0;
+  buffer->no_references  = 0;
+  buffer->doubles        = NULL;
+  buffer->strings        = NULL;
+  buffer->codecs         = NULL;
+  buffer->flushed_bytes  = 0;
+  buffer->write_error    = 0;
 }
 
 int
@@ -68,10 +118,32 @@ jp_buffer_io_grow(jp_buffer_io_t* buffer, size_t not_less_than)
   return 0;
 }
 
+int jp_buffer_io_reserve(jp_buffer_io_t *buffer,
+                         size_t          size)
+{
+  if (jp_buffer_io_bytes_left_to_write(buffer) >= size)
+    return 0;
+
+  if (NULL == buffer->stream)
+    return -1;
+
+  if (buffer->defer_flush)
+    return jp_buffer_io_grow(buffer, buffer->used + size);
+
+  jp_buffer_io_flush_writes(buffer);
+
+  if (jp_buffer_io_bytes_left_to_write(buffer) >= size)
+    return 0;
+
+  return jp_buffer_io_grow(buffer, size);
+}
+
 uint8_t* jp_buffer_io_use_available_bytes(jp_buffer_io_t *buffer,
                                           size_t          size)
 {
-  if (buffer->used + size < buffer->current_size) {
+  int available = jp_buffer_io_bytes_left_to_read(buffer);
+
+  if (available >= 0 && size <= (size_t) available) {
     uint8_t* ret = buffer->current_buffer + buffer->used;
 
     buffer->used += size;
@@ -79,7 +151,7 @@ uint8_t* jp_buffer_io_use_available_bytes(jp_buffer_io_t *buffer,
     return ret;
   }
 
-  fprintf(stderr, "jp_buffer_io_use_available_bytes: trying to consume %ld bytes, but only %ld available \n",size, buffer->current_size - buffer->used);
+  fprintf(stderr, "jp_buffer_io_use_available_bytes: trying to consume %ld bytes, but only %d available \n",size, available);
   fprintf(stderr, "jp_buffer_io_use_available_bytes: buffer size: %ld. used: %ld. Returning NULL \n", buffer->current_size, buffer->used);
 
   return NULL;
@@ -113,6 +185,45 @@ void* jp_buffer_io_memcpy_to(      jp_buffer_io_t *buffer,
   return ret;
 }
 
+static void jp_buffer_io_close_segment(jp_buffer_io_t *buffer)
+{
+  if (buffer->used == buffer->segment_start)
+    return;
+
+  jp_buffer_io_segment_t* segment = & buffer->segments[buffer->nb_segments++];
+
+  segment->external     = NULL;
+  segment->offset       = buffer->segment_start;
+  segment->length       = buffer->used - buffer->segment_start;
+  buffer->segment_start = buffer->used;
+}
+
+const void* jp_buffer_io_reference_bytes(      jp_buffer_io_t *buffer,
+                                         const void           *src,
+                                               size_t          size)
+{
+  if (NULL == buffer->stream || buffer->read_mode || buffer->no_references)
+    return NULL;
+
+  /* room for the pending buffer segment, the referenced one and the buffer segment that follows it */
+  if (buffer->nb_segments + 3 > JP_IO_MAX_SEGMENTS) {
+    if (buffer->defer_flush)
+      return NULL;
+
+    jp_buffer_io_flush_writes(buffer);
+  }
+
+  jp_buffer_io_close_segment(buffer);
+
+  jp_buffer_io_segment_t* segment = & buffer->segments[buffer->nb_segments++];
+
+  segment->external = src;
+  segment->offset   = 0;
+  segment->length   = size;
+
+  return src;
+}
+
 void* jp_buffer_io_memcpy_from(jp_buffer_io_t *buffer,
                                void           *dest,
                                size_t          size)
@@ -128,12 +239,108 @@ void* jp_buffer_io_memcpy_from(jp_buffer_io_t *buffer,
 }
 
 
+static void jp_buffer_io_writev_segments(jp_buffer_io_t* buffer)
+{
+  struct iovec iov[JP_IO_MAX_SEGMENTS];
+  int          nb_iov = buffer->nb_segments;
+
+  for (int i = 0; i < nb_iov; i++) {
+    jp_buffer_io_segment_t* segment = & buffer->segments[i];
+
+    iov[i].iov_base = (void*)((NULL == segment->external) ? buffer->current_buffer + segment->offset : segment->external);
+    iov[i].iov_len  = segment->length;
+
+    buffer->flushed_bytes += segment->length;
+  }
+
+  /* whatever stdio still holds must reach the descriptor before the vector */
+  fflush(buffer->stream);
+
+  int          fd    = fileno(buffer->stream);
+  struct iovec *next = iov;
+
+  while (nb_iov > 0) {
+    ssize_t written = writev(fd, next, nb_iov);
+
+    if (written < 0) {
+      if (EINTR == errno)
+        continue;
+
+      fprintf(stderr, "jp_buffer_io_flush_writes: writev failed: %s \n", strerror(errno));
+      buffer->write_error = 1;
+      break;
+    }
+
+    while (nb_iov > 0 && (size_t) written >= next->iov_len) {
+      written -= next->iov_len;
+      next++;
+      nb_iov--;
+    }
+
+    if (nb_iov > 0) {
+      next->iov_base  = (uint8_t*) next->iov_base + written;
+      next->iov_len  -= written;
+    }
+  }
+}
+
 void jp_buffer_io_flush_writes(jp_buffer_io_t* buffer)
 {
-  if (buffer->stream)
-    fwrite(buffer->current_buffer, 1, buffer->used, buffer->stream);
+  /*
+   *  every write goes through the descriptor, mixing in buffered stdio writes
+   *  would let the stream write at a stale position
+   */
+  if (buffer->stream) {
+    jp_buffer_io_close_segment(buffer);
+    jp_buffer_io_writev_segments(buffer);
+  }
 
-  buffer->used = 0;
+  buffer->used          = 0;
+  buffer->nb_segments   = 0;
+  buffer->segment_start = 0;
+}
+
+int
+jp_buffer_io_ensure_readable(jp_buffer_io_t* buffer, size_t size)
+{
+  while (jp_buffer_io_bytes_left_to_read(buffer) < (int) size) {
+    int available = jp_buffer_io_bytes_left_to_read(buffer);
+
+    if (NULL == buffer->stream || buffer->eof)
+      return -1;
+
+    if (buffer->current_size < size && 0 != jp_buffer_io_grow(buffer, size))
+      return -1;
+
+    jp_buffer_io_read(buffer);
+
+    if (jp_buffer_io_bytes_left_to_read(buffer) <= available)
+      return -1;
+  }
+
+  return 0;
+}
+
+int
+jp_buffer_io_skip_bytes(jp_buffer_io_t* buffer, size_t size)
+{
+  while (size > 0) {
+    int available = jp_buffer_io_bytes_left_to_read(buffer);
+
+    if (available <= 0) {
+      if (0 != jp_buffer_io_read(buffer))
+        return -1;
+
+      continue;
+    }
+
+    size_t to_skip = (size < (size_t) available) ? size : (size_t) available;
+
+    buffer->used += to_skip;
+    size         -= to_skip;
+  }
+
+  return 0;
 }
 
 int
@@ -141,15 +348,22 @@ jp_buffer_io_read(jp_buffer_io_t* buffer)
 {
   int leftover_read = jp_buffer_io_bytes_left_to_read(buffer);
 
-  if (leftover_read < 0)
+  /* static buffers have nothing more to read, and may be read-only mapped memory */
+  if (leftover_read < 0 || NULL == buffer->stream)
     return -1;
 
   if (leftover_read > 0) {
     memmove(buffer->current_buffer, buffer->current_buffer + buffer->used, leftover_read);
   }
 
-  if (buffer->stream) {
-    buffer->read = leftover_read + fread(buffer->current_buffer + leftover_read, 1, buffer->current_size, buffer->stream);
+  size_t to_read = buffer->current_size - leftover_read;
+
+  if (buffer->prefetch) {
+    buffer->read = leftover_read + jp_prefetch_reader_read(buffer->prefetch, buffer->current_buffer + leftover_read, to_read);
+    buffer->eof  = jp_prefetch_reader_eof(buffer->prefetch);
+  }
+  else if (buffer->stream) {
+    buffer->read = leftover_read + fread(buffer->current_buffer + leftover_read, 1, to_read, buffer->stream);
     buffer->eof  = feof(buffer->stream);
   }
   else return -1;
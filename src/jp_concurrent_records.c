@@ -0,0 +1,131 @@
+
+#include <apr_allocator.h>
+#include <apr_hash.h>
+#include <apr_thread_mutex.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  Every producer thread fills a segment of its own: a record collection with its own pool,
+ *  allocator and key index, so that adding records and interning keys never synchronize.
+ *  The mutex only guards the creation of the segments.
+ *
+ *  The segments are written in the order they were created, their key indices translated to
+ *  the key index of the whole collection, which grows with every export.
+ */
+
+struct jp_concurrent_records
+{
+  apr_pool_t         *pool;
+  jp_TLV_records_t   *merged;   /* the key index written, and the block filter settings */
+  apr_array_header_t *segments;
+
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+jp_concurrent_records_t* jp_concurrent_records_make(apr_pool_t *pool)
+{
+  jp_concurrent_records_t* records = apr_pcalloc(pool, sizeof(jp_concurrent_records_t));
+
+  records->pool     = pool;
+  records->merged   = jp_TLV_record_collection_make(pool);
+  records->segments = apr_array_make(pool, 16, sizeof(jp_TLV_records_t*));
+
+#if APR_HAS_THREADS
+  if (APR_SUCCESS != apr_thread_mutex_create(& records->mutex, APR_THREAD_MUTEX_DEFAULT, pool)) {
+    fprintf(stderr, "jp_concurrent_records_make: unable to create a mutex \n");
+    return NULL;
+  }
+#endif
+
+  return records;
+}
+
+void jp_concurrent_records_enable_block_filters(      jp_concurrent_records_t *records,
+                                                const char* const             *value_keys,
+                                                      int                      nb_value_keys)
+{
+  jp_enable_block_filters(records->merged, value_keys, nb_value_keys);
+}
+
+jp_TLV_records_t* jp_concurrent_records_segment_make(jp_concurrent_records_t *records)
+{
+  apr_allocator_t*  allocator;
+  apr_pool_t*       segment_pool;
+  jp_TLV_records_t* segment = NULL;
+
+  /* the allocators of child pools are shared, unless they are given their own */
+  if (APR_SUCCESS != apr_allocator_create(& allocator))
+    return NULL;
+
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(records->mutex);
+#endif
+
+  if (APR_SUCCESS == apr_pool_create_ex(& segment_pool, records->pool, NULL, allocator)) {
+    apr_allocator_owner_set(allocator, segment_pool);
+
+    segment = jp_TLV_record_collection_make(segment_pool);
+
+    *(jp_TLV_records_t**) apr_array_push(records->segments) = segment;
+  } else {
+    apr_allocator_destroy(allocator);
+  }
+
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(records->mutex);
+#endif
+
+  return segment;
+}
+
+/* translates the key indices of a segment, in the order of its own so that exports are reproducible */
+static uint32_t* jp_concurrent_records_key_map(apr_pool_t       *pool,
+                                               jp_TLV_records_t *merged,
+                                               jp_TLV_records_t *segment)
+{
+  unsigned int nb_keys = apr_hash_count(segment->key_index);
+  const char** keys    = apr_pcalloc(pool, (nb_keys + 1) * sizeof(const char*));
+  uint32_t*    key_map = apr_pcalloc(pool, (nb_keys + 1) * sizeof(uint32_t));
+
+  for (apr_hash_index_t* entry = apr_hash_first(pool, segment->key_index); entry; entry = apr_hash_next(entry)) {
+    const void* key;
+    void*       index;
+
+    apr_hash_this(entry, & key, NULL, & index);
+
+    if ((size_t) index <= nb_keys)
+      keys[(size_t) index] = key;
+  }
+
+  for (unsigned int i = 1; i <= nb_keys; i++)
+    key_map[i] = jp_find_or_add_key(merged->key_index, keys[i]);
+
+  return key_map;
+}
+
+int jp_export_concurrent_records_to_file_set(jp_concurrent_records_t *records,
+                                             FILE                    *kv_pair_output,
+                                             FILE                    *key_index_output)
+{
+  apr_pool_t* pool;
+  int         nb_segments = records->segments->nelts;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, records->pool))
+    return -1;
+
+  const uint32_t** key_maps = apr_palloc(pool, (nb_segments + 1) * sizeof(uint32_t*));
+
+  for (int i = 0; i < nb_segments; i++)
+    key_maps[i] = jp_concurrent_records_key_map(pool, records->merged, ((jp_TLV_records_t**) records->segments->elts)[i]);
+
+  int ret = jp_export_segments_to_file_set(records->merged, (const jp_TLV_records_t**) records->segments->elts, key_maps,
+                                           nb_segments, kv_pair_output, key_index_output);
+
+  apr_pool_destroy(pool);
+
+  return ret;
+}
@@ -0,0 +1,121 @@
+
+#include "jp_tlv_encoder_private.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JP_CRC32C_HAS_SSE42 1
+#include <nmmintrin.h>
+#endif
+
+/*
+ *  CRC32C (Castagnoli, reflected polynomial 0x82F63B78), the checksum of the SSE4.2 crc32
+ *  instruction. The table fallback processes eight bytes per step (slicing-by-8)
+ */
+
+#define JP_CRC32C_POLYNOMIAL 0x82F63B78u
+
+static uint32_t jp_crc32c_table[8][256];
+static int      jp_crc32c_table_ready = 0;
+
+static void jp_crc32c_build_table(void)
+{
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 1) ? (crc >> 1) ^ JP_CRC32C_POLYNOMIAL : crc >> 1;
+
+    jp_crc32c_table[0][i] = crc;
+  }
+
+  for (uint32_t i = 0; i < 256; i++)
+    for (int slice = 1; slice < 8; slice++)
+      jp_crc32c_table[slice][i] = (jp_crc32c_table[slice - 1][i] >> 8) ^ jp_crc32c_table[0][jp_crc32c_table[slice - 1][i] & 0xFF];
+
+  __atomic_store_n(& jp_crc32c_table_ready, 1, __ATOMIC_RELEASE);
+}
+
+static uint32_t jp_crc32c_software(uint32_t       crc,
+                                   const uint8_t *bytes,
+                                   size_t         length)
+{
+  /* building the table twice from two threads writes the same values */
+  if (!__atomic_load_n(& jp_crc32c_table_ready, __ATOMIC_ACQUIRE))
+    jp_crc32c_build_table();
+
+  while (length >= 8) {
+    uint32_t low, high;
+
+    memcpy(& low, bytes, sizeof(uint32_t));
+    memcpy(& high, bytes + 4, sizeof(uint32_t));
+
+    low ^= crc;
+
+    crc = jp_crc32c_table[7][low & 0xFF] ^ jp_crc32c_table[6][(low >> 8) & 0xFF] ^
+          jp_crc32c_table[5][(low >> 16) & 0xFF] ^ jp_crc32c_table[4][low >> 24] ^
+          jp_crc32c_table[3][high & 0xFF] ^ jp_crc32c_table[2][(high >> 8) & 0xFF] ^
+          jp_crc32c_table[1][(high >> 16) & 0xFF] ^ jp_crc32c_table[0][high >> 24];
+
+    bytes  += 8;
+    length -= 8;
+  }
+
+  while (length-- > 0)
+    crc = (crc >> 8) ^ jp_crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+
+  return crc;
+}
+
+#ifdef JP_CRC32C_HAS_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t jp_crc32c_sse42(uint32_t       crc,
+                                const uint8_t *bytes,
+                                size_t         length)
+{
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(& word, bytes, sizeof(uint64_t));
+
+    crc64   = _mm_crc32_u64(crc64, word);
+    bytes  += 8;
+    length -= 8;
+  }
+
+  crc = (uint32_t) crc64;
+#endif
+
+  while (length >= 4) {
+    uint32_t word;
+    memcpy(& word, bytes, sizeof(uint32_t));
+
+    crc     = _mm_crc32_u32(crc, word);
+    bytes  += 4;
+    length -= 4;
+  }
+
+  while (length-- > 0)
+    crc = _mm_crc32_u8(crc, *bytes++);
+
+  return crc;
+}
+
+#endif
+
+uint32_t jp_crc32c(uint32_t    crc,
+                   const void *data,
+                   size_t      length)
+{
+  crc = ~crc;
+
+#ifdef JP_CRC32C_HAS_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    return ~jp_crc32c_sse42(crc, data, length);
+#endif
+
+  return ~jp_crc32c_software(crc, data, length);
+}
+
+#undef JP_CRC32C_POLYNOMIAL
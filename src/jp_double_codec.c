@@ -0,0 +1,272 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  Double values are written with the shortest of these encodings, all of them exact to the bit,
+ *  the code taking the 6 low bits of the descriptor byte:
+ *
+ *  - JP_DOUBLE_CODE_SMALL + n: the integral value n, 0 to 31, no payload
+ *
+ *  - JP_DOUBLE_CODE_RAW: the 8 bytes of the IEEE 754 double, the only encoding before format version 4
+ *
+ *  - JP_DOUBLE_CODE_INT8/INT16/INT32: an integral value, as a signed integer of 1, 2 or 4 bytes
+ *
+ *  - JP_DOUBLE_CODE_FLOAT: a value exactly representable as a float, its 4 bytes
+ *
+ *  - JP_DOUBLE_CODE_REPEAT: the same value as the previous double of the key in the block, no payload
+ *
+ *  - JP_DOUBLE_CODE_XOR + m - 1: the previous double of the key in the block XOR the value, as
+ *    a byte counting the trailing zero bytes of the XOR, followed by its m (1 to 7) next bytes
+ *
+ *  The last two only appear in blocks, whose readers and writers keep the last double of every
+ *  key; the previous values of a key are forgotten at the start of every block, so that blocks
+ *  decode on their own. The XOR is byte-granular rather than bit-packed as in Gorilla, the
+ *  records are byte-aligned, but successive values of gauges and latencies still share their
+ *  sign, exponent and high mantissa bytes.
+ */
+
+#define JP_DOUBLE_HISTORY_MAX_KEYS  (1 << 20)
+
+typedef struct jp_double_history_entry
+{
+  uint64_t bits;
+  uint32_t generation;
+} jp_double_history_entry_t;
+
+struct jp_double_history
+{
+  apr_array_header_t *entries;
+  uint32_t            generation;
+};
+
+jp_double_history_t* jp_double_history_make(apr_pool_t *pool)
+{
+  jp_double_history_t* history = apr_palloc(pool, sizeof(jp_double_history_t));
+
+  history->entries    = apr_array_make(pool, 64, sizeof(jp_double_history_entry_t));
+  history->generation = 1;
+
+  return history;
+}
+
+void jp_double_history_reset(jp_double_history_t *history)
+{
+  /* the entries of the previous generations are stale */
+  if (0 == ++history->generation) {
+    history->entries->nelts = 0;
+    history->generation     = 1;
+  }
+}
+
+/* the entry of a key, NULL if the key is beyond the keys followed */
+static jp_double_history_entry_t* jp_double_history_entry(jp_double_history_t *history,
+                                                          uint32_t             key_index)
+{
+  if (NULL == history || key_index >= JP_DOUBLE_HISTORY_MAX_KEYS)
+    return NULL;
+
+  while (history->entries->nelts <= key_index) {
+    jp_double_history_entry_t* entry = apr_array_push(history->entries);
+
+    entry->bits       = 0;
+    entry->generation = 0;
+  }
+
+  return & ((jp_double_history_entry_t*) history->entries->elts)[key_index];
+}
+
+static inline uint64_t jp_double_bits(double value)
+{
+  uint64_t bits;
+
+  memcpy(& bits, & value, sizeof(uint64_t));
+
+  return bits;
+}
+
+static inline double jp_double_from_bits(uint64_t bits)
+{
+  double value;
+
+  memcpy(& value, & bits, sizeof(double));
+
+  return value;
+}
+
+uint32_t jp_double_encode(jp_double_history_t *history,
+                          uint32_t             key_index,
+                          double               value,
+                          uint8_t             *code,
+                          uint8_t             *payload)
+{
+  uint64_t                   bits  = jp_double_bits(value);
+  jp_double_history_entry_t* entry = jp_double_history_entry(history, key_index);
+  uint32_t                   length;
+
+  *code  = JP_DOUBLE_CODE_RAW;
+  length = sizeof(double);
+
+  /* -0.0 and the NaNs fail the bit comparisons, and stay raw */
+  if (value >= -2147483648.0 && value <= 2147483647.0) {
+    int32_t integer = (int32_t) value;
+
+    if (jp_double_bits((double) integer) == bits) {
+      if (integer >= 0 && integer < 32) {
+        *code  = JP_DOUBLE_CODE_SMALL + integer;
+        length = 0;
+      } else if (integer >= INT8_MIN && integer <= INT8_MAX) {
+        int8_t narrow = integer;
+        *code  = JP_DOUBLE_CODE_INT8;
+        length = sizeof(int8_t);
+        memcpy(payload, & narrow, length);
+      } else if (integer >= INT16_MIN && integer <= INT16_MAX) {
+        int16_t narrow = integer;
+        *code  = JP_DOUBLE_CODE_INT16;
+        length = sizeof(int16_t);
+        memcpy(payload, & narrow, length);
+      } else {
+        *code  = JP_DOUBLE_CODE_INT32;
+        length = sizeof(int32_t);
+        memcpy(payload, & integer, length);
+      }
+    }
+  }
+
+  if (length > sizeof(float)) {
+    float narrow = (float) value;
+
+    if (jp_double_bits((double) narrow) == bits) {
+      *code  = JP_DOUBLE_CODE_FLOAT;
+      length = sizeof(float);
+      memcpy(payload, & narrow, length);
+    }
+  }
+
+  if (entry && entry->generation == history->generation && length > 0) {
+    uint64_t delta = entry->bits ^ bits;
+
+    if (0 == delta) {
+      *code  = JP_DOUBLE_CODE_REPEAT;
+      length = 0;
+    } else {
+      uint32_t trailing   = __builtin_ctzll(delta) / 8;
+      uint32_t meaningful = 8 - __builtin_clzll(delta) / 8 - trailing;
+
+      if (meaningful < 8 && 1 + meaningful < length) {
+        uint64_t shifted = delta >> (8 * trailing);
+
+        *code      = JP_DOUBLE_CODE_XOR + meaningful - 1;
+        length     = 1 + meaningful;
+        payload[0] = trailing;
+
+        /* the bytes are stored least significant first, whatever the host */
+        for (uint32_t i = 0; i < meaningful; i++)
+          payload[1 + i] = (uint8_t) (shifted >> (8 * i));
+      }
+    }
+  }
+
+  if (JP_DOUBLE_CODE_RAW == *code)
+    memcpy(payload, & value, sizeof(double));
+
+  if (entry) {
+    entry->bits       = bits;
+    entry->generation = history->generation;
+  }
+
+  return length;
+}
+
+int jp_double_payload_length(uint8_t code)
+{
+  if (code >= JP_DOUBLE_CODE_SMALL)
+    return 0;
+
+  if (code >= JP_DOUBLE_CODE_XOR && code < JP_DOUBLE_CODE_XOR + 7)
+    return 1 + (code - JP_DOUBLE_CODE_XOR + 1);
+
+  switch (code) {
+    case JP_DOUBLE_CODE_RAW:    return sizeof(double);
+    case JP_DOUBLE_CODE_INT8:   return sizeof(int8_t);
+    case JP_DOUBLE_CODE_INT16:  return sizeof(int16_t);
+    case JP_DOUBLE_CODE_INT32:  return sizeof(int32_t);
+    case JP_DOUBLE_CODE_FLOAT:  return sizeof(float);
+    case JP_DOUBLE_CODE_REPEAT: return 0;
+    default:                    return -1;
+  }
+}
+
+int jp_double_decode(      jp_double_history_t *history,
+                           uint32_t             key_index,
+                           uint8_t              code,
+                     const uint8_t             *payload,
+                           double              *value)
+{
+  jp_double_history_entry_t* entry = jp_double_history_entry(history, key_index);
+  int8_t                     narrow8;
+  int16_t                    narrow16;
+  int32_t                    integer;
+  float                      narrow;
+
+  if (code >= JP_DOUBLE_CODE_SMALL) {
+    *value = code - JP_DOUBLE_CODE_SMALL;
+  } else if (code >= JP_DOUBLE_CODE_XOR && code < JP_DOUBLE_CODE_XOR + 7) {
+    uint32_t meaningful = code - JP_DOUBLE_CODE_XOR + 1;
+    uint32_t trailing   = payload[0];
+    uint64_t shifted    = 0;
+
+    if (NULL == entry || entry->generation != history->generation || trailing + meaningful > 8)
+      return -1;
+
+    for (uint32_t i = 0; i < meaningful; i++)
+      shifted |= (uint64_t) payload[1 + i] << (8 * i);
+
+    *value = jp_double_from_bits(entry->bits ^ (shifted << (8 * trailing)));
+  } else {
+    switch (code) {
+      case JP_DOUBLE_CODE_RAW:
+      memcpy(value, payload, sizeof(double));
+      break;
+
+      case JP_DOUBLE_CODE_INT8:
+      memcpy(& narrow8, payload, sizeof(int8_t));
+      *value = narrow8;
+      break;
+
+      case JP_DOUBLE_CODE_INT16:
+      memcpy(& narrow16, payload, sizeof(int16_t));
+      *value = narrow16;
+      break;
+
+      case JP_DOUBLE_CODE_INT32:
+      memcpy(& integer, payload, sizeof(int32_t));
+      *value = integer;
+      break;
+
+      case JP_DOUBLE_CODE_FLOAT:
+      memcpy(& narrow, payload, sizeof(float));
+      *value = narrow;
+      break;
+
+      case JP_DOUBLE_CODE_REPEAT:
+      if (NULL == entry || entry->generation != history->generation)
+        return -1;
+
+      *value = jp_double_from_bits(entry->bits);
+      break;
+
+      default:
+      return -1;
+    }
+  }
+
+  if (entry) {
+    entry->bits       = jp_double_bits(*value);
+    entry->generation = history->generation;
+  }
+
+  return 0;
+}
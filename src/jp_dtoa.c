@@ -0,0 +1,281 @@
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <math.h>
+
+/*
+ *  Shortest round-trip formatting of doubles, with the Grisu2 algorithm (Loitsch, "Printing
+ *  floating-point numbers quickly and accurately with integers", PLDI 2010): the digits always
+ *  read back as the same double, and are the fewest possible for all but a tiny share of values,
+ *  which get one digit more. Only 64-bit integer arithmetic is involved, no bignum.
+ */
+
+typedef struct jp_diy_fp
+{
+  uint64_t f;
+  int      e;
+} jp_diy_fp_t;
+
+/* 10^k for k = -348, -340, ..., 340, normalized to a 64-bit significand and a binary exponent */
+static const struct { uint64_t f; int16_t e; } jp_cached_powers[] = {
+  { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 },
+  { 0xcf42894a5dce35eaULL, -1140 }, { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 },
+  { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 }, { 0xbe5691ef416bd60cULL, -1007 },
+  { 0x8dd01fad907ffc3cULL,  -980 }, { 0xd3515c2831559a83ULL,  -954 }, { 0x9d71ac8fada6c9b5ULL,  -927 },
+  { 0xea9c227723ee8bcbULL,  -901 }, { 0xaecc49914078536dULL,  -874 }, { 0x823c12795db6ce57ULL,  -847 },
+  { 0xc21094364dfb5637ULL,  -821 }, { 0x9096ea6f3848984fULL,  -794 }, { 0xd77485cb25823ac7ULL,  -768 },
+  { 0xa086cfcd97bf97f4ULL,  -741 }, { 0xef340a98172aace5ULL,  -715 }, { 0xb23867fb2a35b28eULL,  -688 },
+  { 0x84c8d4dfd2c63f3bULL,  -661 }, { 0xc5dd44271ad3cdbaULL,  -635 }, { 0x936b9fcebb25c996ULL,  -608 },
+  { 0xdbac6c247d62a584ULL,  -582 }, { 0xa3ab66580d5fdaf6ULL,  -555 }, { 0xf3e2f893dec3f126ULL,  -529 },
+  { 0xb5b5ada8aaff80b8ULL,  -502 }, { 0x87625f056c7c4a8bULL,  -475 }, { 0xc9bcff6034c13053ULL,  -449 },
+  { 0x964e858c91ba2655ULL,  -422 }, { 0xdff9772470297ebdULL,  -396 }, { 0xa6dfbd9fb8e5b88fULL,  -369 },
+  { 0xf8a95fcf88747d94ULL,  -343 }, { 0xb94470938fa89bcfULL,  -316 }, { 0x8a08f0f8bf0f156bULL,  -289 },
+  { 0xcdb02555653131b6ULL,  -263 }, { 0x993fe2c6d07b7facULL,  -236 }, { 0xe45c10c42a2b3b06ULL,  -210 },
+  { 0xaa242499697392d3ULL,  -183 }, { 0xfd87b5f28300ca0eULL,  -157 }, { 0xbce5086492111aebULL,  -130 },
+  { 0x8cbccc096f5088ccULL,  -103 }, { 0xd1b71758e219652cULL,   -77 }, { 0x9c40000000000000ULL,   -50 },
+  { 0xe8d4a51000000000ULL,   -24 }, { 0xad78ebc5ac620000ULL,     3 }, { 0x813f3978f8940984ULL,    30 },
+  { 0xc097ce7bc90715b3ULL,    56 }, { 0x8f7e32ce7bea5c70ULL,    83 }, { 0xd5d238a4abe98068ULL,   109 },
+  { 0x9f4f2726179a2245ULL,   136 }, { 0xed63a231d4c4fb27ULL,   162 }, { 0xb0de65388cc8ada8ULL,   189 },
+  { 0x83c7088e1aab65dbULL,   216 }, { 0xc45d1df942711d9aULL,   242 }, { 0x924d692ca61be758ULL,   269 },
+  { 0xda01ee641a708deaULL,   295 }, { 0xa26da3999aef774aULL,   322 }, { 0xf209787bb47d6b85ULL,   348 },
+  { 0xb454e4a179dd1877ULL,   375 }, { 0x865b86925b9bc5c2ULL,   402 }, { 0xc83553c5c8965d3dULL,   428 },
+  { 0x952ab45cfa97a0b3ULL,   455 }, { 0xde469fbd99a05fe3ULL,   481 }, { 0xa59bc234db398c25ULL,   508 },
+  { 0xf6c69a72a3989f5cULL,   534 }, { 0xb7dcbf5354e9beceULL,   561 }, { 0x88fcf317f22241e2ULL,   588 },
+  { 0xcc20ce9bd35c78a5ULL,   614 }, { 0x98165af37b2153dfULL,   641 }, { 0xe2a0b5dc971f303aULL,   667 },
+  { 0xa8d9d1535ce3b396ULL,   694 }, { 0xfb9b7cd9a4a7443cULL,   720 }, { 0xbb764c4ca7a44410ULL,   747 },
+  { 0x8bab8eefb6409c1aULL,   774 }, { 0xd01fef10a657842cULL,   800 }, { 0x9b10a4e5e9913129ULL,   827 },
+  { 0xe7109bfba19c0c9dULL,   853 }, { 0xac2820d9623bf429ULL,   880 }, { 0x80444b5e7aa7cf85ULL,   907 },
+  { 0xbf21e44003acdd2dULL,   933 }, { 0x8e679c2f5e44ff8fULL,   960 }, { 0xd433179d9c8cb841ULL,   986 },
+  { 0x9e19db92b4e31ba9ULL,  1013 }, { 0xeb96bf6ebadf77d9ULL,  1039 }, { 0xaf87023b9bf0ee6bULL,  1066 }
+};
+
+static const uint64_t jp_powers_of_ten[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+  1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+  100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static inline jp_diy_fp_t jp_diy_fp_normalize(jp_diy_fp_t x)
+{
+  int shift = __builtin_clzll(x.f);
+
+  x.f <<= shift;
+  x.e  -= shift;
+
+  return x;
+}
+
+/* the upper 64 bits of the product, rounded */
+static inline jp_diy_fp_t jp_diy_fp_multiply(jp_diy_fp_t x, jp_diy_fp_t y)
+{
+  unsigned __int128 product = (unsigned __int128) x.f * y.f;
+  jp_diy_fp_t       result  = { (uint64_t) (product >> 64), x.e + y.e + 64 };
+
+  if ((uint64_t) product & (1ULL << 63))
+    result.f++;
+
+  return result;
+}
+
+static inline int jp_count_digits(uint32_t n)
+{
+  int digits = 1;
+
+  while (n >= 10) {
+    n /= 10;
+    digits++;
+  }
+
+  return digits;
+}
+
+/* moves the last digit down while the number stays within the bounds and gets closer to the value */
+static inline void jp_grisu_round(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t distance)
+{
+  while (rest < distance && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < distance || distance - rest > rest + ten_kappa - distance)) {
+    buffer[length - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+static void jp_grisu_digits(jp_diy_fp_t w, jp_diy_fp_t upper, uint64_t delta, char *buffer, int *length, int *k)
+{
+  jp_diy_fp_t one      = { 1ULL << -upper.e, upper.e };
+  uint64_t    distance = upper.f - w.f;
+  uint32_t    p1       = (uint32_t) (upper.f >> -one.e);
+  uint64_t    p2       = upper.f & (one.f - 1);
+  int         kappa    = jp_count_digits(p1);
+
+  *length = 0;
+
+  /* the integral part */
+  while (kappa > 0) {
+    uint32_t divisor = (uint32_t) jp_powers_of_ten[kappa - 1];
+    uint32_t digit   = p1 / divisor;
+
+    p1 %= divisor;
+
+    if (digit || *length)
+      buffer[(*length)++] = '0' + digit;
+
+    kappa--;
+
+    uint64_t rest = ((uint64_t) p1 << -one.e) + p2;
+
+    if (rest <= delta) {
+      *k += kappa;
+      jp_grisu_round(buffer, *length, delta, rest, jp_powers_of_ten[kappa] << -one.e, distance);
+      return;
+    }
+  }
+
+  /* the fractional part */
+  while (1) {
+    p2    *= 10;
+    delta *= 10;
+
+    char digit = (char) (p2 >> -one.e);
+
+    if (digit || *length)
+      buffer[(*length)++] = '0' + digit;
+
+    p2 &= one.f - 1;
+    kappa--;
+
+    if (p2 < delta) {
+      *k += kappa;
+      jp_grisu_round(buffer, *length, delta, p2, one.f, (-kappa < 20) ? distance * jp_powers_of_ten[-kappa] : 0);
+      return;
+    }
+  }
+}
+
+/* the digits of a positive finite value, which is digits * 10^k */
+static int jp_grisu2(double value, char *buffer, int *k)
+{
+  uint64_t bits;
+  memcpy(& bits, & value, sizeof(double));
+
+  int         biased_exponent = (int) ((bits >> 52) & 0x7FF);
+  uint64_t    significand     = bits & ((1ULL << 52) - 1);
+  jp_diy_fp_t v;
+
+  if (biased_exponent) {
+    v.f = significand | (1ULL << 52);
+    v.e = biased_exponent - 1075;
+  } else {
+    v.f = significand;
+    v.e = -1074;
+  }
+
+  /* the halfway points to the neighbouring doubles, the lower one is closer at a power of 2 */
+  jp_diy_fp_t upper = jp_diy_fp_normalize((jp_diy_fp_t) { (v.f << 1) + 1, v.e - 1 });
+  jp_diy_fp_t lower = (v.f == (1ULL << 52) && biased_exponent > 1) ? (jp_diy_fp_t) { (v.f << 2) - 1, v.e - 2 }
+                                                                   : (jp_diy_fp_t) { (v.f << 1) - 1, v.e - 1 };
+
+  lower.f <<= lower.e - upper.e;
+  lower.e   = upper.e;
+
+  /* a cached power bringing the binary exponent of the products within [-60, -32] */
+  double dk = (-61 - upper.e) * 0.30102999566398114 + 347;
+  int    ck = (int) dk;
+
+  if (dk - ck > 0.0)
+    ck++;
+
+  unsigned    index = (unsigned) ((ck >> 3) + 1);
+  jp_diy_fp_t power = { jp_cached_powers[index].f, jp_cached_powers[index].e };
+
+  *k = -(-348 + (int) (index << 3));
+
+  jp_diy_fp_t w = jp_diy_fp_multiply(jp_diy_fp_normalize(v), power);
+
+  upper    = jp_diy_fp_multiply(upper, power);
+  lower    = jp_diy_fp_multiply(lower, power);
+  lower.f += 1;
+  upper.f -= 1;
+
+  int length;
+  jp_grisu_digits(w, upper, upper.f - lower.f, buffer, & length, k);
+
+  return length;
+}
+
+static char* jp_write_exponent(char *out, int exponent)
+{
+  if (exponent < 0) {
+    *out++    = '-';
+    exponent = -exponent;
+  }
+
+  if (exponent >= 100) {
+    *out++    = '0' + exponent / 100;
+    exponent %= 100;
+    *out++    = '0' + exponent / 10;
+  } else if (exponent >= 10) {
+    *out++ = '0' + exponent / 10;
+  }
+
+  *out++ = '0' + exponent % 10;
+
+  return out;
+}
+
+size_t jp_format_double(char *out, double value)
+{
+  char* start = out;
+
+  /* JSON has no literal for infinities and NaN */
+  if (value != value || value - value != 0) {
+    memcpy(out, "null", 4);
+    return 4;
+  }
+
+  if (signbit(value)) {
+    *out++ = '-';
+    value  = -value;
+  }
+
+  if (0 == value) {
+    memcpy(out, "0.0", 3);
+    return out + 3 - start;
+  }
+
+  int k;
+  int length = jp_grisu2(value, out, & k);
+  int point  = length + k; /* 10^(point - 1) <= value < 10^point */
+
+  if (k >= 0 && point <= 21) {
+    /* 1234e7 -> 12340000000.0 */
+    memset(out + length, '0', k);
+    memcpy(out + point, ".0", 2);
+    out += point + 2;
+  } else if (point > 0 && point <= 21) {
+    /* 1234e-2 -> 12.34 */
+    memmove(out + point + 1, out + point, length - point);
+    out[point] = '.';
+    out       += length + 1;
+  } else if (point > -6 && point <= 0) {
+    /* 1234e-6 -> 0.001234 */
+    memmove(out + 2 - point, out, length);
+    out[0] = '0';
+    out[1] = '.';
+    memset(out + 2, '0', -point);
+    out += length + 2 - point;
+  } else if (1 == length) {
+    /* 1e30 */
+    out[1] = 'e';
+    out    = jp_write_exponent(out + 2, point - 1);
+  } else {
+    /* 1234e30 -> 1.234e33 */
+    memmove(out + 2, out + 1, length - 1);
+    out[1]          = '.';
+    out[length + 1] = 'e';
+    out             = jp_write_exponent(out + length + 2, point - 1);
+  }
+
+  return out - start;
+}
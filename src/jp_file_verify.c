@@ -0,0 +1,157 @@
+
+#include <apr_pools.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct jp_verify_mapping
+{
+  void   *address;
+  size_t  size;
+} jp_verify_mapping_t;
+
+static apr_status_t jp_verify_mapping_cleanup(void *data)
+{
+  jp_verify_mapping_t* mapping = data;
+
+  munmap(mapping->address, mapping->size);
+
+  return APR_SUCCESS;
+}
+
+/* maps a whole regular file, other streams are read to their end */
+const uint8_t* jp_map_file(apr_pool_t *pool,
+                           FILE       *input,
+                           int         sequential,
+                           size_t     *size)
+{
+  struct stat input_stat;
+
+  if (0 == fstat(fileno(input), & input_stat) && S_ISREG(input_stat.st_mode) && input_stat.st_size > 0) {
+    void* address = mmap(NULL, input_stat.st_size, PROT_READ, MAP_PRIVATE, fileno(input), 0);
+
+    if (MAP_FAILED != address) {
+      jp_verify_mapping_t* mapping = apr_palloc(pool, sizeof(jp_verify_mapping_t));
+
+      mapping->address = address;
+      mapping->size    = input_stat.st_size;
+
+      apr_pool_cleanup_register(pool, mapping, jp_verify_mapping_cleanup, apr_pool_cleanup_null);
+
+      /* scans read the file once, front to back, lookups only touch a few pages of it */
+      madvise(address, input_stat.st_size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+
+      *size = input_stat.st_size;
+
+      return address;
+    }
+  }
+
+  return jp_read_stream(pool, input, SIZE_MAX, size);
+}
+
+/* every key must be reachable through the hash table under its own index */
+static int jp_verify_key_index(const jp_key_index_map_t *map)
+{
+  uint32_t nb_keys = jp_key_index_map_count(map);
+
+  for (uint32_t index = 1; index <= nb_keys; index++) {
+    uint32_t    key_length;
+    const char* key = jp_key_index_map_key(map, index, & key_length);
+
+    if (NULL == key || strlen(key) != key_length) {
+      fprintf(stderr, "jp_verify_file_set: key %u is out of the key index bounds \n", index);
+      return -1;
+    }
+
+    if (index != jp_key_index_map_find(map, key)) {
+      fprintf(stderr, "jp_verify_file_set: key %u is not found through the key index hash table \n", index);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int jp_map_file_set(apr_pool_t          *pool,
+                    FILE                *kv_pair_input,
+                    FILE                *key_index_input,
+                    const uint8_t      **data,
+                    size_t              *size,
+                    uint64_t            *kv_pair_offset,
+                    jp_key_index_map_t **key_index,
+                    int                  sequential)
+{
+  *data           = jp_map_file(pool, kv_pair_input, sequential, size);
+  *kv_pair_offset = 0;
+
+  if (NULL == key_index_input) {
+    uint32_t magic, version;
+    uint64_t key_index_offset, key_index_length;
+
+    if (*size < JP_CONTAINER_HEADER_SIZE) {
+      fprintf(stderr, "jp_map_file_set: truncated container header \n");
+      return -1;
+    }
+
+    memcpy(& magic, *data, sizeof(uint32_t));
+    memcpy(& version, *data + 4, sizeof(uint32_t));
+    memcpy(& key_index_offset, *data + 8, sizeof(uint64_t));
+    memcpy(& key_index_length, *data + 16, sizeof(uint64_t));
+    memcpy(kv_pair_offset, *data + 24, sizeof(uint64_t));
+
+    if (JP_CONTAINER_MAGIC != magic || version > JP_CONTAINER_FORMAT_VERSION ||
+        JP_CONTAINER_HEADER_SIZE != key_index_offset ||
+        *kv_pair_offset != key_index_offset + key_index_length || *kv_pair_offset > *size) {
+      fprintf(stderr, "jp_map_file_set: not a single-file container, or an unsupported one \n");
+      return -1;
+    }
+
+    *key_index = jp_key_index_map_open_memory(pool, *data + key_index_offset, key_index_length);
+  } else {
+    *key_index = jp_key_index_map_open(pool, key_index_input);
+  }
+
+  return (NULL == *key_index) ? -1 : 0;
+}
+
+int jp_verify_file_set(apr_pool_t         *pool,
+                       FILE               *kv_pair_input,
+                       FILE               *key_index_input,
+                       jp_verify_report_t *report)
+{
+  jp_verify_report_t  local_report;
+  jp_key_index_map_t* map;
+  const uint8_t*      data;
+  size_t              size;
+  uint64_t            kv_pair_offset;
+
+  if (NULL == report)
+    report = & local_report;
+
+  memset(report, 0, sizeof(jp_verify_report_t));
+
+  if (0 != jp_map_file_set(pool, kv_pair_input, key_index_input, & data, & size, & kv_pair_offset, & map, 1))
+    return -1;
+
+  int ret = jp_verify_key_index(map);
+
+  report->nb_keys = jp_key_index_map_count(map);
+
+  jp_key_index_map_close(map);
+
+  if (0 != ret)
+    return -1;
+
+  ret = jp_block_verify(data, size, kv_pair_offset, & report->nb_records, & report->nb_blocks, & report->nb_unchecked_blocks);
+
+  if (1 == ret) {
+    report->legacy = 1;
+    ret            = 0;
+  }
+
+  return ret;
+}
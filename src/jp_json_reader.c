@@ -4,15 +4,141 @@
 #include <json.h>
 #include <json_visit.h>
 
+#include <stdlib.h>
+
 #include "jp_tlv_encoder.h"
 
 
-static json_object*
-jp_process_segment(struct json_tokener *tok,
-                  const char           *segment,
-                  size_t                width)
+struct jp_json_line_reader
+{
+  struct json_tokener *tokener;
+  char                *line;
+  size_t               line_size;
+  size_t               line_capacity;
+};
+
+static apr_status_t jp_json_line_reader_cleanup(void *data)
 {
-  return json_tokener_parse_ex(tok, segment, width);
+  jp_json_line_reader_t* reader = data;
+
+  json_tokener_free(reader->tokener);
+  free(reader->line);
+
+  return APR_SUCCESS;
+}
+
+jp_json_line_reader_t* jp_json_line_reader_make(apr_pool_t *pool)
+{
+  jp_json_line_reader_t* reader = apr_pcalloc(pool, sizeof(jp_json_line_reader_t));
+
+  reader->tokener = json_tokener_new();
+
+  apr_pool_cleanup_register(pool, reader, jp_json_line_reader_cleanup, apr_pool_cleanup_null);
+
+  return reader;
+}
+
+static int jp_json_line_reader_append(jp_json_line_reader_t *reader,
+                                      const char            *segment,
+                                      size_t                 width)
+{
+  if (reader->line_size + width > reader->line_capacity) {
+    size_t capacity = reader->line_capacity ? reader->line_capacity : 256;
+
+    while (capacity < reader->line_size + width)
+      capacity *= 2;
+
+    char* line = realloc(reader->line, capacity);
+
+    if (NULL == line)
+      return -1;
+
+    reader->line          = line;
+    reader->line_capacity = capacity;
+  }
+
+  memcpy(reader->line + reader->line_size, segment, width);
+  reader->line_size += width;
+
+  return 0;
+}
+
+/*
+ *  a line which does not complete a JSON value leaves the tokener waiting for the next
+ *  lines, so values spanning several lines are still parsed
+ */
+static int jp_json_line_reader_parse_line(jp_json_line_reader_t *reader,
+                                          apr_pool_t            *pool,
+                                          jp_TLV_records_t      *record_collection)
+{
+  json_object* next_line_object = json_tokener_parse_ex(reader->tokener, reader->line, reader->line_size);
+
+  enum json_tokener_error jerr;
+
+  reader->line_size = 0;
+
+  if (next_line_object) {
+    jp_update_records_from_json(pool, record_collection, next_line_object);
+    json_tokener_reset(reader->tokener);
+    json_object_put(next_line_object);
+  }
+  else if ((jerr = json_tokener_get_error(reader->tokener)) != json_tokener_continue) {
+    fprintf(stderr, "JSON Tokener Error: %s\n", json_tokener_error_desc(jerr));
+    json_tokener_reset(reader->tokener);
+    return -1;
+  }
+
+  return 0;
+}
+
+int jp_json_line_reader_feed(jp_json_line_reader_t *reader,
+                             apr_pool_t            *pool,
+                             jp_TLV_records_t      *record_collection,
+                             const char            *data,
+                             size_t                 size,
+                             size_t                 max_records,
+                             size_t                *consumed)
+{
+  size_t offset = 0;
+  int    ret    = 0;
+
+  while (offset < size && 0 == ret) {
+    if (max_records > 0 && record_collection->record_list->nelts >= max_records)
+      break;
+
+    size_t end = offset;
+
+    while (end < size && data[end] != '\n' && data[end] != '\0')
+      end++;
+
+    if (end == size) {
+      ret    = jp_json_line_reader_append(reader, data + offset, size - offset);
+      offset = size;
+      break;
+    }
+
+    /* the terminal character is handed to the tokener with its line */
+    if (0 != jp_json_line_reader_append(reader, data + offset, end - offset + 1))
+      ret = -1;
+    else
+      ret = jp_json_line_reader_parse_line(reader, pool, record_collection);
+
+    offset = end + 1;
+  }
+
+  *consumed = offset;
+
+  return ret;
+}
+
+int jp_json_line_reader_finish(jp_json_line_reader_t *reader,
+                               apr_pool_t            *pool,
+                               jp_TLV_records_t      *record_collection)
+{
+  if (0 == reader->line_size)
+    return 0;
+
+  return jp_json_line_reader_parse_line(reader, pool, record_collection);
 }
 
 
@@ -21,64 +147,27 @@ int jp_update_records_from_json_file(apr_pool_t       *pool,
                                      FILE             *input)
 {
   #define JP_FREAD_BUFFER_SIZE 4096
-	char                    buffer[JP_FREAD_BUFFER_SIZE];
-  char                   *next_line        = NULL;
-  int32_t                 line_size        = 0;
-  struct json_tokener    *tokener          = json_tokener_new();
-	int                     ret              = 0;
-
-	while (1) {
-    uint32_t last_parsed_offset = 0, next_segment_size_to_parse = 0;
-		int32_t read = fread(buffer, 1, JP_FREAD_BUFFER_SIZE, input);
-    int     eof  = feof(input);
-
-		if (read <= 0)
-			break;
-
-		for (int i = 0; i < read; i++) {
-      int is_last_read          = (i == read - 1);
-      int is_terminal_character = (buffer[i] == '\n' || buffer[i] == '\0' || (is_last_read && eof));
-
-      enum json_tokener_error jerr;
-
-			if (is_terminal_character || is_last_read) {
-        if (next_line == NULL) {
-          next_line = malloc( next_segment_size_to_parse + 1 );
-        } else {
-          next_line = realloc(next_line, line_size + next_segment_size_to_parse + 1);
-        }
-
-        memcpy(next_line + line_size, buffer + last_parsed_offset, next_segment_size_to_parse + 1);
-        last_parsed_offset        += next_segment_size_to_parse + 1;
-        line_size                 += next_segment_size_to_parse + 1;
-        next_segment_size_to_parse = 0;
-
-        if (is_terminal_character) {
-          json_object* next_line_object = jp_process_segment(tokener, next_line, line_size);
-          free(next_line);
-          next_line = NULL;
-          line_size = 0;
-
-          if (next_line_object) {
-            jp_update_records_from_json(pool, record_collection, next_line_object);
-            json_tokener_reset(tokener);
-            json_object_put(next_line_object);
-            next_line_object = NULL;
-          }
-          else if ((jerr = json_tokener_get_error(tokener)) != json_tokener_continue) {
-            fprintf(stderr, "JSON Tokener Error: %s\n", json_tokener_error_desc(jerr));
-            json_tokener_free(tokener);
-            return 1;
-          }
-        }
-
-      } else
-        next_segment_size_to_parse++;
-		}
-	}
-
-  json_tokener_free(tokener);
-	return ret;
+  char                    buffer[JP_FREAD_BUFFER_SIZE];
+  jp_json_line_reader_t  *reader = jp_json_line_reader_make(pool);
+  int                     ret    = 0;
+
+  while (0 == ret) {
+    size_t read = fread(buffer, 1, JP_FREAD_BUFFER_SIZE, input);
+    size_t consumed;
+
+    if (read == 0)
+      break;
+
+    if (0 != jp_json_line_reader_feed(reader, pool, record_collection, buffer, read, 0, & consumed))
+      ret = 1;
+  }
+
+  if (0 == ret && 0 != jp_json_line_reader_finish(reader, pool, record_collection))
+    ret = 1;
+
+  apr_pool_cleanup_run(pool, reader, jp_json_line_reader_cleanup);
+
+  return ret;
 
   #undef JP_FREAD_BUFFER_SIZE
-}
\ No newline at end of file
+}
@@ -0,0 +1,272 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ *  Records are written as one JSON object per line, in the order of their kv-pairs. The lines
+ *  are assembled in a large buffer written with a single writev once full; keys are escaped once
+ *  and their "key": prefix is cached by key index.
+ */
+
+#define JP_JSON_WRITER_BUFFER_SIZE  (1 << 20)
+#define JP_JSON_NUMBER_SIZE         JP_DOUBLE_TEXT_SIZE
+
+typedef struct jp_json_key
+{
+  char     *text;
+  uint32_t  length;
+} jp_json_key_t;
+
+struct jp_json_line_writer
+{
+  jp_buffer_io_t            buffer;
+  apr_pool_t               *pool;
+  const jp_key_index_map_t *key_index;
+  apr_array_header_t       *keys;
+};
+
+/* 0 for the bytes copied as is, otherwise the letter following the backslash, 'u' for \u00XX */
+static const char jp_json_escapes[256] = {
+  [0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u', [0x05] = 'u', [0x06] = 'u', [0x07] = 'u',
+  [0x08] = 'b', [0x09] = 't', [0x0A] = 'n', [0x0B] = 'u', [0x0C] = 'f', [0x0D] = 'r', [0x0E] = 'u', [0x0F] = 'u',
+  [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u', [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u',
+  [0x18] = 'u', [0x19] = 'u', [0x1A] = 'u', [0x1B] = 'u', [0x1C] = 'u', [0x1D] = 'u', [0x1E] = 'u', [0x1F] = 'u',
+  ['"']  = '"',  ['\\'] = '\\'
+};
+
+static const char jp_json_hex_digits[] = "0123456789abcdef";
+
+static const char jp_json_digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static inline uint8_t* jp_json_escape_byte(uint8_t *out, uint8_t byte)
+{
+  char escape = jp_json_escapes[byte];
+
+  *out++ = '\\';
+  *out++ = escape;
+
+  if ('u' == escape) {
+    *out++ = '0';
+    *out++ = '0';
+    *out++ = jp_json_hex_digits[byte >> 4];
+    *out++ = jp_json_hex_digits[byte & 0xF];
+  }
+
+  return out;
+}
+
+/* out must have room for 6 bytes per input byte, the worst case */
+static uint8_t* jp_json_escape(uint8_t *out, const uint8_t *string, size_t length)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  /* 16 bytes at a time, down to the first one needing an escape */
+  const __m128i quote     = _mm_set1_epi8('"');
+  const __m128i backslash = _mm_set1_epi8('\\');
+  const __m128i control   = _mm_set1_epi8(0x1F);
+
+  while (i + 16 <= length) {
+    __m128i chunk   = _mm_loadu_si128((const __m128i*) (string + i));
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(chunk, control), chunk));
+    int     mask    = _mm_movemask_epi8(special);
+
+    _mm_storeu_si128((__m128i*) out, chunk);
+
+    if (0 == mask) {
+      out += 16;
+      i   += 16;
+      continue;
+    }
+
+    int clean = __builtin_ctz(mask);
+
+    out = jp_json_escape_byte(out + clean, string[i + clean]);
+    i  += clean + 1;
+  }
+#endif
+
+  for (; i < length; i++) {
+    if (jp_json_escapes[string[i]])
+      out = jp_json_escape_byte(out, string[i]);
+    else
+      *out++ = string[i];
+  }
+
+  return out;
+}
+
+static uint8_t* jp_json_format_integer(uint8_t *out, int32_t value)
+{
+  char     digits[12];
+  char*    end       = digits + sizeof(digits);
+  char*    start     = end;
+  uint32_t magnitude = (value < 0) ? 0 - (uint32_t) value : (uint32_t) value;
+
+  while (magnitude >= 100) {
+    uint32_t pair = (magnitude % 100) * 2;
+
+    magnitude /= 100;
+    *--start   = jp_json_digit_pairs[pair + 1];
+    *--start   = jp_json_digit_pairs[pair];
+  }
+
+  if (magnitude >= 10) {
+    *--start = jp_json_digit_pairs[magnitude * 2 + 1];
+    *--start = jp_json_digit_pairs[magnitude * 2];
+  } else {
+    *--start = '0' + magnitude;
+  }
+
+  if (value < 0)
+    *out++ = '-';
+
+  memcpy(out, start, end - start);
+
+  return out + (end - start);
+}
+
+static const jp_json_key_t* jp_json_line_writer_key(jp_json_line_writer_t    *writer,
+                                                    const jp_key_index_map_t *key_index,
+                                                    uint32_t                  index)
+{
+  /* the cached keys belong to one key index */
+  if (key_index != writer->key_index) {
+    writer->key_index   = key_index;
+    writer->keys->nelts = 0;
+  }
+
+  while (writer->keys->nelts <= index) {
+    jp_json_key_t* key = apr_array_push(writer->keys);
+
+    key->text   = NULL;
+    key->length = 0;
+  }
+
+  jp_json_key_t* key = & ((jp_json_key_t*) writer->keys->elts)[index];
+
+  if (NULL == key->text) {
+    uint32_t    key_length;
+    const char* key_string = jp_key_index_map_key(key_index, index, & key_length);
+
+    if (NULL == key_string)
+      return NULL;
+
+    uint8_t* text = apr_palloc(writer->pool, 6 * (size_t) key_length + 3);
+    uint8_t* end  = text;
+
+    *end++ = '"';
+    end    = jp_json_escape(end, (const uint8_t*) key_string, key_length);
+    *end++ = '"';
+    *end++ = ':';
+
+    key->text   = (char*) text;
+    key->length = end - text;
+  }
+
+  return key;
+}
+
+jp_json_line_writer_t* jp_json_line_writer_make(apr_pool_t *pool,
+                                                FILE       *output)
+{
+  jp_json_line_writer_t* writer = apr_pcalloc(pool, sizeof(jp_json_line_writer_t));
+
+  jp_buffer_io_write_initialize(& writer->buffer, pool, output);
+
+  writer->buffer.current_buffer = apr_palloc(pool, JP_JSON_WRITER_BUFFER_SIZE);
+  writer->buffer.current_size   = JP_JSON_WRITER_BUFFER_SIZE;
+
+  writer->pool = pool;
+  writer->keys = apr_array_make(pool, 64, sizeof(jp_json_key_t));
+
+  return writer;
+}
+
+int jp_json_line_writer_add_record(      jp_json_line_writer_t *writer,
+                                   const jp_TLV_record_t       *record,
+                                   const jp_key_index_map_t    *key_index)
+{
+  jp_buffer_io_t*     buffer   = & writer->buffer;
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+
+  /* the braces and the new line of an empty record */
+  if (0 != jp_buffer_io_reserve(buffer, 3))
+    return -1;
+
+  buffer->current_buffer[buffer->used++] = '{';
+
+  for (int i = 0; i < kv_array->nelts; i++) {
+    const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i];
+    const jp_json_key_t*    key     = jp_json_line_writer_key(writer, key_index, kv_pair->key_index);
+
+    if (NULL == key) {
+      fprintf(stderr, "jp_json_line_writer_add_record: unknown key index %u \n", kv_pair->key_index);
+      return -1;
+    }
+
+    size_t value_size = (JP_TYPE_STRING == kv_pair->value_type) ? 6 * (size_t) kv_pair->union_v.string_value.value_length + 2
+                                                                : JP_JSON_NUMBER_SIZE;
+
+    /* the separator, the key, the value and the closing brace and new line */
+    if (0 != jp_buffer_io_reserve(buffer, 1 + key->length + value_size + 2))
+      return -1;
+
+    uint8_t* out = buffer->current_buffer + buffer->used;
+
+    if (i > 0)
+      *out++ = ',';
+
+    memcpy(out, key->text, key->length);
+    out += key->length;
+
+    switch (kv_pair->value_type) {
+      case JP_TYPE_BOOLEAN:
+      memcpy(out, kv_pair->union_v.integer_value ? "true" : "false", kv_pair->union_v.integer_value ? 4 : 5);
+      out += kv_pair->union_v.integer_value ? 4 : 5;
+      break;
+
+      case JP_TYPE_INTEGER:
+      out = jp_json_format_integer(out, kv_pair->union_v.integer_value);
+      break;
+
+      case JP_TYPE_DOUBLE:
+      out += jp_format_double((char*) out, kv_pair->union_v.double_value);
+      break;
+
+      case JP_TYPE_STRING:
+      *out++ = '"';
+      out    = jp_json_escape(out, (const uint8_t*) kv_pair->union_v.string_value.value_buffer,
+                              kv_pair->union_v.string_value.value_length);
+      *out++ = '"';
+      break;
+
+      default:
+      memcpy(out, "null", 4);
+      out += 4;
+      break;
+    }
+
+    buffer->used = out - buffer->current_buffer;
+  }
+
+  buffer->current_buffer[buffer->used++] = '}';
+  buffer->current_buffer[buffer->used++] = '\n';
+
+  return 0;
+}
+
+void jp_json_line_writer_flush(jp_json_line_writer_t *writer)
+{
+  jp_buffer_io_flush_writes(& writer->buffer);
+}
@@ -0,0 +1,520 @@
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  The block writer samples the first JP_ENCODING_SAMPLE_RECORDS records of every block, and
+ *  picks for every key the cheapest of these encodings of its values, the code taking the 6 low
+ *  bits of the descriptor byte:
+ *
+ *  - JP_ENCODING_INLINE: the value on its own, as described in jp_tlv_encoder.c
+ *
+ *  - JP_ENCODING_STRING_DICTIONARY, JP_ENCODING_INTEGER_DICTIONARY: the distinct values of the
+ *    key are numbered in the order they first appear in the block, up to JP_DICTIONARY_MAX_ENTRIES;
+ *    the code is the number of a value seen before (below JP_DICTIONARY_CODE_ENTRY16), or
+ *    JP_DICTIONARY_CODE_ENTRY16 followed by its uint16 number, or JP_DICTIONARY_CODE_LITERAL
+ *    followed by the value encoded inline, which gets the next number
+ *
+ *  - JP_ENCODING_DELTA (integers): the difference with the previous value of the key in the
+ *    block (0 before the first one), wrapping around 32 bits: code - JP_DELTA_CODE_BIAS for the
+ *    codes below JP_DELTA_CODE_INT8, or followed by an int8, an int16 or an int32
+ *
+ *  The values of another type than the one of their key's encoding are written inline. The keys
+ *  with another encoding than JP_ENCODING_INLINE are listed after the checksum (and the record
+ *  order) of the blocks flagged JP_BLOCK_FLAG_ENCODINGS:
+ *
+ *  - uint32 number of keys
+ *
+ *  - for every key, its uint32 index and its uint8 encoding
+ *
+ *  - the uint32 CRC32C of all of the above
+ *
+ *  Readers look the encoding of every value up by the index of its key. As with the doubles,
+ *  the dictionaries and the previous values start over in every block, which decodes on its own.
+ *  Bit-packing a column has no place in records stored row by row, the delta codes stand for it.
+ */
+
+#define JP_KEY_CODECS_MAX_KEYS      (1 << 20)
+#define JP_VALUE_SET_INITIAL_SLOTS  64
+
+/* distinct values, found by their hash: the interned strings come with theirs, computed once */
+typedef struct jp_value_slot
+{
+  const void *bytes;
+  uint32_t    length;
+  uint32_t    hash;
+  uint32_t    number;  /* from 1, 0 for an empty slot */
+} jp_value_slot_t;
+
+typedef struct jp_value_set
+{
+  jp_value_slot_t *slots;
+  uint32_t         mask;
+  uint32_t         count;
+} jp_value_set_t;
+
+typedef struct jp_key_codec
+{
+  uint8_t             encoding;
+  int32_t             last_integer;
+  apr_array_header_t *dictionary; /* the jp_TLV_union_t values numbered so far */
+  jp_value_set_t     *lookup;     /* writers only, the number + 1 of every value of the dictionary */
+} jp_key_codec_t;
+
+struct jp_key_codecs
+{
+  apr_pool_t         *pool;
+  apr_pool_t         *block_pool; /* the dictionaries of the block */
+  apr_array_header_t *keys;       /* jp_key_codec_t, by key index */
+  apr_array_header_t *active;     /* the uint32 indices of the keys with an encoding in the block */
+};
+
+jp_key_codecs_t* jp_key_codecs_make(apr_pool_t *pool)
+{
+  jp_key_codecs_t* codecs = apr_palloc(pool, sizeof(jp_key_codecs_t));
+
+  codecs->pool   = pool;
+  codecs->keys   = apr_array_make(pool, 64, sizeof(jp_key_codec_t));
+  codecs->active = apr_array_make(pool, 16, sizeof(uint32_t));
+
+  if (APR_SUCCESS != apr_pool_create(& codecs->block_pool, pool))
+    return NULL;
+
+  return codecs;
+}
+
+void jp_key_codecs_reset(jp_key_codecs_t *codecs)
+{
+  for (int i = 0; i < codecs->active->nelts; i++) {
+    jp_key_codec_t* codec = & ((jp_key_codec_t*) codecs->keys->elts)[((uint32_t*) codecs->active->elts)[i]];
+
+    codec->encoding   = JP_ENCODING_INLINE;
+    codec->dictionary = NULL;
+    codec->lookup     = NULL;
+  }
+
+  codecs->active->nelts = 0;
+
+  apr_pool_clear(codecs->block_pool);
+}
+
+int jp_key_codecs_active(const jp_key_codecs_t *codecs)
+{
+  return codecs->active->nelts > 0;
+}
+
+static inline jp_key_codec_t* jp_key_codecs_get(jp_key_codecs_t *codecs,
+                                                uint32_t         key_index)
+{
+  return & ((jp_key_codec_t*) codecs->keys->elts)[key_index];
+}
+
+static int jp_key_codecs_set(jp_key_codecs_t *codecs,
+                             uint32_t         key_index,
+                             uint8_t          encoding)
+{
+  if (key_index >= JP_KEY_CODECS_MAX_KEYS || encoding > JP_ENCODING_DELTA)
+    return -1;
+
+  while ((uint32_t) codecs->keys->nelts <= key_index) {
+    jp_key_codec_t* codec = apr_array_push(codecs->keys);
+
+    codec->encoding   = JP_ENCODING_INLINE;
+    codec->dictionary = NULL;
+    codec->lookup     = NULL;
+  }
+
+  jp_key_codec_t* codec = jp_key_codecs_get(codecs, key_index);
+
+  /* a key listed twice */
+  if (JP_ENCODING_INLINE != codec->encoding)
+    return -1;
+
+  if (JP_ENCODING_INLINE == encoding)
+    return 0;
+
+  codec->encoding     = encoding;
+  codec->last_integer = 0;
+
+  if (JP_ENCODING_DELTA != encoding)
+    codec->dictionary = apr_array_make(codecs->block_pool, 64, sizeof(jp_TLV_union_t));
+
+  *(uint32_t*) apr_array_push(codecs->active) = key_index;
+
+  return 0;
+}
+
+uint8_t jp_key_codecs_encoding(jp_key_codecs_t *codecs,
+                               uint32_t         key_index,
+                               uint32_t         value_type)
+{
+  if (NULL == codecs || key_index >= (uint32_t) codecs->keys->nelts)
+    return JP_ENCODING_INLINE;
+
+  uint8_t encoding = jp_key_codecs_get(codecs, key_index)->encoding;
+
+  switch (encoding) {
+    case JP_ENCODING_STRING_DICTIONARY:
+    return (JP_TYPE_STRING == value_type) ? encoding : JP_ENCODING_INLINE;
+
+    case JP_ENCODING_INTEGER_DICTIONARY:
+    case JP_ENCODING_DELTA:
+    return (JP_TYPE_INTEGER == value_type) ? encoding : JP_ENCODING_INLINE;
+
+    default:
+    return JP_ENCODING_INLINE;
+  }
+}
+
+/* the bytes a value is told apart by */
+static inline const void* jp_key_codecs_value_bytes(const jp_TLV_union_t *value,
+                                                          uint32_t        value_type,
+                                                          apr_ssize_t    *length)
+{
+  if (JP_TYPE_STRING == value_type) {
+    *length = value->string_value.value_length;
+    return value->string_value.value_buffer;
+  }
+
+  *length = sizeof(int32_t);
+
+  return & value->integer_value;
+}
+
+static inline uint32_t jp_key_codecs_value_hash(const jp_TLV_union_t *value,
+                                                      uint32_t        value_type)
+{
+  if (JP_TYPE_STRING == value_type)
+    return value->string_value.value_hash ? value->string_value.value_hash
+                                          : jp_string_hash(value->string_value.value_buffer, value->string_value.value_length);
+
+  return (uint32_t) (((uint64_t) (uint32_t) value->integer_value * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static jp_value_set_t* jp_value_set_make(apr_pool_t *pool)
+{
+  jp_value_set_t* set = apr_palloc(pool, sizeof(jp_value_set_t));
+
+  set->slots = apr_pcalloc(pool, JP_VALUE_SET_INITIAL_SLOTS * sizeof(jp_value_slot_t));
+  set->mask  = JP_VALUE_SET_INITIAL_SLOTS - 1;
+  set->count = 0;
+
+  return set;
+}
+
+/* the slot of the value, or the empty slot where it goes */
+static jp_value_slot_t* jp_value_set_slot(      jp_value_set_t *set,
+                                          const void           *bytes,
+                                                uint32_t        length,
+                                                uint32_t        hash)
+{
+  for (uint32_t slot = hash & set->mask; ; slot = (slot + 1) & set->mask) {
+    jp_value_slot_t* entry = & set->slots[slot];
+
+    if (0 == entry->number ||
+        (entry->hash == hash && entry->length == length && 0 == memcmp(entry->bytes, bytes, length)))
+      return entry;
+  }
+}
+
+/* the bytes are referenced as they are, they must outlive the set */
+static void jp_value_set_add(      jp_value_set_t  *set,
+                                   apr_pool_t      *pool,
+                                   jp_value_slot_t *slot,
+                             const void            *bytes,
+                                   uint32_t         length,
+                                   uint32_t         hash,
+                                   uint32_t         number)
+{
+  slot->bytes  = bytes;
+  slot->length = length;
+  slot->hash   = hash;
+  slot->number = number;
+
+  /* grown at three quarters full, the entries are moved by the hashes they keep */
+  if (++set->count * 4 < (set->mask + 1) * 3)
+    return;
+
+  jp_value_slot_t* old_slots = set->slots;
+  uint32_t         old_size  = set->mask + 1;
+
+  set->slots = apr_pcalloc(pool, 2 * old_size * sizeof(jp_value_slot_t));
+  set->mask  = 2 * old_size - 1;
+
+  for (uint32_t i = 0; i < old_size; i++) {
+    if (0 == old_slots[i].number)
+      continue;
+
+    uint32_t slot = old_slots[i].hash & set->mask;
+
+    while (0 != set->slots[slot].number)
+      slot = (slot + 1) & set->mask;
+
+    set->slots[slot] = old_slots[i];
+  }
+}
+
+void jp_key_codecs_add(      jp_key_codecs_t *codecs,
+                             uint32_t         key_index,
+                       const jp_TLV_union_t  *value,
+                             uint32_t         value_type)
+{
+  jp_key_codec_t* codec = jp_key_codecs_get(codecs, key_index);
+
+  /* the values past the last number stay literals */
+  if (codec->dictionary->nelts >= JP_DICTIONARY_MAX_ENTRIES)
+    return;
+
+  jp_TLV_union_t* entry = apr_array_push(codec->dictionary);
+
+  *entry = *value;
+
+  /* the values are looked up by a copy, the records written may be released before the block is */
+  if (codec->lookup) {
+    apr_ssize_t      length;
+    const void*      bytes = jp_key_codecs_value_bytes(entry, value_type, & length);
+    uint32_t         hash  = jp_key_codecs_value_hash(entry, value_type);
+    jp_value_slot_t* slot  = jp_value_set_slot(codec->lookup, bytes, length, hash);
+
+    if (0 == slot->number)
+      jp_value_set_add(codec->lookup, codecs->block_pool, slot, apr_pmemdup(codecs->block_pool, bytes, length), length, hash,
+                       codec->dictionary->nelts);
+  }
+}
+
+int jp_key_codecs_find(      jp_key_codecs_t *codecs,
+                             uint32_t         key_index,
+                       const jp_TLV_union_t  *value,
+                             uint32_t         value_type,
+                             uint32_t        *entry)
+{
+  jp_key_codec_t* codec = jp_key_codecs_get(codecs, key_index);
+
+  if (NULL == codec->lookup)
+    codec->lookup = jp_value_set_make(codecs->block_pool);
+
+  apr_ssize_t      length;
+  const void*      bytes = jp_key_codecs_value_bytes(value, value_type, & length);
+  jp_value_slot_t* found = jp_value_set_slot(codec->lookup, bytes, length, jp_key_codecs_value_hash(value, value_type));
+
+  if (found->number) {
+    *entry = found->number - 1;
+    return 1;
+  }
+
+  jp_key_codecs_add(codecs, key_index, value, value_type);
+
+  return 0;
+}
+
+const jp_TLV_union_t* jp_key_codecs_entry(jp_key_codecs_t *codecs,
+                                          uint32_t         key_index,
+                                          uint32_t         entry)
+{
+  jp_key_codec_t* codec = jp_key_codecs_get(codecs, key_index);
+
+  if (entry >= (uint32_t) codec->dictionary->nelts)
+    return NULL;
+
+  return & ((jp_TLV_union_t*) codec->dictionary->elts)[entry];
+}
+
+int32_t* jp_key_codecs_last_integer(jp_key_codecs_t *codecs,
+                                    uint32_t         key_index)
+{
+  return & jp_key_codecs_get(codecs, key_index)->last_integer;
+}
+
+uint32_t jp_key_codecs_write(jp_buffer_io_t  *buffer,
+                             jp_key_codecs_t *codecs)
+{
+  uint32_t nb_keys = codecs->active->nelts;
+
+  if (0 != jp_buffer_io_reserve(buffer, JP_ENCODINGS_SECTION_SIZE(nb_keys)))
+    return 0;
+
+  size_t start = buffer->used;
+
+  jp_buffer_io_memcpy_to(buffer, & nb_keys, sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < nb_keys; i++) {
+    uint32_t key_index = ((uint32_t*) codecs->active->elts)[i];
+    uint8_t  encoding  = jp_key_codecs_get(codecs, key_index)->encoding;
+
+    jp_buffer_io_memcpy_to(buffer, & key_index, sizeof(uint32_t));
+    jp_buffer_io_memcpy_to(buffer, & encoding, sizeof(uint8_t));
+  }
+
+  uint32_t crc = jp_crc32c(0, buffer->current_buffer + start, buffer->used - start);
+
+  jp_buffer_io_memcpy_to(buffer, & crc, sizeof(uint32_t));
+
+  return buffer->used - start;
+}
+
+uint64_t jp_key_codecs_read(const uint8_t         *data,
+                                  uint64_t         size,
+                                  jp_key_codecs_t *codecs)
+{
+  uint32_t nb_keys;
+
+  if (size < sizeof(uint32_t))
+    return 0;
+
+  memcpy(& nb_keys, data, sizeof(uint32_t));
+
+  uint64_t section = JP_ENCODINGS_SECTION_SIZE((uint64_t) nb_keys) - JP_BLOCK_CRC_SIZE;
+
+  if (section + JP_BLOCK_CRC_SIZE > size)
+    return 0;
+
+  uint32_t stored_crc;
+  memcpy(& stored_crc, data + section, sizeof(uint32_t));
+
+  if (stored_crc != jp_crc32c(0, data, section))
+    return 0;
+
+  for (uint32_t i = 0; codecs && i < nb_keys; i++) {
+    const uint8_t* entry = data + sizeof(uint32_t) + (size_t) i * JP_ENCODING_ENTRY_SIZE;
+    uint32_t       key_index;
+
+    memcpy(& key_index, entry, sizeof(uint32_t));
+
+    if (0 != jp_key_codecs_set(codecs, key_index, entry[sizeof(uint32_t)]))
+      return 0;
+  }
+
+  return section + JP_BLOCK_CRC_SIZE;
+}
+
+uint32_t jp_delta_length(int32_t delta)
+{
+  if (delta >= -JP_DELTA_CODE_BIAS && delta < JP_DELTA_CODE_INT8 - JP_DELTA_CODE_BIAS)
+    return 0;
+
+  if (delta >= INT8_MIN && delta <= INT8_MAX)
+    return sizeof(int8_t);
+
+  if (delta >= INT16_MIN && delta <= INT16_MAX)
+    return sizeof(int16_t);
+
+  return sizeof(int32_t);
+}
+
+typedef struct jp_key_sample
+{
+  uint32_t        nb_strings;
+  uint32_t        nb_integers;
+  uint64_t        inline_cost;
+  uint64_t        dictionary_cost;
+  uint64_t        delta_cost;
+  int32_t         last_integer;
+  jp_value_set_t *distinct;
+} jp_key_sample_t;
+
+static inline uint32_t jp_inline_cost(const jp_TLV_kv_pair_t *kv_pair)
+{
+  if (JP_TYPE_STRING == kv_pair->value_type) {
+    uint32_t length = kv_pair->union_v.string_value.value_length;
+
+    return 1 + ((length < 32) ? 0 : sizeof(uint32_t)) + length;
+  }
+
+  int32_t value = kv_pair->union_v.integer_value;
+
+  return 1 + ((value >= 0 && value < 32) ? 0 : sizeof(int32_t));
+}
+
+void jp_key_codecs_choose(      jp_key_codecs_t        *codecs,
+                          const jp_TLV_record_t *const *records,
+                                uint32_t                nb_records)
+{
+  apr_pool_t* pool;
+  uint32_t    nb_keys = 0;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, codecs->pool))
+    return;
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    apr_array_header_t* kv_array = records[i]->kv_pairs_array;
+
+    for (int j = 0; j < kv_array->nelts; j++) {
+      uint32_t key_index = ((const jp_TLV_kv_pair_t*) kv_array->elts)[j].key_index;
+
+      if (key_index < JP_KEY_CODECS_MAX_KEYS && key_index >= nb_keys)
+        nb_keys = key_index + 1;
+    }
+  }
+
+  jp_key_sample_t* samples = apr_pcalloc(pool, (nb_keys + 1) * sizeof(jp_key_sample_t));
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    apr_array_header_t* kv_array = records[i]->kv_pairs_array;
+
+    for (int j = 0; j < kv_array->nelts; j++) {
+      const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+      if (kv_pair->key_index >= nb_keys ||
+          (JP_TYPE_STRING != kv_pair->value_type && JP_TYPE_INTEGER != kv_pair->value_type))
+        continue;
+
+      jp_key_sample_t* sample = & samples[kv_pair->key_index];
+      uint32_t         cost   = jp_inline_cost(kv_pair);
+
+      sample->inline_cost += cost;
+
+      if (NULL == sample->distinct)
+        sample->distinct = jp_value_set_make(pool);
+
+      apr_ssize_t      length;
+      const void*      bytes = jp_key_codecs_value_bytes(& kv_pair->union_v, kv_pair->value_type, & length);
+      uint32_t         hash  = jp_key_codecs_value_hash(& kv_pair->union_v, kv_pair->value_type);
+      jp_value_slot_t* found = jp_value_set_slot(sample->distinct, bytes, length, hash);
+
+      if (found->number) {
+        sample->dictionary_cost += (found->number <= JP_DICTIONARY_CODE_ENTRY16) ? 1 : 1 + sizeof(uint16_t);
+      } else {
+        sample->dictionary_cost += 1 + cost;
+        jp_value_set_add(sample->distinct, pool, found, bytes, length, hash, sample->distinct->count + 1);
+      }
+
+      if (JP_TYPE_STRING == kv_pair->value_type) {
+        sample->nb_strings++;
+      } else {
+        int32_t delta = (int32_t) ((uint32_t) kv_pair->union_v.integer_value - (uint32_t) sample->last_integer);
+
+        sample->nb_integers++;
+        sample->delta_cost  += 1 + jp_delta_length(delta);
+        sample->last_integer = kv_pair->union_v.integer_value;
+      }
+    }
+  }
+
+  for (uint32_t key_index = 0; key_index < nb_keys; key_index++) {
+    jp_key_sample_t* sample = & samples[key_index];
+
+    /* the values of the other type would be written inline, and the estimates would not hold */
+    if (sample->nb_strings > 0 && sample->nb_integers > 0)
+      continue;
+
+    /* an encoding also costs its entry in the block */
+    uint8_t  encoding = JP_ENCODING_INLINE;
+    uint64_t best     = sample->inline_cost;
+
+    if (sample->dictionary_cost + JP_ENCODING_ENTRY_SIZE < best) {
+      encoding = sample->nb_strings ? JP_ENCODING_STRING_DICTIONARY : JP_ENCODING_INTEGER_DICTIONARY;
+      best     = sample->dictionary_cost + JP_ENCODING_ENTRY_SIZE;
+    }
+
+    if (sample->nb_integers > 0 && sample->delta_cost + JP_ENCODING_ENTRY_SIZE < best)
+      encoding = JP_ENCODING_DELTA;
+
+    if (JP_ENCODING_INLINE != encoding)
+      jp_key_codecs_set(codecs, key_index, encoding);
+  }
+
+  apr_pool_destroy(pool);
+}
@@ -0,0 +1,394 @@
+
+#include <apr_strings.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ *  key dictionary file layout:
+ *
+ *  - header: uint32 JP_DICTIONARY_MAGIC and uint32 format version
+ *
+ *  - the keys, in the order they are numbered from 1: uint32 length, the bytes of the key, and the
+ *    uint32 CRC32C of the length and the bytes
+ *
+ *  The file is only ever appended to, under an exclusive flock, so a key keeps its number for good:
+ *  the version of a dictionary is its number of keys, and every version is a prefix of the next ones.
+ *  An append cut short fails its checksum, is ignored by readers and overwritten by the next append.
+ *
+ *  File sets written against a dictionary carry its keys as their key index, so the file sets of the
+ *  same dictionary number their keys alike, and their blocks can be concatenated as they are.
+ */
+
+#define JP_DICTIONARY_MAGIC           0x444B504A /* "JPKD" */
+#define JP_DICTIONARY_FORMAT_VERSION  1
+#define JP_DICTIONARY_HEADER_SIZE     (2 * sizeof(uint32_t))
+
+typedef struct jp_key_dictionary
+{
+  apr_array_header_t *keys;       /* const char*, the key numbered i at i - 1 */
+  apr_hash_t         *numbers;    /* key -> number */
+  uint64_t            end;        /* the end of the last sound entry */
+
+} jp_key_dictionary_t;
+
+static uint32_t jp_key_dictionary_entry_crc(const uint8_t *entry,
+                                            uint32_t       length)
+{
+  return jp_crc32c(0, entry, sizeof(uint32_t) + length);
+}
+
+/* reads the sound entries of a dictionary, an empty file is an empty dictionary */
+static int jp_key_dictionary_read(apr_pool_t          *pool,
+                                  int                  fd,
+                                  jp_key_dictionary_t *dictionary)
+{
+  struct stat file_stat;
+
+  dictionary->keys    = apr_array_make(pool, 64, sizeof(const char*));
+  dictionary->numbers = apr_hash_make(pool);
+  dictionary->end     = JP_DICTIONARY_HEADER_SIZE;
+
+  if (0 != fstat(fd, & file_stat))
+    return -1;
+
+  if (0 == file_stat.st_size)
+    return 0;
+
+  uint64_t size = file_stat.st_size;
+  uint8_t* data = apr_palloc(pool, size);
+
+  for (uint64_t done = 0; done < size; ) {
+    ssize_t bytes = pread(fd, data + done, size - done, done);
+
+    if (bytes <= 0)
+      return -1;
+
+    done += bytes;
+  }
+
+  uint32_t magic = 0, version = 0;
+
+  if (size >= JP_DICTIONARY_HEADER_SIZE) {
+    memcpy(& magic, data, sizeof(uint32_t));
+    memcpy(& version, data + sizeof(uint32_t), sizeof(uint32_t));
+  }
+
+  if (JP_DICTIONARY_MAGIC != magic || version > JP_DICTIONARY_FORMAT_VERSION) {
+    fprintf(stderr, "jp_key_dictionary_read: not a key dictionary, or an unsupported one \n");
+    return -1;
+  }
+
+  uint64_t position = JP_DICTIONARY_HEADER_SIZE;
+
+  while (size - position >= 2 * sizeof(uint32_t)) {
+    uint32_t length, crc;
+
+    memcpy(& length, data + position, sizeof(uint32_t));
+
+    if (size - position - 2 * sizeof(uint32_t) < length)
+      break;
+
+    memcpy(& crc, data + position + sizeof(uint32_t) + length, sizeof(uint32_t));
+
+    if (crc != jp_key_dictionary_entry_crc(data + position, length))
+      break;
+
+    char* key = apr_palloc(pool, length + 1);
+
+    memcpy(key, data + position + sizeof(uint32_t), length);
+    key[length] = '\0';
+
+    *(const char**) apr_array_push(dictionary->keys) = key;
+    apr_hash_set(dictionary->numbers, key, APR_HASH_KEY_STRING, (void*) (size_t) dictionary->keys->nelts);
+
+    position += 2 * sizeof(uint32_t) + length;
+  }
+
+  dictionary->end = position;
+
+  return 0;
+}
+
+/* appends entries, overwriting whatever a torn append left behind */
+static int jp_key_dictionary_append(int                  fd,
+                                    jp_key_dictionary_t *dictionary,
+                                    const uint8_t       *entries,
+                                    size_t               length)
+{
+  uint64_t position = dictionary->end;
+
+  if (JP_DICTIONARY_HEADER_SIZE == position) {
+    uint32_t header[2] = { JP_DICTIONARY_MAGIC, JP_DICTIONARY_FORMAT_VERSION };
+
+    if (sizeof(header) != pwrite(fd, header, sizeof(header), 0))
+      return -1;
+  }
+
+  for (size_t done = 0; done < length; ) {
+    ssize_t bytes = pwrite(fd, entries + done, length - done, position + done);
+
+    if (bytes <= 0)
+      return -1;
+
+    done += bytes;
+  }
+
+  if (0 != ftruncate(fd, position + length) || 0 != fsync(fd))
+    return -1;
+
+  dictionary->end = position + length;
+
+  return 0;
+}
+
+int jp_bind_key_dictionary(jp_TLV_records_t *record_collection,
+                           const char       *dictionary_path,
+                           uint32_t         *version)
+{
+  apr_pool_t* collection_pool = apr_hash_pool_get(record_collection->key_index);
+  apr_pool_t* pool;
+  int         ret = 0;
+
+  int fd = open(dictionary_path, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0) {
+    fprintf(stderr, "jp_bind_key_dictionary: cannot open %s: %s \n", dictionary_path, strerror(errno));
+    return -1;
+  }
+
+  if (APR_SUCCESS != apr_pool_create(& pool, collection_pool)) {
+    close(fd);
+    return -1;
+  }
+
+  /* every writer appends under the lock, after reading the keys the others appended */
+  jp_key_dictionary_t dictionary;
+
+  if (0 != flock(fd, LOCK_EX) || 0 != jp_key_dictionary_read(pool, fd, & dictionary)) {
+    fprintf(stderr, "jp_bind_key_dictionary: cannot read the dictionary %s \n", dictionary_path);
+    apr_pool_destroy(pool);
+    close(fd);
+    return -1;
+  }
+
+  unsigned int nb_keys = apr_hash_count(record_collection->key_index);
+  const char** keys    = apr_pcalloc(pool, (nb_keys + 1) * sizeof(const char*));
+  uint32_t*    numbers = apr_pcalloc(pool, (nb_keys + 1) * sizeof(uint32_t));
+  int          renumbered = 0;
+
+  for (apr_hash_index_t* entry = apr_hash_first(pool, record_collection->key_index); entry; entry = apr_hash_next(entry)) {
+    const void* key;
+    void*       index;
+
+    apr_hash_this(entry, & key, NULL, & index);
+
+    if ((size_t) index <= nb_keys)
+      keys[(size_t) index] = key;
+  }
+
+  /* the new keys are appended in the order the collection numbered them */
+  size_t length = 0;
+
+  for (unsigned int i = 1; i <= nb_keys; i++) {
+    numbers[i] = (uint32_t) (size_t) apr_hash_get(dictionary.numbers, keys[i], APR_HASH_KEY_STRING);
+
+    if (0 == numbers[i])
+      length += 2 * sizeof(uint32_t) + strlen(keys[i]);
+  }
+
+  uint8_t* entries = apr_palloc(pool, length + 1);
+  size_t   offset  = 0;
+
+  for (unsigned int i = 1; i <= nb_keys; i++) {
+    if (0 == numbers[i]) {
+      uint32_t key_length = strlen(keys[i]);
+
+      memcpy(entries + offset, & key_length, sizeof(uint32_t));
+      memcpy(entries + offset + sizeof(uint32_t), keys[i], key_length);
+
+      uint32_t crc = jp_key_dictionary_entry_crc(entries + offset, key_length);
+
+      memcpy(entries + offset + sizeof(uint32_t) + key_length, & crc, sizeof(uint32_t));
+      offset += 2 * sizeof(uint32_t) + key_length;
+
+      *(const char**) apr_array_push(dictionary.keys) = keys[i];
+      numbers[i] = dictionary.keys->nelts;
+    }
+
+    if (numbers[i] != i)
+      renumbered = 1;
+  }
+
+  if (length > 0 && 0 != jp_key_dictionary_append(fd, & dictionary, entries, length)) {
+    fprintf(stderr, "jp_bind_key_dictionary: cannot append to the dictionary %s: %s \n", dictionary_path, strerror(errno));
+    ret = -1;
+  }
+
+  flock(fd, LOCK_UN);
+  close(fd);
+
+  if (0 == ret) {
+    /* the records take the numbers of the dictionary, whose keys all go to the key index */
+    apr_array_header_t* record_array = record_collection->record_list;
+
+    for (int r = 0; renumbered && r < record_array->nelts; r++) {
+      apr_array_header_t* kv_array = ((jp_TLV_record_t**) record_array->elts)[r]->kv_pairs_array;
+
+      for (int j = 0; j < kv_array->nelts; j++) {
+        jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+        kv_pair->key_index = numbers[kv_pair->key_index];
+      }
+    }
+
+    /* in place, the key index may be kept across several binds */
+    for (int k = 0; k < dictionary.keys->nelts; k++) {
+      const char* key = ((const char**) dictionary.keys->elts)[k];
+
+      if (NULL == apr_hash_get(record_collection->key_index, key, APR_HASH_KEY_STRING))
+        key = apr_pstrdup(collection_pool, key);
+
+      apr_hash_set(record_collection->key_index, key, APR_HASH_KEY_STRING, (void*) (size_t) (k + 1));
+    }
+
+    if (version)
+      *version = dictionary.keys->nelts;
+  }
+
+  apr_pool_destroy(pool);
+
+  return ret;
+}
+
+int jp_concatenate_file_sets(apr_pool_t   *pool,
+                             FILE* const  *kv_pair_inputs,
+                             FILE* const  *key_index_inputs,
+                             int           nb_inputs,
+                             FILE         *kv_pair_output,
+                             FILE         *key_index_output)
+{
+  apr_pool_t* run_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& run_pool, pool))
+    return -1;
+
+  const uint8_t**      data           = apr_pcalloc(run_pool, nb_inputs * sizeof(const uint8_t*));
+  size_t*              sizes          = apr_pcalloc(run_pool, nb_inputs * sizeof(size_t));
+  uint64_t*            offsets        = apr_pcalloc(run_pool, nb_inputs * sizeof(uint64_t));
+  uint64_t*            footer_offsets = apr_pcalloc(run_pool, nb_inputs * sizeof(uint64_t));
+  uint32_t*            nb_blocks      = apr_pcalloc(run_pool, nb_inputs * sizeof(uint32_t));
+  jp_key_index_map_t** maps           = apr_pcalloc(run_pool, nb_inputs * sizeof(jp_key_index_map_t*));
+  int                  widest         = 0;
+  uint64_t             nb_records     = 0;
+  int                  ret            = 0;
+
+  /* everything is checked before a byte is written, so that the caller can decode the file sets instead */
+  for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+    uint64_t input_records, verified_records;
+    uint32_t verified_blocks, unchecked_blocks;
+
+    if (0 != jp_map_file_set(run_pool, kv_pair_inputs[i], key_index_inputs ? key_index_inputs[i] : NULL,
+                             & data[i], & sizes[i], & offsets[i], & maps[i], 1)) {
+      ret = -1;
+      break;
+    }
+
+    /* the files written before the block framing have no blocks to copy */
+    ret = jp_block_verify(data[i], sizes[i], offsets[i], & verified_records, & verified_blocks, & unchecked_blocks);
+
+    if (0 == ret && 0 != jp_scan_read_footer(data[i], sizes[i], offsets[i], & footer_offsets[i], & input_records, & nb_blocks[i]))
+      ret = -1;
+
+    /* the arrival ordinals of clustered blocks are only meaningful within their file */
+    for (uint32_t b = 0; b < nb_blocks[i] && 0 == ret; b++) {
+      uint64_t block_offset;
+      uint32_t flags;
+
+      memcpy(& block_offset, data[i] + footer_offsets[i] + 3 * sizeof(uint32_t) + sizeof(uint64_t) + (uint64_t) b * JP_BLOCK_INDEX_ENTRY_SIZE,
+             sizeof(uint64_t));
+      memcpy(& flags, data[i] + block_offset + sizeof(uint32_t), sizeof(uint32_t));
+
+      if (flags & JP_BLOCK_FLAG_ORDER)
+        ret = 1;
+    }
+
+    if (jp_key_index_map_count(maps[i]) > jp_key_index_map_count(maps[widest]))
+      widest = i;
+
+    nb_records += input_records;
+  }
+
+  /* the keys of every file set are numbered as the first keys of the widest one */
+  for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+    for (uint32_t k = 1; k <= jp_key_index_map_count(maps[i]) && 0 == ret; k++)
+      if (0 != strcmp(jp_key_index_map_key(maps[i], k, NULL), jp_key_index_map_key(maps[widest], k, NULL)))
+        ret = 1;
+  }
+
+  apr_hash_t* key_index = apr_hash_make(run_pool);
+
+  for (uint32_t k = 1; 0 == ret && k <= jp_key_index_map_count(maps[widest]); k++)
+    jp_find_or_add_key(key_index, jp_key_index_map_key(maps[widest], k, NULL));
+
+  uint64_t base_offset = 0;
+
+  if (0 == ret && NULL == key_index_output && 0 == (base_offset = jp_write_container_prelude(key_index, kv_pair_output)))
+    ret = -1;
+
+  if (0 == ret) {
+    jp_buffer_io_t      buffer;
+    apr_array_header_t* block_index = apr_array_make(run_pool, 256, sizeof(jp_block_index_entry_t));
+    uint64_t            position    = base_offset + 2 * sizeof(uint32_t);
+
+    jp_buffer_io_write_initialize(& buffer, run_pool, kv_pair_output);
+
+    if (0 == jp_export_uint32_to_buffer(JP_KV_PAIR_MAGIC, & buffer) ||
+        0 == jp_export_uint32_to_buffer(JP_KV_PAIR_FORMAT_VERSION, & buffer))
+      ret = -1;
+
+    /* the blocks of a file run from its header to its footer, they are written from the mappings */
+    for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+      uint64_t start = offsets[i] + 2 * sizeof(uint32_t);
+
+      for (uint32_t b = 0; b < nb_blocks[i]; b++) {
+        jp_block_index_entry_t* entry = apr_array_push(block_index);
+
+        memcpy(entry, data[i] + footer_offsets[i] + 3 * sizeof(uint32_t) + sizeof(uint64_t) + (uint64_t) b * JP_BLOCK_INDEX_ENTRY_SIZE,
+               JP_BLOCK_INDEX_ENTRY_SIZE);
+
+        entry->offset = entry->offset - start + position;
+      }
+
+      if (footer_offsets[i] > start && NULL == jp_buffer_io_reference_bytes(& buffer, data[i] + start, footer_offsets[i] - start))
+        ret = -1;
+
+      position += footer_offsets[i] - start;
+    }
+
+    if (0 == ret && 0 != jp_block_footer_write(& buffer, block_index, nb_records, position))
+      ret = -1;
+
+    jp_buffer_io_flush_writes(& buffer);
+
+    if (buffer.write_error)
+      ret = -1;
+  }
+
+  if (0 == ret && key_index_output && 0 != jp_export_key_index_to_file(key_index, key_index_output))
+    ret = -1;
+
+  for (int i = 0; i < nb_inputs; i++)
+    if (maps[i])
+      jp_key_index_map_close(maps[i]);
+
+  apr_pool_destroy(run_pool);
+
+  return ret;
+}
@@ -8,92 +8,85 @@
 
 
 
-static int jp_write_key_index_pair(void *rec, const void *key, apr_ssize_t klen, const void *value)
+uint8_t* jp_key_index_image_from_key_index(apr_pool_t *pool,
+                                           apr_hash_t *key_index,
+                                           size_t     *image_size)
 {
-  jp_buffer_io_t* buffer = rec;
+  uint32_t     nb_keys = apr_hash_count(key_index);
+  const char** keys    = apr_pcalloc(pool, (nb_keys + 1) * sizeof(const char*));
 
-  uint32_t expected_length_to_write = sizeof(uint32_t) + sizeof(uint32_t) + (size_t)klen;
+  for (apr_hash_index_t *hi = apr_hash_first(NULL, key_index); hi; hi = apr_hash_next(hi)) {
+    const char *key;
+    void       *index;
 
-  if (buffer->current_size < expected_length_to_write) {
-    if (0 != jp_buffer_io_grow(buffer, expected_length_to_write))
-      return 0;
-  }
-
-  if (jp_buffer_io_bytes_left_to_write(buffer) < expected_length_to_write) {
-    jp_buffer_io_flush_writes(buffer);
-  }
+    apr_hash_this(hi, (const void**) & key, NULL, & index);
 
-  expected_length_to_write -= jp_export_uint32_to_buffer(expected_length_to_write, buffer);
-  expected_length_to_write -= jp_export_uint32_to_buffer((uint32_t) value, buffer);
+    if ((size_t) index == 0 || (size_t) index > nb_keys) {
+      fprintf(stderr, "jp_key_index_image_from_key_index: key indices are not contiguous \n");
+      return NULL;
+    }
 
-  jp_buffer_io_memcpy_to(buffer, key, expected_length_to_write);
+    keys[(size_t) index - 1] = key;
+  }
 
-  return 1;
+  return jp_key_index_image_build(pool, keys, nb_keys, image_size);
 }
 
-
 int jp_export_key_index_to_file(apr_hash_t *key_index,
                                 FILE       *output)
 {
-  jp_buffer_io_t buffer;
-  jp_buffer_io_write_initialize(& buffer, apr_hash_pool_get(key_index), output);
+  apr_pool_t* pool;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, apr_hash_pool_get(key_index)))
+    return -1;
+
+  size_t   image_size;
+  uint8_t* image = jp_key_index_image_from_key_index(pool, key_index, & image_size);
 
-  uint64_t length = apr_hash_count(key_index);
+  jp_buffer_io_t buffer;
+  jp_buffer_io_write_initialize(& buffer, pool, output);
 
-  jp_buffer_io_memcpy_to(& buffer, & length, sizeof(uint64_t));
+  int ret = 0;
 
-  int ret = !apr_hash_do(jp_write_key_index_pair, & buffer, key_index);
+  if (NULL == image || NULL == jp_buffer_io_reference_bytes(& buffer, image, image_size))
+    ret = -1;
 
   jp_buffer_io_flush_writes(& buffer);
 
+  if (buffer.write_error)
+    ret = -1;
+
+  apr_pool_destroy(pool);
+
   return ret;
 }
 
 apr_hash_t* jp_import_key_index_from_file(apr_pool_t *pool,
                                           FILE       *input)
 {
-  jp_buffer_io_t buffer;
-  jp_buffer_io_read_initialize(& buffer, pool, input);
-
-  jp_buffer_io_read(& buffer);
-
-  uint64_t length;
+  jp_key_index_map_t* map = jp_key_index_map_open(pool, input);
 
-  jp_buffer_io_memcpy_from(& buffer, & length, sizeof(uint64_t));
-
-  uint64_t pending_pairs_to_read = length;
+  if (NULL == map)
+    return NULL;
 
   apr_hash_t* key_index = apr_hash_make(pool);
+  uint32_t    nb_keys   = jp_key_index_map_count(map);
 
-  while(pending_pairs_to_read > 0) {
-
-    if (jp_buffer_io_bytes_left_to_read(& buffer) < sizeof(uint32_t))
-      jp_buffer_io_read(& buffer);
-
-    uint32_t expected_length_to_read;
+  /* the keys are copied since the file may be rewritten while the hash is in use */
+  for (uint32_t index = 1; index <= nb_keys; index++) {
+    uint32_t    key_length;
+    const char* key = jp_key_index_map_key(map, index, & key_length);
 
-    expected_length_to_read -= jp_import_uint32_from_buffer(& expected_length_to_read, & buffer);
-
-    if (expected_length_to_read > buffer.current_size) {
-      if (0 != jp_buffer_io_grow(& buffer, expected_length_to_read))
-        return NULL;
+    if (NULL == key) {
+      jp_key_index_map_close(map);
+      return NULL;
     }
 
-    if (jp_buffer_io_bytes_left_to_read(& buffer) < expected_length_to_read)
-      jp_buffer_io_read(& buffer);
-
-    uint32_t index_value;
-
-    expected_length_to_read -= jp_import_uint32_from_buffer(& index_value, & buffer);
-
-    char* key    = apr_pmemdup(pool, jp_buffer_io_use_available_bytes(& buffer, expected_length_to_read), expected_length_to_read + 1);
-    char zero    = 0;
-    memcpy(key + expected_length_to_read, &zero, 1);
-
-    apr_hash_set(key_index, key, APR_HASH_KEY_STRING, (void*)index_value);
-    --pending_pairs_to_read;
+    apr_hash_set(key_index, apr_pmemdup(pool, key, key_length + 1), key_length, (void*)(size_t) index);
   }
 
+  jp_key_index_map_close(map);
+
   return key_index;
 }
 
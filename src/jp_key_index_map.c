@@ -0,0 +1,365 @@
+
+#include <apr_pools.h>
+#include <apr_strings.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ *  Key index file layout:
+ *
+ *  - header: uint32 JP_KEY_INDEX_MAGIC, uint32 format version, uint32 number of keys,
+ *    uint32 number of hash slots (a power of two, at least twice the number of keys)
+ *
+ *  - one entry per key, ordered by key index: uint32 offset of the key from the start of the
+ *    key index, uint32 key length and uint32 jp_hash_bytes of the key
+ *
+ *  - the hash slots: uint32 key index of the key hashed to the slot (linear probing), 0 if empty
+ *
+ *  - the keys, each one followed by a NUL character so they can be used in place
+ *
+ *  Opening a key index maps the file and checks the table bounds, key lookups in both
+ *  directions are then O(1) and work directly on the mapped memory.
+ *
+ *  Key indices written before this layout (a uint64 count followed by (length, index, key)
+ *  entries in hash order) are converted to an in-memory image of the same layout when opened.
+ */
+
+struct jp_key_index_map
+{
+  const uint8_t *base;
+  size_t         size;
+  uint32_t       nb_keys;
+  uint32_t       nb_slots;
+
+  apr_pool_t    *pool;
+  void          *mapping;
+  size_t         mapping_size;
+};
+
+static inline uint32_t jp_read_image_uint32(const uint8_t *image, size_t offset)
+{
+  uint32_t value;
+  memcpy(& value, image + offset, sizeof(uint32_t));
+
+  return value;
+}
+
+static inline void jp_write_image_uint32(uint8_t *image, size_t offset, uint32_t value)
+{
+  memcpy(image + offset, & value, sizeof(uint32_t));
+}
+
+static inline size_t jp_key_index_entry_offset(uint32_t index)
+{
+  return JP_KEY_INDEX_HEADER_SIZE + (size_t)(index - 1) * JP_KEY_INDEX_ENTRY_SIZE;
+}
+
+static inline size_t jp_key_index_slot_offset(uint32_t nb_keys, uint32_t slot)
+{
+  return JP_KEY_INDEX_HEADER_SIZE + (size_t) nb_keys * JP_KEY_INDEX_ENTRY_SIZE + (size_t) slot * sizeof(uint32_t);
+}
+
+static uint32_t jp_key_index_nb_slots(uint32_t nb_keys)
+{
+  uint32_t nb_slots = 1;
+
+  while (nb_slots < 2 * (uint64_t) nb_keys)
+    nb_slots *= 2;
+
+  return nb_slots;
+}
+
+uint8_t* jp_key_index_image_build(apr_pool_t   *pool,
+                                  const char  **keys,
+                                  uint32_t      nb_keys,
+                                  size_t       *image_size)
+{
+  uint32_t nb_slots       = jp_key_index_nb_slots(nb_keys);
+  size_t   strings_offset = jp_key_index_slot_offset(nb_keys, nb_slots);
+  size_t   size           = strings_offset;
+
+  for (uint32_t i = 0; i < nb_keys; i++)
+    size += strlen(keys[i]) + 1;
+
+  uint8_t* image = apr_pcalloc(pool, size);
+
+  jp_write_image_uint32(image, 0, JP_KEY_INDEX_MAGIC);
+  jp_write_image_uint32(image, 4, JP_KEY_INDEX_FORMAT_VERSION);
+  jp_write_image_uint32(image, 8, nb_keys);
+  jp_write_image_uint32(image, 12, nb_slots);
+
+  size_t key_offset = strings_offset;
+
+  for (uint32_t index = 1; index <= nb_keys; index++) {
+    const char* key        = keys[index - 1];
+    uint32_t    key_length = strlen(key);
+    uint32_t    hash       = jp_hash_bytes(key, key_length);
+    size_t      entry      = jp_key_index_entry_offset(index);
+
+    jp_write_image_uint32(image, entry, key_offset);
+    jp_write_image_uint32(image, entry + 4, key_length);
+    jp_write_image_uint32(image, entry + 8, hash);
+
+    memcpy(image + key_offset, key, key_length + 1);
+    key_offset += key_length + 1;
+
+    uint32_t slot = hash & (nb_slots - 1);
+
+    while (0 != jp_read_image_uint32(image, jp_key_index_slot_offset(nb_keys, slot)))
+      slot = (slot + 1) & (nb_slots - 1);
+
+    jp_write_image_uint32(image, jp_key_index_slot_offset(nb_keys, slot), index);
+  }
+
+  *image_size = size;
+
+  return image;
+}
+
+static apr_status_t jp_key_index_map_cleanup(void *data)
+{
+  jp_key_index_map_t* map = data;
+
+  if (map->mapping) {
+    munmap(map->mapping, map->mapping_size);
+    map->mapping = NULL;
+  }
+
+  return APR_SUCCESS;
+}
+
+/* converts the original (length, index, key) layout */
+static int jp_key_index_map_convert_legacy(jp_key_index_map_t *map)
+{
+  uint64_t nb_keys;
+  size_t   offset = sizeof(uint64_t);
+
+  if (map->size < sizeof(uint64_t))
+    return -1;
+
+  memcpy(& nb_keys, map->base, sizeof(uint64_t));
+
+  if (nb_keys > (map->size - offset) / (2 * sizeof(uint32_t)))
+    return -1;
+
+  const char** keys = apr_pcalloc(map->pool, (nb_keys + 1) * sizeof(const char*));
+
+  for (uint64_t i = 0; i < nb_keys; i++) {
+    if (map->size - offset < 2 * sizeof(uint32_t))
+      return -1;
+
+    uint32_t entry_length = jp_read_image_uint32(map->base, offset);
+    uint32_t index        = jp_read_image_uint32(map->base, offset + 4);
+
+    if (entry_length < 2 * sizeof(uint32_t) || entry_length > map->size - offset || 0 == index || index > nb_keys)
+      return -1;
+
+    keys[index - 1] = apr_pstrndup(map->pool, (const char*) map->base + offset + 2 * sizeof(uint32_t), entry_length - 2 * sizeof(uint32_t));
+    offset         += entry_length;
+  }
+
+  for (uint64_t i = 0; i < nb_keys; i++)
+    if (NULL == keys[i])
+      return -1;
+
+  size_t   image_size;
+  uint8_t* image = jp_key_index_image_build(map->pool, keys, nb_keys, & image_size);
+
+  jp_key_index_map_cleanup(map);
+
+  map->base = image;
+  map->size = image_size;
+
+  return 0;
+}
+
+uint8_t* jp_read_stream(apr_pool_t *pool,
+                        FILE       *input,
+                        size_t      length,
+                        size_t     *size)
+{
+  size_t   capacity = JP_IO_HELPER_BUFFER_SIZE;
+  size_t   filled   = 0;
+  uint8_t* data     = apr_palloc(pool, capacity);
+
+  while (filled < length) {
+    size_t to_read = (length - filled < capacity - filled) ? length - filled : capacity - filled;
+    size_t got     = fread(data + filled, 1, to_read, input);
+
+    filled += got;
+
+    if (got < to_read)
+      break;
+
+    if (filled == capacity && filled < length) {
+      uint8_t* larger = apr_palloc(pool, 2 * capacity);
+      memcpy(larger, data, filled);
+
+      data      = larger;
+      capacity *= 2;
+    }
+  }
+
+  *size = filled;
+
+  return data;
+}
+
+/* checks the header and the table bounds, converting a key index in the original layout on the way */
+static int jp_key_index_map_check(jp_key_index_map_t *map)
+{
+  if (map->size < sizeof(uint32_t) || JP_KEY_INDEX_MAGIC != jp_read_image_uint32(map->base, 0)) {
+    if (0 != jp_key_index_map_convert_legacy(map)) {
+      fprintf(stderr, "jp_key_index_map_open: not a key index \n");
+      jp_key_index_map_close(map);
+      return -1;
+    }
+  }
+
+  if (map->size < JP_KEY_INDEX_HEADER_SIZE || JP_KEY_INDEX_FORMAT_VERSION < jp_read_image_uint32(map->base, 4)) {
+    fprintf(stderr, "jp_key_index_map_open: unsupported key index \n");
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  map->nb_keys  = jp_read_image_uint32(map->base, 8);
+  map->nb_slots = jp_read_image_uint32(map->base, 12);
+
+  if (0 == map->nb_slots || 0 != (map->nb_slots & (map->nb_slots - 1)) || map->nb_slots < map->nb_keys ||
+      (uint64_t) jp_key_index_slot_offset(map->nb_keys, map->nb_slots) > map->size) {
+    fprintf(stderr, "jp_key_index_map_open: truncated key index \n");
+    jp_key_index_map_close(map);
+    return -1;
+  }
+
+  return 0;
+}
+
+jp_key_index_map_t* jp_key_index_map_open_range(apr_pool_t *pool,
+                                                FILE       *input,
+                                                off_t       offset,
+                                                size_t      length)
+{
+  jp_key_index_map_t* map = apr_pcalloc(pool, sizeof(jp_key_index_map_t));
+  map->pool = pool;
+
+  long  page_size      = sysconf(_SC_PAGESIZE);
+  off_t mapping_offset = offset - (offset % page_size);
+
+  map->mapping_size = length + (offset - mapping_offset);
+  map->mapping      = (length > 0 && SIZE_MAX != length) ? mmap(NULL, map->mapping_size, PROT_READ, MAP_PRIVATE, fileno(input), mapping_offset) : MAP_FAILED;
+
+  if (MAP_FAILED != map->mapping) {
+    map->base = (const uint8_t*) map->mapping + (offset - mapping_offset);
+    map->size = length;
+
+    apr_pool_cleanup_register(pool, map, jp_key_index_map_cleanup, apr_pool_cleanup_null);
+  } else {
+    /* not a regular file, which is then read up to length (SIZE_MAX for its end) from its current position */
+    map->mapping = NULL;
+
+    if (0 != fseeko(input, offset, SEEK_SET) && ESPIPE != errno)
+      return NULL;
+
+    map->base = jp_read_stream(pool, input, length, & map->size);
+  }
+
+  return (0 == jp_key_index_map_check(map)) ? map : NULL;
+}
+
+jp_key_index_map_t* jp_key_index_map_open_memory(apr_pool_t    *pool,
+                                                 const uint8_t *data,
+                                                 size_t         size)
+{
+  jp_key_index_map_t* map = apr_pcalloc(pool, sizeof(jp_key_index_map_t));
+
+  map->pool = pool;
+  map->base = data;
+  map->size = size;
+
+  return (0 == jp_key_index_map_check(map)) ? map : NULL;
+}
+
+jp_key_index_map_t* jp_key_index_map_open(apr_pool_t *pool,
+                                          FILE       *input)
+{
+  struct stat input_stat;
+  off_t       offset = ftello(input);
+
+  if (offset < 0)
+    offset = 0;
+
+  if (0 == fstat(fileno(input), & input_stat) && S_ISREG(input_stat.st_mode) && input_stat.st_size >= offset)
+    return jp_key_index_map_open_range(pool, input, offset, input_stat.st_size - offset);
+
+  return jp_key_index_map_open_range(pool, input, 0, SIZE_MAX);
+}
+
+void jp_key_index_map_close(jp_key_index_map_t *map)
+{
+  jp_key_index_map_cleanup(map);
+
+  map->base    = NULL;
+  map->size    = 0;
+  map->nb_keys = 0;
+}
+
+uint32_t jp_key_index_map_count(const jp_key_index_map_t *map)
+{
+  return map->nb_keys;
+}
+
+const char* jp_key_index_map_key(const jp_key_index_map_t *map,
+                                       uint32_t            index,
+                                       uint32_t           *key_length)
+{
+  if (0 == index || index > map->nb_keys)
+    return NULL;
+
+  size_t   entry  = jp_key_index_entry_offset(index);
+  uint32_t offset = jp_read_image_uint32(map->base, entry);
+  uint32_t length = jp_read_image_uint32(map->base, entry + 4);
+
+  if ((uint64_t) offset + length + 1 > map->size || '\0' != map->base[offset + length])
+    return NULL;
+
+  if (key_length)
+    *key_length = length;
+
+  return (const char*) map->base + offset;
+}
+
+uint32_t jp_key_index_map_find(const jp_key_index_map_t *map,
+                               const char               *key)
+{
+  if (0 == map->nb_keys)
+    return 0;
+
+  size_t   length = strlen(key);
+  uint32_t hash   = jp_hash_bytes(key, length);
+  uint32_t mask   = map->nb_slots - 1;
+
+  for (uint32_t slot = hash & mask, probes = 0; probes < map->nb_slots; slot = (slot + 1) & mask, probes++) {
+    uint32_t index = jp_read_image_uint32(map->base, jp_key_index_slot_offset(map->nb_keys, slot));
+
+    if (0 == index)
+      return 0;
+
+    if (index > map->nb_keys || hash != jp_read_image_uint32(map->base, jp_key_index_entry_offset(index) + 8))
+      continue;
+
+    uint32_t    candidate_length;
+    const char* candidate = jp_key_index_map_key(map, index, & candidate_length);
+
+    if (candidate && candidate_length == length && 0 == memcmp(candidate, key, length))
+      return index;
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+
+#include <apr_pools.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+
+#include "jp_tlv_encoder_private.h"
+
+
+struct jp_prefetch_reader
+{
+  apr_pool_t         *pool;
+  FILE               *stream;
+
+#if APR_HAS_THREADS
+  apr_thread_t       *thread;
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t  *chunk_filled;
+  apr_thread_cond_t  *chunk_released;
+#endif
+
+  uint8_t            *chunks[JP_PREFETCH_NB_CHUNKS];
+  size_t              chunk_fill[JP_PREFETCH_NB_CHUNKS];
+  unsigned int        head;
+  unsigned int        count;
+  size_t              consumed;
+  int                 eof;
+  int                 stop;
+};
+
+#if APR_HAS_THREADS
+
+/*
+ *  The ring is a single producer / single consumer queue: the background thread only
+ *  writes into the slot right after the last filled one, and the consumer only reads
+ *  the slot at head, so the chunk contents can be touched without holding the mutex
+ */
+static void* APR_THREAD_FUNC jp_prefetch_reader_thread(apr_thread_t *thread,
+                                                       void         *data)
+{
+  jp_prefetch_reader_t* reader = data;
+
+  while (1) {
+    apr_thread_mutex_lock(reader->mutex);
+
+    while (reader->count == JP_PREFETCH_NB_CHUNKS && !reader->stop)
+      apr_thread_cond_wait(reader->chunk_released, reader->mutex);
+
+    unsigned int slot = (reader->head + reader->count) % JP_PREFETCH_NB_CHUNKS;
+    int          stop = reader->stop;
+
+    apr_thread_mutex_unlock(reader->mutex);
+
+    if (stop)
+      break;
+
+    size_t filled = fread(reader->chunks[slot], 1, JP_PREFETCH_CHUNK_SIZE, reader->stream);
+    int    eof    = feof(reader->stream) || ferror(reader->stream);
+
+    apr_thread_mutex_lock(reader->mutex);
+
+    if (filled > 0) {
+      reader->chunk_fill[slot] = filled;
+      reader->count++;
+    }
+
+    reader->eof = eof || (0 == filled);
+
+    apr_thread_cond_signal(reader->chunk_filled);
+    apr_thread_mutex_unlock(reader->mutex);
+
+    if (eof || 0 == filled)
+      break;
+  }
+
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+#endif
+
+jp_prefetch_reader_t* jp_prefetch_reader_start(apr_pool_t *pool,
+                                               FILE       *stream)
+{
+  apr_pool_t* reader_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& reader_pool, pool))
+    return NULL;
+
+  jp_prefetch_reader_t* reader = apr_pcalloc(reader_pool, sizeof(jp_prefetch_reader_t));
+
+  reader->pool   = reader_pool;
+  reader->stream = stream;
+
+  for (int i = 0; i < JP_PREFETCH_NB_CHUNKS; i++)
+    reader->chunks[i] = apr_palloc(reader_pool, JP_PREFETCH_CHUNK_SIZE);
+
+#if APR_HAS_THREADS
+  if (APR_SUCCESS != apr_thread_mutex_create(& reader->mutex, APR_THREAD_MUTEX_DEFAULT, reader_pool) ||
+      APR_SUCCESS != apr_thread_cond_create(& reader->chunk_filled, reader_pool) ||
+      APR_SUCCESS != apr_thread_cond_create(& reader->chunk_released, reader_pool) ||
+      APR_SUCCESS != apr_thread_create(& reader->thread, NULL, jp_prefetch_reader_thread, reader, reader_pool)) {
+    apr_pool_destroy(reader_pool);
+    return NULL;
+  }
+#endif
+
+  return reader;
+}
+
+size_t jp_prefetch_reader_read(jp_prefetch_reader_t *reader,
+                               uint8_t              *dest,
+                               size_t                size)
+{
+#if APR_HAS_THREADS
+  size_t copied = 0;
+
+  while (copied < size) {
+    apr_thread_mutex_lock(reader->mutex);
+
+    while (0 == reader->count && !reader->eof)
+      apr_thread_cond_wait(reader->chunk_filled, reader->mutex);
+
+    if (0 == reader->count) {
+      apr_thread_mutex_unlock(reader->mutex);
+      break;
+    }
+
+    unsigned int slot      = reader->head;
+    size_t       available = reader->chunk_fill[slot] - reader->consumed;
+
+    apr_thread_mutex_unlock(reader->mutex);
+
+    size_t to_copy = (size - copied < available) ? size - copied : available;
+    memcpy(dest + copied, reader->chunks[slot] + reader->consumed, to_copy);
+    copied += to_copy;
+
+    apr_thread_mutex_lock(reader->mutex);
+
+    reader->consumed += to_copy;
+
+    if (reader->consumed == reader->chunk_fill[slot]) {
+      reader->head     = (reader->head + 1) % JP_PREFETCH_NB_CHUNKS;
+      reader->consumed = 0;
+      reader->count--;
+      apr_thread_cond_signal(reader->chunk_released);
+    }
+
+    apr_thread_mutex_unlock(reader->mutex);
+  }
+
+  return copied;
+#else
+  return fread(dest, 1, size, reader->stream);
+#endif
+}
+
+int jp_prefetch_reader_eof(jp_prefetch_reader_t *reader)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(reader->mutex);
+  int eof = reader->eof && 0 == reader->count;
+  apr_thread_mutex_unlock(reader->mutex);
+
+  return eof;
+#else
+  return feof(reader->stream);
+#endif
+}
+
+void jp_prefetch_reader_stop(jp_prefetch_reader_t *reader)
+{
+#if APR_HAS_THREADS
+  apr_status_t thread_rv;
+
+  apr_thread_mutex_lock(reader->mutex);
+  reader->stop = 1;
+  apr_thread_cond_signal(reader->chunk_released);
+  apr_thread_mutex_unlock(reader->mutex);
+
+  apr_thread_join(& thread_rv, reader->thread);
+#endif
+
+  apr_pool_destroy(reader->pool);
+}
@@ -0,0 +1,314 @@
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <stdlib.h>
+
+/*
+ *  Records are clustered by shape when they are exported: every window of cluster_window records
+ *  is reordered so that the records with the same keys, in the same order, follow each other. The
+ *  shapes keep the order their first record arrived in, and the records of a shape keep theirs,
+ *  unless they are sorted by the value of the cluster key (the records without it last).
+ *
+ *  With keep_order, the blocks flagged JP_BLOCK_FLAG_ORDER carry the arrival order of their
+ *  records, right after the checksum of the payload:
+ *
+ *  - uint64 smallest arrival ordinal of the block, the ordinals counting the records of the file
+ *
+ *  - for every record of the block, in the order they are stored: its uint32 arrival ordinal,
+ *    from the smallest one
+ *
+ *  - the uint32 CRC32C of all of the above
+ *
+ *  The records are only moved within their window, so the ordinals of a block never span more
+ *  than its records and a window.
+ */
+
+void jp_enable_record_clustering(      jp_TLV_records_t *record_collection,
+                                       uint32_t          window,
+                                 const char             *sort_key,
+                                       int               keep_order)
+{
+  apr_pool_t* pool = apr_hash_pool_get(record_collection->key_index);
+
+  record_collection->cluster_window = (window > JP_CLUSTER_MAX_WINDOW) ? JP_CLUSTER_MAX_WINDOW : window;
+  record_collection->cluster_key    = sort_key ? apr_pstrdup(pool, sort_key) : NULL;
+  record_collection->keep_order     = keep_order;
+}
+
+uint32_t jp_block_order_write(jp_buffer_io_t     *buffer,
+                              apr_array_header_t *ordinals)
+{
+  uint32_t  nb_records = ordinals->nelts;
+  uint64_t* values     = (uint64_t*) ordinals->elts;
+  uint64_t  base       = UINT64_MAX;
+
+  for (uint32_t i = 0; i < nb_records; i++)
+    if (values[i] < base)
+      base = values[i];
+
+  if (0 != jp_buffer_io_reserve(buffer, JP_ORDER_SECTION_SIZE(nb_records)))
+    return 0;
+
+  size_t start = buffer->used;
+
+  jp_buffer_io_memcpy_to(buffer, & base, sizeof(uint64_t));
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    uint32_t offset = values[i] - base;
+
+    jp_buffer_io_memcpy_to(buffer, & offset, sizeof(uint32_t));
+  }
+
+  uint32_t crc = jp_crc32c(0, buffer->current_buffer + start, buffer->used - start);
+
+  if (0 == jp_export_uint32_to_buffer(crc, buffer))
+    return 0;
+
+  return buffer->used - start;
+}
+
+uint64_t jp_block_order_read(const uint8_t  *data,
+                                   uint64_t  size,
+                                   uint32_t  nb_records,
+                                   uint64_t *base,
+                             const uint8_t **offsets)
+{
+  uint64_t section = JP_ORDER_SECTION_SIZE(nb_records) - JP_BLOCK_CRC_SIZE;
+
+  if (section + JP_BLOCK_CRC_SIZE > size)
+    return 0;
+
+  uint32_t stored_crc;
+  memcpy(& stored_crc, data + section, sizeof(uint32_t));
+
+  if (stored_crc != jp_crc32c(0, data, section))
+    return 0;
+
+  memcpy(base, data, sizeof(uint64_t));
+  *offsets = data + sizeof(uint64_t);
+
+  return section + JP_BLOCK_CRC_SIZE;
+}
+
+typedef struct jp_cluster_entry
+{
+  uint32_t                shape;
+  uint32_t                position;
+  const jp_TLV_kv_pair_t *sort_value;
+  jp_TLV_record_t        *record;
+} jp_cluster_entry_t;
+
+int jp_compare_sort_values(const jp_TLV_kv_pair_t *a,
+                           const jp_TLV_kv_pair_t *b)
+{
+  if (NULL == a || NULL == b)
+    return (NULL == a) - (NULL == b);
+
+  int numeric_a = (JP_TYPE_INTEGER == a->value_type || JP_TYPE_DOUBLE == a->value_type);
+  int numeric_b = (JP_TYPE_INTEGER == b->value_type || JP_TYPE_DOUBLE == b->value_type);
+
+  if (numeric_a && numeric_b) {
+    double value_a = (JP_TYPE_INTEGER == a->value_type) ? a->union_v.integer_value : a->union_v.double_value;
+    double value_b = (JP_TYPE_INTEGER == b->value_type) ? b->union_v.integer_value : b->union_v.double_value;
+
+    /* NaN compares equal to everything, the records keep their order */
+    return (value_a < value_b) ? -1 : (value_a > value_b);
+  }
+
+  if (a->value_type != b->value_type)
+    return (a->value_type < b->value_type) ? -1 : 1;
+
+  if (JP_TYPE_BOOLEAN == a->value_type)
+    return a->union_v.integer_value - b->union_v.integer_value;
+
+  const jp_TLV_string_t* string_a = & a->union_v.string_value;
+  const jp_TLV_string_t* string_b = & b->union_v.string_value;
+  uint32_t               length   = (string_a->value_length < string_b->value_length) ? string_a->value_length
+                                                                                      : string_b->value_length;
+  int                    ret      = memcmp(string_a->value_buffer, string_b->value_buffer, length);
+
+  if (0 != ret)
+    return ret;
+
+  return (string_a->value_length < string_b->value_length) ? -1 : (string_a->value_length > string_b->value_length);
+}
+
+static int jp_compare_cluster_entries(const void *a,
+                                      const void *b)
+{
+  const jp_cluster_entry_t* entry_a = a;
+  const jp_cluster_entry_t* entry_b = b;
+
+  if (entry_a->shape != entry_b->shape)
+    return (entry_a->shape < entry_b->shape) ? -1 : 1;
+
+  int ret = jp_compare_sort_values(entry_a->sort_value, entry_b->sort_value);
+
+  if (0 != ret)
+    return ret;
+
+  /* qsort is not stable, the arrival order breaks the ties */
+  return (entry_a->position < entry_b->position) ? -1 : (entry_a->position > entry_b->position);
+}
+
+/* numbers the shapes of a window in the order they first appear, the shape being the sequence of the key indices */
+static void jp_cluster_window(apr_pool_t         *pool,
+                              jp_cluster_entry_t *entries,
+                              uint32_t            nb_entries,
+                              uint32_t            sort_key_index)
+{
+  apr_hash_t* shapes = apr_hash_make(pool);
+
+  for (uint32_t i = 0; i < nb_entries; i++) {
+    apr_array_header_t* kv_array = entries[i].record->kv_pairs_array;
+    uint32_t*           keys     = apr_palloc(pool, (kv_array->nelts + 1) * sizeof(uint32_t));
+
+    entries[i].sort_value = NULL;
+
+    for (int j = 0; j < kv_array->nelts; j++) {
+      const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+      keys[j] = kv_pair->key_index;
+
+      if (sort_key_index && kv_pair->key_index == sort_key_index && NULL == entries[i].sort_value)
+        entries[i].sort_value = kv_pair;
+    }
+
+    apr_ssize_t length = kv_array->nelts * sizeof(uint32_t);
+    void*       shape  = apr_hash_get(shapes, keys, length);
+
+    if (NULL == shape) {
+      shape = (void*) (size_t) (apr_hash_count(shapes) + 1);
+      apr_hash_set(shapes, keys, length, shape);
+    }
+
+    entries[i].shape = (uint32_t) (size_t) shape;
+  }
+
+  qsort(entries, nb_entries, sizeof(jp_cluster_entry_t), jp_compare_cluster_entries);
+}
+
+int jp_block_writer_add_translated(      jp_block_writer_t *writer,
+                                         jp_TLV_record_t   *record,
+                                   const uint32_t          *key_map,
+                                         jp_TLV_record_t   *scratch)
+{
+  if (key_map) {
+    apr_array_header_t* kv_array = record->kv_pairs_array;
+
+    scratch->kv_pairs_array->nelts = 0;
+
+    for (int i = 0; i < kv_array->nelts; i++) {
+      jp_TLV_kv_pair_t* kv_pair = apr_array_push(scratch->kv_pairs_array);
+
+      *kv_pair           = ((jp_TLV_kv_pair_t*) kv_array->elts)[i];
+      kv_pair->key_index = key_map[kv_pair->key_index];
+    }
+
+    record = scratch;
+  }
+
+  return jp_block_writer_add_record(writer, record);
+}
+
+int jp_block_writer_add_records(      jp_block_writer_t *writer,
+                                const jp_TLV_records_t  *record_collection,
+                                const jp_TLV_records_t  *segment,
+                                const uint32_t          *key_map,
+                                      jp_TLV_record_t   *scratch)
+{
+  apr_array_header_t* record_array = segment->record_list;
+  jp_TLV_record_t**   records      = (jp_TLV_record_t**) record_array->elts;
+  uint32_t            nb_records   = record_array->nelts;
+  uint32_t            window       = record_collection->cluster_window;
+
+  if (0 == window) {
+    for (uint32_t i = 0; i < nb_records; i++) {
+      writer->record_ordinal = jp_block_writer_nb_records_added(writer);
+
+      if (0 != jp_block_writer_add_translated(writer, records[i], key_map, scratch))
+        return -1;
+    }
+
+    return 0;
+  }
+
+  apr_pool_t* window_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& window_pool, writer->pool))
+    return -1;
+
+  /* the key is looked up in the key index of the segment, its records are not translated yet */
+  uint32_t sort_key_index = 0;
+
+  if (record_collection->cluster_key)
+    sort_key_index = (uint32_t) (size_t) apr_hash_get(segment->key_index, record_collection->cluster_key, APR_HASH_KEY_STRING);
+
+  uint32_t            entries_size = (nb_records < window) ? nb_records : window;
+  jp_cluster_entry_t* entries      = apr_palloc(writer->pool, (entries_size + 1) * sizeof(jp_cluster_entry_t));
+  int                 ret          = 0;
+
+  for (uint32_t start = 0; start < nb_records && 0 == ret; start += window) {
+    uint32_t nb_entries    = (nb_records - start < window) ? nb_records - start : window;
+    uint64_t first_ordinal = jp_block_writer_nb_records_added(writer);
+
+    for (uint32_t i = 0; i < nb_entries; i++) {
+      entries[i].position = i;
+      entries[i].record   = records[start + i];
+    }
+
+    jp_cluster_window(window_pool, entries, nb_entries, sort_key_index);
+
+    for (uint32_t i = 0; i < nb_entries && 0 == ret; i++) {
+      writer->record_ordinal = first_ordinal + entries[i].position;
+
+      if (0 != jp_block_writer_add_translated(writer, entries[i].record, key_map, scratch))
+        ret = -1;
+    }
+
+    apr_pool_clear(window_pool);
+  }
+
+  apr_pool_destroy(window_pool);
+
+  return ret;
+}
+
+typedef struct jp_ordered_record
+{
+  uint64_t         ordinal;
+  jp_TLV_record_t *record;
+} jp_ordered_record_t;
+
+static int jp_compare_ordered_records(const void *a,
+                                      const void *b)
+{
+  uint64_t ordinal_a = ((const jp_ordered_record_t*) a)->ordinal;
+  uint64_t ordinal_b = ((const jp_ordered_record_t*) b)->ordinal;
+
+  return (ordinal_a < ordinal_b) ? -1 : (ordinal_a > ordinal_b);
+}
+
+void jp_restore_arrival_order(apr_pool_t         *pool,
+                              apr_array_header_t *record_list,
+                              int                 first_record,
+                              apr_array_header_t *ordinals)
+{
+  jp_TLV_record_t**    records    = (jp_TLV_record_t**) record_list->elts + first_record;
+  int                  nb_records = ordinals->nelts;
+  jp_ordered_record_t* ordered    = apr_palloc(pool, (nb_records + 1) * sizeof(jp_ordered_record_t));
+
+  for (int i = 0; i < nb_records; i++) {
+    ordered[i].ordinal = ((uint64_t*) ordinals->elts)[i];
+    ordered[i].record  = records[i];
+  }
+
+  qsort(ordered, nb_records, sizeof(jp_ordered_record_t), jp_compare_ordered_records);
+
+  for (int i = 0; i < nb_records; i++)
+    records[i] = ordered[i].record;
+}
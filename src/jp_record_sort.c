@@ -0,0 +1,538 @@
+
+#include <apr_hash.h>
+#include <apr_strings.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ *  File sets are sorted by the value of a key with an external merge sort. The inputs are read
+ *  into a run until its records reach the memory budget, and every run is sorted (the records
+ *  with the same value in the order they were read) and written as a single-file container to a
+ *  temporary file, unlinked as soon as it is created.
+ *
+ *  The runs are then merged, each read a block at a time by its own block reader: as many at once
+ *  as the budget leaves room for the prefetch buffers of their readers. When there are more runs
+ *  than that, consecutive runs are merged together first, so that the records with the same value
+ *  keep their order from one pass to the next.
+ *
+ *  The strings numbered in the dictionary of a block are shared by the records of the block: a run
+ *  is only cut between two blocks of an input, and the records read from a run are released a
+ *  block at a time, once the writer is done with them.
+ */
+
+#define JP_SORT_READER_MEMORY   (JP_PREFETCH_NB_CHUNKS * JP_PREFETCH_CHUNK_SIZE + JP_PREFETCH_WINDOW_SIZE)
+#define JP_SORT_MAX_FAN_IN      64
+#define JP_SORT_CURSOR_RECORDS  1024 /* more than the writer holds back, JP_ENCODING_SAMPLE_RECORDS */
+
+typedef struct jp_sort_entry
+{
+  const jp_TLV_kv_pair_t *sort_value;
+  uint32_t                position;
+  jp_TLV_record_t        *record;
+} jp_sort_entry_t;
+
+typedef struct jp_sort_cursor
+{
+  int                     run;
+  jp_block_reader_t       reader;
+  jp_key_index_map_t     *key_index;
+  uint32_t               *key_map;         /* the key indices of the run translated to the ones written */
+  uint32_t                sort_key_index;  /* in the key index of the run, 0 if none of its records has the key */
+
+  apr_pool_t             *record_pools[2]; /* the records read, the older pool is cleared when the newer one is full */
+  int                     current_pool;
+  uint32_t                nb_pool_records;
+
+  jp_TLV_record_t        *record;
+  const jp_TLV_kv_pair_t *sort_value;
+} jp_sort_cursor_t;
+
+static const jp_TLV_kv_pair_t* jp_sort_value(const jp_TLV_record_t *record,
+                                                   uint32_t         sort_key_index)
+{
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+
+  for (int i = 0; sort_key_index && i < kv_array->nelts; i++) {
+    const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i];
+
+    if (kv_pair->key_index == sort_key_index)
+      return kv_pair;
+  }
+
+  return NULL;
+}
+
+/* an upper bound, the interned strings are counted every time */
+static size_t jp_sort_record_size(const jp_TLV_record_t *record)
+{
+  apr_array_header_t* kv_array = record->kv_pairs_array;
+  size_t              size     = sizeof(jp_TLV_record_t*) + sizeof(jp_TLV_record_t) + sizeof(apr_array_header_t) +
+                                 kv_array->nalloc * sizeof(jp_TLV_kv_pair_t);
+
+  for (int i = 0; i < kv_array->nelts; i++) {
+    const jp_TLV_kv_pair_t* kv_pair = & ((const jp_TLV_kv_pair_t*) kv_array->elts)[i];
+
+    if (JP_TYPE_STRING == kv_pair->value_type)
+      size += kv_pair->union_v.string_value.value_length + 1;
+  }
+
+  return size;
+}
+
+static int jp_compare_sort_entries(const void *a,
+                                   const void *b)
+{
+  const jp_sort_entry_t* entry_a = a;
+  const jp_sort_entry_t* entry_b = b;
+
+  int ret = jp_compare_sort_values(entry_a->sort_value, entry_b->sort_value);
+
+  if (0 != ret)
+    return ret;
+
+  /* qsort is not stable, the input order breaks the ties */
+  return (entry_a->position < entry_b->position) ? -1 : (entry_a->position > entry_b->position);
+}
+
+/* a temporary file, removed from the directory right away so that it goes away with its descriptor */
+static FILE* jp_sort_run_file(apr_pool_t *pool,
+                              const char *directory)
+{
+  if (NULL == directory)
+    return tmpfile();
+
+  char* path = apr_pstrcat(pool, directory, "/jp-sort-XXXXXX", NULL);
+  int   fd   = mkstemp(path);
+
+  if (fd < 0) {
+    fprintf(stderr, "jp_sort_run_file: cannot create a run in %s \n", directory);
+    return NULL;
+  }
+
+  unlink(path);
+
+  FILE* file = fdopen(fd, "w+b");
+
+  if (NULL == file)
+    close(fd);
+
+  return file;
+}
+
+static void jp_sort_close_runs(apr_array_header_t *run_files)
+{
+  for (int i = 0; i < run_files->nelts; i++) {
+    FILE** file = & ((FILE**) run_files->elts)[i];
+
+    if (*file)
+      fclose(*file);
+
+    *file = NULL;
+  }
+}
+
+static jp_TLV_records_t* jp_sort_run_make(apr_pool_t *pool)
+{
+  jp_TLV_records_t* run = jp_TLV_record_collection_make(pool);
+
+  jp_enable_string_interning(run, pool);
+
+  return run;
+}
+
+/* sorts the records of a run and writes them to a new run file */
+static int jp_sort_write_run(apr_pool_t         *pool,
+                             jp_TLV_records_t   *run,
+                             const char         *sort_key,
+                             const char         *temporary_directory,
+                             apr_array_header_t *run_files)
+{
+  jp_TLV_record_t** records    = (jp_TLV_record_t**) run->record_list->elts;
+  uint32_t          nb_records = run->record_list->nelts;
+
+  if (0 == nb_records)
+    return 0;
+
+  uint32_t         sort_key_index = (uint32_t) (size_t) apr_hash_get(run->key_index, sort_key, APR_HASH_KEY_STRING);
+  jp_sort_entry_t* entries        = apr_palloc(pool, nb_records * sizeof(jp_sort_entry_t));
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    entries[i].sort_value = jp_sort_value(records[i], sort_key_index);
+    entries[i].position   = i;
+    entries[i].record     = records[i];
+  }
+
+  qsort(entries, nb_records, sizeof(jp_sort_entry_t), jp_compare_sort_entries);
+
+  for (uint32_t i = 0; i < nb_records; i++)
+    records[i] = entries[i].record;
+
+  FILE* run_file = jp_sort_run_file(pool, temporary_directory);
+
+  if (NULL == run_file)
+    return -1;
+
+  *(FILE**) apr_array_push(run_files) = run_file;
+
+  return jp_export_records_to_file_set(run, run_file, NULL);
+}
+
+/* reads the inputs into sorted runs of at most run_budget bytes of records */
+static int jp_sort_write_runs(apr_pool_t         *pool,
+                              FILE* const        *kv_pair_inputs,
+                              FILE* const        *key_index_inputs,
+                              int                 nb_inputs,
+                              const char         *sort_key,
+                              size_t              run_budget,
+                              const char         *temporary_directory,
+                              apr_array_header_t *run_files)
+{
+  apr_pool_t* run_pool;
+  apr_pool_t* input_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& run_pool, pool) ||
+      APR_SUCCESS != apr_pool_create(& input_pool, pool))
+    return -1;
+
+  jp_TLV_records_t* run      = jp_sort_run_make(run_pool);
+  size_t            run_size = 0;
+  int               ret      = 0;
+
+  for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+    jp_key_index_map_t* file_key_index = key_index_inputs ? jp_key_index_map_open(input_pool, key_index_inputs[i])
+                                                          : jp_open_container_key_index(input_pool, kv_pair_inputs[i]);
+    jp_block_reader_t   reader;
+    jp_TLV_record_t*    record;
+
+    if (NULL == file_key_index)
+      ret = -1;
+    else if (0 != jp_block_reader_open(& reader, input_pool, kv_pair_inputs[i]))
+      ret = -1;
+
+    /* the values are sampled by key index on the source, which differs from one file set to the next */
+    jp_string_table_reset_keys(run->string_values);
+    reader.buffer.strings = run->string_values;
+
+    while (0 == ret) {
+      if (run_size >= run_budget && 0 == reader.block_records_left) {
+        ret = jp_sort_write_run(run_pool, run, sort_key, temporary_directory, run_files);
+
+        apr_pool_clear(run_pool);
+
+        run                   = jp_sort_run_make(run_pool);
+        run_size              = 0;
+        reader.buffer.strings = run->string_values;
+
+        continue;
+      }
+
+      int next = jp_block_reader_next_record(& reader, run_pool, & record);
+
+      if (1 != next) {
+        ret = next;
+        break;
+      }
+
+      apr_array_header_t* kv_array = record->kv_pairs_array;
+
+      for (int j = 0; j < kv_array->nelts && 0 == ret; j++) {
+        jp_TLV_kv_pair_t* kv_pair       = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
+        const char*       key_on_source = jp_key_index_map_key(file_key_index, kv_pair->key_index, NULL);
+
+        if (NULL == key_on_source) {
+          fprintf(stderr, "jp_sort_write_runs: unknown key index %u \n", kv_pair->key_index);
+          ret = -1;
+        } else {
+          kv_pair->key_index = jp_find_or_add_key(run->key_index, key_on_source);
+        }
+      }
+
+      jp_add_record_to_TLV_collection(run, record);
+
+      run_size += jp_sort_record_size(record);
+    }
+
+    if (file_key_index) {
+      jp_block_reader_close(& reader);
+      jp_key_index_map_close(file_key_index);
+    }
+
+    apr_pool_clear(input_pool);
+  }
+
+  if (0 == ret)
+    ret = jp_sort_write_run(run_pool, run, sort_key, temporary_directory, run_files);
+
+  apr_pool_destroy(input_pool);
+  apr_pool_destroy(run_pool);
+
+  return ret;
+}
+
+static int jp_sort_cursor_next(jp_sort_cursor_t *cursor)
+{
+  /* the records of the older pool were all written since, and their blocks are over */
+  if (cursor->nb_pool_records >= JP_SORT_CURSOR_RECORDS && 0 == cursor->reader.block_records_left) {
+    cursor->current_pool ^= 1;
+    cursor->nb_pool_records = 0;
+
+    apr_pool_clear(cursor->record_pools[cursor->current_pool]);
+  }
+
+  int ret = jp_block_reader_next_record(& cursor->reader, cursor->record_pools[cursor->current_pool], & cursor->record);
+
+  if (1 != ret)
+    return ret;
+
+  cursor->nb_pool_records++;
+  cursor->sort_value = jp_sort_value(cursor->record, cursor->sort_key_index);
+
+  return 1;
+}
+
+/* the keys of the run are added to the key index written */
+static int jp_sort_cursor_open(apr_pool_t       *pool,
+                               jp_sort_cursor_t *cursor,
+                               FILE             *run_file,
+                               apr_hash_t       *key_index,
+                               const char       *sort_key)
+{
+  rewind(run_file);
+
+  cursor->key_index = jp_open_container_key_index(pool, run_file);
+
+  if (NULL == cursor->key_index)
+    return -1;
+
+  uint32_t nb_keys = jp_key_index_map_count(cursor->key_index);
+
+  cursor->key_map    = apr_palloc(pool, (nb_keys + 1) * sizeof(uint32_t));
+  cursor->key_map[0] = 0;
+
+  for (uint32_t i = 1; i <= nb_keys; i++)
+    cursor->key_map[i] = jp_find_or_add_key(key_index, jp_key_index_map_key(cursor->key_index, i, NULL));
+
+  cursor->sort_key_index = jp_key_index_map_find(cursor->key_index, sort_key);
+
+  if (APR_SUCCESS != apr_pool_create(& cursor->record_pools[0], pool) ||
+      APR_SUCCESS != apr_pool_create(& cursor->record_pools[1], pool))
+    return -1;
+
+  return jp_block_reader_open(& cursor->reader, pool, run_file);
+}
+
+/* the smaller value first, and the earlier run for the same value */
+static inline int jp_sort_cursor_before(const jp_sort_cursor_t *a,
+                                        const jp_sort_cursor_t *b)
+{
+  int ret = jp_compare_sort_values(a->sort_value, b->sort_value);
+
+  return (0 != ret) ? (ret < 0) : (a->run < b->run);
+}
+
+static void jp_sort_heap_down(jp_sort_cursor_t **heap,
+                              int                nb_heap,
+                              int                position)
+{
+  while (1) {
+    int smallest = position;
+    int left     = 2 * position + 1;
+    int right    = left + 1;
+
+    if (left < nb_heap && jp_sort_cursor_before(heap[left], heap[smallest]))
+      smallest = left;
+
+    if (right < nb_heap && jp_sort_cursor_before(heap[right], heap[smallest]))
+      smallest = right;
+
+    if (smallest == position)
+      return;
+
+    jp_sort_cursor_t* cursor = heap[position];
+
+    heap[position] = heap[smallest];
+    heap[smallest] = cursor;
+    position       = smallest;
+  }
+}
+
+/* merges sorted runs into a file set, with the key index and the block filter settings of a collection */
+static int jp_sort_merge_runs(apr_pool_t        *pool,
+                              jp_TLV_records_t  *record_collection,
+                              FILE* const       *run_files,
+                              int                nb_runs,
+                              const char        *sort_key,
+                              FILE              *kv_pair_output,
+                              FILE              *key_index_output)
+{
+  jp_sort_cursor_t*  cursors = apr_pcalloc(pool, (nb_runs + 1) * sizeof(jp_sort_cursor_t));
+  jp_sort_cursor_t** heap    = apr_palloc(pool, (nb_runs + 1) * sizeof(jp_sort_cursor_t*));
+  int                nb_heap = 0;
+  int                nb_open = 0;
+  int                ret     = 0;
+
+  /* a container writes its key index ahead of the records, every run is opened first */
+  for (int i = 0; i < nb_runs && 0 == ret; i++) {
+    cursors[i].run = i;
+
+    if (0 != jp_sort_cursor_open(pool, & cursors[i], run_files[i], record_collection->key_index, sort_key))
+      ret = -1;
+
+    nb_open = (cursors[i].record_pools[1]) ? i + 1 : i;
+  }
+
+  for (int i = 0; i < nb_runs && 0 == ret; i++) {
+    int next = jp_sort_cursor_next(& cursors[i]);
+
+    if (next < 0)
+      ret = -1;
+    else if (1 == next)
+      heap[nb_heap++] = & cursors[i];
+  }
+
+  for (int i = nb_heap / 2 - 1; i >= 0; i--)
+    jp_sort_heap_down(heap, nb_heap, i);
+
+  uint64_t kv_pair_offset = 0;
+
+  if (0 == ret && NULL == key_index_output) {
+    kv_pair_offset = jp_write_container_prelude(record_collection->key_index, kv_pair_output);
+
+    if (0 == kv_pair_offset)
+      ret = -1;
+  }
+
+  apr_pool_t*       writer_pool;
+  jp_block_writer_t writer;
+
+  if (APR_SUCCESS != apr_pool_create(& writer_pool, pool))
+    ret = -1;
+  else if (0 == ret && 0 != jp_block_writer_open(& writer, writer_pool, kv_pair_output, kv_pair_offset))
+    ret = -1;
+
+  if (0 == ret) {
+    jp_TLV_record_t* scratch = jp_TLV_record_make(writer_pool);
+
+    jp_enable_writer_filters(& writer, record_collection);
+
+    while (0 == ret && nb_heap > 0) {
+      jp_sort_cursor_t* cursor = heap[0];
+
+      if (0 != jp_block_writer_add_translated(& writer, cursor->record, cursor->key_map, scratch)) {
+        ret = -1;
+        break;
+      }
+
+      int next = jp_sort_cursor_next(cursor);
+
+      if (next < 0)
+        ret = -1;
+      else if (0 == next)
+        heap[0] = heap[--nb_heap];
+
+      jp_sort_heap_down(heap, nb_heap, 0);
+    }
+
+    if (0 == ret && 0 != jp_block_writer_close(& writer))
+      ret = -1;
+  }
+
+  for (int i = 0; i < nb_open; i++) {
+    jp_block_reader_close(& cursors[i].reader);
+    jp_key_index_map_close(cursors[i].key_index);
+  }
+
+  if (0 == ret && key_index_output)
+    ret = jp_export_key_index_to_file(record_collection->key_index, key_index_output);
+
+  return ret;
+}
+
+int jp_sort_file_sets(jp_TLV_records_t *record_collection,
+                      FILE* const      *kv_pair_inputs,
+                      FILE* const      *key_index_inputs,
+                      int               nb_inputs,
+                      const char       *sort_key,
+                      size_t            memory_budget,
+                      const char       *temporary_directory,
+                      FILE             *kv_pair_output,
+                      FILE             *key_index_output)
+{
+  apr_pool_t* pool;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, apr_hash_pool_get(record_collection->key_index)))
+    return -1;
+
+  /* the reader of the inputs comes out of the budget of the runs, the readers of the runs out of the one of a merge */
+  size_t run_budget = (memory_budget > 2 * JP_SORT_READER_MEMORY) ? memory_budget - JP_SORT_READER_MEMORY : memory_budget / 2;
+  int    fan_in     = memory_budget / JP_SORT_READER_MEMORY;
+
+  if (fan_in < 2)
+    fan_in = 2;
+
+  if (fan_in > JP_SORT_MAX_FAN_IN)
+    fan_in = JP_SORT_MAX_FAN_IN;
+
+  apr_array_header_t* runs = apr_array_make(pool, 64, sizeof(FILE*));
+
+  int ret = jp_sort_write_runs(pool, kv_pair_inputs, key_index_inputs, nb_inputs, sort_key, run_budget, temporary_directory, runs);
+
+  while (0 == ret && runs->nelts > fan_in) {
+    apr_array_header_t* merged = apr_array_make(pool, runs->nelts / fan_in + 1, sizeof(FILE*));
+    FILE**              inputs = (FILE**) runs->elts;
+
+    for (int first = 0; first < runs->nelts && 0 == ret; first += fan_in) {
+      int nb_merged = (runs->nelts - first < fan_in) ? runs->nelts - first : fan_in;
+
+      if (1 == nb_merged) {
+        *(FILE**) apr_array_push(merged) = inputs[first];
+        inputs[first] = NULL;
+        continue;
+      }
+
+      apr_pool_t* merge_pool;
+
+      if (APR_SUCCESS != apr_pool_create(& merge_pool, pool)) {
+        ret = -1;
+        break;
+      }
+
+      FILE* run_file = jp_sort_run_file(merge_pool, temporary_directory);
+
+      if (NULL == run_file) {
+        ret = -1;
+      } else {
+        *(FILE**) apr_array_push(merged) = run_file;
+
+        ret = jp_sort_merge_runs(merge_pool, jp_TLV_record_collection_make(merge_pool), inputs + first, nb_merged,
+                                 sort_key, run_file, NULL);
+      }
+
+      apr_pool_destroy(merge_pool);
+
+      /* the runs merged are removed as soon as they are, the disk holds the records twice at most */
+      for (int i = first; i < first + nb_merged; i++) {
+        fclose(inputs[i]);
+        inputs[i] = NULL;
+      }
+    }
+
+    jp_sort_close_runs(runs);
+
+    runs = merged;
+  }
+
+  if (0 == ret)
+    ret = jp_sort_merge_runs(pool, record_collection, (FILE* const*) runs->elts, runs->nelts, sort_key,
+                             kv_pair_output, key_index_output);
+
+  jp_sort_close_runs(runs);
+
+  apr_pool_destroy(pool);
+
+  return ret;
+}
@@ -0,0 +1,196 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  String values interned while records are built or imported: identical values share a single
+ *  copy, found through an open addressing table of their hashes.
+ *
+ *  The keys whose values hardly ever repeat (request ids, timestamps as strings) would only pay
+ *  for the table entries: every key is sampled over its first JP_STRING_TABLE_SAMPLE values, and
+ *  its values are copied as they are from then on if too few of them were already in the table.
+ */
+
+#define JP_STRING_TABLE_INITIAL_SLOTS  1024
+#define JP_STRING_TABLE_SAMPLE         1024
+#define JP_STRING_TABLE_MIN_HITS       (JP_STRING_TABLE_SAMPLE / 4)
+#define JP_STRING_TABLE_MAX_KEYS       (1 << 20)
+#define JP_STRING_TABLE_KEY_DISABLED   UINT32_MAX
+
+#define JP_STRING_HASH_K1  0x9E3779B97F4A7C15ULL
+#define JP_STRING_HASH_K2  0xC2B2AE3D27D4EB4FULL
+
+typedef struct jp_string_entry
+{
+  const char *value;
+  uint32_t    length;
+  uint32_t    hash;
+} jp_string_entry_t;
+
+typedef struct jp_string_key_stats
+{
+  uint32_t lookups;
+  uint32_t hits;
+} jp_string_key_stats_t;
+
+struct jp_string_table
+{
+  apr_pool_t         *pool;
+  jp_string_entry_t  *slots;
+  uint32_t            mask;
+  uint32_t            count;
+  apr_array_header_t *keys;
+};
+
+static inline uint64_t jp_string_rotl(uint64_t value, int bits)
+{
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/* 8 bytes at a time, most values are short */
+uint32_t jp_string_hash(const char *value,
+                        uint32_t    length)
+{
+  const uint8_t* bytes = (const uint8_t*) value;
+  uint64_t       hash  = JP_STRING_HASH_K2 ^ (length * JP_STRING_HASH_K1);
+  uint64_t       word;
+
+  for (; length >= 8; bytes += 8, length -= 8) {
+    memcpy(& word, bytes, sizeof(uint64_t));
+    hash = jp_string_rotl(hash ^ (word * JP_STRING_HASH_K1), 31) * JP_STRING_HASH_K2;
+  }
+
+  if (length > 0) {
+    word = 0;
+    memcpy(& word, bytes, length);
+    hash = jp_string_rotl(hash ^ (word * JP_STRING_HASH_K1), 31) * JP_STRING_HASH_K2;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+
+  /* 0 stands for a hash not computed */
+  return (0 == (uint32_t) hash) ? 1 : (uint32_t) hash;
+}
+
+jp_string_table_t* jp_string_table_make(apr_pool_t *pool)
+{
+  jp_string_table_t* table = apr_palloc(pool, sizeof(jp_string_table_t));
+
+  table->pool  = pool;
+  table->slots = apr_pcalloc(pool, JP_STRING_TABLE_INITIAL_SLOTS * sizeof(jp_string_entry_t));
+  table->mask  = JP_STRING_TABLE_INITIAL_SLOTS - 1;
+  table->count = 0;
+  table->keys  = apr_array_make(pool, 64, sizeof(jp_string_key_stats_t));
+
+  return table;
+}
+
+void jp_string_table_reset_keys(jp_string_table_t *table)
+{
+  table->keys->nelts = 0;
+}
+
+static void jp_string_table_grow(jp_string_table_t *table)
+{
+  uint32_t           nb_slots = 2 * (table->mask + 1);
+  jp_string_entry_t* slots    = apr_pcalloc(table->pool, nb_slots * sizeof(jp_string_entry_t));
+
+  for (uint32_t i = 0; i <= table->mask; i++) {
+    jp_string_entry_t* entry = & table->slots[i];
+
+    if (NULL == entry->value)
+      continue;
+
+    uint32_t slot = entry->hash & (nb_slots - 1);
+
+    while (slots[slot].value)
+      slot = (slot + 1) & (nb_slots - 1);
+
+    slots[slot] = *entry;
+  }
+
+  /* the old slots stay in the pool, at most as large as the new ones altogether */
+  table->slots = slots;
+  table->mask  = nb_slots - 1;
+}
+
+static char* jp_string_copy(apr_pool_t *pool,
+                            const char *value,
+                            uint32_t    length)
+{
+  char* copy = apr_palloc(pool, (size_t) length + 1);
+
+  memcpy(copy, value, length);
+  copy[length] = '\0';
+
+  return copy;
+}
+
+char* jp_string_table_intern(      jp_string_table_t *table,
+                                   uint32_t           key_index,
+                             const char              *value,
+                                   uint32_t           length,
+                                   uint32_t          *hash)
+{
+  jp_string_key_stats_t* stats = NULL;
+
+  if (key_index < JP_STRING_TABLE_MAX_KEYS) {
+    while (table->keys->nelts <= key_index) {
+      jp_string_key_stats_t* new_stats = apr_array_push(table->keys);
+
+      new_stats->lookups = 0;
+      new_stats->hits    = 0;
+    }
+
+    stats = & ((jp_string_key_stats_t*) table->keys->elts)[key_index];
+
+    if (JP_STRING_TABLE_KEY_DISABLED == stats->lookups) {
+      *hash = 0;
+      return jp_string_copy(table->pool, value, length);
+    }
+  }
+
+  uint32_t value_hash = jp_string_hash(value, length);
+  uint32_t slot       = value_hash & table->mask;
+  int      hit        = 0;
+
+  for (; table->slots[slot].value; slot = (slot + 1) & table->mask) {
+    jp_string_entry_t* entry = & table->slots[slot];
+
+    if (entry->hash == value_hash && entry->length == length && 0 == memcmp(entry->value, value, length)) {
+      hit = 1;
+      break;
+    }
+  }
+
+  const char* interned = table->slots[slot].value;
+
+  if (!hit) {
+    jp_string_entry_t* entry = & table->slots[slot];
+
+    interned      = jp_string_copy(table->pool, value, length);
+    entry->value  = interned;
+    entry->length = length;
+    entry->hash   = value_hash;
+
+    /* at most half full */
+    if (2 * ++table->count > table->mask)
+      jp_string_table_grow(table);
+  }
+
+  if (stats) {
+    stats->hits    += hit;
+    stats->lookups += 1;
+
+    if (JP_STRING_TABLE_SAMPLE == stats->lookups && stats->hits < JP_STRING_TABLE_MIN_HITS)
+      stats->lookups = JP_STRING_TABLE_KEY_DISABLED;
+  }
+
+  *hash = value_hash;
+
+  return (char*) interned;
+}
@@ -17,9 +17,22 @@ jp_TLV_records_t* jp_TLV_record_collection_make(apr_pool_t *pool)
   record_collection->key_index   = apr_hash_make(pool);
   record_collection->record_list = apr_array_make(pool, 1, sizeof(jp_TLV_record_t*));
 
+  record_collection->block_filters     = 0;
+  record_collection->filter_value_keys = NULL;
+  record_collection->string_values     = NULL;
+  record_collection->cluster_window    = 0;
+  record_collection->cluster_key       = NULL;
+  record_collection->keep_order        = 0;
+
   return record_collection;
 }
 
+void jp_enable_string_interning(jp_TLV_records_t *record_collection,
+                                apr_pool_t       *pool)
+{
+  record_collection->string_values = jp_string_table_make(pool);
+}
+
 
 jp_TLV_record_t* jp_TLV_record_make(apr_pool_t *pool)
 {
@@ -62,8 +75,8 @@ size_t jp_find_or_add_key(apr_hash_t       *key_index,
 uint32_t jp_export_uint32_to_buffer(uint32_t        value,
                                     jp_buffer_io_t *buffer)
 {
-  if (jp_buffer_io_bytes_left_to_write(buffer) < sizeof(uint32_t))
-    jp_buffer_io_flush_writes(buffer);
+  if (0 != jp_buffer_io_reserve(buffer, sizeof(uint32_t)))
+    return 0;
 
   jp_buffer_io_memcpy_to(buffer, & value, sizeof(uint32_t));
   return sizeof(uint32_t);
@@ -78,10 +91,37 @@ uint32_t jp_import_uint32_from_buffer(uint32_t       *value,
     }
   }
 
-  jp_buffer_io_memcpy_from(buffer, value, sizeof(uint32_t));
+  if (NULL == jp_buffer_io_memcpy_from(buffer, value, sizeof(uint32_t)))
+    return 0;
+
   return sizeof(uint32_t);
 }
 
+uint32_t jp_export_uint64_to_buffer(uint64_t        value,
+                                    jp_buffer_io_t *buffer)
+{
+  if (0 != jp_buffer_io_reserve(buffer, sizeof(uint64_t)))
+    return 0;
+
+  jp_buffer_io_memcpy_to(buffer, & value, sizeof(uint64_t));
+  return sizeof(uint64_t);
+}
+
+uint32_t jp_import_uint64_from_buffer(uint64_t       *value,
+                                      jp_buffer_io_t *buffer)
+{
+  if (jp_buffer_io_bytes_left_to_read(buffer) < sizeof(uint64_t)) {
+    if (0 != jp_buffer_io_read(buffer)) {
+      return 0;
+    }
+  }
+
+  if (NULL == jp_buffer_io_memcpy_from(buffer, value, sizeof(uint64_t)))
+    return 0;
+
+  return sizeof(uint64_t);
+}
+
 /*
  *  In the current implementation:
  *
@@ -95,9 +135,10 @@ uint32_t jp_import_uint32_from_buffer(uint32_t       *value,
  *
  *  if the type is integer and the 3rd bit is unset, then the record takes 4 extra bytes to store the value
  *
- *  if the type is double and __STDC_IEC_559__ is defined, the record takes 8 extra bytes to store the value
- *  regardless of the 3rd bit, if __STDC_IEC_559__ is not defined we should produce a compilation error as this
- *  case is unaddressed in this implementation
+ *  if the type is double, the 3rd bit and the 5 extra bits hold the code of one of the encodings described in
+ *  jp_double_codec.c, followed by up to 8 extra bytes (code 0, the 8 bytes of the value, was the only one
+ *  before format version 4); __STDC_IEC_559__ must be defined, the other double formats are unaddressed
+ *  in this implementation
  *
  *  if the type is string, and the 3rd bit is unset, then the record takes 4 extra bytes to store the length
  *  interpreted as an uint32_t, and as much extra bytes as the stored length specifies
@@ -107,6 +148,9 @@ uint32_t jp_import_uint32_from_buffer(uint32_t       *value,
  *
  *  if the type is boolean, the 3rd bit is ignored, since a boolean value will always fit in 5 bits.
  *
+ *  in the blocks of format version 5 on, the strings and integers of the keys the block gives an encoding
+ *  hold the code of their dictionary entry or of their delta instead, as described in jp_key_codecs.c
+ *
  */
 
 #ifndef __STDC_IEC_559__
@@ -174,12 +218,29 @@ set_extra_bits(uint8_t* byte, uint32_t value)
 #undef WILL_FIT_MASK_C
 #undef WILL_FIT_SHIFT
 
-uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
-                                               uint32_t        value_type,
-                                               jp_buffer_io_t *buffer)
+static uint32_t jp_export_coded_value(const jp_TLV_union_t  *union_value,
+                                            uint32_t         value_type,
+                                            uint8_t          encoding,
+                                            jp_key_codecs_t *codecs,
+                                            uint32_t         key_index,
+                                            jp_buffer_io_t  *buffer);
+
+/* the doubles of a key may be encoded relative to the previous value of the key, kept in the history, and
+   the strings and integers of a key with one of the encodings of the block as described in jp_key_codecs.c */
+static uint32_t jp_export_value_to_buffer(const jp_TLV_union_t      *union_value,
+                                                uint32_t             value_type,
+                                                jp_double_history_t *doubles,
+                                                jp_key_codecs_t     *codecs,
+                                                uint32_t             key_index,
+                                                jp_buffer_io_t      *buffer)
 {
-  if (jp_buffer_io_bytes_left_to_write(buffer) < 1)
-    jp_buffer_io_flush_writes(buffer);
+  uint8_t encoding = jp_key_codecs_encoding(codecs, key_index, value_type);
+
+  if (JP_ENCODING_INLINE != encoding)
+    return jp_export_coded_value(union_value, value_type, encoding, codecs, key_index, buffer);
+
+  if (0 != jp_buffer_io_reserve(buffer, 1))
+    return 0;
 
   uint8_t descriptor_byte = 0;
   set_type_bits(& descriptor_byte, value_type);
@@ -190,6 +251,9 @@ uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
         double           double_value;
   const jp_TLV_string_t* string_value;
         uint32_t         will_fit;
+        uint8_t          double_code;
+        uint8_t          double_payload[JP_DOUBLE_PAYLOAD_MAX_SIZE];
+        uint32_t         payload_length;
 
   switch(value_type) {
     case JP_TYPE_BOOLEAN:
@@ -213,8 +277,10 @@ uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
 
       required += sizeof(int32_t);
 
-      if (jp_buffer_io_bytes_left_to_write(buffer) < sizeof(int32_t))
-        jp_buffer_io_flush_writes(buffer);
+      if (0 != jp_buffer_io_reserve(buffer, sizeof(int32_t))) {
+        written = 0;
+        break;
+      }
 
       jp_buffer_io_memcpy_to(buffer, & integer_value, sizeof(int32_t));
       written += sizeof(int32_t);
@@ -224,16 +290,22 @@ uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
 
     case JP_TYPE_DOUBLE:
 
+    double_value   = union_value->double_value;
+    payload_length = jp_double_encode(doubles, key_index, double_value, & double_code, double_payload);
+
+    set_will_fit_bit(& descriptor_byte, double_code >> 5);
+    set_extra_bits(& descriptor_byte, double_code);
     jp_buffer_io_memcpy_to(buffer, & descriptor_byte, sizeof(uint8_t));
 
-    required    += sizeof(double);
-    double_value = union_value->double_value;
+    required += payload_length;
 
-    if (jp_buffer_io_bytes_left_to_write(buffer) < sizeof(double))
-      jp_buffer_io_flush_writes(buffer);
+    if (0 != jp_buffer_io_reserve(buffer, payload_length)) {
+      written = 0;
+      break;
+    }
 
-    jp_buffer_io_memcpy_to(buffer, & double_value, sizeof(double));
-    written += sizeof(double);
+    jp_buffer_io_memcpy_to(buffer, double_payload, payload_length);
+    written += payload_length;
 
     break;
 
@@ -252,22 +324,25 @@ uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
 
       required += sizeof(uint32_t);
 
-      if (jp_buffer_io_bytes_left_to_write(buffer) < sizeof(uint32_t))
-        jp_buffer_io_flush_writes(buffer);
+      if (0 != jp_buffer_io_reserve(buffer, sizeof(uint32_t))) {
+        written = 0;
+        break;
+      }
 
       jp_buffer_io_memcpy_to(buffer, & string_value->value_length, sizeof(uint32_t));
       written += sizeof(uint32_t);
     }
 
-    if (buffer->current_size < string_value->value_length) {
-      if (0 != jp_buffer_io_grow(buffer, string_value->value_length)) {
-        written = 0;
-        break;
-      }
+    if (string_value->value_length >= JP_IO_ZERO_COPY_THRESHOLD &&
+        NULL != jp_buffer_io_reference_bytes(buffer, string_value->value_buffer, string_value->value_length)) {
+      written += string_value->value_length;
+      break;
     }
 
-    if (jp_buffer_io_bytes_left_to_write(buffer) < string_value->value_length)
-      jp_buffer_io_flush_writes(buffer);
+    if (0 != jp_buffer_io_reserve(buffer, string_value->value_length)) {
+      written = 0;
+      break;
+    }
 
     jp_buffer_io_memcpy_to(buffer, string_value->value_buffer, string_value->value_length);
     written += string_value->value_length;
@@ -282,23 +357,128 @@ uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
   return written;
 }
 
-uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
-                                           jp_TLV_union_t *union_value,
-                                           uint32_t       *value_type,
-                                           jp_buffer_io_t *buffer)
+uint32_t jp_export_value_union_to_buffer(const jp_TLV_union_t *union_value,
+                                               uint32_t        value_type,
+                                               jp_buffer_io_t *buffer)
+{
+  return jp_export_value_to_buffer(union_value, value_type, NULL, NULL, 0, buffer);
+}
+
+static uint32_t jp_export_coded_value(const jp_TLV_union_t  *union_value,
+                                            uint32_t         value_type,
+                                            uint8_t          encoding,
+                                            jp_key_codecs_t *codecs,
+                                            uint32_t         key_index,
+                                            jp_buffer_io_t  *buffer)
+{
+  uint8_t  descriptor_byte = 0;
+  uint8_t  code;
+  uint8_t  payload[sizeof(int32_t)];
+  uint32_t payload_length  = 0;
+  int      literal         = 0;
+
+  set_type_bits(& descriptor_byte, value_type);
+
+  if (JP_ENCODING_DELTA == encoding) {
+    int32_t* last_integer = jp_key_codecs_last_integer(codecs, key_index);
+    int32_t  delta        = (int32_t) ((uint32_t) union_value->integer_value - (uint32_t) *last_integer);
+    int8_t   narrow8      = delta;
+    int16_t  narrow16     = delta;
+
+    *last_integer  = union_value->integer_value;
+    payload_length = jp_delta_length(delta);
+
+    if (0 == payload_length) {
+      code = delta + JP_DELTA_CODE_BIAS;
+    } else if (sizeof(int8_t) == payload_length) {
+      code = JP_DELTA_CODE_INT8;
+      memcpy(payload, & narrow8, sizeof(int8_t));
+    } else if (sizeof(int16_t) == payload_length) {
+      code = JP_DELTA_CODE_INT16;
+      memcpy(payload, & narrow16, sizeof(int16_t));
+    } else {
+      code = JP_DELTA_CODE_INT32;
+      memcpy(payload, & delta, sizeof(int32_t));
+    }
+  } else {
+    uint32_t entry;
+
+    if (!jp_key_codecs_find(codecs, key_index, union_value, value_type, & entry)) {
+      code    = JP_DICTIONARY_CODE_LITERAL;
+      literal = 1;
+    } else if (entry < JP_DICTIONARY_CODE_ENTRY16) {
+      code = entry;
+    } else {
+      uint16_t narrow = entry;
+
+      code           = JP_DICTIONARY_CODE_ENTRY16;
+      payload_length = sizeof(uint16_t);
+      memcpy(payload, & narrow, sizeof(uint16_t));
+    }
+  }
+
+  set_will_fit_bit(& descriptor_byte, code >> 5);
+  set_extra_bits(& descriptor_byte, code);
+
+  if (0 != jp_buffer_io_reserve(buffer, 1 + payload_length))
+    return 0;
+
+  jp_buffer_io_memcpy_to(buffer, & descriptor_byte, sizeof(uint8_t));
+  jp_buffer_io_memcpy_to(buffer, payload, payload_length);
+
+  uint32_t written = 1 + payload_length;
+
+  if (literal) {
+    uint32_t literal_written = jp_export_value_to_buffer(union_value, value_type, NULL, NULL, key_index, buffer);
+
+    if (0 == literal_written)
+      return 0;
+
+    written += literal_written;
+  }
+
+  return written;
+}
+
+static uint32_t jp_import_coded_value(apr_pool_t      *pool,
+                                      jp_TLV_union_t  *union_value,
+                                      uint32_t         value_type,
+                                      uint8_t          descriptor_byte,
+                                      uint8_t          encoding,
+                                      jp_key_codecs_t *codecs,
+                                      uint32_t         key_index,
+                                      jp_buffer_io_t  *buffer);
+
+static uint32_t jp_import_value_from_buffer(apr_pool_t          *pool,
+                                            jp_TLV_union_t      *union_value,
+                                            uint32_t            *value_type,
+                                            jp_double_history_t *doubles,
+                                            jp_key_codecs_t     *codecs,
+                                            uint32_t             key_index,
+                                            jp_buffer_io_t      *buffer)
 {
   if (jp_buffer_io_bytes_left_to_read(buffer) < 1)
     jp_buffer_io_read(buffer);
 
   uint8_t descriptor_byte;
-  jp_buffer_io_memcpy_from(buffer, & descriptor_byte, 1);
+
+  if (NULL == jp_buffer_io_memcpy_from(buffer, & descriptor_byte, 1))
+    return 0;
 
   uint32_t read     = 1;
   uint32_t required = 1;
 
   *value_type = get_type_bits(descriptor_byte);
 
+  uint8_t encoding = jp_key_codecs_encoding(codecs, key_index, *value_type);
+
+  if (JP_ENCODING_INLINE != encoding)
+    return jp_import_coded_value(pool, union_value, *value_type, descriptor_byte, encoding, codecs, key_index, buffer);
+
   jp_TLV_string_t* string_value;
+  uint8_t          double_code;
+  uint8_t          double_payload[JP_DOUBLE_PAYLOAD_MAX_SIZE];
+  int              payload_length;
 
   switch (*value_type) {
     case JP_TYPE_BOOLEAN:
@@ -319,7 +499,11 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
         jp_buffer_io_read(buffer);
 
       //memcpy(& union_value->integer_value, buffer + read, sizeof(int32_t));
-      jp_buffer_io_memcpy_from(buffer, & union_value->integer_value, sizeof(int32_t));
+      if (NULL == jp_buffer_io_memcpy_from(buffer, & union_value->integer_value, sizeof(int32_t))) {
+        read = 0;
+        break;
+      }
+
       read += sizeof(int32_t);
     }
 
@@ -327,14 +511,26 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
 
     case JP_TYPE_DOUBLE:
 
-    required += sizeof(double);
+    double_code    = (get_will_fit_bit(descriptor_byte) ? 32 : 0) | get_extra_bits(descriptor_byte);
+    payload_length = jp_double_payload_length(double_code);
+
+    if (payload_length < 0) {
+      read = 0;
+      break;
+    }
 
-    if (jp_buffer_io_bytes_left_to_read(buffer) < sizeof(double))
+    required += payload_length;
+
+    if (jp_buffer_io_bytes_left_to_read(buffer) < payload_length)
       jp_buffer_io_read(buffer);
 
-    //memcpy(& union_value->double_value, buffer + read, sizeof(double));
-    jp_buffer_io_memcpy_from(buffer, & union_value->double_value, sizeof(double));
-    read += sizeof(double);
+    if (NULL == jp_buffer_io_memcpy_from(buffer, double_payload, payload_length) ||
+        0 != jp_double_decode(doubles, key_index, double_code, double_payload, & union_value->double_value)) {
+      read = 0;
+      break;
+    }
+
+    read += payload_length;
 
     break;
 
@@ -351,7 +547,11 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
         jp_buffer_io_read(buffer);
 
       //memcpy(& string_value->value_length, buffer + read, sizeof(uint32_t));
-      jp_buffer_io_memcpy_from(buffer, & string_value->value_length, sizeof(uint32_t));
+      if (NULL == jp_buffer_io_memcpy_from(buffer, & string_value->value_length, sizeof(uint32_t))) {
+        read = 0;
+        break;
+      }
+
       read += sizeof(uint32_t);
     }
 
@@ -367,8 +567,24 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
     if (jp_buffer_io_bytes_left_to_read(buffer) < string_value->value_length)
         jp_buffer_io_read(buffer);
 
-    string_value->value_buffer = apr_pmemdup(pool, jp_buffer_io_use_available_bytes(buffer, string_value->value_length), string_value->value_length + 1);
-    string_value->value_buffer[string_value->value_length] = '\0';
+    const uint8_t* string_bytes = jp_buffer_io_use_available_bytes(buffer, string_value->value_length);
+
+    /* a truncated string */
+    if (NULL == string_bytes) {
+      read = 0;
+      break;
+    }
+
+    if (buffer->strings) {
+      string_value->value_buffer = jp_string_table_intern(buffer->strings, key_index, (const char*) string_bytes,
+                                                          string_value->value_length, & string_value->value_hash);
+    } else {
+      string_value->value_buffer = apr_palloc(pool, string_value->value_length + 1);
+      string_value->value_hash   = 0;
+      memcpy(string_value->value_buffer, string_bytes, string_value->value_length);
+      string_value->value_buffer[string_value->value_length] = '\0';
+    }
+
     read += string_value->value_length;
 
     break;
@@ -381,6 +597,182 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
   return read;
 }
 
+uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
+                                           jp_TLV_union_t *union_value,
+                                           uint32_t       *value_type,
+                                           jp_buffer_io_t *buffer)
+{
+  return jp_import_value_from_buffer(pool, union_value, value_type, NULL, NULL, 0, buffer);
+}
+
+static uint32_t jp_import_coded_value(apr_pool_t      *pool,
+                                      jp_TLV_union_t  *union_value,
+                                      uint32_t         value_type,
+                                      uint8_t          descriptor_byte,
+                                      uint8_t          encoding,
+                                      jp_key_codecs_t *codecs,
+                                      uint32_t         key_index,
+                                      jp_buffer_io_t  *buffer)
+{
+  uint8_t  code           = (get_will_fit_bit(descriptor_byte) ? 32 : 0) | get_extra_bits(descriptor_byte);
+  uint32_t payload_length = 0;
+  uint8_t  payload[sizeof(int32_t)];
+
+  if (JP_ENCODING_DELTA == encoding) {
+    if (code > JP_DELTA_CODE_INT32)
+      return 0;
+
+    if (code >= JP_DELTA_CODE_INT8)
+      payload_length = (JP_DELTA_CODE_INT8 == code) ? sizeof(int8_t) : (JP_DELTA_CODE_INT16 == code) ? sizeof(int16_t) : sizeof(int32_t);
+  } else if (JP_DICTIONARY_CODE_ENTRY16 == code) {
+    payload_length = sizeof(uint16_t);
+  }
+
+  if (jp_buffer_io_bytes_left_to_read(buffer) < payload_length)
+    jp_buffer_io_read(buffer);
+
+  if (payload_length > 0 && NULL == jp_buffer_io_memcpy_from(buffer, payload, payload_length))
+    return 0;
+
+  uint32_t read = 1 + payload_length;
+
+  if (JP_ENCODING_DELTA == encoding) {
+    int32_t* last_integer = jp_key_codecs_last_integer(codecs, key_index);
+    int32_t  delta;
+    int8_t   narrow8;
+    int16_t  narrow16;
+
+    if (0 == payload_length) {
+      delta = (int32_t) code - JP_DELTA_CODE_BIAS;
+    } else if (sizeof(int8_t) == payload_length) {
+      memcpy(& narrow8, payload, sizeof(int8_t));
+      delta = narrow8;
+    } else if (sizeof(int16_t) == payload_length) {
+      memcpy(& narrow16, payload, sizeof(int16_t));
+      delta = narrow16;
+    } else {
+      memcpy(& delta, payload, sizeof(int32_t));
+    }
+
+    union_value->integer_value = (int32_t) ((uint32_t) *last_integer + (uint32_t) delta);
+    *last_integer              = union_value->integer_value;
+
+    return read;
+  }
+
+  if (JP_DICTIONARY_CODE_LITERAL == code) {
+    uint32_t literal_type;
+    uint32_t literal_read = jp_import_value_from_buffer(pool, union_value, & literal_type, NULL, NULL, key_index, buffer);
+
+    if (0 == literal_read || literal_type != value_type)
+      return 0;
+
+    jp_key_codecs_add(codecs, key_index, union_value, value_type);
+
+    return read + literal_read;
+  }
+
+  uint32_t entry = code;
+
+  if (JP_DICTIONARY_CODE_ENTRY16 == code) {
+    uint16_t narrow;
+
+    memcpy(& narrow, payload, sizeof(uint16_t));
+    entry = narrow;
+  }
+
+  /* the records of the block share the value */
+  const jp_TLV_union_t* value = jp_key_codecs_entry(codecs, key_index, entry);
+
+  if (NULL == value)
+    return 0;
+
+  *union_value = *value;
+
+  return read;
+}
+
+uint32_t jp_measure_value(const uint8_t   *data,
+                                size_t     size,
+                          jp_key_codecs_t *codecs,
+                          uint32_t         key_index)
+{
+  if (size < 1)
+    return 0;
+
+  uint8_t  descriptor_byte = data[0];
+  uint32_t value_type      = get_type_bits(descriptor_byte);
+  uint8_t  encoding        = jp_key_codecs_encoding(codecs, key_index, value_type);
+  uint8_t  code            = (get_will_fit_bit(descriptor_byte) ? 32 : 0) | get_extra_bits(descriptor_byte);
+  uint64_t length          = 1;
+  uint32_t string_length;
+  int      payload_length;
+
+  if (JP_ENCODING_DELTA == encoding) {
+    if (code > JP_DELTA_CODE_INT32)
+      return 0;
+
+    if (code >= JP_DELTA_CODE_INT8)
+      length += (JP_DELTA_CODE_INT8 == code) ? sizeof(int8_t) : (JP_DELTA_CODE_INT16 == code) ? sizeof(int16_t) : sizeof(int32_t);
+
+  } else if (JP_ENCODING_INLINE != encoding) {
+    if (JP_DICTIONARY_CODE_ENTRY16 == code)
+      length += sizeof(uint16_t);
+
+    /* the first occurrence of a value in the block follows its code inline */
+    if (JP_DICTIONARY_CODE_LITERAL == code) {
+      uint32_t literal_length = jp_measure_value(data + 1, size - 1, NULL, key_index);
+
+      if (0 == literal_length || get_type_bits(data[1]) != value_type)
+        return 0;
+
+      length += literal_length;
+    }
+
+  } else {
+    switch (value_type) {
+      case JP_TYPE_BOOLEAN:
+      break;
+
+      case JP_TYPE_INTEGER:
+
+      if (!get_will_fit_bit(descriptor_byte))
+        length += sizeof(int32_t);
+
+      break;
+
+      case JP_TYPE_DOUBLE:
+
+      payload_length = jp_double_payload_length(code);
+
+      if (payload_length < 0)
+        return 0;
+
+      length += payload_length;
+
+      break;
+
+      default:
+
+      if (get_will_fit_bit(descriptor_byte)) {
+        string_length = get_extra_bits(descriptor_byte);
+      } else {
+        if (size < 1 + sizeof(uint32_t))
+          return 0;
+
+        memcpy(& string_length, data + 1, sizeof(uint32_t));
+        length += sizeof(uint32_t);
+      }
+
+      length += string_length;
+
+      break;
+    }
+  }
+
+  return (length <= size) ? (uint32_t) length : 0;
+}
+
 #undef EXTRA_BITS_MASK
 #undef EXTRA_BITS_MASK_C
 
@@ -407,13 +799,58 @@ int jp_add_string_kv_pair_to_record(jp_TLV_record_t *record,
 {
   jp_TLV_kv_pair_t* kv_pair = apr_array_push(record->kv_pairs_array);
   apr_pool_t*       pool    = record->kv_pairs_array->pool;
+  size_t            length  = strlen(value);
+
+  kv_pair->key_index  = key_index;
+  kv_pair->value_type = JP_TYPE_STRING;
+
+  jp_TLV_string_t* string_value = & kv_pair->union_v.string_value;
+  string_value->value_buffer    = apr_pmemdup(pool, value, length + 1);
+  string_value->value_length    = length;
+  string_value->value_hash      = 0;
+
+  return 0;
+}
+
+static void jp_add_string_table_kv_pair_to_record(      jp_TLV_record_t   *record,
+                                                        size_t             key_index,
+                                                        jp_string_table_t *strings,
+                                                  const char              *value,
+                                                        uint32_t           length)
+{
+  jp_TLV_kv_pair_t* kv_pair = apr_array_push(record->kv_pairs_array);
 
   kv_pair->key_index  = key_index;
   kv_pair->value_type = JP_TYPE_STRING;
 
   jp_TLV_string_t* string_value = & kv_pair->union_v.string_value;
-  string_value->value_buffer    = apr_pmemdup(pool, value, strlen(value) + 1);
-  string_value->value_length    = strlen(value);
+  string_value->value_length    = length;
+  string_value->value_buffer    = jp_string_table_intern(strings, key_index, value, length, & string_value->value_hash);
+}
+
+int jp_add_interned_string_kv_pair_to_record(jp_TLV_records_t *record_collection,
+                                             jp_TLV_record_t  *record,
+                                             size_t            key_index,
+                                             const char       *value,
+                                             uint32_t          length)
+{
+  if (record_collection->string_values) {
+    jp_add_string_table_kv_pair_to_record(record, key_index, record_collection->string_values, value, length);
+    return 0;
+  }
+
+  jp_TLV_kv_pair_t* kv_pair = apr_array_push(record->kv_pairs_array);
+  char*             copy    = apr_palloc(record->kv_pairs_array->pool, (size_t) length + 1);
+
+  memcpy(copy, value, length);
+  copy[length] = '\0';
+
+  kv_pair->key_index  = key_index;
+  kv_pair->value_type = JP_TYPE_STRING;
+
+  kv_pair->union_v.string_value.value_buffer = copy;
+  kv_pair->union_v.string_value.value_length = length;
+  kv_pair->union_v.string_value.value_hash   = 0;
 
   return 0;
 }
@@ -501,7 +938,8 @@ uint32_t jp_export_kv_pair_to_buffer(jp_TLV_kv_pair_t *kv_pair,
   if (0 == k_written)
     return 0;
 
-  uint32_t v_written = jp_export_value_union_to_buffer(& kv_pair->union_v, kv_pair->value_type, buffer);
+  uint32_t v_written = jp_export_value_to_buffer(& kv_pair->union_v, kv_pair->value_type, buffer->doubles, buffer->codecs,
+                                                 kv_pair->key_index, buffer);
 
   if (0 == v_written)
     return 0;
@@ -528,7 +966,8 @@ uint32_t jp_import_kv_pair_from_buffer(apr_pool_t       *pool,
   if (0 == k_read)
     return 0;
 
-  uint32_t v_read = jp_import_value_union_from_buffer(pool, & kv_pair->union_v, & kv_pair->value_type, buffer);
+  uint32_t v_read = jp_import_value_from_buffer(pool, & kv_pair->union_v, & kv_pair->value_type, buffer->doubles, buffer->codecs,
+                                                kv_pair->key_index, buffer);
 
   if (0 == v_read)
     return 0;
@@ -635,6 +1074,7 @@ typedef struct jp_TLV_record_builder
   const json_object *jso;
   jp_TLV_record_t   *tlv_record;
   apr_hash_t        *key_index;
+  jp_string_table_t *strings;
 
 } jp_TLV_record_builder_t;
 
@@ -666,7 +1106,11 @@ static int json_record_builder_visitor(json_object *jso,
       jp_add_integer_kv_pair_to_record(builder->tlv_record, key_index, json_object_get_int(jso));
       break;
   	  case json_type_string:
-      jp_add_string_kv_pair_to_record(builder->tlv_record, key_index, json_object_get_string(jso));
+      if (builder->strings)
+        jp_add_string_table_kv_pair_to_record(builder->tlv_record, key_index, builder->strings,
+                                              json_object_get_string(jso), json_object_get_string_len(jso));
+      else
+        jp_add_string_kv_pair_to_record(builder->tlv_record, key_index, json_object_get_string(jso));
       break;
 
       default:
@@ -686,6 +1130,7 @@ int jp_update_records_from_json(apr_pool_t       *pool,
   builder.jso         = jso;
   builder.tlv_record  = jp_TLV_record_make(pool);
   builder.key_index   = record_collection->key_index;
+  builder.strings     = record_collection->string_values;
 
   json_c_visit(jso, 0, json_record_builder_visitor, & builder);
   jp_add_record_to_TLV_collection(record_collection, builder.tlv_record);
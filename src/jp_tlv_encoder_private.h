@@ -3,6 +3,28 @@
 
 
 #define JP_IO_HELPER_BUFFER_SIZE 4096
+
+#define JP_PREFETCH_CHUNK_SIZE   (1 << 20)
+#define JP_PREFETCH_NB_CHUNKS    4
+#define JP_PREFETCH_WINDOW_SIZE  (64 * 1024)
+
+/* strings at least this long are referenced in place instead of copied into the buffer */
+#define JP_IO_ZERO_COPY_THRESHOLD 1024
+#define JP_IO_MAX_SEGMENTS        64
+
+typedef struct jp_prefetch_reader jp_prefetch_reader_t;
+
+typedef struct jp_buffer_io_segment
+{
+  const uint8_t *external;
+  size_t         offset;
+  size_t         length;
+
+} jp_buffer_io_segment_t;
+
+typedef struct jp_double_history jp_double_history_t;
+typedef struct jp_key_codecs jp_key_codecs_t;
+
 typedef struct jp_buffer_io
 {
   size_t      used;
@@ -15,8 +37,62 @@ typedef struct jp_buffer_io
   apr_pool_t *pool;
   int         read_mode;
 
+  jp_prefetch_reader_t *prefetch;
+
+  jp_buffer_io_segment_t segments[JP_IO_MAX_SEGMENTS];
+  int                    nb_segments;
+  size_t                 segment_start;
+
+  int                    defer_flush;
+  int                    no_references; /* the memory written may not outlive the call, it is always copied */
+  jp_double_history_t   *doubles;       /* the last double of every key in the block, NULL outside of blocks */
+  jp_string_table_t     *strings;       /* the table string values are interned to when read, NULL to copy them */
+  jp_key_codecs_t       *codecs;        /* the encodings of the keys in the block, NULL to write every value inline */
+  uint64_t               flushed_bytes;
+  int                    write_error;   /* set once a flush failed to reach the stream, the output is incomplete */
+
 } jp_buffer_io_t;
 
+/**
+ * Starts a read-ahead thread that keeps a ring of large buffers filled from a stream
+ *
+ * @param pool    A memory pool, the ring is allocated in a subpool released by jp_prefetch_reader_stop
+ * @param stream  An input file stream, it must not be read by anyone else until the reader is stopped
+ *
+ * @returns A pointer to the new reader, NULL if the thread could not be started
+ */
+jp_prefetch_reader_t* jp_prefetch_reader_start(apr_pool_t *pool,
+                                               FILE       *stream);
+
+/**
+ * Copies prefetched bytes, only blocking if the read-ahead thread has not caught up yet
+ *
+ * @param reader  The prefetch reader
+ * @param dest    Pointer to the memory destination
+ * @param size    bytes to copy
+ *
+ * @returns bytes copied, less than size only at the end of the stream
+ */
+size_t jp_prefetch_reader_read(jp_prefetch_reader_t *reader,
+                               uint8_t              *dest,
+                               size_t                size);
+
+/**
+ * Checks whether all the bytes of the stream have been consumed
+ *
+ * @param reader  The prefetch reader
+ *
+ * @returns non-zero if the stream is exhausted
+ */
+int jp_prefetch_reader_eof(jp_prefetch_reader_t *reader);
+
+/**
+ * Stops the read-ahead thread and releases the ring buffers
+ *
+ * @param reader  The prefetch reader
+ */
+void jp_prefetch_reader_stop(jp_prefetch_reader_t *reader);
+
 /**
  * Initializes an instance of the I/O buffer for reading
  *
@@ -28,6 +104,26 @@ void jp_buffer_io_read_initialize(jp_buffer_io_t *buffer,
                                   apr_pool_t     *pool,
                                   FILE           *file);
 
+/**
+ * Initializes an instance of the I/O buffer for reading through a read-ahead thread
+ *
+ * @param buffer  A pointer to the buffer
+ * @param pool    A memory pool
+ * @param file    An input file stream
+ *
+ * @remarks falls back to plain reads if the thread cannot be started, jp_buffer_io_release must be called when done
+ */
+void jp_buffer_io_read_initialize_prefetch(jp_buffer_io_t *buffer,
+                                           apr_pool_t     *pool,
+                                           FILE           *file);
+
+/**
+ * Releases the resources held by an I/O buffer, such as a read-ahead thread
+ *
+ * @param buffer  A pointer to the buffer
+ */
+void jp_buffer_io_release(jp_buffer_io_t *buffer);
+
 /**
  * Initializes an instance of the I/O buffer for writing
  *
@@ -62,6 +158,19 @@ void jp_buffer_io_initialize_static(jp_buffer_io_t *buffer,
 int jp_buffer_io_grow(jp_buffer_io_t *buffer,
                       size_t          not_less_than);
 
+/**
+ * Makes room for a number of bytes to be written
+ *
+ * @param buffer  A pointer to the buffer
+ * @param size    The number of bytes about to be written
+ *
+ * @returns zero if the bytes fit in the buffer, non-zero otherwise
+ *
+ * @remarks pending bytes are flushed to the stream first, unless defer_flush is set, in which case the buffer grows instead
+ */
+int jp_buffer_io_reserve(jp_buffer_io_t *buffer,
+                         size_t          size);
+
 /**
  * Used a block of available bytes from the buffer
  *
@@ -86,6 +195,21 @@ void* jp_buffer_io_memcpy_to(      jp_buffer_io_t *buffer,
                              const void           *src,
                                    size_t          size);
 
+/**
+ * Queues a block of memory to be written in place, after the bytes already in the buffer
+ *
+ * @param buffer  A pointer to the buffer
+ * @param src     Pointer to the memory to write, it must stay valid until the next flush
+ * @param size    bytes to write
+ *
+ * @returns src if the bytes were queued, NULL if the buffer is not backed by a stream or no more blocks can be queued before a flush
+ *
+ * @remarks queued blocks are written together with the buffer contents with a single writev on the stream descriptor
+ */
+const void* jp_buffer_io_reference_bytes(      jp_buffer_io_t *buffer,
+                                         const void           *src,
+                                               size_t          size);
+
 /**
  * A bounds checked memcpy that copies from next available buffer byte
  *
@@ -112,9 +236,33 @@ int jp_buffer_io_bytes_left_to_write(jp_buffer_io_t *buffer);
  * Flushes any pending writes to the I/O stream
  *
  * @param buffer  A pointer to the buffer
+ *
+ * @remarks A write that fails (a full disk...) sets write_error, which the writers check once done
  */
 void jp_buffer_io_flush_writes(jp_buffer_io_t *buffer);
 
+/**
+ * Makes a number of unread bytes available contiguously in the buffer, reading and growing it as needed
+ *
+ * @param buffer  A pointer to the buffer
+ * @param size    bytes needed
+ *
+ * @returns zero if the bytes are available, non-zero if the stream ended first
+ */
+int jp_buffer_io_ensure_readable(jp_buffer_io_t *buffer,
+                                 size_t          size);
+
+/**
+ * Consumes bytes without copying them, reading from the stream as needed
+ *
+ * @param buffer  A pointer to the buffer
+ * @param size    bytes to skip
+ *
+ * @returns zero if the bytes were skipped, non-zero if the stream ended first
+ */
+int jp_buffer_io_skip_bytes(jp_buffer_io_t *buffer,
+                            size_t          size);
+
 /**
  * Gets remaining unread bytes in the buffer
  *
@@ -155,6 +303,28 @@ uint32_t jp_export_uint32_to_buffer(uint32_t        value,
 uint32_t jp_import_uint32_from_buffer(uint32_t       *value,
                                       jp_buffer_io_t *buffer);
 
+/**
+ *  Exports a uint64_t to a buffer
+ *
+ *  @param value   The uint64_t to export
+ *  @param buffer  A pointer to the I/O buffer
+ *
+ * @returns bytes written to the buffer
+ */
+uint32_t jp_export_uint64_to_buffer(uint64_t        value,
+                                    jp_buffer_io_t *buffer);
+
+/**
+ *  Imports a uint64_t from a buffer
+ *
+ *  @param value   The uint64_t to write
+ *  @param buffer  A pointer to the I/O buffer
+ *
+ * @returns bytes read from the buffer
+ */
+uint32_t jp_import_uint64_from_buffer(uint64_t       *value,
+                                      jp_buffer_io_t *buffer);
+
 /**
  *  Exports a TLV value union to a buffer
  *
@@ -183,6 +353,21 @@ uint32_t jp_import_value_union_from_buffer(apr_pool_t     *pool,
                                            uint32_t       *value_type,
                                            jp_buffer_io_t *buffer);
 
+/**
+ *  Measures an encoded value without decoding it, from its descriptor byte and the encoding of its key
+ *
+ *  @param data       The encoded value
+ *  @param size       The bytes available from data
+ *  @param codecs     The encodings of the keys of the block, NULL if every value is inline
+ *  @param key_index  The key of the value, as numbered in the block
+ *
+ *  @returns the length of the value, 0 if it is malformed or truncated
+ */
+uint32_t jp_measure_value(const uint8_t   *data,
+                                size_t     size,
+                          jp_key_codecs_t *codecs,
+                          uint32_t         key_index);
+
 
 /**
  *  Exports a TLV record key-value pair to a buffer
@@ -232,3 +417,1117 @@ uint32_t jp_export_record_to_buffer(const jp_TLV_record_t *record,
 uint32_t jp_import_record_from_buffer(apr_pool_t       *pool,
                                       jp_TLV_record_t **record,
                                       jp_buffer_io_t  *buffer);
+
+
+/**
+ *  Creates an empty table of interned strings
+ *
+ *  @param pool  A memory pool, for the table and the strings
+ *
+ *  @returns the table
+ */
+jp_string_table_t* jp_string_table_make(apr_pool_t *pool);
+
+/**
+ *  Interns a string value, unless its key was found to hardly ever repeat its values
+ *
+ *  @param table      The table
+ *  @param key_index  The key of the value
+ *  @param value      The value, not necessarily NUL terminated
+ *  @param length     The value length
+ *  @param hash       Set to the hash of the value, 0 if it was copied without being interned
+ *
+ * @returns the interned copy of the value, NUL terminated
+ */
+char* jp_string_table_intern(      jp_string_table_t *table,
+                                   uint32_t           key_index,
+                             const char              *value,
+                                   uint32_t           length,
+                                   uint32_t          *hash);
+
+/**
+ *  Forgets the statistics of the keys, when the key indices change meaning
+ */
+void jp_string_table_reset_keys(jp_string_table_t *table);
+
+/**
+ *  @returns the non-zero hash of a string value, as in jp_TLV_string_t
+ */
+uint32_t jp_string_hash(const char *value,
+                        uint32_t    length);
+
+/*
+ *  Double sub-encodings, described in jp_double_codec.c, the code is stored in the low 6 bits of the descriptor
+ */
+#define JP_DOUBLE_CODE_RAW     0
+#define JP_DOUBLE_CODE_INT8    1
+#define JP_DOUBLE_CODE_INT16   2
+#define JP_DOUBLE_CODE_INT32   3
+#define JP_DOUBLE_CODE_FLOAT   4
+#define JP_DOUBLE_CODE_REPEAT  5
+#define JP_DOUBLE_CODE_XOR     8  /* to 14, for 1 to 7 bytes */
+#define JP_DOUBLE_CODE_SMALL   32 /* to 63, for the values 0 to 31 */
+
+#define JP_DOUBLE_PAYLOAD_MAX_SIZE  sizeof(double)
+
+/**
+ *  Creates the record of the last double of every key, used by the block readers and writers
+ *
+ *  @param pool  A memory pool
+ *
+ *  @returns the history, empty
+ */
+jp_double_history_t* jp_double_history_make(apr_pool_t *pool);
+
+/**
+ *  Forgets the previous values, at the start of every block
+ */
+void jp_double_history_reset(jp_double_history_t *history);
+
+/**
+ *  Picks the shortest exact encoding of a double, and records it as the last value of its key
+ *
+ *  @param history    The last doubles of the keys in the block, NULL outside of blocks
+ *  @param key_index  The key of the value
+ *  @param value      The value
+ *  @param code       Set to the encoding code
+ *  @param payload    Set to the payload, JP_DOUBLE_PAYLOAD_MAX_SIZE bytes at most
+ *
+ * @returns the payload length
+ */
+uint32_t jp_double_encode(jp_double_history_t *history,
+                          uint32_t             key_index,
+                          double               value,
+                          uint8_t             *code,
+                          uint8_t             *payload);
+
+/**
+ *  @returns the payload length of an encoding code, -1 if the code is unknown
+ */
+int jp_double_payload_length(uint8_t code);
+
+/**
+ *  Decodes a double, and records it as the last value of its key
+ *
+ *  @param history    The last doubles of the keys in the block, NULL outside of blocks
+ *  @param key_index  The key of the value
+ *  @param code       The encoding code
+ *  @param payload    The payload, of the length given by jp_double_payload_length
+ *  @param value      Set to the value
+ *
+ * @returns zero if succeeded, non-zero if the code is unknown or refers to a value never seen
+ */
+int jp_double_decode(      jp_double_history_t *history,
+                           uint32_t             key_index,
+                           uint8_t              code,
+                     const uint8_t             *payload,
+                           double              *value);
+
+/*
+ *  kv-pair file framing, the layout is described in jp_block_encoder.c
+ */
+#define JP_KV_PAIR_MAGIC           0x564B504A /* "JPKV" */
+#define JP_KV_PAIR_FORMAT_VERSION  5
+#define JP_BLOCK_TAG               0x4B42504A /* "JPBK" */
+#define JP_FOOTER_TAG              0x5446504A /* "JPFT" */
+
+#define JP_BLOCK_TARGET_SIZE       (64 * 1024)
+#define JP_BLOCK_HEADER_SIZE       (4 * sizeof(uint32_t))
+#define JP_BLOCK_INDEX_ENTRY_SIZE  (sizeof(uint64_t) + 2 * sizeof(uint32_t))
+#define JP_TRAILER_SIZE            (sizeof(uint64_t) + sizeof(uint32_t))
+
+/* block flags */
+#define JP_BLOCK_FLAG_CRC32C       0x1 /* the payload is followed by its uint32 CRC32C */
+#define JP_BLOCK_FLAG_FILTER       0x2 /* the block ends with its Bloom filter, see jp_block_filter.c */
+#define JP_BLOCK_FLAG_ZONE_MAP     0x4 /* followed by the numeric ranges of the block, see jp_block_zone_map.c */
+#define JP_BLOCK_FLAG_ORDER        0x8 /* the checksum is followed by the arrival order of the records, see jp_record_order.c */
+#define JP_BLOCK_FLAG_ENCODINGS    0x10 /* then by the encodings of the keys, see jp_key_codecs.c */
+
+#define JP_BLOCK_CRC_SIZE          sizeof(uint32_t)
+
+/**
+ *  Extends a CRC32C (Castagnoli) checksum, with the SSE4.2 instruction when the CPU has it
+ *
+ *  @param crc     The checksum of the previous bytes, 0 to start
+ *  @param data    The bytes to add
+ *  @param length  The number of bytes
+ *
+ * @returns the checksum
+ */
+uint32_t jp_crc32c(uint32_t    crc,
+                   const void *data,
+                   size_t      length);
+
+#define JP_DOUBLE_TEXT_SIZE        32
+
+/**
+ *  Formats a double with the fewest digits reading back as the same value, as a JSON number
+ *
+ *  @param out    At least JP_DOUBLE_TEXT_SIZE bytes, not NUL terminated
+ *  @param value  The value, infinities and NaN are written as null
+ *
+ * @returns the number of bytes written
+ */
+size_t jp_format_double(char   *out,
+                        double  value);
+
+typedef struct jp_block_index_entry
+{
+  uint64_t offset;
+  uint32_t nb_records;
+  uint32_t length;
+
+} jp_block_index_entry_t;
+
+typedef struct jp_block_writer
+{
+  jp_buffer_io_t      buffer;
+  apr_pool_t         *pool;
+  apr_array_header_t *block_index;
+  uint64_t            base_offset;
+  uint64_t            nb_records;
+  uint64_t            block_offset;
+  size_t              header_offset;
+  uint32_t            block_records;
+  uint32_t            block_length;
+  int                 block_open;
+  int                 appending;
+
+  int                 filters;
+  apr_array_header_t *filter_value_keys;
+  apr_array_header_t *filter_items;
+
+  apr_array_header_t *zones;
+  apr_array_header_t *zone_slots;
+
+  size_t              saved_used;         /* the block before the record being written, see jp_block_writer_save_record */
+  int                 saved_filter_items;
+  apr_array_header_t *saved_zones;
+
+  apr_array_header_t *ordinals;       /* the uint64 arrival ordinals of the records of the block, NULL if not kept */
+  uint64_t            record_ordinal; /* the arrival ordinal of the record being written */
+
+  jp_TLV_record_t   **pending;          /* copies of the records held back while the encodings of the block are chosen */
+  uint64_t           *pending_ordinals;
+  uint32_t            nb_pending;
+  int                 sampling;         /* the encodings of the open block are not chosen yet */
+
+} jp_block_writer_t;
+
+typedef struct jp_block_reader
+{
+  jp_buffer_io_t      buffer;
+  int                 legacy;
+  uint64_t            records_left;
+  uint32_t            block_records_left;
+  uint32_t            block_flags;
+  uint64_t            nb_records;
+  int                 finished;
+
+  uint32_t            block_records;
+  int                 ordered;        /* a block carried the arrival order of its records */
+  uint64_t            order_base;
+  apr_array_header_t *ordinals;       /* the uint32 arrival ordinals of the records of the block, from order_base */
+  uint64_t            record_ordinal; /* the arrival ordinal of the last record read */
+
+  uint64_t            encodings;      /* the length of the encodings of the block */
+
+} jp_block_reader_t;
+
+/**
+ *  Starts a new kv-pair file
+ *
+ *  @param writer       The block writer to initialize
+ *  @param pool         A memory pool
+ *  @param stream       The output file stream
+ *  @param base_offset  The file offset the kv-pair stream starts at, 0 unless it is a container section
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_writer_open(jp_block_writer_t *writer,
+                         apr_pool_t        *pool,
+                         FILE              *stream,
+                         uint64_t           base_offset);
+
+/**
+ *  Reopens an existing kv-pair file to append blocks to it
+ *
+ *  @param writer  The block writer to initialize
+ *  @param pool    A memory pool
+ *  @param stream  The kv-pair file stream, opened for reading and writing
+ *
+ * @returns zero if succeeded, non-zero if the file is not a complete block framed file
+ */
+int jp_block_writer_reopen(jp_block_writer_t *writer,
+                           apr_pool_t        *pool,
+                           FILE              *stream);
+
+/**
+ *  Encodes a record in the current block, starting a new block when needed; the first records of
+ *  a block are held back until the encodings of its keys are chosen
+ *
+ *  @param writer  The block writer
+ *  @param record  The record, its values must stay valid until the block is written, its kv-pairs are copied
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_writer_add_record(      jp_block_writer_t *writer,
+                               const jp_TLV_record_t   *record);
+
+/**
+ *  Starts a record encoded directly in the writer buffer, starting a new block when needed
+ *
+ *  @param writer  The block writer
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_writer_begin_record(jp_block_writer_t *writer);
+
+/**
+ *  Saves the state of the open block after jp_block_writer_begin_record, so that the record can be dropped
+ *
+ *  @param writer  The block writer
+ */
+void jp_block_writer_save_record(jp_block_writer_t *writer);
+
+/**
+ *  Drops the record being written since jp_block_writer_save_record: its bytes, and the filter items
+ *  and zone map ranges of its kv-pairs
+ *
+ *  @param writer  The block writer
+ */
+void jp_block_writer_drop_record(jp_block_writer_t *writer);
+
+/**
+ *  Adds a kv-pair of the current record to the filter and the zone map of the block
+ *
+ *  @param writer   The block writer
+ *  @param kv_pair  The kv-pair, already encoded
+ */
+void jp_block_writer_index_kv_pair(      jp_block_writer_t *writer,
+                                   const jp_TLV_kv_pair_t  *kv_pair);
+
+/**
+ *  Ends a record started with jp_block_writer_begin_record, ending the block once large enough
+ *
+ *  @param writer   The block writer
+ *  @param written  The number of bytes encoded for the record
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_writer_end_record(jp_block_writer_t *writer,
+                               uint32_t           written);
+
+/**
+ *  Writes the pending block, the footer and the trailer
+ *
+ *  @param writer  The block writer
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_writer_close(jp_block_writer_t *writer);
+
+/**
+ *  Writes the footer and the trailer of a kv-pair file
+ *
+ *  @param buffer         The buffer of the kv-pair file
+ *  @param block_index    The jp_block_index_entry_t of the blocks written
+ *  @param nb_records     The number of records of the file
+ *  @param footer_offset  The offset the footer is written at
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_footer_write(jp_buffer_io_t     *buffer,
+                          apr_array_header_t *block_index,
+                          uint64_t            nb_records,
+                          uint64_t            footer_offset);
+
+/**
+ *  Starts reading a kv-pair file, either block framed or in the original single count layout
+ *
+ *  @param reader  The block reader to initialize
+ *  @param pool    A memory pool
+ *  @param stream  The input file stream
+ *
+ * @returns zero if succeeded, non-zero if an error condition occurred
+ */
+int jp_block_reader_open(jp_block_reader_t *reader,
+                         apr_pool_t        *pool,
+                         FILE              *stream);
+
+/**
+ *  Reads the next record
+ *
+ *  @param reader  The block reader
+ *  @param pool    A memory pool for the record
+ *  @param record  The imported record
+ *
+ * @returns 1 if a record was read, 0 at the end of the records, -1 if an error condition occurred
+ */
+int jp_block_reader_next_record(jp_block_reader_t  *reader,
+                                apr_pool_t         *pool,
+                                jp_TLV_record_t   **record);
+
+/**
+ *  Releases the resources held by a block reader
+ *
+ *  @param reader  The block reader
+ */
+void jp_block_reader_close(jp_block_reader_t *reader);
+
+/**
+ *  Maps a whole file set in memory, kv-pair file and key index
+ *
+ *  @param pool             A memory pool, the files are mapped until it is cleared
+ *  @param kv_pair_input    The kv-pair file, or the single-file container
+ *  @param key_index_input  The key index file, NULL if kv_pair_input is a single-file container
+ *  @param data             Set to the memory holding the kv-pair file
+ *  @param size             Set to its size
+ *  @param kv_pair_offset   Set to the offset of the kv-pair stream in it
+ *  @param key_index        Set to the key index of the file set
+ *  @param sequential       Non-zero if the kv-pairs are read front to back, zero if only a few blocks are
+ *
+ * @returns zero if succeeded, non-zero otherwise
+ */
+int jp_map_file_set(apr_pool_t          *pool,
+                    FILE                *kv_pair_input,
+                    FILE                *key_index_input,
+                    const uint8_t      **data,
+                    size_t              *size,
+                    uint64_t            *kv_pair_offset,
+                    jp_key_index_map_t **key_index,
+                    int                  sequential);
+
+/**
+ *  Maps a whole file in memory, or reads it if it is not a regular file
+ *
+ *  @param pool        A memory pool, the file is mapped until it is cleared
+ *  @param input       The file
+ *  @param sequential  Non-zero if the file is read front to back, zero for random accesses
+ *  @param size        Set to the size of the file
+ *
+ * @returns the memory holding the file
+ */
+const uint8_t* jp_map_file(apr_pool_t *pool,
+                           FILE       *input,
+                           int         sequential,
+                           size_t     *size);
+
+/**
+ *  Reads the footer of a mapped kv-pair file
+ *
+ *  @param data           The memory holding the kv-pair file
+ *  @param size           Its size
+ *  @param offset         The offset of the kv-pair stream in it
+ *  @param footer_offset  Set to the offset of the footer
+ *  @param nb_records     Set to the number of records of the file
+ *  @param nb_blocks      Set to its number of blocks
+ *
+ * @returns zero if succeeded, non-zero if the file is not block framed or its footer is corrupted
+ */
+int jp_scan_read_footer(const uint8_t *data,
+                        size_t         size,
+                        uint64_t       offset,
+                        uint64_t      *footer_offset,
+                        uint64_t      *nb_records,
+                        uint32_t      *nb_blocks);
+
+/**
+ *  Hands every record of consecutive blocks of a mapped kv-pair file to a function
+ *
+ *  @param pool           A memory pool
+ *  @param data           The memory holding the kv-pair file
+ *  @param size           Its size
+ *  @param offset         The offset of the kv-pair stream in it
+ *  @param footer_offset  The offset of its footer, from jp_scan_read_footer
+ *  @param first_block    The first block scanned
+ *  @param nb_blocks      The number of blocks scanned
+ *  @param map            The key index of the file set
+ *  @param record_fn      The function receiving the records, released once their block is scanned
+ *  @param context        The context handed to record_fn
+ *
+ * @returns zero if succeeded, non-zero if the blocks are corrupted
+ *
+ * @remarks the blocks decode on their own, so ranges of blocks can be scanned by several threads with their own pools
+ */
+int jp_scan_block_range(apr_pool_t         *pool,
+                        const uint8_t      *data,
+                        size_t              size,
+                        uint64_t            offset,
+                        uint64_t            footer_offset,
+                        uint32_t            first_block,
+                        uint32_t            nb_blocks,
+                        jp_key_index_map_t *map,
+                        jp_scan_record_fn   record_fn,
+                        void               *context);
+
+/**
+ *  Hands every record of a mapped file set to a function, whether it is block framed or not
+ *
+ *  @param pool       A memory pool
+ *  @param data       The memory holding the kv-pair file
+ *  @param size       Its size
+ *  @param offset     The offset of the kv-pair stream in it
+ *  @param map        The key index of the file set
+ *  @param record_fn  The function receiving the records
+ *  @param context    The context handed to record_fn
+ *
+ * @returns zero if succeeded, non-zero if the file set is corrupted
+ */
+int jp_scan_mapped_file_set(apr_pool_t         *pool,
+                            const uint8_t      *data,
+                            size_t              size,
+                            uint64_t            offset,
+                            jp_key_index_map_t *map,
+                            jp_scan_record_fn   record_fn,
+                            void               *context);
+
+/*
+ *  value index file layout, described in jp_value_index.c
+ */
+typedef struct jp_value_index_builder jp_value_index_builder_t;
+
+/**
+ *  Hashes the value of a kv-pair as the value indices do
+ *
+ *  @param kv_pair  The kv-pair
+ *  @param hash     Set to the hash of its value
+ *
+ * @returns 1 if the value is indexed, 0 for the doubles and booleans
+ */
+int jp_value_index_hash(const jp_TLV_kv_pair_t *kv_pair,
+                        uint32_t               *hash);
+
+/**
+ *  Creates a value index builder
+ *
+ *  @param pool     A memory pool, holding the entries until the index is written
+ *  @param keys     The names of the keys indexed
+ *  @param nb_keys  The number of keys
+ *
+ * @returns the builder
+ */
+jp_value_index_builder_t* jp_value_index_builder_make(      apr_pool_t  *pool,
+                                                      const char* const *keys,
+                                                            int          nb_keys);
+
+/**
+ *  Lists a value of a key in a block
+ *
+ *  @param builder  The builder
+ *  @param key      The position of the key in the keys of the builder
+ *  @param hash     The hash of the value, from jp_value_index_hash
+ *  @param block    The block holding it, the blocks are added in increasing order
+ */
+void jp_value_index_builder_add(jp_value_index_builder_t *builder,
+                                int                       key,
+                                uint32_t                  hash,
+                                uint32_t                  block);
+
+/**
+ *  Writes a value index
+ *
+ *  @param builder        The builder
+ *  @param block_records  For every block of the kv-pair file, the number of its first record
+ *  @param nb_blocks      The number of blocks
+ *  @param nb_records     The number of records of the kv-pair file
+ *  @param footer_offset  The offset of its footer
+ *  @param output         The index output file
+ *
+ * @returns zero if succeeded, non-zero otherwise
+ */
+int jp_value_index_write(      jp_value_index_builder_t *builder,
+                         const uint64_t                 *block_records,
+                               uint32_t                  nb_blocks,
+                               uint64_t                  nb_records,
+                               uint64_t                  footer_offset,
+                               FILE                     *output);
+
+/**
+ *  @returns non-zero if a value index was built from a kv-pair file with these blocks, records and footer offset
+ */
+int jp_value_index_matches(const jp_value_index_t *index,
+                                 uint64_t          nb_records,
+                                 uint32_t          nb_blocks,
+                                 uint64_t          footer_offset);
+
+/**
+ *  @returns the number of the first record of a block, the block must be within the index
+ */
+uint64_t jp_value_index_block_record(const jp_value_index_t *index,
+                                           uint32_t          block);
+
+/**
+ *  Finds the blocks which may hold a value of a key
+ *
+ *  @param index   The value index
+ *  @param key     The key
+ *  @param value   The value, integers are looked up by their decimal text
+ *  @param blocks  The uint32 block numbers are pushed to this array, in increasing order
+ *
+ * @returns zero if succeeded, non-zero if the key is not indexed or the index is corrupted
+ */
+int jp_value_index_find(const jp_value_index_t *index,
+                        const char             *key,
+                        const char             *value,
+                        apr_array_header_t     *blocks);
+
+/**
+ *  Writes the records of several collections, in order, as a single file set
+ *
+ *  @param record_collection  The collection whose key index is written, its block filter settings apply
+ *  @param segments           The collections whose records are written
+ *  @param key_maps           For every segment, its key indices translated to the ones of record_collection,
+ *                            NULL (or a NULL map) if they are already the same
+ *  @param nb_segments        The number of segments
+ *  @param kv_pair_output     The kv-pair output file
+ *  @param key_index_output   The key index output file, NULL to write a single-file container
+ *
+ * @returns zero if succeeded, non-zero otherwise
+ */
+int jp_export_segments_to_file_set(      jp_TLV_records_t  *record_collection,
+                                   const jp_TLV_records_t **segments,
+                                   const uint32_t         **key_maps,
+                                         int                nb_segments,
+                                         FILE              *kv_pair_output,
+                                         FILE              *key_index_output);
+
+/**
+ *  Writes the header and the key index section of a single-file container
+ *
+ *  @param key_index  The key index of the records to follow
+ *  @param output     The container file
+ *
+ * @returns the offset of the kv-pair section, 0 on failure
+ */
+uint64_t jp_write_container_prelude(apr_hash_t *key_index,
+                                    FILE       *output);
+
+/**
+ *  Reads the header of a single-file container and opens its key index section
+ *
+ *  @param pool   A memory pool
+ *  @param input  The container file, left on its kv-pair section
+ *
+ * @returns the key index map, NULL if the file is not a container
+ */
+jp_key_index_map_t* jp_open_container_key_index(apr_pool_t *pool,
+                                                FILE       *input);
+
+/**
+ *  Attaches the Bloom filters a collection asks for to a block writer, its value keys looked up in its key index
+ *
+ *  @param writer             The block writer
+ *  @param record_collection  The collection whose block filter settings apply
+ */
+void jp_enable_writer_filters(jp_block_writer_t *writer,
+                              jp_TLV_records_t  *record_collection);
+
+/**
+ *  Attaches a Bloom filter to every block written from now on
+ *
+ *  @param writer      The block writer
+ *  @param value_keys  The uint32 key indices whose string values go to the filters, may be NULL
+ */
+void jp_block_writer_enable_filters(jp_block_writer_t  *writer,
+                                    apr_array_header_t *value_keys);
+
+/**
+ *  Writes the arrival ordinal of every record, set in record_ordinal before it is added, with the blocks
+ *  written from now on
+ *
+ *  @param writer  The block writer
+ */
+void jp_block_writer_keep_order(jp_block_writer_t *writer);
+
+/**
+ *  @returns the number of records added to a block writer, including the ones held back
+ */
+uint64_t jp_block_writer_nb_records_added(const jp_block_writer_t *writer);
+
+/**
+ *  Adds the records of a collection to the blocks, grouped by shape if the collection asks for it
+ *
+ *  @param writer             The block writer
+ *  @param record_collection  The collection whose clustering settings apply
+ *  @param segment            The collection whose records are written
+ *  @param key_map            The key indices of the segment translated to the ones written, NULL if the same
+ *  @param scratch            A record the translated kv-pairs are copied to, when there is a key map
+ *
+ * @returns zero if succeeded, non-zero otherwise
+ */
+int jp_block_writer_add_records(      jp_block_writer_t *writer,
+                                const jp_TLV_records_t  *record_collection,
+                                const jp_TLV_records_t  *segment,
+                                const uint32_t          *key_map,
+                                      jp_TLV_record_t   *scratch);
+
+/**
+ *  Puts imported records back in the order they arrived in before they were clustered
+ *
+ *  @param pool          A memory pool for the sort
+ *  @param record_list   The records of a collection
+ *  @param first_record  The position of the first record imported
+ *  @param ordinals      The uint64 arrival ordinal of every record imported
+ */
+void jp_restore_arrival_order(apr_pool_t         *pool,
+                              apr_array_header_t *record_list,
+                              int                 first_record,
+                              apr_array_header_t *ordinals);
+
+/**
+ *  Compares two values the records are sorted by: numbers first, by value, then booleans and strings
+ *
+ *  @param a  A kv-pair, NULL if the record has no such key
+ *  @param b  Another kv-pair, or NULL
+ *
+ * @returns a negative, zero or positive value as a sorts before, with or after b, the missing values last
+ */
+int jp_compare_sort_values(const jp_TLV_kv_pair_t *a,
+                           const jp_TLV_kv_pair_t *b);
+
+/**
+ *  Adds a record to the blocks, its key indices translated first
+ *
+ *  @param writer   The block writer
+ *  @param record   The record
+ *  @param key_map  The key indices of the record translated to the ones written, NULL if the same
+ *  @param scratch  A record the translated kv-pairs are copied to, when there is a key map
+ *
+ * @returns zero if succeeded, non-zero otherwise
+ */
+int jp_block_writer_add_translated(      jp_block_writer_t *writer,
+                                         jp_TLV_record_t   *record,
+                                   const uint32_t          *key_map,
+                                         jp_TLV_record_t   *scratch);
+
+/*
+ *  Arrival order of the records of a clustered block, the layout is described in jp_record_order.c
+ */
+#define JP_ORDER_SECTION_SIZE(nb_records)  (sizeof(uint64_t) + (uint64_t) (nb_records) * sizeof(uint32_t) + JP_BLOCK_CRC_SIZE)
+
+/**
+ *  Writes the arrival order of the records of a block
+ *
+ *  @param buffer    The buffer the block is assembled in
+ *  @param ordinals  The uint64 arrival ordinals of the records of the block
+ *
+ * @returns the number of bytes written, 0 on failure
+ */
+uint32_t jp_block_order_write(jp_buffer_io_t     *buffer,
+                              apr_array_header_t *ordinals);
+
+/**
+ *  Reads the arrival order written by jp_block_order_write, checking its bounds and its checksum
+ *
+ *  @param data        The order section
+ *  @param size        The number of bytes available from data
+ *  @param nb_records  The number of records of the block
+ *  @param base        Set to the smallest ordinal of the block
+ *  @param offsets     Set to the uint32 ordinals of the records, from base, unaligned
+ *
+ * @returns the length of the section, 0 if it is truncated or corrupted
+ */
+uint64_t jp_block_order_read(const uint8_t  *data,
+                                   uint64_t  size,
+                                   uint32_t  nb_records,
+                                   uint64_t *base,
+                             const uint8_t **offsets);
+
+
+/*
+ *  Encodings of the keys of a block, described in jp_key_codecs.c
+ */
+#define JP_ENCODING_INLINE              0
+#define JP_ENCODING_STRING_DICTIONARY   1
+#define JP_ENCODING_INTEGER_DICTIONARY  2
+#define JP_ENCODING_DELTA               3
+
+#define JP_ENCODING_SAMPLE_RECORDS      128
+#define JP_ENCODING_ENTRY_SIZE          (sizeof(uint32_t) + sizeof(uint8_t))
+#define JP_ENCODINGS_SECTION_SIZE(nb_keys)  (sizeof(uint32_t) + (nb_keys) * JP_ENCODING_ENTRY_SIZE + JP_BLOCK_CRC_SIZE)
+
+#define JP_DICTIONARY_MAX_ENTRIES       65536
+#define JP_DICTIONARY_CODE_ENTRY16      62 /* followed by the uint16 number of the entry */
+#define JP_DICTIONARY_CODE_LITERAL      63 /* followed by the value encoded inline */
+
+#define JP_DELTA_CODE_BIAS              30 /* the codes below JP_DELTA_CODE_INT8 are the deltas -30 to 29 */
+#define JP_DELTA_CODE_INT8              60
+#define JP_DELTA_CODE_INT16             61
+#define JP_DELTA_CODE_INT32             62
+
+/**
+ *  Creates the encodings of the keys, used by the block readers and writers
+ *
+ *  @param pool  A memory pool
+ *
+ *  @returns the encodings, every key inline
+ */
+jp_key_codecs_t* jp_key_codecs_make(apr_pool_t *pool);
+
+/**
+ *  Puts every key back inline and forgets the dictionaries, at the start of every block
+ */
+void jp_key_codecs_reset(jp_key_codecs_t *codecs);
+
+/**
+ *  @returns non-zero if a key has another encoding than JP_ENCODING_INLINE
+ */
+int jp_key_codecs_active(const jp_key_codecs_t *codecs);
+
+/**
+ *  Picks the encoding of every key from the cost of its values in the first records of a block
+ *
+ *  @param codecs      The encodings, reset
+ *  @param records     The records sampled
+ *  @param nb_records  The number of records
+ */
+void jp_key_codecs_choose(      jp_key_codecs_t        *codecs,
+                          const jp_TLV_record_t *const *records,
+                                uint32_t                nb_records);
+
+/**
+ *  @returns the encoding of a value of a key, JP_ENCODING_INLINE if codecs is NULL or if the
+ *           encoding of the key is for values of another type
+ */
+uint8_t jp_key_codecs_encoding(jp_key_codecs_t *codecs,
+                               uint32_t         key_index,
+                               uint32_t         value_type);
+
+/**
+ *  Looks a value up in the dictionary of its key, adding it if it is not there yet
+ *
+ *  @param codecs      The encodings
+ *  @param key_index   The key, with a dictionary encoding
+ *  @param value       The value, a string must stay valid until the block is written
+ *  @param value_type  JP_TYPE_STRING or JP_TYPE_INTEGER
+ *  @param entry       Set to the number of the value, if found
+ *
+ * @returns 1 if the value was found, 0 if it is written as a literal
+ */
+int jp_key_codecs_find(      jp_key_codecs_t *codecs,
+                             uint32_t         key_index,
+                       const jp_TLV_union_t  *value,
+                             uint32_t         value_type,
+                             uint32_t        *entry);
+
+/**
+ *  Numbers a literal read from a block, unless the dictionary of its key is full
+ */
+void jp_key_codecs_add(      jp_key_codecs_t *codecs,
+                             uint32_t         key_index,
+                       const jp_TLV_union_t  *value,
+                             uint32_t         value_type);
+
+/**
+ *  @returns a value of the dictionary of a key, NULL if there is no such entry
+ */
+const jp_TLV_union_t* jp_key_codecs_entry(jp_key_codecs_t *codecs,
+                                          uint32_t         key_index,
+                                          uint32_t         entry);
+
+/**
+ *  @returns the previous value of a key with the delta encoding
+ */
+int32_t* jp_key_codecs_last_integer(jp_key_codecs_t *codecs,
+                                    uint32_t         key_index);
+
+/**
+ *  @returns the number of bytes following the code of a delta, 0 if it fits in the code
+ */
+uint32_t jp_delta_length(int32_t delta);
+
+/**
+ *  Writes the encodings of the keys of a block
+ *
+ *  @param buffer  The buffer the block is assembled in
+ *  @param codecs  The encodings
+ *
+ * @returns the number of bytes written, 0 on failure
+ */
+uint32_t jp_key_codecs_write(jp_buffer_io_t  *buffer,
+                             jp_key_codecs_t *codecs);
+
+/**
+ *  Reads the encodings written by jp_key_codecs_write, checking their bounds and their checksum
+ *
+ *  @param data    The encodings section
+ *  @param size    The number of bytes available from data
+ *  @param codecs  The encodings to set, reset, or NULL to check the section only
+ *
+ * @returns the length of the section, 0 if it is truncated or corrupted
+ */
+uint64_t jp_key_codecs_read(const uint8_t         *data,
+                                  uint64_t         size,
+                                  jp_key_codecs_t *codecs);
+
+/*
+ *  Bloom filters of the blocks, the layout is described in jp_block_filter.c
+ */
+#define JP_FILTER_HEADER_SIZE      (3 * sizeof(uint32_t))
+#define JP_FILTER_BITS_PER_ITEM    10
+#define JP_FILTER_NB_HASHES        7
+
+typedef struct jp_block_filter
+{
+  const uint8_t *value_keys;
+  const uint8_t *words;
+  uint32_t       nb_value_keys;
+  uint32_t       nb_words;
+  uint32_t       nb_hashes;
+} jp_block_filter_t;
+
+/**
+ *  The filter item of a key index
+ */
+uint64_t jp_block_filter_key_hash(uint32_t key_index);
+
+/**
+ *  The filter item of a string value of a key
+ */
+uint64_t jp_block_filter_value_hash(      uint32_t  key_index,
+                                    const char     *value,
+                                          uint32_t  value_length);
+
+/**
+ *  Writes the filter of a block
+ *
+ *  @param buffer      The buffer the block is assembled in
+ *  @param items       The uint64 items of the block, sorted in place
+ *  @param value_keys  The uint32 key indices whose string values are in the items, may be NULL
+ *
+ * @returns the number of bytes written, 0 on failure
+ */
+uint32_t jp_block_filter_write(jp_buffer_io_t     *buffer,
+                               apr_array_header_t *items,
+                               apr_array_header_t *value_keys);
+
+/**
+ *  Reads a filter written by jp_block_filter_write, checking its bounds and its checksum
+ *
+ *  @param data    The filter
+ *  @param size    The number of bytes available from data
+ *  @param filter  Set to the filter
+ *
+ * @returns the length of the filter, 0 if it is truncated or corrupted
+ */
+uint64_t jp_block_filter_read(const uint8_t           *data,
+                                    uint64_t           size,
+                                    jp_block_filter_t *filter);
+
+/**
+ *  Tells whether the string values of a key were added to a filter
+ */
+int jp_block_filter_has_values(const jp_block_filter_t *filter,
+                                     uint32_t           key_index);
+
+/**
+ *  Tests an item against a filter
+ *
+ * @returns zero if the item is not in the block, non-zero if it may be
+ */
+int jp_block_filter_may_contain(const jp_block_filter_t *filter,
+                                      uint64_t           item);
+
+/*
+ *  Zone maps of the blocks, the layout is described in jp_block_zone_map.c
+ */
+#define JP_ZONE_MAP_ENTRY_SIZE     (sizeof(uint32_t) + 2 * sizeof(double))
+
+typedef struct jp_block_zone
+{
+  uint32_t key_index;
+  double   min;
+  double   max;
+} jp_block_zone_t;
+
+typedef struct jp_block_zone_map
+{
+  const uint8_t *entries;
+  uint32_t       nb_entries;
+} jp_block_zone_map_t;
+
+/**
+ *  Widens the range of a key in the zone map of the block being written
+ *
+ *  @param zones      The jp_block_zone_t ranges of the block
+ *  @param slots      The uint32 position + 1 in zones of every key index, 0 if not there yet
+ *  @param key_index  The key index
+ *  @param value      The numeric value
+ */
+void jp_block_zone_map_add(apr_array_header_t *zones,
+                           apr_array_header_t *slots,
+                           uint32_t            key_index,
+                           double              value);
+
+/**
+ *  Empties the zone map of a block, for the next one
+ */
+void jp_block_zone_map_reset(apr_array_header_t *zones,
+                             apr_array_header_t *slots);
+
+/**
+ *  Writes the zone map of a block
+ *
+ *  @param buffer  The buffer the block is assembled in
+ *  @param zones   The jp_block_zone_t ranges of the block
+ *
+ * @returns the number of bytes written, 0 on failure
+ */
+uint32_t jp_block_zone_map_write(jp_buffer_io_t     *buffer,
+                                 apr_array_header_t *zones);
+
+/**
+ *  Reads a zone map written by jp_block_zone_map_write, checking its bounds and its checksum
+ *
+ *  @param data      The zone map
+ *  @param size      The number of bytes available from data
+ *  @param zone_map  Set to the zone map
+ *
+ * @returns the length of the zone map, 0 if it is truncated or corrupted
+ */
+uint64_t jp_block_zone_map_read(const uint8_t             *data,
+                                      uint64_t             size,
+                                      jp_block_zone_map_t *zone_map);
+
+/**
+ *  Looks up the range of a key in a zone map
+ *
+ * @returns non-zero if the key has numeric values in the block, zero otherwise
+ */
+int jp_block_zone_map_find(const jp_block_zone_map_t *zone_map,
+                                 uint32_t             key_index,
+                                 double              *min,
+                                 double              *max);
+
+/**
+ *  Checks the framing, the footer and the block checksums of an in-memory kv-pair stream,
+ *  without decoding the records
+ *
+ *  @param data          The memory holding the file
+ *  @param size          The size of the file
+ *  @param offset        The offset of the kv-pair stream in the file, which runs to its end
+ *  @param nb_records    Set to the number of records
+ *  @param nb_blocks     Set to the number of blocks
+ *  @param nb_unchecked  Set to the number of blocks without checksum
+ *
+ * @returns zero if the stream is sound, 1 if it predates the block framing and holds nothing to check,
+ *          -1 otherwise (the reason is printed on stderr)
+ */
+int jp_block_verify(const uint8_t *data,
+                    uint64_t       size,
+                    uint64_t       offset,
+                    uint64_t      *nb_records,
+                    uint32_t      *nb_blocks,
+                    uint32_t      *nb_unchecked);
+
+
+/*
+ *  key index file layout, described in jp_key_index_map.c
+ */
+#define JP_KEY_INDEX_MAGIC          0x494B504A /* "JPKI" */
+#define JP_KEY_INDEX_FORMAT_VERSION 2
+#define JP_KEY_INDEX_HEADER_SIZE    (4 * sizeof(uint32_t))
+#define JP_KEY_INDEX_ENTRY_SIZE     (3 * sizeof(uint32_t))
+
+/**
+ *  FNV-1a hash of a byte string, the hash persisted in key index files
+ *
+ *  @param data    The bytes to hash
+ *  @param length  The number of bytes
+ *
+ * @returns the 32 bits hash
+ */
+static inline uint32_t jp_hash_bytes(const void *data,
+                                     size_t      length)
+{
+  const uint8_t* bytes = data;
+  uint32_t       hash  = 2166136261u;
+
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ *  Builds a key index image, in the file layout, from the keys ordered by index
+ *
+ *  @param pool        A memory pool
+ *  @param keys        The keys, keys[i] has the index i + 1
+ *  @param nb_keys     The number of keys
+ *  @param image_size  The size of the image
+ *
+ * @returns the image
+ */
+uint8_t* jp_key_index_image_build(apr_pool_t   *pool,
+                                  const char  **keys,
+                                  uint32_t      nb_keys,
+                                  size_t       *image_size);
+
+/**
+ *  Builds the key index image of a key index hash
+ *
+ *  @param pool        A memory pool
+ *  @param key_index   The key index, with indices from 1 to its number of keys
+ *  @param image_size  The size of the image
+ *
+ * @returns the image, NULL if the key indices are not contiguous
+ */
+uint8_t* jp_key_index_image_from_key_index(apr_pool_t *pool,
+                                           apr_hash_t *key_index,
+                                           size_t     *image_size);
+
+/*
+ *  single-file container: the uint32 JP_CONTAINER_MAGIC, uint32 format version, then the uint64
+ *  offset and length of the key index section and the uint64 offset of the kv-pair section, which
+ *  runs to the end of the file. The key index comes first so that readers never need to seek
+ */
+#define JP_CONTAINER_MAGIC          0x5443504A /* "JPCT" */
+#define JP_CONTAINER_FORMAT_VERSION 1
+#define JP_CONTAINER_HEADER_SIZE    (2 * sizeof(uint32_t) + 3 * sizeof(uint64_t))
+
+/**
+ *  Opens a key index stored in a byte range of a file
+ *
+ *  @param pool    A memory pool, the mapping is released with the pool
+ *  @param input   The input file
+ *  @param offset  The offset of the key index in the file
+ *  @param length  The length of the key index
+ *
+ * @returns the key index map, NULL if the range does not hold a key index
+ */
+jp_key_index_map_t* jp_key_index_map_open_range(apr_pool_t *pool,
+                                                FILE       *input,
+                                                off_t       offset,
+                                                size_t      length);
+
+/**
+ *  Opens a key index held in memory, such as a section of a mapped container
+ *
+ *  @param pool  A memory pool
+ *  @param data  The key index, which must outlive the map
+ *  @param size  The length of the key index
+ *
+ * @returns the key index map, NULL if the memory does not hold a key index
+ */
+jp_key_index_map_t* jp_key_index_map_open_memory(apr_pool_t    *pool,
+                                                 const uint8_t *data,
+                                                 size_t         size);
+
+/**
+ *  Reads a stream up to a length or to its end
+ *
+ *  @param pool    A memory pool for the bytes
+ *  @param input   The input stream
+ *  @param length  The number of bytes to read, SIZE_MAX to read to the end of the stream
+ *  @param size    Set to the number of bytes read
+ *
+ * @returns the bytes read
+ */
+uint8_t* jp_read_stream(apr_pool_t *pool,
+                        FILE       *input,
+                        size_t      length,
+                        size_t     *size);
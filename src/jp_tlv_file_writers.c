@@ -1,71 +1,538 @@
 
+#include <apr_allocator.h>
+#include <apr_strings.h>
 
 #include <jp_tlv_encoder.h>
 #include "jp_tlv_encoder_private.h"
 
-int jp_export_records_to_file_set(jp_TLV_records_t *record_collection,
-                                  FILE             *kv_pair_output,
-                                  FILE             *key_index_output)
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void jp_enable_block_filters(      jp_TLV_records_t *record_collection,
+                             const char* const      *value_keys,
+                                   int               nb_value_keys)
+{
+  apr_pool_t* pool = apr_hash_pool_get(record_collection->key_index);
+
+  record_collection->block_filters     = 1;
+  record_collection->filter_value_keys = apr_array_make(pool, nb_value_keys, sizeof(const char*));
+
+  for (int i = 0; i < nb_value_keys; i++)
+    *(const char**) apr_array_push(record_collection->filter_value_keys) = apr_pstrdup(pool, value_keys[i]);
+}
+
+/* the value keys are given by name, the writer needs their indices in the key index written */
+void jp_enable_writer_filters(jp_block_writer_t *writer,
+                              jp_TLV_records_t  *record_collection)
+{
+  if (!record_collection->block_filters)
+    return;
+
+  apr_array_header_t* value_keys = apr_array_make(writer->pool, 4, sizeof(uint32_t));
+
+  for (int i = 0; record_collection->filter_value_keys && i < record_collection->filter_value_keys->nelts; i++) {
+    const char* key   = ((const char**) record_collection->filter_value_keys->elts)[i];
+    void*       index = apr_hash_get(record_collection->key_index, key, APR_HASH_KEY_STRING);
+
+    if (index)
+      *(uint32_t*) apr_array_push(value_keys) = (uint32_t) (size_t) index;
+  }
+
+  jp_block_writer_enable_filters(writer, value_keys);
+}
+
+/* writes the container header and the key index section, returns the offset of the kv-pair section */
+uint64_t jp_write_container_prelude(apr_hash_t *key_index,
+                                    FILE       *output)
+{
+  apr_pool_t* pool;
+
+  if (APR_SUCCESS != apr_pool_create(& pool, apr_hash_pool_get(key_index)))
+    return 0;
+
+  size_t   image_size;
+  uint8_t* image = jp_key_index_image_from_key_index(pool, key_index, & image_size);
+
+  jp_buffer_io_t buffer;
+  jp_buffer_io_write_initialize(& buffer, pool, output);
+
+  uint64_t kv_pair_offset = JP_CONTAINER_HEADER_SIZE + image_size;
+
+  if (NULL == image ||
+      0 == jp_export_uint32_to_buffer(JP_CONTAINER_MAGIC, & buffer) ||
+      0 == jp_export_uint32_to_buffer(JP_CONTAINER_FORMAT_VERSION, & buffer) ||
+      0 == jp_export_uint64_to_buffer(JP_CONTAINER_HEADER_SIZE, & buffer) ||
+      0 == jp_export_uint64_to_buffer(image_size, & buffer) ||
+      0 == jp_export_uint64_to_buffer(kv_pair_offset, & buffer) ||
+      NULL == jp_buffer_io_reference_bytes(& buffer, image, image_size))
+    kv_pair_offset = 0;
+
+  jp_buffer_io_flush_writes(& buffer);
+
+  if (buffer.write_error)
+    kv_pair_offset = 0;
+
+  apr_pool_destroy(pool);
+
+  return kv_pair_offset;
+}
+
+/* reads the container header and opens the key index section, leaving the stream on the kv-pair section */
+jp_key_index_map_t* jp_open_container_key_index(apr_pool_t *pool,
+                                                FILE       *input)
+{
+  uint32_t magic, version;
+  uint64_t key_index_offset, key_index_length, kv_pair_offset;
+
+  if (1 != fread(& magic, sizeof(uint32_t), 1, input) ||
+      1 != fread(& version, sizeof(uint32_t), 1, input) ||
+      1 != fread(& key_index_offset, sizeof(uint64_t), 1, input) ||
+      1 != fread(& key_index_length, sizeof(uint64_t), 1, input) ||
+      1 != fread(& kv_pair_offset, sizeof(uint64_t), 1, input) ||
+      JP_CONTAINER_MAGIC != magic) {
+    fprintf(stderr, "jp_open_container_key_index: not a single-file container \n");
+    return NULL;
+  }
+
+  if (version > JP_CONTAINER_FORMAT_VERSION ||
+      JP_CONTAINER_HEADER_SIZE != key_index_offset ||
+      kv_pair_offset != key_index_offset + key_index_length) {
+    fprintf(stderr, "jp_open_container_key_index: unsupported container layout \n");
+    return NULL;
+  }
+
+  jp_key_index_map_t* map = jp_key_index_map_open_range(pool, input, key_index_offset, key_index_length);
+
+  if (NULL == map)
+    return NULL;
+
+  /* a mapped key index leaves the stream on it, streams that can not seek were read through it */
+  if (0 != fseeko(input, kv_pair_offset, SEEK_SET) && ESPIPE != errno)
+    return NULL;
+
+  return map;
+}
+
+int jp_export_segments_to_file_set(      jp_TLV_records_t  *record_collection,
+                                   const jp_TLV_records_t **segments,
+                                   const uint32_t         **key_maps,
+                                         int                nb_segments,
+                                         FILE              *kv_pair_output,
+                                         FILE              *key_index_output)
 {
+  uint64_t kv_pair_offset = 0;
+
+  if (NULL == key_index_output) {
+    kv_pair_offset = jp_write_container_prelude(record_collection->key_index, kv_pair_output);
+
+    if (0 == kv_pair_offset)
+      return -1;
+  }
+
   {
-    jp_buffer_io_t buffer;
-    jp_buffer_io_write_initialize(& buffer, apr_hash_pool_get(record_collection->key_index), kv_pair_output);
+    /* the writer buffers go to a subpool, the key index pool may outlive many exports */
+    jp_block_writer_t writer;
+    apr_pool_t*       writer_pool;
+    int               ret = 0;
+
+    if (APR_SUCCESS != apr_pool_create(& writer_pool, apr_hash_pool_get(record_collection->key_index)))
+      return -1;
 
-    apr_array_header_t* record_array = record_collection->record_list;
-    uint32_t            nb_records   = record_array->nelts;
+    if (0 != jp_block_writer_open(& writer, writer_pool, kv_pair_output, kv_pair_offset))
+      ret = -1;
 
-    if (0 == jp_export_uint32_to_buffer(nb_records, & buffer))
-        return -1;
+    jp_enable_writer_filters(& writer, record_collection);
 
-    for (int i = 0; i < nb_records; i++) {
-      jp_TLV_record_t* record =  ((jp_TLV_record_t**) record_array->elts)[i];
+    if (record_collection->cluster_window && record_collection->keep_order)
+      jp_block_writer_keep_order(& writer);
 
-      if (0 == jp_export_record_to_buffer(record, & buffer))
-        return -1;
+    jp_TLV_record_t* scratch = jp_TLV_record_make(writer_pool);
+
+    for (int s = 0; s < nb_segments && 0 == ret; s++) {
+      if (0 != jp_block_writer_add_records(& writer, record_collection, segments[s], key_maps ? key_maps[s] : NULL, scratch))
+        ret = -1;
     }
 
-    jp_buffer_io_flush_writes(& buffer);
+    if (0 == ret && 0 != jp_block_writer_close(& writer))
+      ret = -1;
+
+    apr_pool_destroy(writer_pool);
+
+    if (0 != ret)
+      return -1;
   }
 
+  if (NULL == key_index_output)
+    return 0;
+
   return jp_export_key_index_to_file(record_collection->key_index, key_index_output);
 }
 
+int jp_export_records_to_file_set(jp_TLV_records_t *record_collection,
+                                  FILE             *kv_pair_output,
+                                  FILE             *key_index_output)
+{
+  const jp_TLV_records_t* segment = record_collection;
+
+  return jp_export_segments_to_file_set(record_collection, & segment, NULL, 1, kv_pair_output, key_index_output);
+}
+
 int jp_import_records_from_file_set(jp_TLV_records_t *record_collection,
                                     FILE             *kv_pair_input,
                                     FILE             *key_index_input)
 {
   apr_pool_t* pool = apr_hash_pool_get(record_collection->key_index);
 
-  apr_hash_t*         file_key_index = jp_import_key_index_from_file(pool, key_index_input);
-  apr_array_header_t* file_key_array = jp_build_key_array_from_key_index(file_key_index);
+  jp_key_index_map_t* file_key_index = (NULL == key_index_input) ? jp_open_container_key_index(pool, kv_pair_input)
+                                                                 : jp_key_index_map_open(pool, key_index_input);
+
+  if (NULL == file_key_index)
+    return -1;
 
   {
-    jp_buffer_io_t buffer;
-    jp_buffer_io_read_initialize(& buffer, pool, kv_pair_input);
+    jp_block_reader_t reader;
+    jp_TLV_record_t*  record;
+    int               ret;
+    int               first_record = record_collection->record_list->nelts;
+
+    if (0 != jp_block_reader_open(& reader, pool, kv_pair_input)) {
+      jp_block_reader_close(& reader);
+      return -1;
+    }
 
-    uint32_t nb_records;
+    /* the arrival ordinals of the records imported, for the file sets whose records were clustered */
+    apr_pool_t* order_pool;
 
-    if (0 == jp_import_uint32_from_buffer(& nb_records, & buffer))
+    if (APR_SUCCESS != apr_pool_create(& order_pool, pool)) {
+      jp_block_reader_close(& reader);
       return -1;
+    }
 
-    for (int i = 0; i < nb_records; i++) {
-      jp_TLV_record_t* record;
+    apr_array_header_t* ordinals = apr_array_make(order_pool, 1024, sizeof(uint64_t));
 
-      if (0 == jp_import_record_from_buffer(pool, & record, & buffer))
-        return -1;
+    /* the values are sampled by key index on the source, which differs from one file set to the next */
+    if (record_collection->string_values) {
+      jp_string_table_reset_keys(record_collection->string_values);
+      reader.buffer.strings = record_collection->string_values;
+    }
 
+    while (1 == (ret = jp_block_reader_next_record(& reader, pool, & record))) {
       apr_array_header_t* kv_array = record->kv_pairs_array;
       uint32_t            nb_pairs = kv_array->nelts;
 
       for (int j = 0; j < nb_pairs; j++) {
         jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
 
-        const char* key_on_source = ((const char**) file_key_array->elts)[kv_pair->key_index - 1];
+        const char* key_on_source = jp_key_index_map_key(file_key_index, kv_pair->key_index, NULL);
+
+        if (NULL == key_on_source) {
+          fprintf(stderr, "jp_import_records_from_file_set: unknown key index %u \n", kv_pair->key_index);
+          ret = -1;
+          break;
+        }
+
         size_t index_on_target    = jp_find_or_add_key(record_collection->key_index, key_on_source);
         kv_pair->key_index        = index_on_target;
       }
 
+      if (-1 == ret)
+        break;
+
+      jp_add_record_to_TLV_collection(record_collection, record);
+
+      *(uint64_t*) apr_array_push(ordinals) = reader.record_ordinal;
+    }
+
+    if (0 == ret && reader.ordered)
+      jp_restore_arrival_order(order_pool, record_collection->record_list, first_record, ordinals);
+
+    apr_pool_destroy(order_pool);
+
+    jp_block_reader_close(& reader);
+    jp_key_index_map_close(file_key_index);
+
+    if (0 != ret)
+      return -1;
+  }
+
+  return 0;
+}
+
+typedef struct jp_import_run
+{
+  jp_TLV_records_t **inputs;           /* the collection of every file set, in its own pool */
+  FILE* const       *kv_pair_inputs;
+  FILE* const       *key_index_inputs;
+} jp_import_run_t;
+
+static int jp_import_task(void *context, size_t task)
+{
+  jp_import_run_t* run = context;
+
+  return jp_import_records_from_file_set(run->inputs[task], run->kv_pair_inputs[task],
+                                         run->key_index_inputs ? run->key_index_inputs[task] : NULL);
+}
+
+int jp_import_file_sets(jp_TLV_records_t *record_collection,
+                        FILE* const      *kv_pair_inputs,
+                        FILE* const      *key_index_inputs,
+                        int               nb_inputs,
+                        unsigned int      nb_workers)
+{
+  apr_pool_t*     pool = apr_hash_pool_get(record_collection->key_index);
+  apr_pool_t*     run_pool;
+  jp_import_run_t run;
+  int             ret  = 0;
+
+  if (APR_SUCCESS != apr_pool_create(& run_pool, pool))
+    return -1;
+
+  run.inputs           = apr_pcalloc(run_pool, nb_inputs * sizeof(jp_TLV_records_t*));
+  run.kv_pair_inputs   = kv_pair_inputs;
+  run.key_index_inputs = key_index_inputs;
+
+  /*
+   *  the pools of the file sets are created here, before any thread runs: they are children of the
+   *  collection pool, with allocators of their own, so that the records outlive the import
+   */
+  for (int i = 0; i < nb_inputs; i++) {
+    apr_allocator_t* allocator;
+    apr_pool_t*      input_pool;
+
+    if (APR_SUCCESS != apr_allocator_create(& allocator)) {
+      apr_pool_destroy(run_pool);
+      return -1;
+    }
+
+    if (APR_SUCCESS != apr_pool_create_ex(& input_pool, pool, NULL, allocator)) {
+      apr_allocator_destroy(allocator);
+      apr_pool_destroy(run_pool);
+      return -1;
+    }
+
+    apr_allocator_owner_set(allocator, input_pool);
+
+    run.inputs[i] = jp_TLV_record_collection_make(input_pool);
+
+    if (record_collection->string_values)
+      jp_enable_string_interning(run.inputs[i], input_pool);
+  }
+
+  if (0 != jp_worker_pool_run(run_pool, nb_workers, nb_inputs, jp_import_task, & run))
+    ret = -1;
+
+  /*
+   *  the keys of a file set are numbered in the order they first appear in its records, translating
+   *  them in that order numbers the keys of the collection as a sequential import would
+   */
+  for (int i = 0; i < nb_inputs; i++) {
+    jp_TLV_records_t*   input     = run.inputs[i];
+    apr_array_header_t* key_array = jp_build_key_array_from_key_index(input->key_index);
+    unsigned int        nb_keys   = apr_hash_count(input->key_index);
+    uint32_t*           key_map   = apr_palloc(run_pool, (nb_keys + 1) * sizeof(uint32_t));
+
+    for (unsigned int k = 0; k < nb_keys; k++)
+      key_map[k + 1] = jp_find_or_add_key(record_collection->key_index, ((const char**) key_array->elts)[k]);
+
+    for (int r = 0; r < input->record_list->nelts; r++) {
+      jp_TLV_record_t*    record   = ((jp_TLV_record_t**) input->record_list->elts)[r];
+      apr_array_header_t* kv_array = record->kv_pairs_array;
+
+      for (int j = 0; j < kv_array->nelts; j++) {
+        jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+        kv_pair->key_index = key_map[kv_pair->key_index];
+      }
+
       jp_add_record_to_TLV_collection(record_collection, record);
     }
   }
-}
\ No newline at end of file
+
+  apr_pool_destroy(run_pool);
+
+  return ret;
+}
+
+typedef struct jp_partition_run
+{
+  jp_TLV_records_t **partitions;       /* the records of every partition, in its own pool */
+  FILE* const       *kv_pair_outputs;
+  FILE* const       *key_index_outputs;
+} jp_partition_run_t;
+
+static int jp_partition_task(void *context, size_t task)
+{
+  jp_partition_run_t* run = context;
+
+  return jp_export_records_to_file_set(run->partitions[task], run->kv_pair_outputs[task],
+                                       run->key_index_outputs ? run->key_index_outputs[task] : NULL);
+}
+
+int jp_export_records_to_partitions(      jp_TLV_records_t *record_collection,
+                                    const char             *partition_key,
+                                          FILE* const      *kv_pair_outputs,
+                                          FILE* const      *key_index_outputs,
+                                          uint32_t          nb_partitions,
+                                          unsigned int      nb_workers)
+{
+  apr_pool_t*        pool = apr_hash_pool_get(record_collection->key_index);
+  apr_pool_t*        run_pool;
+  jp_partition_run_t run;
+  int                ret  = 0;
+
+  if (0 == nb_partitions || APR_SUCCESS != apr_pool_create(& run_pool, pool))
+    return -1;
+
+  run.partitions        = apr_pcalloc(run_pool, nb_partitions * sizeof(jp_TLV_records_t*));
+  run.kv_pair_outputs   = kv_pair_outputs;
+  run.key_index_outputs = key_index_outputs;
+
+  /*
+   *  every partition is a copy of the collection, settings and key index included, in a pool with an
+   *  allocator of its own created before any thread runs: the records are shared and only read
+   */
+  for (uint32_t i = 0; i < nb_partitions; i++) {
+    apr_allocator_t* allocator;
+    apr_pool_t*      partition_pool;
+
+    if (APR_SUCCESS != apr_allocator_create(& allocator)) {
+      apr_pool_destroy(run_pool);
+      return -1;
+    }
+
+    if (APR_SUCCESS != apr_pool_create_ex(& partition_pool, run_pool, NULL, allocator)) {
+      apr_allocator_destroy(allocator);
+      apr_pool_destroy(run_pool);
+      return -1;
+    }
+
+    apr_allocator_owner_set(allocator, partition_pool);
+
+    jp_TLV_records_t* partition = apr_palloc(partition_pool, sizeof(jp_TLV_records_t));
+
+    *partition               = *record_collection;
+    partition->key_index     = apr_hash_copy(partition_pool, record_collection->key_index);
+    partition->record_list   = apr_array_make(partition_pool, 1024, sizeof(jp_TLV_record_t*));
+    partition->string_values = NULL;
+
+    run.partitions[i] = partition;
+  }
+
+  uint32_t partition_key_index = (uint32_t) (size_t) apr_hash_get(record_collection->key_index, partition_key, APR_HASH_KEY_STRING);
+
+  for (int r = 0; r < record_collection->record_list->nelts; r++) {
+    jp_TLV_record_t*    record    = ((jp_TLV_record_t**) record_collection->record_list->elts)[r];
+    apr_array_header_t* kv_array  = record->kv_pairs_array;
+    uint32_t            partition = 0;
+    uint32_t            hash;
+
+    for (int j = 0; 0 != partition_key_index && j < kv_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+      if (partition_key_index == kv_pair->key_index) {
+        if (jp_value_index_hash(kv_pair, & hash))
+          partition = hash % nb_partitions;
+
+        break;
+      }
+    }
+
+    *(jp_TLV_record_t**) apr_array_push(run.partitions[partition]->record_list) = record;
+  }
+
+  if (0 != jp_worker_pool_run(run_pool, nb_workers, nb_partitions, jp_partition_task, & run))
+    ret = -1;
+
+  apr_pool_destroy(run_pool);
+
+  return ret;
+}
+
+static int jp_file_is_empty(FILE *file)
+{
+  struct stat file_stat;
+
+  fflush(file);
+
+  return 0 == fstat(fileno(file), & file_stat) && 0 == file_stat.st_size;
+}
+
+int jp_append_records_to_file_set(jp_TLV_records_t *record_collection,
+                                  FILE             *kv_pair_file,
+                                  FILE             *key_index_file)
+{
+  apr_pool_t* pool = apr_hash_pool_get(record_collection->key_index);
+
+  if (NULL == key_index_file) {
+    fprintf(stderr, "jp_append_records_to_file_set: single-file containers cannot be appended to \n");
+    return -1;
+  }
+
+  /* the records are renumbered against the key index of the file set, which only grows */
+  apr_hash_t* file_key_index = apr_hash_make(pool);
+
+  if (!jp_file_is_empty(key_index_file)) {
+    rewind(key_index_file);
+    file_key_index = jp_import_key_index_from_file(pool, key_index_file);
+
+    if (NULL == file_key_index)
+      return -1;
+  }
+
+  apr_array_header_t* key_array    = jp_build_key_array_from_key_index(record_collection->key_index);
+  apr_array_header_t* record_array = record_collection->record_list;
+
+  for (int i = 0; i < record_array->nelts; i++) {
+    apr_array_header_t* kv_array = ((jp_TLV_record_t**) record_array->elts)[i]->kv_pairs_array;
+
+    for (int j = 0; j < kv_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) kv_array->elts)[j];
+
+      kv_pair->key_index = jp_find_or_add_key(file_key_index, ((const char**) key_array->elts)[kv_pair->key_index - 1]);
+    }
+  }
+
+  record_collection->key_index = file_key_index;
+
+  {
+    jp_block_writer_t writer;
+
+    int open_ret = jp_file_is_empty(kv_pair_file) ? jp_block_writer_open(& writer, pool, kv_pair_file, 0)
+                                                  : jp_block_writer_reopen(& writer, pool, kv_pair_file);
+
+    if (0 != open_ret)
+      return -1;
+
+    jp_enable_writer_filters(& writer, record_collection);
+
+    if (record_collection->cluster_window && record_collection->keep_order)
+      jp_block_writer_keep_order(& writer);
+
+    if (0 != jp_block_writer_add_records(& writer, record_collection, record_collection, NULL, NULL))
+      return -1;
+
+    if (0 != jp_block_writer_close(& writer))
+      return -1;
+  }
+
+  /*
+   *  the key index is small next to the records, so it is simply rewritten; the descriptor is
+   *  repositioned explicitly since the buffered writes bypass stdio
+   */
+  int key_index_fd = fileno(key_index_file);
+
+  rewind(key_index_file);
+  fflush(key_index_file);
+
+  if (0 != lseek(key_index_fd, 0, SEEK_SET))
+    return -1;
+
+  if (0 != jp_export_key_index_to_file(file_key_index, key_index_file))
+    return -1;
+
+  if (0 != ftruncate(key_index_fd, lseek(key_index_fd, 0, SEEK_CUR)))
+    return -1;
+
+  return 0;
+}
@@ -0,0 +1,314 @@
+
+#include <apr_pools.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <inttypes.h>
+
+/*
+ *  Transcoding merges file sets whose keys are numbered differently without decoding their values.
+ *
+ *  The keys of the inputs are numbered in the output in the order of the inputs, and in the order
+ *  of their key index within an input. Every block is then copied with its key indices rewritten:
+ *  the records are walked through their framing only, the uint32 key of every kv-pair is renumbered
+ *  and its value is measured from its descriptor byte (and the encoding the block gives its key) to
+ *  be copied as it is. The value encodings of a block only refer to the other values of the same key
+ *  in the block, so they stay valid whatever the number of the key.
+ *
+ *  The encodings and the zone map of a block are renumbered alike, and every checksum recomputed.
+ *  Bloom filters hold hashes of the key numbers, which cannot be renumbered: they are dropped, as a
+ *  consolidation without filters would. The blocks with the arrival order of their records, and the
+ *  files predating the block framing, are left to a decoding consolidation.
+ */
+
+/* renumbers the keys of the records of a payload in place */
+static int jp_transcode_records(      uint8_t         *data,
+                                      uint32_t         size,
+                                      uint32_t         nb_records,
+                                const uint32_t        *keys,
+                                      uint32_t         nb_keys,
+                                      jp_key_codecs_t *codecs)
+{
+  uint64_t position = 0;
+
+  for (uint32_t i = 0; i < nb_records; i++) {
+    uint32_t nb_pairs;
+
+    if (size - position < sizeof(uint32_t))
+      return -1;
+
+    memcpy(& nb_pairs, data + position, sizeof(uint32_t));
+    position += sizeof(uint32_t);
+
+    for (uint32_t j = 0; j < nb_pairs; j++) {
+      uint32_t key_index;
+
+      if (size - position < sizeof(uint32_t))
+        return -1;
+
+      memcpy(& key_index, data + position, sizeof(uint32_t));
+
+      if (key_index >= nb_keys || 0 == keys[key_index])
+        return -1;
+
+      memcpy(data + position, & keys[key_index], sizeof(uint32_t));
+      position += sizeof(uint32_t);
+
+      /* the codecs are numbered as in the input */
+      uint32_t length = jp_measure_value(data + position, size - position, codecs, key_index);
+
+      if (0 == length)
+        return -1;
+
+      position += length;
+    }
+  }
+
+  return (position == size) ? 0 : -1;
+}
+
+/* copies a section listing an entry per key, each starting with its uint32 key index, renumbering the keys */
+static int jp_transcode_section(      jp_buffer_io_t *buffer,
+                                const uint8_t        *section,
+                                      uint64_t        length,
+                                      size_t          entry_size,
+                                const uint32_t       *keys,
+                                      uint32_t        nb_keys)
+{
+  uint32_t nb_entries;
+  uint8_t* copy = jp_buffer_io_memcpy_to(buffer, section, length - JP_BLOCK_CRC_SIZE);
+
+  if (NULL == copy)
+    return -1;
+
+  memcpy(& nb_entries, copy, sizeof(uint32_t));
+
+  for (uint32_t i = 0; i < nb_entries; i++) {
+    uint8_t* entry = copy + sizeof(uint32_t) + (size_t) i * entry_size;
+    uint32_t key_index;
+
+    memcpy(& key_index, entry, sizeof(uint32_t));
+
+    if (key_index >= nb_keys || 0 == keys[key_index])
+      return -1;
+
+    memcpy(entry, & keys[key_index], sizeof(uint32_t));
+  }
+
+  uint32_t crc = jp_crc32c(0, copy, length - JP_BLOCK_CRC_SIZE);
+
+  return (NULL == jp_buffer_io_memcpy_to(buffer, & crc, sizeof(uint32_t))) ? -1 : 0;
+}
+
+/* writes a block renumbered, returns its length, 0 on error */
+static uint32_t jp_transcode_block(      jp_buffer_io_t  *buffer,
+                                   const uint8_t         *data,
+                                         uint64_t         size,
+                                   const uint32_t        *keys,
+                                         uint32_t         nb_keys,
+                                         jp_key_codecs_t *codecs)
+{
+  uint32_t tag, flags, nb_records, payload_length;
+
+  if (size < JP_BLOCK_HEADER_SIZE)
+    return 0;
+
+  memcpy(& tag, data, sizeof(uint32_t));
+  memcpy(& flags, data + 4, sizeof(uint32_t));
+  memcpy(& nb_records, data + 8, sizeof(uint32_t));
+  memcpy(& payload_length, data + 12, sizeof(uint32_t));
+
+  uint64_t crc_size = (flags & JP_BLOCK_FLAG_CRC32C) ? JP_BLOCK_CRC_SIZE : 0;
+  uint64_t position = JP_BLOCK_HEADER_SIZE + (uint64_t) payload_length + crc_size;
+
+  if (JP_BLOCK_TAG != tag || (flags & JP_BLOCK_FLAG_ORDER) || position > size)
+    return 0;
+
+  /* the sections were checked with the blocks, only their lengths are needed */
+  uint64_t encodings        = position;
+  uint64_t encodings_length = 0;
+
+  jp_key_codecs_reset(codecs);
+
+  if ((flags & JP_BLOCK_FLAG_ENCODINGS) && 0 == (encodings_length = jp_key_codecs_read(data + position, size - position, codecs)))
+    return 0;
+
+  position += encodings_length;
+
+  if (flags & JP_BLOCK_FLAG_FILTER) {
+    jp_block_filter_t filter;
+    uint64_t          filter_length = jp_block_filter_read(data + position, size - position, & filter);
+
+    if (0 == filter_length)
+      return 0;
+
+    position += filter_length;
+  }
+
+  uint64_t zone_map        = position;
+  uint64_t zone_map_length = 0;
+
+  if (flags & JP_BLOCK_FLAG_ZONE_MAP) {
+    jp_block_zone_map_t map;
+
+    if (0 == (zone_map_length = jp_block_zone_map_read(data + position, size - position, & map)))
+      return 0;
+  }
+
+  uint32_t out_flags  = (flags & ~JP_BLOCK_FLAG_FILTER) | JP_BLOCK_FLAG_CRC32C;
+  uint64_t out_length = JP_BLOCK_HEADER_SIZE + (uint64_t) payload_length + JP_BLOCK_CRC_SIZE + encodings_length + zone_map_length;
+
+  /* the whole block is assembled in the buffer before it may be flushed */
+  if (out_length > UINT32_MAX || 0 != jp_buffer_io_reserve(buffer, out_length))
+    return 0;
+
+  jp_buffer_io_memcpy_to(buffer, & tag, sizeof(uint32_t));
+  jp_buffer_io_memcpy_to(buffer, & out_flags, sizeof(uint32_t));
+  jp_buffer_io_memcpy_to(buffer, & nb_records, sizeof(uint32_t));
+  jp_buffer_io_memcpy_to(buffer, & payload_length, sizeof(uint32_t));
+
+  uint8_t* payload = jp_buffer_io_memcpy_to(buffer, data + JP_BLOCK_HEADER_SIZE, payload_length);
+
+  if ((payload_length > 0 && NULL == payload) ||
+      0 != jp_transcode_records(payload, payload_length, nb_records, keys, nb_keys, codecs))
+    return 0;
+
+  uint32_t crc = jp_crc32c(0, payload, payload_length);
+
+  jp_buffer_io_memcpy_to(buffer, & crc, sizeof(uint32_t));
+
+  if (encodings_length > 0 &&
+      0 != jp_transcode_section(buffer, data + encodings, encodings_length, JP_ENCODING_ENTRY_SIZE, keys, nb_keys))
+    return 0;
+
+  if (zone_map_length > 0 &&
+      0 != jp_transcode_section(buffer, data + zone_map, zone_map_length, JP_ZONE_MAP_ENTRY_SIZE, keys, nb_keys))
+    return 0;
+
+  return (uint32_t) out_length;
+}
+
+int jp_transcode_file_sets(apr_pool_t   *pool,
+                           FILE* const  *kv_pair_inputs,
+                           FILE* const  *key_index_inputs,
+                           int           nb_inputs,
+                           FILE         *kv_pair_output,
+                           FILE         *key_index_output)
+{
+  apr_pool_t* run_pool;
+
+  if (APR_SUCCESS != apr_pool_create(& run_pool, pool))
+    return -1;
+
+  const uint8_t**      data           = apr_pcalloc(run_pool, nb_inputs * sizeof(const uint8_t*));
+  size_t*              sizes          = apr_pcalloc(run_pool, nb_inputs * sizeof(size_t));
+  uint64_t*            offsets        = apr_pcalloc(run_pool, nb_inputs * sizeof(uint64_t));
+  uint64_t*            footer_offsets = apr_pcalloc(run_pool, nb_inputs * sizeof(uint64_t));
+  uint32_t*            nb_blocks      = apr_pcalloc(run_pool, nb_inputs * sizeof(uint32_t));
+  jp_key_index_map_t** maps           = apr_pcalloc(run_pool, nb_inputs * sizeof(jp_key_index_map_t*));
+  uint32_t**           keys           = apr_pcalloc(run_pool, nb_inputs * sizeof(uint32_t*));
+  apr_hash_t*          key_index      = apr_hash_make(run_pool);
+  uint64_t             nb_records     = 0;
+  int                  ret            = 0;
+
+  /* everything is checked before a byte is written, so that the caller can decode the file sets instead */
+  for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+    uint64_t input_records, verified_records;
+    uint32_t verified_blocks, unchecked_blocks;
+
+    if (0 != jp_map_file_set(run_pool, kv_pair_inputs[i], key_index_inputs ? key_index_inputs[i] : NULL,
+                             & data[i], & sizes[i], & offsets[i], & maps[i], 1)) {
+      ret = -1;
+      break;
+    }
+
+    /* the files written before the block framing have no blocks to copy */
+    ret = jp_block_verify(data[i], sizes[i], offsets[i], & verified_records, & verified_blocks, & unchecked_blocks);
+
+    if (0 == ret && 0 != jp_scan_read_footer(data[i], sizes[i], offsets[i], & footer_offsets[i], & input_records, & nb_blocks[i]))
+      ret = -1;
+
+    /* the arrival ordinals of clustered blocks are only meaningful within their file */
+    for (uint32_t b = 0; b < nb_blocks[i] && 0 == ret; b++) {
+      uint64_t block_offset;
+      uint32_t flags;
+
+      memcpy(& block_offset, data[i] + footer_offsets[i] + 3 * sizeof(uint32_t) + sizeof(uint64_t) + (uint64_t) b * JP_BLOCK_INDEX_ENTRY_SIZE,
+             sizeof(uint64_t));
+      memcpy(& flags, data[i] + block_offset + sizeof(uint32_t), sizeof(uint32_t));
+
+      if (flags & JP_BLOCK_FLAG_ORDER)
+        ret = 1;
+    }
+
+    uint32_t nb_keys = jp_key_index_map_count(maps[i]);
+
+    keys[i] = apr_pcalloc(run_pool, (nb_keys + 1) * sizeof(uint32_t));
+
+    for (uint32_t k = 1; k <= nb_keys && 0 == ret; k++)
+      keys[i][k] = jp_find_or_add_key(key_index, jp_key_index_map_key(maps[i], k, NULL));
+
+    nb_records += input_records;
+  }
+
+  uint64_t base_offset = 0;
+
+  if (0 == ret && NULL == key_index_output && 0 == (base_offset = jp_write_container_prelude(key_index, kv_pair_output)))
+    ret = -1;
+
+  if (0 == ret) {
+    jp_buffer_io_t      buffer;
+    jp_key_codecs_t*    codecs      = jp_key_codecs_make(run_pool);
+    apr_array_header_t* block_index = apr_array_make(run_pool, 256, sizeof(jp_block_index_entry_t));
+    uint64_t            position    = base_offset + 2 * sizeof(uint32_t);
+
+    jp_buffer_io_write_initialize(& buffer, run_pool, kv_pair_output);
+
+    if (0 == jp_export_uint32_to_buffer(JP_KV_PAIR_MAGIC, & buffer) ||
+        0 == jp_export_uint32_to_buffer(JP_KV_PAIR_FORMAT_VERSION, & buffer))
+      ret = -1;
+
+    for (int i = 0; i < nb_inputs && 0 == ret; i++) {
+      uint32_t nb_keys = jp_key_index_map_count(maps[i]) + 1;
+
+      for (uint32_t b = 0; b < nb_blocks[i] && 0 == ret; b++) {
+        jp_block_index_entry_t* entry = apr_array_push(block_index);
+
+        memcpy(entry, data[i] + footer_offsets[i] + 3 * sizeof(uint32_t) + sizeof(uint64_t) + (uint64_t) b * JP_BLOCK_INDEX_ENTRY_SIZE,
+               JP_BLOCK_INDEX_ENTRY_SIZE);
+
+        uint32_t length = jp_transcode_block(& buffer, data[i] + entry->offset, footer_offsets[i] - entry->offset,
+                                             keys[i], nb_keys, codecs);
+
+        if (0 == length) {
+          fprintf(stderr, "jp_transcode_file_sets: cannot renumber block %" PRIu32 " of file set %d \n", b, i);
+          ret = -1;
+        }
+
+        entry->offset  = position;
+        entry->length  = length;
+        position      += length;
+      }
+    }
+
+    if (0 == ret && 0 != jp_block_footer_write(& buffer, block_index, nb_records, position))
+      ret = -1;
+
+    jp_buffer_io_flush_writes(& buffer);
+
+    if (buffer.write_error)
+      ret = -1;
+  }
+
+  if (0 == ret && key_index_output && 0 != jp_export_key_index_to_file(key_index, key_index_output))
+    ret = -1;
+
+  for (int i = 0; i < nb_inputs; i++)
+    if (maps[i])
+      jp_key_index_map_close(maps[i]);
+
+  apr_pool_destroy(run_pool);
+
+  return ret;
+}
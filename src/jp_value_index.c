@@ -0,0 +1,401 @@
+
+#include <apr_tables.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+/*
+ *  Value index file layout, a sidecar of a kv-pair file listing the blocks where the values of
+ *  a few keys are found:
+ *
+ *  - header: uint32 JP_VALUE_INDEX_MAGIC, uint32 format version, uint32 number of keys, uint32
+ *    number of blocks, uint64 number of records and uint64 footer offset of the kv-pair file
+ *    indexed, uint32 CRC32C of the header and of the tables up to the key names, uint32 reserved
+ *
+ *  - for every block of the kv-pair file: the uint64 number of its first record
+ *
+ *  - for every key indexed: uint64 offset and uint32 length of its name, uint32 number of
+ *    fences, uint64 offset of its fences, uint64 offset and uint64 number of its entries
+ *
+ *  - the key names, each one followed by a NUL character, padded to 8 bytes
+ *
+ *  - for every key: its fences, the uint32 hash of every JP_VALUE_INDEX_FENCE_STRIDE-th entry,
+ *    padded to 8 bytes, then its entries, a uint32 jp_string_hash of a value and the uint32 block
+ *    holding it, sorted and without duplicates
+ *
+ *  The strings are hashed as they are and the integers as their decimal text, the other values
+ *  are not indexed. A lookup binary searches the fences, a few pages, and reads the entries of
+ *  the hash from the page of its fence on: the blocks listed are the only ones decoded, those
+ *  with a colliding value included, and the records are then matched against the value itself.
+ *
+ *  The blocks, the records and the footer offset of the kv-pair file tell whether it changed
+ *  since it was indexed, an index is only used with the file set it was built from.
+ */
+
+#define JP_VALUE_INDEX_MAGIC           0x5856504A /* "JPVX" */
+#define JP_VALUE_INDEX_FORMAT_VERSION  1
+
+#define JP_VALUE_INDEX_HEADER_SIZE     (6 * sizeof(uint32_t) + 2 * sizeof(uint64_t))
+#define JP_VALUE_INDEX_KEY_SIZE        (4 * sizeof(uint64_t) + 2 * sizeof(uint32_t))
+#define JP_VALUE_INDEX_ENTRY_SIZE      (2 * sizeof(uint32_t))
+#define JP_VALUE_INDEX_FENCE_STRIDE    512
+
+typedef struct jp_value_index_entry
+{
+  uint32_t hash;
+  uint32_t block;
+} jp_value_index_entry_t;
+
+struct jp_value_index_builder
+{
+  apr_pool_t          *pool;
+  int                  nb_keys;
+  const char         **keys;
+  apr_array_header_t **entries;
+  int                 *block_starts;
+  uint32_t             block;
+};
+
+struct jp_value_index
+{
+  const uint8_t *base;
+  size_t         size;
+  uint32_t       nb_keys;
+  uint32_t       nb_blocks;
+  uint64_t       nb_records;
+  uint64_t       footer_offset;
+};
+
+static inline uint32_t jp_value_index_read_uint32(const uint8_t *base, uint64_t offset)
+{
+  uint32_t value;
+  memcpy(& value, base + offset, sizeof(uint32_t));
+
+  return value;
+}
+
+static inline uint64_t jp_value_index_read_uint64(const uint8_t *base, uint64_t offset)
+{
+  uint64_t value;
+  memcpy(& value, base + offset, sizeof(uint64_t));
+
+  return value;
+}
+
+static inline uint64_t jp_value_index_pad(uint64_t offset)
+{
+  return (offset + 7) & ~(uint64_t) 7;
+}
+
+static int jp_compare_value_index_entries(const void *a, const void *b)
+{
+  const jp_value_index_entry_t* left  = a;
+  const jp_value_index_entry_t* right = b;
+
+  if (left->hash != right->hash)
+    return (left->hash < right->hash) ? -1 : 1;
+
+  return (left->block < right->block) ? -1 : (left->block > right->block);
+}
+
+/* sorts the entries from start on and drops their duplicates */
+static void jp_value_index_entries_compact(apr_array_header_t *entries,
+                                           int                 start)
+{
+  jp_value_index_entry_t* values = (jp_value_index_entry_t*) entries->elts;
+  int                     kept   = start;
+
+  if (entries->nelts - start < 2)
+    return;
+
+  qsort(values + start, entries->nelts - start, sizeof(jp_value_index_entry_t), jp_compare_value_index_entries);
+
+  for (int i = start; i < entries->nelts; i++)
+    if (kept == start || 0 != jp_compare_value_index_entries(& values[kept - 1], & values[i]))
+      values[kept++] = values[i];
+
+  entries->nelts = kept;
+}
+
+int jp_value_index_hash(const jp_TLV_kv_pair_t *kv_pair,
+                        uint32_t               *hash)
+{
+  if (JP_TYPE_STRING == kv_pair->value_type) {
+    *hash = jp_string_hash(kv_pair->union_v.string_value.value_buffer, kv_pair->union_v.string_value.value_length);
+    return 1;
+  }
+
+  if (JP_TYPE_INTEGER == kv_pair->value_type) {
+    char text[16];
+    int  length = snprintf(text, sizeof(text), "%" PRId32, kv_pair->union_v.integer_value);
+
+    *hash = jp_string_hash(text, length);
+    return 1;
+  }
+
+  return 0;
+}
+
+jp_value_index_builder_t* jp_value_index_builder_make(      apr_pool_t  *pool,
+                                                      const char* const *keys,
+                                                            int          nb_keys)
+{
+  jp_value_index_builder_t* builder = apr_pcalloc(pool, sizeof(jp_value_index_builder_t));
+
+  builder->pool         = pool;
+  builder->nb_keys      = nb_keys;
+  builder->keys         = apr_palloc(pool, nb_keys * sizeof(const char*));
+  builder->entries      = apr_palloc(pool, nb_keys * sizeof(apr_array_header_t*));
+  builder->block_starts = apr_pcalloc(pool, nb_keys * sizeof(int));
+
+  for (int i = 0; i < nb_keys; i++) {
+    builder->keys[i]    = keys[i];
+    builder->entries[i] = apr_array_make(pool, 1024, sizeof(jp_value_index_entry_t));
+  }
+
+  return builder;
+}
+
+void jp_value_index_builder_add(jp_value_index_builder_t *builder,
+                                int                       key,
+                                uint32_t                  hash,
+                                uint32_t                  block)
+{
+  /* the values repeating within a block are only listed once, which bounds the entries kept */
+  if (block != builder->block) {
+    for (int i = 0; i < builder->nb_keys; i++) {
+      jp_value_index_entries_compact(builder->entries[i], builder->block_starts[i]);
+      builder->block_starts[i] = builder->entries[i]->nelts;
+    }
+
+    builder->block = block;
+  }
+
+  jp_value_index_entry_t* entry = apr_array_push(builder->entries[key]);
+
+  entry->hash  = hash;
+  entry->block = block;
+}
+
+int jp_value_index_write(      jp_value_index_builder_t *builder,
+                         const uint64_t                 *block_records,
+                               uint32_t                  nb_blocks,
+                               uint64_t                  nb_records,
+                               uint64_t                  footer_offset,
+                               FILE                     *output)
+{
+  uint64_t names_offset = JP_VALUE_INDEX_HEADER_SIZE + (uint64_t) nb_blocks * sizeof(uint64_t) +
+                          (uint64_t) builder->nb_keys * JP_VALUE_INDEX_KEY_SIZE;
+  uint64_t offset       = names_offset;
+
+  for (int i = 0; i < builder->nb_keys; i++)
+    offset += strlen(builder->keys[i]) + 1;
+
+  uint64_t tables_offset = jp_value_index_pad(offset);
+  uint8_t* tables        = apr_pcalloc(builder->pool, tables_offset);
+
+  memcpy(tables + JP_VALUE_INDEX_HEADER_SIZE, block_records, (size_t) nb_blocks * sizeof(uint64_t));
+
+  offset = tables_offset;
+
+  uint64_t name_offset = names_offset;
+  uint8_t* directory   = tables + JP_VALUE_INDEX_HEADER_SIZE + (size_t) nb_blocks * sizeof(uint64_t);
+
+  for (int i = 0; i < builder->nb_keys; i++, directory += JP_VALUE_INDEX_KEY_SIZE) {
+    apr_array_header_t* entries = builder->entries[i];
+
+    /* the whole key this time, the entries of a value are spread over the blocks */
+    jp_value_index_entries_compact(entries, 0);
+
+    uint32_t name_length    = strlen(builder->keys[i]);
+    uint32_t nb_fences      = (entries->nelts + JP_VALUE_INDEX_FENCE_STRIDE - 1) / JP_VALUE_INDEX_FENCE_STRIDE;
+    uint64_t fences_offset  = offset;
+    uint64_t entries_offset = jp_value_index_pad(fences_offset + (uint64_t) nb_fences * sizeof(uint32_t));
+    uint64_t nb_entries     = entries->nelts;
+
+    memcpy(tables + name_offset, builder->keys[i], name_length + 1);
+
+    memcpy(directory, & name_offset, sizeof(uint64_t));
+    memcpy(directory + 8, & name_length, sizeof(uint32_t));
+    memcpy(directory + 12, & nb_fences, sizeof(uint32_t));
+    memcpy(directory + 16, & fences_offset, sizeof(uint64_t));
+    memcpy(directory + 24, & entries_offset, sizeof(uint64_t));
+    memcpy(directory + 32, & nb_entries, sizeof(uint64_t));
+
+    name_offset += name_length + 1;
+    offset       = entries_offset + nb_entries * JP_VALUE_INDEX_ENTRY_SIZE;
+  }
+
+  uint32_t header[4] = { JP_VALUE_INDEX_MAGIC, JP_VALUE_INDEX_FORMAT_VERSION, builder->nb_keys, nb_blocks };
+
+  memcpy(tables, header, sizeof(header));
+  memcpy(tables + 16, & nb_records, sizeof(uint64_t));
+  memcpy(tables + 24, & footer_offset, sizeof(uint64_t));
+
+  uint32_t crc = jp_crc32c(jp_crc32c(0, tables, 32), tables + JP_VALUE_INDEX_HEADER_SIZE, tables_offset - JP_VALUE_INDEX_HEADER_SIZE);
+
+  memcpy(tables + 32, & crc, sizeof(uint32_t));
+
+  if (1 != fwrite(tables, tables_offset, 1, output))
+    return -1;
+
+  static const uint8_t padding[8] = { 0 };
+
+  for (int i = 0; i < builder->nb_keys; i++) {
+    apr_array_header_t*     entries   = builder->entries[i];
+    jp_value_index_entry_t* values    = (jp_value_index_entry_t*) entries->elts;
+    uint32_t                nb_fences = (entries->nelts + JP_VALUE_INDEX_FENCE_STRIDE - 1) / JP_VALUE_INDEX_FENCE_STRIDE;
+
+    for (uint32_t fence = 0; fence < nb_fences; fence++)
+      if (1 != fwrite(& values[(size_t) fence * JP_VALUE_INDEX_FENCE_STRIDE].hash, sizeof(uint32_t), 1, output))
+        return -1;
+
+    if (nb_fences & 1 && 1 != fwrite(padding, sizeof(uint32_t), 1, output))
+      return -1;
+
+    for (int j = 0; j < entries->nelts; j++)
+      if (1 != fwrite(& values[j], JP_VALUE_INDEX_ENTRY_SIZE, 1, output))
+        return -1;
+  }
+
+  return (0 == fflush(output)) ? 0 : -1;
+}
+
+jp_value_index_t* jp_value_index_open(apr_pool_t *pool,
+                                      FILE       *input)
+{
+  jp_value_index_t* index = apr_pcalloc(pool, sizeof(jp_value_index_t));
+
+  index->base = jp_map_file(pool, input, 0, & index->size);
+
+  if (index->size < JP_VALUE_INDEX_HEADER_SIZE || JP_VALUE_INDEX_MAGIC != jp_value_index_read_uint32(index->base, 0)) {
+    fprintf(stderr, "jp_value_index_open: not a value index \n");
+    return NULL;
+  }
+
+  if (JP_VALUE_INDEX_FORMAT_VERSION < jp_value_index_read_uint32(index->base, 4)) {
+    fprintf(stderr, "jp_value_index_open: unsupported value index \n");
+    return NULL;
+  }
+
+  index->nb_keys       = jp_value_index_read_uint32(index->base, 8);
+  index->nb_blocks     = jp_value_index_read_uint32(index->base, 12);
+  index->nb_records    = jp_value_index_read_uint64(index->base, 16);
+  index->footer_offset = jp_value_index_read_uint64(index->base, 24);
+
+  uint64_t directory_offset = JP_VALUE_INDEX_HEADER_SIZE + (uint64_t) index->nb_blocks * sizeof(uint64_t);
+  uint64_t names_offset     = directory_offset + (uint64_t) index->nb_keys * JP_VALUE_INDEX_KEY_SIZE;
+
+  if (names_offset > index->size) {
+    fprintf(stderr, "jp_value_index_open: truncated value index \n");
+    return NULL;
+  }
+
+  /* the key names end where the tables of the first key start */
+  uint64_t tables_offset = (index->nb_keys > 0) ? jp_value_index_read_uint64(index->base, directory_offset + 16) : names_offset;
+
+  if (tables_offset < names_offset || tables_offset > index->size ||
+      jp_value_index_read_uint32(index->base, 32) != jp_crc32c(jp_crc32c(0, index->base, 32), index->base + JP_VALUE_INDEX_HEADER_SIZE,
+                                                               tables_offset - JP_VALUE_INDEX_HEADER_SIZE)) {
+    fprintf(stderr, "jp_value_index_open: value index checksum mismatch \n");
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < index->nb_keys; i++) {
+    uint64_t key            = directory_offset + (uint64_t) i * JP_VALUE_INDEX_KEY_SIZE;
+    uint64_t name_offset    = jp_value_index_read_uint64(index->base, key);
+    uint32_t name_length    = jp_value_index_read_uint32(index->base, key + 8);
+    uint32_t nb_fences      = jp_value_index_read_uint32(index->base, key + 12);
+    uint64_t fences_offset  = jp_value_index_read_uint64(index->base, key + 16);
+    uint64_t entries_offset = jp_value_index_read_uint64(index->base, key + 24);
+    uint64_t nb_entries     = jp_value_index_read_uint64(index->base, key + 32);
+
+    if (name_offset < names_offset || name_offset + name_length >= tables_offset || '\0' != index->base[name_offset + name_length] ||
+        nb_fences != (nb_entries + JP_VALUE_INDEX_FENCE_STRIDE - 1) / JP_VALUE_INDEX_FENCE_STRIDE ||
+        fences_offset + (uint64_t) nb_fences * sizeof(uint32_t) > entries_offset ||
+        entries_offset > index->size || (index->size - entries_offset) / JP_VALUE_INDEX_ENTRY_SIZE < nb_entries) {
+      fprintf(stderr, "jp_value_index_open: key %u is out of the value index bounds \n", i);
+      return NULL;
+    }
+  }
+
+  return index;
+}
+
+int jp_value_index_matches(const jp_value_index_t *index,
+                                 uint64_t          nb_records,
+                                 uint32_t          nb_blocks,
+                                 uint64_t          footer_offset)
+{
+  return index->nb_records == nb_records && index->nb_blocks == nb_blocks && index->footer_offset == footer_offset;
+}
+
+uint64_t jp_value_index_block_record(const jp_value_index_t *index,
+                                           uint32_t          block)
+{
+  return jp_value_index_read_uint64(index->base, JP_VALUE_INDEX_HEADER_SIZE + (uint64_t) block * sizeof(uint64_t));
+}
+
+int jp_value_index_find(const jp_value_index_t *index,
+                        const char             *key,
+                        const char             *value,
+                        apr_array_header_t     *blocks)
+{
+  uint64_t directory_offset = JP_VALUE_INDEX_HEADER_SIZE + (uint64_t) index->nb_blocks * sizeof(uint64_t);
+  uint64_t entry            = 0;
+
+  for (uint32_t i = 0; i < index->nb_keys && 0 == entry; i++) {
+    uint64_t candidate = directory_offset + (uint64_t) i * JP_VALUE_INDEX_KEY_SIZE;
+
+    if (0 == strcmp(key, (const char*) index->base + jp_value_index_read_uint64(index->base, candidate)))
+      entry = candidate;
+  }
+
+  if (0 == entry) {
+    fprintf(stderr, "jp_value_index_find: the key %s is not indexed \n", key);
+    return -1;
+  }
+
+  uint32_t nb_fences      = jp_value_index_read_uint32(index->base, entry + 12);
+  uint64_t fences_offset  = jp_value_index_read_uint64(index->base, entry + 16);
+  uint64_t entries_offset = jp_value_index_read_uint64(index->base, entry + 24);
+  uint64_t nb_entries     = jp_value_index_read_uint64(index->base, entry + 32);
+  uint32_t hash           = jp_string_hash(value, strlen(value));
+
+  /* the first fence not below the hash, the entries of the hash may start in the stride before it */
+  uint32_t low = 0, high = nb_fences;
+
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+
+    if (jp_value_index_read_uint32(index->base, fences_offset + (uint64_t) middle * sizeof(uint32_t)) < hash)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  uint64_t position = (low > 0) ? (uint64_t)(low - 1) * JP_VALUE_INDEX_FENCE_STRIDE : 0;
+
+  for (; position < nb_entries; position++) {
+    uint64_t offset      = entries_offset + position * JP_VALUE_INDEX_ENTRY_SIZE;
+    uint32_t entry_hash  = jp_value_index_read_uint32(index->base, offset);
+    uint32_t entry_block = jp_value_index_read_uint32(index->base, offset + 4);
+
+    if (entry_hash > hash)
+      break;
+
+    if (entry_hash == hash) {
+      if (entry_block >= index->nb_blocks) {
+        fprintf(stderr, "jp_value_index_find: entry %" PRIu64 " is out of the blocks \n", position);
+        return -1;
+      }
+
+      *(uint32_t*) apr_array_push(blocks) = entry_block;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,116 @@
+
+#include <apr_pools.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+
+#include "jp_tlv_encoder.h"
+
+
+typedef struct jp_worker_pool
+{
+  jp_worker_task_fn   task_fn;
+  void               *context;
+  size_t              nb_tasks;
+  size_t              next_task;
+  size_t              nb_failures;
+
+#if APR_HAS_THREADS
+  apr_thread_mutex_t *mutex;
+#endif
+
+} jp_worker_pool_t;
+
+/* workers pull the next task until there are none left */
+static void jp_worker_pool_work(jp_worker_pool_t *workers)
+{
+  while (1) {
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(workers->mutex);
+#endif
+
+    size_t task = workers->next_task++;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(workers->mutex);
+#endif
+
+    if (task >= workers->nb_tasks)
+      break;
+
+    int ret = workers->task_fn(workers->context, task);
+
+    if (0 != ret) {
+#if APR_HAS_THREADS
+      apr_thread_mutex_lock(workers->mutex);
+#endif
+
+      workers->nb_failures++;
+
+#if APR_HAS_THREADS
+      apr_thread_mutex_unlock(workers->mutex);
+#endif
+    }
+  }
+}
+
+#if APR_HAS_THREADS
+
+static void* APR_THREAD_FUNC jp_worker_pool_thread(apr_thread_t *thread,
+                                                   void         *data)
+{
+  jp_worker_pool_work(data);
+
+  apr_thread_exit(thread, APR_SUCCESS);
+  return NULL;
+}
+
+#endif
+
+size_t jp_worker_pool_run(apr_pool_t        *pool,
+                          unsigned int       nb_workers,
+                          size_t             nb_tasks,
+                          jp_worker_task_fn  task_fn,
+                          void              *context)
+{
+  apr_pool_t*      workers_pool;
+  jp_worker_pool_t workers;
+
+  workers.task_fn     = task_fn;
+  workers.context     = context;
+  workers.nb_tasks    = nb_tasks;
+  workers.next_task   = 0;
+  workers.nb_failures = 0;
+
+  if (nb_workers > nb_tasks)
+    nb_workers = nb_tasks;
+
+  if (APR_SUCCESS != apr_pool_create(& workers_pool, pool))
+    return nb_tasks;
+
+#if APR_HAS_THREADS
+  apr_thread_t** threads    = apr_pcalloc(workers_pool, (nb_workers + 1) * sizeof(apr_thread_t*));
+  unsigned int   nb_threads = 0;
+
+  if (APR_SUCCESS == apr_thread_mutex_create(& workers.mutex, APR_THREAD_MUTEX_DEFAULT, workers_pool)) {
+    /* the calling thread is one of the workers */
+    while (nb_threads + 1 < nb_workers &&
+           APR_SUCCESS == apr_thread_create(& threads[nb_threads], NULL, jp_worker_pool_thread, & workers, workers_pool))
+      nb_threads++;
+
+    jp_worker_pool_work(& workers);
+
+    for (unsigned int i = 0; i < nb_threads; i++) {
+      apr_status_t thread_rv;
+      apr_thread_join(& thread_rv, threads[i]);
+    }
+  }
+  else
+    workers.nb_failures = nb_tasks;
+#else
+  jp_worker_pool_work(& workers);
+#endif
+
+  apr_pool_destroy(workers_pool);
+
+  return workers.nb_failures;
+}
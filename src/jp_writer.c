@@ -0,0 +1,186 @@
+
+#include <apr_hash.h>
+
+#include <jp_tlv_encoder.h>
+#include "jp_tlv_encoder_private.h"
+
+/*
+ *  Records are encoded field by field straight into the buffer of the block being assembled:
+ *  the pair count of a record is written as a placeholder by jp_writer_begin_record, and patched
+ *  by jp_writer_end_record. The block buffer is only flushed between records, and it only grows
+ *  for records larger than the ones before, so a steady stream of records allocates nothing.
+ */
+
+struct jp_writer
+{
+  jp_block_writer_t  block_writer;
+  apr_hash_t        *key_index;
+  FILE              *key_index_output;
+  size_t             record_offset;
+  uint32_t           record_pairs;
+  uint32_t           record_length;
+  int                record_open;
+  int                failed;
+};
+
+jp_writer_t* jp_writer_open(apr_pool_t *pool,
+                            FILE       *kv_pair_output,
+                            FILE       *key_index_output)
+{
+  if (NULL == key_index_output) {
+    fprintf(stderr, "jp_writer_open: the key index is only known once the records are written, it needs its own file \n");
+    return NULL;
+  }
+
+  jp_writer_t* writer = apr_pcalloc(pool, sizeof(jp_writer_t));
+
+  if (0 != jp_block_writer_open(& writer->block_writer, pool, kv_pair_output, 0))
+    return NULL;
+
+  /* the strings are borrowed for the duration of a call only, and the records are not held back to choose encodings */
+  writer->block_writer.buffer.no_references = 1;
+  writer->block_writer.buffer.codecs        = NULL;
+
+  writer->key_index        = apr_hash_make(pool);
+  writer->key_index_output = key_index_output;
+
+  return writer;
+}
+
+uint32_t jp_writer_key(      jp_writer_t *writer,
+                       const char        *key)
+{
+  return jp_find_or_add_key(writer->key_index, key);
+}
+
+int jp_writer_begin_record(jp_writer_t *writer)
+{
+  if (writer->failed || writer->record_open)
+    return -1;
+
+  if (0 != jp_block_writer_begin_record(& writer->block_writer)) {
+    writer->failed = 1;
+    return -1;
+  }
+
+  jp_block_writer_save_record(& writer->block_writer);
+
+  writer->record_offset = writer->block_writer.buffer.used;
+  writer->record_pairs  = 0;
+
+  writer->record_length = jp_export_uint32_to_buffer(0, & writer->block_writer.buffer);
+
+  if (0 == writer->record_length) {
+    writer->failed = 1;
+    return -1;
+  }
+
+  writer->record_open = 1;
+
+  return 0;
+}
+
+static int jp_writer_add_kv_pair(jp_writer_t      *writer,
+                                 jp_TLV_kv_pair_t *kv_pair)
+{
+  if (writer->failed || !writer->record_open)
+    return -1;
+
+  /* an unknown key is refused, the record stays consistent */
+  if (0 == kv_pair->key_index || kv_pair->key_index > apr_hash_count(writer->key_index)) {
+    fprintf(stderr, "jp_writer_add: key id %u was not returned by jp_writer_key \n", kv_pair->key_index);
+    return -1;
+  }
+
+  uint32_t written = jp_export_kv_pair_to_buffer(kv_pair, & writer->block_writer.buffer);
+
+  if (0 == written) {
+    writer->failed = 1;
+    return -1;
+  }
+
+  jp_block_writer_index_kv_pair(& writer->block_writer, kv_pair);
+
+  writer->record_pairs  += 1;
+  writer->record_length += written;
+
+  return 0;
+}
+
+int jp_writer_add_boolean(jp_writer_t *writer,
+                          uint32_t     key_id,
+                          int          value)
+{
+  jp_TLV_kv_pair_t kv_pair = { .key_index = key_id, .value_type = JP_TYPE_BOOLEAN };
+
+  kv_pair.union_v.integer_value = !! value;
+
+  return jp_writer_add_kv_pair(writer, & kv_pair);
+}
+
+int jp_writer_add_int(jp_writer_t *writer,
+                      uint32_t     key_id,
+                      int32_t      value)
+{
+  jp_TLV_kv_pair_t kv_pair = { .key_index = key_id, .value_type = JP_TYPE_INTEGER };
+
+  kv_pair.union_v.integer_value = value;
+
+  return jp_writer_add_kv_pair(writer, & kv_pair);
+}
+
+int jp_writer_add_double(jp_writer_t *writer,
+                         uint32_t     key_id,
+                         double       value)
+{
+  jp_TLV_kv_pair_t kv_pair = { .key_index = key_id, .value_type = JP_TYPE_DOUBLE };
+
+  kv_pair.union_v.double_value = value;
+
+  return jp_writer_add_kv_pair(writer, & kv_pair);
+}
+
+int jp_writer_add_string(      jp_writer_t *writer,
+                               uint32_t     key_id,
+                         const char        *value,
+                               uint32_t     length)
+{
+  jp_TLV_kv_pair_t kv_pair = { .key_index = key_id, .value_type = JP_TYPE_STRING };
+
+  /* only read, and copied into the block before returning */
+  kv_pair.union_v.string_value.value_buffer = (char*) value;
+  kv_pair.union_v.string_value.value_length = length;
+
+  return jp_writer_add_kv_pair(writer, & kv_pair);
+}
+
+int jp_writer_end_record(jp_writer_t *writer)
+{
+  if (writer->failed || !writer->record_open)
+    return -1;
+
+  memcpy(writer->block_writer.buffer.current_buffer + writer->record_offset, & writer->record_pairs, sizeof(uint32_t));
+
+  writer->record_open = 0;
+
+  if (0 != jp_block_writer_end_record(& writer->block_writer, writer->record_length)) {
+    writer->failed = 1;
+    return -1;
+  }
+
+  return 0;
+}
+
+int jp_writer_close(jp_writer_t *writer)
+{
+  /* a record left open is dropped, with what its kv-pairs added to the filter and the zone map */
+  if (writer->record_open) {
+    jp_block_writer_drop_record(& writer->block_writer);
+    writer->record_open = 0;
+  }
+
+  if (writer->failed || 0 != jp_block_writer_close(& writer->block_writer))
+    return -1;
+
+  return jp_export_key_index_to_file(writer->key_index, writer->key_index_output);
+}
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+# Compacts a directory of file sets in size tiers, then interrupts two merges the way a crash
+# would, one after its output was renamed into place and one before, and compacts again. The
+# records must come out of the directory unchanged every time, none lost and none twice, and
+# no temporary file, manifest or stale value index may be left behind.
+
+RED="\033[1;31m"
+GREEN="\033[1;32m"
+WHITE="\033[0m"
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/jp_compaction.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+SETS="$WORK/sets"
+mkdir -p "$SETS" || exit 1
+
+status=0
+
+fail() {
+	echo "$1"
+	status=1
+}
+
+# packs part N of the corpus into the directory, with a value index
+pack_part() {
+	"$TOOLS/json_corpus" --shape mixed --seed "$1" --records 300 "$WORK/part-$1.json" 2>/dev/null &&
+	"$TOOLS/json_packer" --index host "$WORK/part-$1.json" "$SETS/part-$1.kv_pair.tlv" "$SETS/part-$1.key_index.tlv" > /dev/null &&
+	cat "$WORK/part-$1.json" >> "$WORK/expected.json"
+}
+
+# every set of the directory must verify, and their records, in any order, be the expected ones
+check_sets() {
+	: > "$WORK/unpacked.json"
+
+	for kv_pair in "$SETS"/*.kv_pair.tlv; do
+		key_index="${kv_pair%.kv_pair.tlv}.key_index.tlv"
+
+		"$TOOLS/tlv_verify" "$kv_pair" "$key_index" > /dev/null || fail "$1: $kv_pair does not verify"
+		"$TOOLS/tlv_unpacker" --format jsonl "$kv_pair" "$key_index" >> "$WORK/unpacked.json" || fail "$1: cannot unpack $kv_pair"
+	done
+
+	sort "$WORK/expected.json" > "$WORK/expected.sorted"
+	sort "$WORK/unpacked.json" > "$WORK/unpacked.sorted"
+
+	cmp -s "$WORK/expected.sorted" "$WORK/unpacked.sorted" || fail "$1: the records differ from the packed ones"
+
+	for leftover in "$SETS"/*.tmp "$SETS"/*.consumed "$SETS"/*.idx; do
+		[ -e "$leftover" ] && fail "$1: $leftover is left behind"
+	done
+
+	for key_index in "$SETS"/*.key_index.tlv; do
+		[ -e "${key_index%.key_index.tlv}.kv_pair.tlv" ] || fail "$1: $key_index is left behind"
+	done
+}
+
+compact() {
+	"$TOOLS/tlv_consolidator" --compact "$SETS" --fanout 2 --base-size 4096 > /dev/null 2>&1 || fail "$1: compaction failed"
+}
+
+: > "$WORK/expected.json"
+
+for part in 1 2 3 4 5 6 7 8; do
+	pack_part "$part" || exit 1
+done
+
+compact "first compaction"
+check_sets "first compaction"
+
+# a merge interrupted once its output was renamed into place: the inputs are still there
+for part in 9 10; do
+	pack_part "$part" || exit 1
+done
+
+cd "$WORK" || exit 1
+"$TOOLS/tlv_consolidator" "$SETS/part-9.kv_pair.tlv" "$SETS/part-9.key_index.tlv" "$SETS/part-10.kv_pair.tlv" "$SETS/part-10.key_index.tlv" > /dev/null || exit 1
+mv consolidated_kv_pair.tlv "$SETS/compact-crash-1.kv_pair.tlv"
+mv consolidated_key_index.tlv "$SETS/compact-crash-1.key_index.tlv"
+printf "compact-crash-1.kv_pair.tlv\npart-9.kv_pair.tlv\npart-9.key_index.tlv\npart-10.kv_pair.tlv\npart-10.key_index.tlv\n" > "$SETS/compact-crash-1.consumed"
+
+# a merge interrupted before: its key index is renamed, its kv-pairs still temporary, and another manifest half written
+for part in 11 12; do
+	pack_part "$part" || exit 1
+done
+
+head -c 1000 "$SETS/part-11.kv_pair.tlv" > "$SETS/compact-crash-2.kv_pair.tlv.tmp"
+cp "$SETS/part-11.key_index.tlv" "$SETS/compact-crash-2.key_index.tlv"
+printf "compact-crash-2.kv_pair.tlv\npart-11.kv_pair.tlv\npart-11.key_index.tlv\npart-12.kv_pair.tlv\npart-12.key_index.tlv\n" > "$SETS/compact-crash-2.consumed"
+printf "compact-crash-3.kv_pair.tlv\npart-1" > "$SETS/compact-crash-3.consumed.tmp"
+
+compact "compaction after a crash"
+check_sets "compaction after a crash"
+
+if [ $status -eq 0 ]; then
+		echo -e "${GREEN}SUCCESS${WHITE}:  compaction"
+	else
+		echo -e "${RED}FAILED${WHITE} :  compaction"
+fi
+
+exit $status
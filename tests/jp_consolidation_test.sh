@@ -11,7 +11,17 @@ WHITE="\033[0m"
 
 ./tlv_consolidator kv_pair_1.tlv key_index_1.tlv kv_pair_2.tlv key_index_2.tlv kv_pair_3.tlv key_index_3.tlv
 
-./tlv_unpacker consolidated_kv_pair.tlv consolidated_key_index.tlv
+./tlv_unpacker consolidated_kv_pair.tlv consolidated_key_index.tlv > consolidated_unpacked.txt
+
+./json_packer --single-file ./json-input/input-json.1.txt records_1.tlv
+./json_packer --single-file ./json-input/input-json.2.txt records_2.tlv
+./json_packer --single-file ./json-input/input-json.3.txt records_3.tlv
+
+./tlv_consolidator --single-file records_1.tlv records_2.tlv records_3.tlv
+
+./tlv_verify consolidated_kv_pair.tlv consolidated_key_index.tlv > /dev/null &&
+./tlv_verify --single-file consolidated.tlv > /dev/null &&
+./tlv_unpacker --single-file consolidated.tlv | cmp -s - consolidated_unpacked.txt
 
 if [ $? -eq 0 ]; then
 		echo -e "${GREEN}SUCCESS${WHITE}:  $file"
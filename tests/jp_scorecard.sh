@@ -0,0 +1,113 @@
+#!/bin/sh
+
+# Size and speed scorecard: for every corpus shape, packs PARTS seeded parts of RECORDS records
+# with json_packer, consolidates them with tlv_consolidator, unpacks the result with
+# tlv_unpacker --format jsonl and checks it against the corpus byte for byte.
+#
+#   ./jp_scorecard.sh [records per part] [parts] [shapes]
+#
+# Sizes are in bytes: "x raw" is the raw size over the packed size, "x gzip" the raw size over
+# the gzip size, and "gz/pk" the gzip size over the packed size. The times are wall clock seconds
+# summed over the parts, and the peak RSS (KB) the largest of any step, when GNU time is
+# installed. The exit status is non-zero if any round trip differs, or tlv_unpacker fails.
+
+RED="\033[1;31m"
+GREEN="\033[1;32m"
+WHITE="\033[0m"
+
+RECORDS=${1:-100000}
+PARTS=${2:-3}
+SHAPES=${3:-"access metrics traces mixed"}
+
+TOOLS=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/jp_scorecard.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+if /usr/bin/time -f "%e %M" -o /dev/null true 2>/dev/null; then
+	GNU_TIME=1
+fi
+
+# runs a command, adding its wall time to $SECONDS_SUM and its peak RSS (KB) to $PEAK_RSS
+timed() {
+	if [ -n "$GNU_TIME" ]; then
+		/usr/bin/time -f "%e %M" -o "$WORK/time" "$@" || return 1
+		read -r seconds rss < "$WORK/time"
+	else
+		start=$(date +%s.%N)
+		"$@" || return 1
+		seconds=$(echo "$start $(date +%s.%N)" | awk '{ printf "%.2f", $2 - $1 }')
+		rss=
+	fi
+	SECONDS_SUM=$(echo "$SECONDS_SUM $seconds" | awk '{ printf "%.2f", $1 + $2 }')
+	[ -n "$rss" ] && [ "$rss" -gt "${PEAK_RSS:-0}" ] && PEAK_RSS=$rss
+	return 0
+}
+
+ratio() {
+	echo "$1 $2" | awk '{ printf "%.2f", ($2 > 0) ? $1 / $2 : 0 }'
+}
+
+size() {
+	wc -c < "$1" | tr -d ' '
+}
+
+status=0
+
+printf "%-8s %9s %11s %11s %11s %7s %7s %7s %7s %7s %7s %7s %9s %s\n" \
+	shape records raw gzip packed "B/rec" "x raw" "x gzip" "gz/pk" pack cons unpack peak_kb round_trip
+
+for shape in $SHAPES; do
+	dir="$WORK/$shape"
+	mkdir -p "$dir" || exit 1
+
+	sets=""
+	: > "$dir/corpus.json"
+
+	for part in $(seq 1 "$PARTS"); do
+		"$TOOLS/json_corpus" --shape "$shape" --seed "$part" --records "$RECORDS" "$dir/part-$part.json" 2>/dev/null || exit 1
+		cat "$dir/part-$part.json" >> "$dir/corpus.json"
+		sets="$sets part-$part.kv_pair.tlv part-$part.key_index.tlv"
+	done
+
+	cd "$dir" || exit 1
+
+	PEAK_RSS=
+
+	SECONDS_SUM=0
+	for part in $(seq 1 "$PARTS"); do
+		timed "$TOOLS/json_packer" part-$part.json part-$part.kv_pair.tlv part-$part.key_index.tlv > /dev/null
+	done
+	pack_seconds=$SECONDS_SUM
+
+	SECONDS_SUM=0
+	timed "$TOOLS/tlv_consolidator" $sets > /dev/null
+	consolidate_seconds=$SECONDS_SUM
+
+	SECONDS_SUM=0
+	timed "$TOOLS/tlv_unpacker" --format jsonl consolidated_kv_pair.tlv consolidated_key_index.tlv > unpacked.json
+	unpacked=$?
+	unpack_seconds=$SECONDS_SUM
+
+	if [ $unpacked -eq 0 ] && cmp -s unpacked.json corpus.json; then
+		round_trip="${GREEN}SUCCESS${WHITE}"
+	else
+		round_trip="${RED}FAILED${WHITE}"
+		status=1
+	fi
+
+	records=$((RECORDS * PARTS))
+	raw=$(size corpus.json)
+	gzipped=$(gzip -c corpus.json | wc -c | tr -d ' ')
+	packed=$(( $(size consolidated_kv_pair.tlv) + $(size consolidated_key_index.tlv) ))
+
+	printf "%-8s %9s %11s %11s %11s %7s %7s %7s %7s %7s %7s %7s %9s " \
+		"$shape" "$records" "$raw" "$gzipped" "$packed" "$(ratio "$packed" "$records")" \
+		"$(ratio "$raw" "$packed")" "$(ratio "$raw" "$gzipped")" "$(ratio "$gzipped" "$packed")" \
+		"$pack_seconds" "$consolidate_seconds" "$unpack_seconds" "${PEAK_RSS:--}"
+	printf "$round_trip\n"
+
+	cd "$TOOLS" || exit 1
+	rm -rf "$dir"
+done
+
+exit $status
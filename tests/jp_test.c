@@ -1,9 +1,12 @@
 
 #include <apr.h>
+#include <apr_strings.h>
 
 #include <check.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <jp_tlv_encoder.h>
 
@@ -47,7 +50,7 @@ int compare_kv_pairs(const jp_TLV_kv_pair_t* pair_A, const jp_TLV_kv_pair_t* pai
     case JP_TYPE_DOUBLE:
     jp_read_double_from_kv_pair(pair_A, & double_A);
     jp_read_double_from_kv_pair(pair_B, & double_B);
-    return !(double_A == double_B);
+    return memcmp(& double_A, & double_B, sizeof(double));
 
     case JP_TYPE_STRING:
     jp_read_string_from_kv_pair(pair_A, & string_A);
@@ -258,6 +261,1924 @@ START_TEST(test_TLV_record_export_import)
 }
 END_TEST
 
+static
+jp_TLV_records_t* export_import_file_set(jp_TLV_records_t* records) {
+  jp_TLV_records_t* imported_records = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_file     = tmpfile();
+  FILE*             key_index_file   = tmpfile();
+
+  ck_assert_msg(kv_pair_file && key_index_file, "unable to create temporary files");
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file);
+  rewind(key_index_file);
+
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported_records, kv_pair_file, key_index_file), "unable to import the file set");
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+
+  return imported_records;
+}
+
+static
+void check_same_records(jp_TLV_records_t* records_A, jp_TLV_records_t* records_B) {
+  ck_assert_msg(records_A->record_list->nelts == records_B->record_list->nelts, "record counts do not match");
+
+  for (int i = 0; i < records_A->record_list->nelts; i++) {
+    jp_TLV_record_t* record_A = ((jp_TLV_record_t**) records_A->record_list->elts)[i];
+    jp_TLV_record_t* record_B = ((jp_TLV_record_t**) records_B->record_list->elts)[i];
+
+    ck_assert_msg(0 == compare_records(record_A, record_B), "records do not match");
+  }
+}
+
+START_TEST(test_file_set_export_import)
+{
+  /* arrange */
+  jp_TLV_records_t* records = jp_TLV_record_collection_make(pool);
+
+  const char* value = "a string value long enough to take more than the 31 characters of the descriptor";
+
+  /* enough records to span several read-ahead chunks */
+  for (int i = 0; i < 40000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), i);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "text"), value);
+    jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ratio"), i / 7.0);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  jp_TLV_records_t* imported_records = export_import_file_set(records);
+
+  /* check */
+  check_same_records(records, imported_records);
+}
+END_TEST
+
+START_TEST(test_file_set_large_string_export_import)
+{
+  /* arrange */
+  jp_TLV_records_t* records    = jp_TLV_record_collection_make(pool);
+  size_t            large_size = 100000;
+  char*             large      = apr_palloc(pool, large_size + 1);
+
+  for (size_t i = 0; i < large_size; i++)
+    large[i] = 'a' + (i % 26);
+
+  large[large_size] = '\0';
+
+  /* large strings interleaved with small values, so that referenced and buffered bytes alternate */
+  for (int i = 0; i < 100; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), i);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "payload"), large + i);
+    jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "flag"), i % 2);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  jp_TLV_records_t* imported_records = export_import_file_set(records);
+
+  /* check */
+  check_same_records(records, imported_records);
+}
+END_TEST
+
+START_TEST(test_single_file_container_export_import)
+{
+  /* arrange */
+  jp_TLV_records_t* records          = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* imported_records = jp_TLV_record_collection_make(pool);
+  FILE*             container_file   = tmpfile();
+
+  ck_assert_msg(NULL != container_file, "unable to create a temporary file");
+
+  for (int i = 0; i < 5000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), i);
+    jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, (i % 2) ? "odd" : "even"), 1);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, container_file, NULL), "unable to export the container");
+
+  rewind(container_file);
+
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported_records, container_file, NULL), "unable to import the container");
+
+  /* check */
+  check_same_records(records, imported_records);
+
+  fclose(container_file);
+}
+END_TEST
+
+START_TEST(test_file_set_verify_detects_corruption)
+{
+  /* arrange */
+  jp_TLV_records_t*  records          = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t*  imported_records = jp_TLV_record_collection_make(pool);
+  FILE*              container_file   = tmpfile();
+  jp_verify_report_t report;
+
+  ck_assert_msg(NULL != container_file, "unable to create a temporary file");
+
+  for (int i = 0; i < 5000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), i);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "text"), "some text to checksum");
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, container_file, NULL), "unable to export the container");
+
+  /* act */
+  rewind(container_file);
+  int sound_ret = jp_verify_file_set(pool, container_file, NULL, & report);
+
+  /* a single bit flipped in the middle of the records */
+  fflush(container_file);
+
+  off_t   middle = lseek(fileno(container_file), 0, SEEK_END) / 2;
+  uint8_t byte;
+
+  ck_assert_msg(1 == pread(fileno(container_file), & byte, 1, middle), "unable to read the container");
+  byte ^= 0x10;
+  ck_assert_msg(1 == pwrite(fileno(container_file), & byte, 1, middle), "unable to corrupt the container");
+
+  rewind(container_file);
+  int corrupted_ret = jp_verify_file_set(pool, container_file, NULL, NULL);
+
+  rewind(container_file);
+  int import_ret = jp_import_records_from_file_set(imported_records, container_file, NULL);
+
+  /* check */
+  ck_assert_msg(0 == sound_ret, "a sound container fails verification");
+  ck_assert_msg(5000 == report.nb_records && report.nb_blocks > 1 && 0 == report.nb_unchecked_blocks, "unexpected verification report");
+  ck_assert_msg(2 == report.nb_keys, "unexpected number of keys");
+
+  ck_assert_msg(0 != corrupted_ret, "a corrupted container passes verification");
+  ck_assert_msg(0 != import_ret, "a corrupted container is imported");
+
+  fclose(container_file);
+}
+END_TEST
+
+static int collect_scanned_record(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index)
+{
+  *(uint64_t*) apr_array_push((apr_array_header_t*) context) = record_number;
+
+  return 0;
+}
+
+START_TEST(test_block_filters_skip_blocks)
+{
+  /* arrange */
+  jp_TLV_records_t*   records        = jp_TLV_record_collection_make(pool);
+  FILE*               container_file = tmpfile();
+  apr_array_header_t* matches        = apr_array_make(pool, 4, sizeof(uint64_t));
+  const char*         value_keys[]   = { "request" };
+  jp_scan_report_t    value_report, key_report, all_report;
+
+  ck_assert_msg(NULL != container_file, "unable to create a temporary file");
+
+  for (int i = 0; i < 20000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "request"), apr_psprintf(pool, "request-%d", i));
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), i);
+
+    if (12345 == i)
+      jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "rare"), 1);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  jp_enable_block_filters(records, value_keys, 1);
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, container_file, NULL), "unable to export the container");
+
+  /* act */
+  rewind(container_file);
+  int value_ret = jp_scan_file_set(pool, container_file, NULL, "request", "request-4321", collect_scanned_record, matches, & value_report);
+
+  rewind(container_file);
+  int key_ret = jp_scan_file_set(pool, container_file, NULL, "rare", NULL, collect_scanned_record, matches, & key_report);
+
+  rewind(container_file);
+  int all_ret = jp_scan_file_set(pool, container_file, NULL, NULL, NULL, collect_scanned_record, matches, & all_report);
+
+  /* check */
+  ck_assert_msg(0 == value_ret && 0 == key_ret && 0 == all_ret, "unable to scan the container");
+
+  ck_assert_msg(1 == value_report.nb_records_matched, "the value probe matched %lu records", (unsigned long) value_report.nb_records_matched);
+  ck_assert_msg(value_report.nb_blocks > 1 && value_report.nb_blocks_skipped > value_report.nb_blocks / 2, "the value probe skipped too few blocks");
+
+  ck_assert_msg(1 == key_report.nb_records_matched, "the key probe matched %lu records", (unsigned long) key_report.nb_records_matched);
+  ck_assert_msg(key_report.nb_blocks_skipped > 0, "the key probe skipped no block");
+
+  ck_assert_msg(0 == all_report.nb_blocks_skipped && 20000 == all_report.nb_records_matched, "a scan without probe skipped records");
+
+  ck_assert_msg(4321 == ((uint64_t*) matches->elts)[0] && 12345 == ((uint64_t*) matches->elts)[1], "wrong records matched");
+
+  fclose(container_file);
+}
+END_TEST
+
+static int write_scanned_record(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index)
+{
+  return jp_json_line_writer_add_record(context, record, key_index);
+}
+
+START_TEST(test_json_line_writer_output)
+{
+  /* arrange */
+  jp_TLV_records_t* records        = jp_TLV_record_collection_make(pool);
+  FILE*             container_file = tmpfile();
+  FILE*             json_file      = tmpfile();
+  char              output[512];
+
+  ck_assert_msg(NULL != container_file && NULL != json_file, "unable to create temporary files");
+
+  jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+  jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "msg"), "say \"hi\"\\ \x01\tthere, a line long enough for the wide path\n");
+  jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "sum"), 0.1 + 0.2);
+  jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ratio"), 0.1);
+  jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "round"), 3.0);
+  jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "min"), -2147483647 - 1);
+  jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "n"), 1234567);
+  jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "a \"quoted\" key"), 0);
+
+  jp_add_record_to_TLV_collection(records, record);
+  jp_add_record_to_TLV_collection(records, jp_TLV_record_make(pool));
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, container_file, NULL), "unable to export the container");
+
+  /* act */
+  jp_json_line_writer_t* writer = jp_json_line_writer_make(pool, json_file);
+
+  rewind(container_file);
+  int ret = jp_scan_file_set(pool, container_file, NULL, NULL, NULL, write_scanned_record, writer, NULL);
+
+  jp_json_line_writer_flush(writer);
+
+  rewind(json_file);
+  size_t length = fread(output, 1, sizeof(output) - 1, json_file);
+  output[length] = 0;
+
+  /* check */
+  ck_assert_msg(0 == ret, "unable to scan the container");
+  ck_assert_str_eq(output,
+                   "{\"msg\":\"say \\\"hi\\\"\\\\ \\u0001\\tthere, a line long enough for the wide path\\n\","
+                   "\"sum\":0.30000000000000004,\"ratio\":0.1,\"round\":3.0,\"min\":-2147483648,\"n\":1234567,"
+                   "\"a \\\"quoted\\\" key\":false}\n"
+                   "{}\n");
+
+  fclose(container_file);
+  fclose(json_file);
+}
+END_TEST
+
+START_TEST(test_direct_writer_records)
+{
+  /* arrange */
+  jp_TLV_records_t* expected_records = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* imported_records = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_file     = tmpfile();
+  FILE*             key_index_file   = tmpfile();
+  char              text[2048];
+  jp_scan_report_t  report;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  jp_writer_t* writer = jp_writer_open(pool, kv_pair_file, key_index_file);
+
+  ck_assert_msg(NULL != writer, "unable to open the writer");
+
+  uint32_t id_key    = jp_writer_key(writer, "id");
+  uint32_t text_key  = jp_writer_key(writer, "text");
+  uint32_t ratio_key = jp_writer_key(writer, "ratio");
+  uint32_t ok_key    = jp_writer_key(writer, "ok");
+
+  /* act */
+  for (int i = 0; i < 20000; i++) {
+    /* the text is overwritten in place for every record, the writer must have copied it */
+    uint32_t length = (0 == i % 1000) ? sizeof(text) - 1 : (uint32_t) snprintf(text, sizeof(text), "text-%d", i);
+
+    if (0 == i % 1000)
+      memset(text, 'a' + (i / 1000) % 26, length);
+
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(expected_records->key_index, "id"), i);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(expected_records->key_index, "text"), apr_pstrndup(pool, text, length));
+    jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(expected_records->key_index, "ratio"), i / 7.0);
+    jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(expected_records->key_index, "ok"), i & 1);
+    jp_add_record_to_TLV_collection(expected_records, record);
+
+    ck_assert_msg(0 == jp_writer_begin_record(writer), "unable to begin record %d", i);
+    ck_assert_msg(0 == jp_writer_add_int(writer, id_key, i), "unable to add an integer");
+    ck_assert_msg(0 == jp_writer_add_string(writer, text_key, text, length), "unable to add a string");
+    ck_assert_msg(0 == jp_writer_add_double(writer, ratio_key, i / 7.0), "unable to add a double");
+
+    /* an unknown key id is refused without spoiling the record, once as it is reported on stderr */
+    if (1 == i)
+      ck_assert_msg(0 != jp_writer_add_int(writer, 1000, i), "an unknown key id was accepted");
+
+    ck_assert_msg(0 == jp_writer_add_boolean(writer, ok_key, i & 1), "unable to add a boolean");
+    ck_assert_msg(0 == jp_writer_end_record(writer), "unable to end record %d", i);
+  }
+
+  ck_assert_msg(0 != jp_writer_add_int(writer, id_key, 0), "a field was added outside of a record");
+
+  /* left open, dropped by the close */
+  ck_assert_msg(0 == jp_writer_begin_record(writer), "unable to begin the last record");
+  ck_assert_msg(0 == jp_writer_add_int(writer, id_key, -1), "unable to add an integer");
+
+  ck_assert_msg(0 == jp_writer_close(writer), "unable to close the writer");
+
+  /* every record fills a block, the one dropped would start an empty one */
+  FILE*              large_kv_file  = tmpfile();
+  FILE*              large_key_file = tmpfile();
+  jp_verify_report_t verify_report;
+  char*              large_text     = apr_palloc(pool, 70000);
+
+  ck_assert_msg(NULL != large_kv_file && NULL != large_key_file, "unable to create temporary files");
+
+  memset(large_text, 'x', 70000);
+
+  jp_writer_t* large_writer = jp_writer_open(pool, large_kv_file, large_key_file);
+  uint32_t     large_key    = jp_writer_key(large_writer, "text");
+
+  for (int i = 0; i < 3; i++) {
+    ck_assert_msg(0 == jp_writer_begin_record(large_writer), "unable to begin large record %d", i);
+    ck_assert_msg(0 == jp_writer_add_string(large_writer, large_key, large_text, 70000), "unable to add a large string");
+    ck_assert_msg(0 == jp_writer_end_record(large_writer), "unable to end large record %d", i);
+  }
+
+  ck_assert_msg(0 == jp_writer_begin_record(large_writer), "unable to begin the dropped record");
+  ck_assert_msg(0 == jp_writer_close(large_writer), "unable to close the writer");
+
+  rewind(large_kv_file); rewind(large_key_file);
+  ck_assert_msg(0 == jp_verify_file_set(pool, large_kv_file, large_key_file, & verify_report), "the file set does not verify");
+
+  /* check */
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported_records, kv_pair_file, key_index_file), "unable to import the file set");
+
+  check_same_records(expected_records, imported_records);
+
+  /* the blocks carry zone maps like the ones of the other writers */
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set_range(pool, kv_pair_file, key_index_file, "id", 19990, 19999, collect_scanned_record,
+                                            apr_array_make(pool, 16, sizeof(uint64_t)), & report), "unable to scan the file set");
+
+  ck_assert_msg(10 == report.nb_records_matched, "the range matched %lu records", (unsigned long) report.nb_records_matched);
+  ck_assert_msg(report.nb_blocks > 1 && report.nb_blocks_skipped > 0, "the range scan skipped no block");
+
+  /* the id of the dropped record left no trace in the zone maps */
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set_range(pool, kv_pair_file, key_index_file, "id", -10, -1, collect_scanned_record,
+                                            apr_array_make(pool, 16, sizeof(uint64_t)), & report), "unable to scan the file set");
+
+  ck_assert_msg(report.nb_blocks == report.nb_blocks_skipped, "%lu of %lu blocks may hold the dropped id",
+                (unsigned long) (report.nb_blocks - report.nb_blocks_skipped), (unsigned long) report.nb_blocks);
+
+  ck_assert_msg(3 == verify_report.nb_records && 3 == verify_report.nb_blocks, "%u blocks written for %lu records",
+                verify_report.nb_blocks, (unsigned long) verify_report.nb_records);
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+  fclose(large_kv_file);
+  fclose(large_key_file);
+}
+END_TEST
+
+START_TEST(test_block_trailer_grows_buffer)
+{
+  char text[1000];
+
+  memset(text, 'x', sizeof(text) - 1);
+  text[sizeof(text) - 1] = '\0';
+
+  /*
+   *  the dictionary coded records are followed by a record filling the block buffer, a little more
+   *  every time: the arrival order written after some of them no longer fits and moves the buffer
+   */
+  for (int nb_strings = 96; nb_strings < 128; nb_strings++) {
+    jp_TLV_records_t* records        = jp_TLV_record_collection_make(pool);
+    jp_TLV_records_t* imported       = jp_TLV_record_collection_make(pool);
+    FILE*             kv_pair_file   = tmpfile();
+    FILE*             key_index_file = tmpfile();
+
+    ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+    for (int i = 0; i < 1000; i++) {
+      jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "level"), (i % 3) ? "info" : "warn");
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "n"), i);
+      jp_add_record_to_TLV_collection(records, record);
+    }
+
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "level"), "info");
+
+    for (int j = 0; j < nb_strings; j++)
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "s%d", j)), text);
+
+    jp_add_record_to_TLV_collection(records, record);
+
+    jp_enable_record_clustering(records, 2048, NULL, 1);
+
+    /* act */
+    ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+    rewind(kv_pair_file); rewind(key_index_file);
+    ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file),
+                  "unable to import the file set with %d strings", nb_strings);
+
+    /* check */
+    check_same_records(records, imported);
+
+    fclose(kv_pair_file);
+    fclose(key_index_file);
+  }
+}
+END_TEST
+
+static
+int collect_scanned_doubles(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index) {
+  for (int i = 0; i < record->kv_pairs_array->nelts; i++) {
+    double value;
+
+    if (0 == jp_read_double_from_kv_pair(& ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[i], & value))
+      *(double*) apr_array_push((apr_array_header_t*) context) = value;
+  }
+
+  return 0;
+}
+
+static
+int collect_scanned_shapes(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index) {
+  int32_t n;
+
+  jp_read_integer_from_kv_pair(& ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[0], & n);
+
+  /* the shape of the test records is their number of kv-pairs */
+  *(int32_t*) apr_array_push((apr_array_header_t*) context) = record->kv_pairs_array->nelts;
+  *(int32_t*) apr_array_push((apr_array_header_t*) context) = n;
+
+  return 0;
+}
+
+START_TEST(test_record_clustering_by_shape)
+{
+  /* arrange */
+  jp_TLV_records_t*   records        = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t*   imported       = jp_TLV_record_collection_make(pool);
+  apr_array_header_t* scanned        = apr_array_make(pool, 12000, sizeof(int32_t));
+  FILE*               kv_pair_file   = tmpfile();
+  FILE*               key_index_file = tmpfile();
+  const int           nb_records     = 3000;
+  const int           window         = 1000;
+  jp_verify_report_t  report;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  /* three shapes interleaved, the sort key first */
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "n"), (i * 7919) % nb_records);
+
+    for (int j = 0; j < i % 3; j++)
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "x%d", j)), "value");
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  jp_enable_record_clustering(records, window, "n", 0);
+
+  /* act */
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_verify_file_set(pool, kv_pair_file, key_index_file, & report), "the file set does not verify");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set(pool, kv_pair_file, key_index_file, NULL, NULL, collect_scanned_shapes, scanned, NULL),
+                "unable to scan the file set");
+
+  /* the same clusters, with their arrival order */
+  jp_enable_record_clustering(records, window, "n", 1);
+
+  ck_assert_msg(0 == ftruncate(fileno(kv_pair_file), 0) && 0 == ftruncate(fileno(key_index_file), 0), "unable to truncate the files");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set(pool, kv_pair_file, key_index_file, NULL, NULL, collect_scanned_shapes, scanned, NULL),
+                "unable to scan the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file), "unable to import the file set");
+
+  /* check: every window holds one run per shape, sorted by n */
+  ck_assert_msg(4 * nb_records == scanned->nelts, "%d records scanned", scanned->nelts / 2);
+
+  int32_t* values = (int32_t*) scanned->elts;
+
+  for (int start = 0; start < nb_records; start += window) {
+    int nb_runs = 1;
+
+    for (int i = start + 1; i < start + window; i++) {
+      if (values[2 * i] != values[2 * (i - 1)])
+        nb_runs++;
+      else
+        ck_assert_msg(values[2 * i + 1] > values[2 * (i - 1) + 1], "record %d is out of order in its shape", i);
+    }
+
+    ck_assert_msg(3 == nb_runs, "%d runs in the window starting at %d", nb_runs, start);
+  }
+
+  /* the scan and the import restore the arrival order */
+  for (int i = 0; i < nb_records; i++)
+    ck_assert_msg(values[2 * (nb_records + i) + 1] == (i * 7919) % nb_records, "record %d is out of order", i);
+
+  check_same_records(records, imported);
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+/* the JSON lines of the records of a file set holding a key, or a value of the key within a range */
+static
+char* scan_json_lines(FILE *kv_pair_file, FILE *key_index_file, const char *key, double min, double max) {
+  FILE*                  json_file = tmpfile();
+  jp_json_line_writer_t* writer    = jp_json_line_writer_make(pool, json_file);
+  int                    ret;
+
+  rewind(kv_pair_file); rewind(key_index_file);
+
+  if (min <= max)
+    ret = jp_scan_file_set_range(pool, kv_pair_file, key_index_file, key, min, max, write_scanned_record, writer, NULL);
+  else
+    ret = jp_scan_file_set(pool, kv_pair_file, key_index_file, key, NULL, write_scanned_record, writer, NULL);
+
+  ck_assert_msg(0 == ret, "unable to scan the file set for %s", key ? key : "every record");
+
+  jp_json_line_writer_flush(writer);
+
+  long  length = ftell(json_file);
+  char* lines  = apr_palloc(pool, length + 1);
+
+  rewind(json_file);
+  ck_assert_msg((size_t) length == fread(lines, 1, length, json_file), "unable to read the JSON lines");
+  lines[length] = 0;
+
+  fclose(json_file);
+
+  return lines;
+}
+
+START_TEST(test_scan_keeps_arrival_order)
+{
+  /* arrange */
+  jp_TLV_records_t* records          = jp_TLV_record_collection_make(pool);
+  FILE*             plain_kv_file    = tmpfile();
+  FILE*             plain_key_file   = tmpfile();
+  FILE*             ordered_kv_file  = tmpfile();
+  FILE*             ordered_key_file = tmpfile();
+  const int         nb_records       = 20000;
+
+  ck_assert_msg(NULL != plain_kv_file && NULL != plain_key_file && NULL != ordered_kv_file && NULL != ordered_key_file,
+                "unable to create temporary files");
+
+  /* four shapes interleaved, and a key only held by a few records, so that filters skip blocks */
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "n"), i);
+
+    for (int j = 0; j < i % 4; j++)
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "x%d", j)),
+                                      apr_psprintf(pool, "value-%d", i % 97));
+
+    if (i >= 12000 && i < 12100)
+      jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "rare"), 1);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  jp_enable_block_filters(records, NULL, 0);
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, plain_kv_file, plain_key_file), "unable to export the file set");
+
+  /* the windows span several blocks */
+  jp_enable_record_clustering(records, 5000, NULL, 1);
+
+  /* act */
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, ordered_kv_file, ordered_key_file), "unable to export the file set");
+
+  char* plain_lines   = scan_json_lines(plain_kv_file, plain_key_file, NULL, 1, 0);
+  char* ordered_lines = scan_json_lines(ordered_kv_file, ordered_key_file, NULL, 1, 0);
+  char* plain_rare    = scan_json_lines(plain_kv_file, plain_key_file, "rare", 1, 0);
+  char* ordered_rare  = scan_json_lines(ordered_kv_file, ordered_key_file, "rare", 1, 0);
+  char* plain_range   = scan_json_lines(plain_kv_file, plain_key_file, "n", 3000, 3500);
+  char* ordered_range = scan_json_lines(ordered_kv_file, ordered_key_file, "n", 3000, 3500);
+
+  int nb_rare = 0, nb_range = 0;
+
+  for (const char* line = ordered_rare; (line = strchr(line, '\n')); line++)
+    nb_rare++;
+
+  for (const char* line = ordered_range; (line = strchr(line, '\n')); line++)
+    nb_range++;
+
+  /* check: the clustered records come out of the scans as they were added */
+  ck_assert_msg(0 == strcmp(plain_lines, ordered_lines), "the scan does not restore the arrival order");
+  ck_assert_msg(0 == strcmp(plain_rare, ordered_rare), "the key scan does not restore the arrival order");
+  ck_assert_msg(0 == strcmp(plain_range, ordered_range), "the range scan does not restore the arrival order");
+  ck_assert_msg(100 == nb_rare, "%d records hold the rare key", nb_rare);
+  ck_assert_msg(501 == nb_range, "%d records in the range", nb_range);
+
+  fclose(plain_kv_file);
+  fclose(plain_key_file);
+  fclose(ordered_kv_file);
+  fclose(ordered_key_file);
+}
+END_TEST
+
+START_TEST(test_sort_file_sets_by_key)
+{
+  /* arrange */
+  jp_TLV_records_t* imported      = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* sorted        = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_files[3];
+  FILE*             key_index_files[3];
+  FILE*             kv_pair_file   = tmpfile();
+  FILE*             key_index_file = tmpfile();
+  const int         nb_records     = 4000;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  /* three inputs overlapping in time, with ties, a few records without the key */
+  for (int s = 0; s < 3; s++) {
+    jp_TLV_records_t* records = jp_TLV_record_collection_make(pool);
+
+    for (int i = 0; i < nb_records; i++) {
+      jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+      if (0 != i % 97)
+        jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ts"), 1000 + i * (s + 1) / 2);
+
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "input"), s);
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "seq"), i);
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "level-%d", s)), (i % 3) ? "info" : "warn");
+
+      jp_add_record_to_TLV_collection(records, record);
+    }
+
+    kv_pair_files[s]   = tmpfile();
+    key_index_files[s] = tmpfile();
+
+    ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_files[s], key_index_files[s]), "unable to export input %d", s);
+
+    rewind(kv_pair_files[s]); rewind(key_index_files[s]);
+  }
+
+  /* act: a budget this small takes many runs, merged two by two */
+  ck_assert_msg(0 == jp_sort_file_sets(sorted, kv_pair_files, key_index_files, 3, "ts", 64 * 1024, NULL, kv_pair_file, key_index_file),
+                "unable to sort the file sets");
+
+  /* check */
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file), "unable to import the file set");
+
+  ck_assert_msg(3 * nb_records == imported->record_list->nelts, "%d records imported", imported->record_list->nelts);
+  ck_assert_msg(6 == apr_hash_count(imported->key_index), "the keys were not merged");
+
+  uint32_t ts_key    = (uint32_t) (size_t) apr_hash_get(imported->key_index, "ts", APR_HASH_KEY_STRING);
+  uint32_t input_key = (uint32_t) (size_t) apr_hash_get(imported->key_index, "input", APR_HASH_KEY_STRING);
+  uint32_t seq_key   = (uint32_t) (size_t) apr_hash_get(imported->key_index, "seq", APR_HASH_KEY_STRING);
+  int32_t  last_ts   = INT32_MIN, last_input = -1, last_seq = -1;
+  int      nb_missing = 0;
+
+  for (int i = 0; i < imported->record_list->nelts; i++) {
+    jp_TLV_record_t* record = ((jp_TLV_record_t**) imported->record_list->elts)[i];
+    int32_t          ts     = INT32_MAX, input = -1, seq = -1;
+
+    for (int j = 0; j < record->kv_pairs_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[j];
+
+      if (ts_key == kv_pair->key_index)
+        jp_read_integer_from_kv_pair(kv_pair, & ts);
+      else if (input_key == kv_pair->key_index)
+        jp_read_integer_from_kv_pair(kv_pair, & input);
+      else if (seq_key == kv_pair->key_index)
+        jp_read_integer_from_kv_pair(kv_pair, & seq);
+    }
+
+    /* the records without the key come last, INT32_MAX stands for them */
+    nb_missing += (INT32_MAX == ts);
+
+    ck_assert_msg(ts >= last_ts, "record %d is out of order", i);
+
+    /* the ties keep the order of the inputs */
+    if (ts == last_ts)
+      ck_assert_msg(input > last_input || (input == last_input && seq > last_seq), "record %d breaks a tie", i);
+
+    last_ts    = ts;
+    last_input = input;
+    last_seq   = seq;
+  }
+
+  ck_assert_msg(3 * (1 + (nb_records - 1) / 97) == nb_missing, "%d records without the key", nb_missing);
+
+  for (int s = 0; s < 3; s++) {
+    fclose(kv_pair_files[s]);
+    fclose(key_index_files[s]);
+  }
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+START_TEST(test_aggregate_file_sets_by_group)
+{
+  /* arrange */
+  jp_TLV_records_t* records        = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_file   = tmpfile();
+  FILE*             key_index_file = tmpfile();
+  const char*       levels[]       = { "info", "warn", "error" };
+  const char*       keys[]         = { "n", "latency" };
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  for (int i = 0; i < 30000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    if (i % 1000 != 999)
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "level"), levels[i % 3]);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "n"), i);
+
+    if (0 == i % 2)
+      jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "latency"), 0.5 * i);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+
+  FILE* const kv_pair_inputs[]   = { kv_pair_file, kv_pair_file };
+  FILE* const key_index_inputs[] = { key_index_file, key_index_file };
+
+  /* act */
+  jp_aggregation_t* grouped = jp_aggregation_make(pool, "level", keys, 2);
+  jp_aggregation_t* total   = jp_aggregation_make(pool, NULL, keys, 2);
+
+  int grouped_ret = jp_aggregate_file_sets(grouped, kv_pair_inputs, key_index_inputs, 1, 3);
+  int total_ret   = jp_aggregate_file_sets(total, kv_pair_inputs, key_index_inputs, 2, 3);
+
+  /* check */
+  ck_assert_msg(0 == grouped_ret && 0 == total_ret, "unable to aggregate the file set");
+
+  ck_assert_msg(4 == jp_aggregation_count_groups(grouped), "%u groups", jp_aggregation_count_groups(grouped));
+
+  uint64_t    nb_records;
+  const char* info    = jp_aggregation_group(grouped, 0, & nb_records);
+  const char* missing = jp_aggregation_group(grouped, 3, NULL);
+
+  ck_assert_msg(0 == strcmp("info", info) && 0 == strcmp("warn", jp_aggregation_group(grouped, 1, NULL)) && NULL == missing,
+                "wrong groups");
+  ck_assert_msg(9990 == nb_records, "%lu info records", (unsigned long) nb_records);
+
+  const jp_aggregate_t* info_values = jp_aggregation_values(grouped, 0);
+
+  ck_assert_msg(9990 == info_values[0].count && 0 == info_values[0].min && 29997 == info_values[0].max, "wrong info n aggregates");
+  ck_assert_msg(5000 == info_values[1].count && 0 == info_values[1].min && 0.5 * 29994 == info_values[1].max, "wrong info latency aggregates");
+
+  uint64_t              nb_total;
+  const jp_aggregate_t* total_values = jp_aggregation_values(total, 0);
+
+  ck_assert_msg(1 == jp_aggregation_count_groups(total) && NULL == jp_aggregation_group(total, 0, & nb_total) && 60000 == nb_total,
+                "wrong total group");
+  ck_assert_msg(60000 == total_values[0].count && 2.0 * 29999 * 30000 / 2 == total_values[0].sum, "wrong total of n");
+  ck_assert_msg(30000 == total_values[1].count && 0.5 * 29998 == total_values[1].max, "wrong total of latency");
+
+  fclose(key_index_file);
+  fclose(kv_pair_file);
+}
+END_TEST
+
+START_TEST(test_aggregate_duplicated_keys)
+{
+  /* arrange: records holding their key three times, which fill the batch of values in the middle of a record */
+  jp_TLV_records_t* records        = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_file   = tmpfile();
+  FILE*             key_index_file = tmpfile();
+  const char*       keys[]         = { "v" };
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  for (int i = 0; i < 2 * 342 + 1; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+    int              group  = (i < 342) ? 0 : (i < 2 * 342) ? 1 : 2;
+
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "g"), (const char*[]) { "a", "b", "c" }[group]);
+
+    /* the last record holds more values than a batch */
+    for (int j = 0; j < ((2 == group) ? 3000 : 3); j++)
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "v"), group + 1);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+
+  FILE* const kv_pair_inputs[]   = { kv_pair_file };
+  FILE* const key_index_inputs[] = { key_index_file };
+
+  /* act */
+  jp_aggregation_t* grouped = jp_aggregation_make(pool, "g", keys, 1);
+
+  ck_assert_msg(0 == jp_aggregate_file_sets(grouped, kv_pair_inputs, key_index_inputs, 1, 1), "unable to aggregate the file set");
+
+  /* check: every value is in the group of its record */
+  ck_assert_msg(3 == jp_aggregation_count_groups(grouped), "%u groups", jp_aggregation_count_groups(grouped));
+
+  for (uint32_t group = 0; group < 3; group++) {
+    uint64_t              nb_records;
+    const char*           text   = jp_aggregation_group(grouped, group, & nb_records);
+    const jp_aggregate_t* values = jp_aggregation_values(grouped, group);
+    uint64_t              count  = (2 == group) ? 3000 : 3 * 342;
+
+    ck_assert_msg(text[0] == "abc"[group] && nb_records == ((2 == group) ? 1 : 342), "wrong group %u", group);
+    ck_assert_msg(count == values[0].count && (double) count * (group + 1) == values[0].sum &&
+                  group + 1 == values[0].min && group + 1 == values[0].max,
+                  "group %s has %lu values summing to %g", text, (unsigned long) values[0].count, values[0].sum);
+  }
+
+  fclose(key_index_file);
+  fclose(kv_pair_file);
+}
+END_TEST
+
+START_TEST(test_value_index_lookups)
+{
+  /* arrange */
+  jp_TLV_records_t*   records        = jp_TLV_record_collection_make(pool);
+  FILE*               kv_pair_file   = tmpfile();
+  FILE*               key_index_file = tmpfile();
+  FILE*               index_file     = tmpfile();
+  apr_array_header_t* matches        = apr_array_make(pool, 4, sizeof(uint64_t));
+  const char*         index_keys[]   = { "request", "user" };
+  jp_scan_report_t    request_report, user_report, missing_report;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file && NULL != index_file, "unable to create temporary files");
+
+  for (int i = 0; i < 20000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "request"), apr_psprintf(pool, "request-%d", i));
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "user"), i % 1000);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file);
+  rewind(key_index_file);
+  ck_assert_msg(0 == jp_build_value_index(pool, kv_pair_file, key_index_file, index_keys, 2, index_file), "unable to build the value index");
+
+  rewind(index_file);
+  jp_value_index_t* index = jp_value_index_open(pool, index_file);
+
+  ck_assert_msg(NULL != index, "unable to open the value index");
+
+  /* act */
+  rewind(kv_pair_file);
+  rewind(key_index_file);
+  int request_ret = jp_lookup_file_set(pool, index, kv_pair_file, key_index_file, "request", "request-4321", collect_scanned_record, matches, & request_report);
+
+  int user_ret = jp_lookup_file_set(pool, index, kv_pair_file, key_index_file, "user", "7", collect_scanned_record, matches, & user_report);
+
+  int missing_ret = jp_lookup_file_set(pool, index, kv_pair_file, key_index_file, "request", "request-20000", collect_scanned_record, matches, & missing_report);
+
+  int unindexed_ret = jp_lookup_file_set(pool, index, kv_pair_file, key_index_file, "other", "7", collect_scanned_record, matches, NULL);
+
+  /* check */
+  ck_assert_msg(0 == request_ret && 0 == user_ret && 0 == missing_ret, "unable to look the values up");
+  ck_assert_msg(0 != unindexed_ret, "a key without index was looked up");
+
+  ck_assert_msg(1 == request_report.nb_records_matched, "the request lookup matched %lu records", (unsigned long) request_report.nb_records_matched);
+  ck_assert_msg(request_report.nb_blocks > 1 && request_report.nb_blocks_skipped == request_report.nb_blocks - 1, "the request lookup decoded more than its block");
+
+  ck_assert_msg(20 == user_report.nb_records_matched, "the user lookup matched %lu records", (unsigned long) user_report.nb_records_matched);
+  ck_assert_msg(0 == missing_report.nb_records_matched && missing_report.nb_blocks_skipped == missing_report.nb_blocks, "a missing value was found");
+
+  ck_assert_msg(21 == matches->nelts && 4321 == ((uint64_t*) matches->elts)[0], "wrong records matched");
+
+  for (int i = 1; i < matches->nelts; i++)
+    ck_assert_msg(7 + 1000 * (i - 1) == ((uint64_t*) matches->elts)[i], "wrong record numbers for the user lookup");
+
+  fclose(index_file);
+  fclose(key_index_file);
+  fclose(kv_pair_file);
+}
+END_TEST
+
+START_TEST(test_double_encodings_round_trip)
+{
+  /* arrange */
+  jp_TLV_records_t*   records        = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t*   imported       = jp_TLV_record_collection_make(pool);
+  apr_array_header_t* written        = apr_array_make(pool, 1024, sizeof(double));
+  apr_array_header_t* scanned        = apr_array_make(pool, 1024, sizeof(double));
+  FILE*               kv_pair_file   = tmpfile();
+  FILE*               key_index_file = tmpfile();
+  uint64_t            nan_bits       = 0x7FF4000000000123ULL;
+  double              nan_payload;
+  double              gauge          = 100.0;
+  uint32_t            seed           = 12345;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  memcpy(& nan_payload, & nan_bits, sizeof(double));
+
+  const double specials[] = { 0.0, -0.0, 1.0, 31.0, 32.0, -1.0, 127.0, -128.0, 128.0, 32767.0, -32768.0, 40000.0,
+                              2147483647.0, -2147483648.0, 2147483648.0, 0.5, 0.1, 1.0 / 3.0, 1e300, -1e-300,
+                              4.9e-324, INFINITY, -INFINITY, NAN, nan_payload, 16777217.0, 3.4028234663852886e38 };
+  const int    nb_specials = sizeof(specials) / sizeof(double);
+
+  for (int i = 0; i < 30000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    /* a gauge drifting by small steps, a counter, a repeated setting and the special values */
+    seed   = seed * 1103515245 + 12345;
+    gauge += ((seed >> 16) % 201 - 100) / 1000.0;
+
+    double values[] = { gauge, (double) i, 0.25, specials[i % nb_specials] };
+
+    for (int j = 0; j < 4; j++) {
+      jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "d%d", j)), values[j]);
+      *(double*) apr_array_push(written) = values[j];
+    }
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file), "unable to import the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set(pool, kv_pair_file, key_index_file, NULL, NULL, collect_scanned_doubles, scanned, NULL),
+                "unable to scan the file set");
+
+  /* check */
+  check_same_records(records, imported);
+
+  ck_assert_msg(written->nelts == scanned->nelts, "%d doubles scanned", scanned->nelts);
+  ck_assert_msg(0 == memcmp(written->elts, scanned->elts, written->nelts * sizeof(double)), "the scanned doubles differ");
+
+  /* 4 kv-pairs of 4 key bytes and 9 value bytes per record without the sub-encodings */
+  fseeko(kv_pair_file, 0, SEEK_END);
+  ck_assert_msg(ftello(kv_pair_file) < 30000 * (4 + 4 * 13) * 7 / 10, "the doubles take %ld bytes", (long) ftello(kv_pair_file));
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+START_TEST(test_key_encodings_round_trip)
+{
+  /* arrange */
+  jp_TLV_records_t*   records        = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t*   imported       = jp_TLV_record_collection_make(pool);
+  apr_array_header_t* matches        = apr_array_make(pool, 1024, sizeof(uint64_t));
+  FILE*               kv_pair_file   = tmpfile();
+  FILE*               key_index_file = tmpfile();
+  const char*         levels[]       = { "info", "warn", "error" };
+  const int           nb_records     = 20000;
+  uint8_t             scratch[1024];
+  long                inline_size    = 0;
+  int                 nb_warnings    = 0;
+  jp_verify_report_t  report;
+  jp_scan_report_t    scan_report;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    /* a clock (deltas), a few levels and statuses (dictionaries), a hundred users (two byte entries), unique ids (inline) */
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ts"), 1700000000 + 3 * i + i % 2);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "level"), levels[(i / 7) % 3]);
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "status"), (i % 5) ? 200 : 404 + i % 2);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "user"),
+                                    apr_psprintf(pool, "user-%d", (i * 37) % 100));
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "id"), apr_psprintf(pool, "%08x", i * 2654435761u));
+
+    /* values wrapping around, and values of another type than the one of the encoding of their key */
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "counter"), (i % 2) ? INT32_MIN : INT32_MAX);
+
+    if (0 == i % 1000)
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ts"), "late");
+
+    nb_warnings += (1 == (i / 7) % 3);
+    inline_size += jp_export_record_to_static_buffer(record, scratch, sizeof(scratch));
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  long kv_pair_size = ftell(kv_pair_file);
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_verify_file_set(pool, kv_pair_file, key_index_file, & report), "the file set does not verify");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_scan_file_set(pool, kv_pair_file, key_index_file, "level", "warn", collect_scanned_record, matches, & scan_report),
+                "unable to scan the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file), "unable to import the file set");
+
+  /* check */
+  check_same_records(records, imported);
+
+  ck_assert_msg(nb_warnings == matches->nelts, "%d warnings scanned, %d written", matches->nelts, nb_warnings);
+  ck_assert_msg(kv_pair_size < inline_size * 7 / 10, "%ld bytes written for %ld bytes of records", kv_pair_size, inline_size);
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+START_TEST(test_zone_maps_prune_ranges)
+{
+  /* arrange */
+  jp_TLV_records_t*   records       = jp_TLV_record_collection_make(pool);
+  FILE*               kv_pair_file  = tmpfile();
+  FILE*               key_file      = tmpfile();
+  apr_array_header_t* matches       = apr_array_make(pool, 64, sizeof(uint64_t));
+  jp_scan_report_t    int_report, double_report, miss_report;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_file, "unable to create temporary files");
+
+  /* a time-ordered log: the timestamps grow, the latencies are scattered */
+  for (int i = 0; i < 20000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "ts"), 1000000 + i);
+    jp_add_double_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "latency"), (i % 7919) / 1000.0);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "host"), "host-1");
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_file), "unable to export the file set");
+
+  /* act */
+  rewind(kv_pair_file); rewind(key_file);
+  int int_ret = jp_scan_file_set_range(pool, kv_pair_file, key_file, "ts", 1010000, 1010009, collect_scanned_record, matches, & int_report);
+
+  rewind(kv_pair_file); rewind(key_file);
+  int double_ret = jp_scan_file_set_range(pool, kv_pair_file, key_file, "latency", 7.9175, INFINITY, collect_scanned_record, matches, & double_report);
+
+  rewind(kv_pair_file); rewind(key_file);
+  int miss_ret = jp_scan_file_set_range(pool, kv_pair_file, key_file, "host", -INFINITY, INFINITY, collect_scanned_record, matches, & miss_report);
+
+  /* check */
+  ck_assert_msg(0 == int_ret && 0 == double_ret && 0 == miss_ret, "unable to scan the file set");
+
+  ck_assert_msg(10 == int_report.nb_records_matched, "the integer range matched %lu records", (unsigned long) int_report.nb_records_matched);
+  ck_assert_msg(int_report.nb_blocks > 2 && int_report.nb_blocks_skipped + 2 >= int_report.nb_blocks, "the integer range decoded too many blocks");
+
+  for (int i = 0; i < 10; i++)
+    ck_assert_msg(10000 + i == ((uint64_t*) matches->elts)[i], "wrong record matched for the integer range");
+
+  /* 7.918 is only reached by the records 7918, 15837 */
+  ck_assert_msg(2 == double_report.nb_records_matched, "the double range matched %lu records", (unsigned long) double_report.nb_records_matched);
+  ck_assert_msg(double_report.nb_blocks_skipped > 0, "the double range skipped no block");
+
+  ck_assert_msg(0 == miss_report.nb_records_matched && miss_report.nb_blocks_skipped == miss_report.nb_blocks, "a string key matched a numeric range");
+
+  fclose(kv_pair_file);
+  fclose(key_file);
+}
+END_TEST
+
+START_TEST(test_file_set_append)
+{
+  /* arrange */
+  jp_TLV_records_t* first_records  = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* second_records = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* all_records    = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_file   = tmpfile();
+  FILE*             key_index_file = tmpfile();
+
+  ck_assert_msg(kv_pair_file && key_index_file, "unable to create temporary files");
+
+  for (int i = 0; i < 3000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(first_records->key_index, "id"), i);
+    jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(first_records->key_index, "host"), "first");
+
+    jp_add_record_to_TLV_collection(first_records, record);
+  }
+
+  /* the second collection numbers its keys differently and brings a new one */
+  for (int i = 0; i < 2000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(second_records->key_index, "extra"), 1);
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(second_records->key_index, "id"), 3000 + i);
+
+    jp_add_record_to_TLV_collection(second_records, record);
+  }
+
+  /* act */
+  ck_assert_msg(0 == jp_append_records_to_file_set(first_records, kv_pair_file, key_index_file), "unable to start the file set");
+  ck_assert_msg(0 == jp_append_records_to_file_set(second_records, kv_pair_file, key_index_file), "unable to append to the file set");
+
+  rewind(kv_pair_file);
+  rewind(key_index_file);
+
+  ck_assert_msg(0 == jp_import_records_from_file_set(all_records, kv_pair_file, key_index_file), "unable to import the file set");
+
+  /* check */
+  ck_assert_msg(5000 == all_records->record_list->nelts, "record counts do not match");
+
+  size_t id_index    = jp_find_or_add_key(all_records->key_index, "id");
+  size_t extra_index = jp_find_or_add_key(all_records->key_index, "extra");
+
+  ck_assert_msg(3 == apr_hash_count(all_records->key_index), "unexpected keys in the file set");
+
+  for (int i = 0; i < 5000; i++) {
+    jp_TLV_record_t*  record  = ((jp_TLV_record_t**) all_records->record_list->elts)[i];
+    jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[(i < 3000) ? 0 : 1];
+    int32_t           id;
+
+    ck_assert_msg(id_index == kv_pair->key_index, "the id key was not renumbered");
+    ck_assert_msg(0 == jp_read_integer_from_kv_pair(kv_pair, & id) && i == id, "records out of order");
+
+    if (i >= 3000)
+      ck_assert_msg(extra_index == ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[0].key_index, "the new key was not added");
+  }
+
+  /* a truncated file of an older version refuses the append, and keeps its version */
+  uint32_t version, old_version, kept_version;
+  off_t    size = lseek(fileno(kv_pair_file), 0, SEEK_END);
+
+  ck_assert_msg(sizeof(uint32_t) == pread(fileno(kv_pair_file), & version, sizeof(uint32_t), sizeof(uint32_t)), "unable to read the version");
+
+  old_version = version - 1;
+
+  ck_assert_msg(sizeof(uint32_t) == pwrite(fileno(kv_pair_file), & old_version, sizeof(uint32_t), sizeof(uint32_t)), "unable to write the version");
+  ck_assert_msg(0 == ftruncate(fileno(kv_pair_file), size - 1), "unable to truncate the file");
+
+  ck_assert_msg(0 != jp_append_records_to_file_set(second_records, kv_pair_file, key_index_file), "appended to a truncated file set");
+
+  ck_assert_msg(sizeof(uint32_t) == pread(fileno(kv_pair_file), & kept_version, sizeof(uint32_t), sizeof(uint32_t)), "unable to read the version");
+  ck_assert_msg(old_version == kept_version, "the version of a refused append was bumped to %u", kept_version);
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+START_TEST(test_json_line_reader_chunks)
+{
+  /* arrange */
+  jp_TLV_records_t*      records = jp_TLV_record_collection_make(pool);
+  jp_json_line_reader_t* reader  = jp_json_line_reader_make(pool);
+  const char*            input   = "{ \"id\": 1 }\n{ \"id\": 2 }\n{ \"id\": 3, \"name\": \"third\" }\n{ \"id\": 4 }";
+  size_t                 length  = strlen(input);
+  size_t                 offset  = 0;
+
+  /* act: lines split across chunks, at most two records at a time */
+  while (offset < length) {
+    size_t chunk = (length - offset < 5) ? length - offset : 5;
+    size_t consumed;
+
+    ck_assert_msg(0 == jp_json_line_reader_feed(reader, pool, records, input + offset, chunk, 2, & consumed), "unable to parse the chunk");
+
+    if (0 == consumed) {
+      ck_assert_msg(2 == records->record_list->nelts, "the record limit was not honored");
+      records->record_list->nelts = 0;
+    }
+
+    offset += consumed;
+  }
+
+  ck_assert_msg(0 == jp_json_line_reader_finish(reader, pool, records), "unable to parse the last line");
+
+  /* check */
+  ck_assert_msg(2 == records->record_list->nelts, "record counts do not match");
+
+  jp_TLV_record_t*  record  = ((jp_TLV_record_t**) records->record_list->elts)[1];
+  jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[0];
+  int32_t           id;
+
+  ck_assert_msg(0 == jp_read_integer_from_kv_pair(kv_pair, & id) && 4 == id, "the last line was not parsed");
+}
+END_TEST
+
+/* the string value of a key in a record, NULL if the record has none */
+static
+jp_TLV_string_t* find_string_value(jp_TLV_record_t *record, uint32_t key_index) {
+  for (int i = 0; i < record->kv_pairs_array->nelts; i++) {
+    jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[i];
+
+    if (kv_pair->key_index == key_index && JP_TYPE_STRING == kv_pair->value_type)
+      return & kv_pair->union_v.string_value;
+  }
+
+  return NULL;
+}
+
+START_TEST(test_string_interning_shares_values)
+{
+  /* arrange */
+  jp_TLV_records_t*      records        = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t*      imported       = jp_TLV_record_collection_make(pool);
+  jp_json_line_reader_t* reader         = jp_json_line_reader_make(pool);
+  FILE*                  kv_pair_file   = tmpfile();
+  FILE*                  key_index_file = tmpfile();
+  const char*            hosts[]        = { "web-01", "web-02", "db-01", "a-hostname-longer-than-eight-bytes" };
+  const int              nb_records     = 3000;
+
+  ck_assert_msg(NULL != kv_pair_file && NULL != key_index_file, "unable to create temporary files");
+
+  jp_enable_string_interning(records, pool);
+  jp_enable_string_interning(imported, pool);
+
+  /* act: a host among a few, and a request id which never repeats */
+  for (int i = 0; i < nb_records; i++) {
+    const char* line = apr_psprintf(pool, "{ \"host\": \"%s\", \"request\": \"req-%08d\" }\n", hosts[i % 4], i);
+    size_t      consumed;
+
+    ck_assert_msg(0 == jp_json_line_reader_feed(reader, pool, records, line, strlen(line), nb_records, & consumed), "unable to parse the line");
+  }
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the file set");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_file, key_index_file), "unable to import the file set");
+
+  /* check */
+  check_same_records(records, imported);
+
+  jp_TLV_records_t* collections[] = { records, imported };
+
+  for (int c = 0; c < 2; c++) {
+    jp_TLV_record_t** list        = (jp_TLV_record_t**) collections[c]->record_list->elts;
+    uint32_t          host_key    = jp_find_or_add_key(collections[c]->key_index, "host");
+    uint32_t          request_key = jp_find_or_add_key(collections[c]->key_index, "request");
+
+    for (int i = 4; i < nb_records; i++) {
+      jp_TLV_string_t* host  = find_string_value(list[i], host_key);
+      jp_TLV_string_t* first = find_string_value(list[i % 4], host_key);
+
+      ck_assert_msg(host->value_buffer == first->value_buffer, "the host of record %d is not shared", i);
+      ck_assert_msg(0 != host->value_hash && host->value_hash == first->value_hash, "the host of record %d has no hash", i);
+    }
+
+    /* the request ids stop being looked up once their key is sampled */
+    jp_TLV_string_t* request = find_string_value(list[nb_records - 1], request_key);
+
+    ck_assert_msg(0 == request->value_hash, "the request ids are still interned");
+    ck_assert_str_eq(request->value_buffer, apr_psprintf(pool, "req-%08d", nb_records - 1));
+  }
+
+  /* the records built by hand are interned alike, and copied without interning */
+  jp_TLV_records_t* added  = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* copied = jp_TLV_record_collection_make(pool);
+  char              text[64];
+
+  jp_enable_string_interning(added, pool);
+
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_records_t* targets[] = { added, copied };
+
+    for (int c = 0; c < 2; c++) {
+      jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+      strcpy(text, hosts[i % 4]);
+      ck_assert_msg(0 == jp_add_interned_string_kv_pair_to_record(targets[c], record, jp_find_or_add_key(targets[c]->key_index, "host"),
+                                                                  text, strlen(text)), "unable to add the host");
+
+      /* the value is copied before the call returns */
+      memset(text, 'x', sizeof(text));
+
+      jp_add_record_to_TLV_collection(targets[c], record);
+    }
+  }
+
+  check_same_records(added, copied);
+
+  jp_TLV_record_t** added_list  = (jp_TLV_record_t**) added->record_list->elts;
+  jp_TLV_record_t** copied_list = (jp_TLV_record_t**) copied->record_list->elts;
+  uint32_t          host_key    = jp_find_or_add_key(added->key_index, "host");
+
+  for (int i = 4; i < nb_records; i++) {
+    jp_TLV_string_t* host  = find_string_value(added_list[i], host_key);
+    jp_TLV_string_t* first = find_string_value(added_list[i % 4], host_key);
+
+    ck_assert_msg(host->value_buffer == first->value_buffer && 0 != host->value_hash, "the host of record %d is not interned", i);
+    ck_assert_msg(0 == find_string_value(copied_list[i], host_key)->value_hash, "the host of record %d is interned", i);
+  }
+
+  /* the dictionaries of the blocks find the hosts by the hashes they carry */
+  jp_TLV_records_t* reimported = jp_TLV_record_collection_make(pool);
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == ftruncate(fileno(kv_pair_file), 0) && 0 == ftruncate(fileno(key_index_file), 0), "unable to truncate the files");
+  ck_assert_msg(0 == jp_export_records_to_file_set(added, kv_pair_file, key_index_file), "unable to export the added records");
+
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(reimported, kv_pair_file, key_index_file), "unable to import the added records");
+
+  check_same_records(copied, reimported);
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+static
+int mark_task(void *context, size_t task) {
+  int* marks = context;
+
+  marks[task]++;
+
+  return (task % 10 == 0) ? -1 : 0;
+}
+
+START_TEST(test_worker_pool_runs_every_task)
+{
+  /* arrange */
+  int marks[100] = { 0 };
+
+  /* act */
+  size_t nb_failures = jp_worker_pool_run(pool, 4, 100, mark_task, marks);
+
+  /* check */
+  ck_assert_msg(10 == nb_failures, "failed tasks were not counted");
+
+  for (int i = 0; i < 100; i++)
+    ck_assert_msg(1 == marks[i], "a task did not run exactly once");
+}
+END_TEST
+
+static
+int produce_segment_task(void *context, size_t task) {
+  jp_TLV_records_t* segment = jp_concurrent_records_segment_make(context);
+
+  if (NULL == segment)
+    return -1;
+
+  apr_pool_t* segment_pool = apr_hash_pool_get(segment->key_index);
+  const char* own_key      = apr_psprintf(segment_pool, "producer-%d", (int) task);
+
+  for (int i = 0; i < 5000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(segment_pool);
+
+    /* every producer meets its keys in a different order */
+    if (0 == task % 2)
+      jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(segment->key_index, own_key), 1);
+
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(segment->key_index, "producer"), (int32_t) task);
+    jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(segment->key_index, "seq"), i);
+
+    if (1 == task % 2)
+      jp_add_boolean_kv_pair_to_record(record, jp_find_or_add_key(segment->key_index, own_key), 1);
+
+    jp_add_record_to_TLV_collection(segment, record);
+  }
+
+  return 0;
+}
+
+START_TEST(test_concurrent_records_segments)
+{
+  /* arrange */
+  jp_concurrent_records_t* records          = jp_concurrent_records_make(pool);
+  jp_TLV_records_t*        imported_records = jp_TLV_record_collection_make(pool);
+  FILE*                    kv_pair_file     = tmpfile();
+  FILE*                    key_index_file   = tmpfile();
+  int                      seen[8]          = { 0 };
+  int32_t                  last_producer    = -1;
+
+  ck_assert_msg(NULL != records && NULL != kv_pair_file && NULL != key_index_file, "unable to create the collection");
+
+  /* act */
+  size_t nb_failures = jp_worker_pool_run(pool, 4, 8, produce_segment_task, records);
+
+  ck_assert_msg(0 == nb_failures, "a producer failed");
+  ck_assert_msg(0 == jp_export_concurrent_records_to_file_set(records, kv_pair_file, key_index_file), "unable to export the collection");
+
+  /* check */
+  rewind(kv_pair_file); rewind(key_index_file);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported_records, kv_pair_file, key_index_file), "unable to import the file set");
+
+  ck_assert_msg(40000 == imported_records->record_list->nelts, "%d records imported", imported_records->record_list->nelts);
+  ck_assert_msg(10 == apr_hash_count(imported_records->key_index), "the keys were not merged");
+
+  uint32_t producer_key = (uint32_t) (size_t) apr_hash_get(imported_records->key_index, "producer", APR_HASH_KEY_STRING);
+  uint32_t seq_key      = (uint32_t) (size_t) apr_hash_get(imported_records->key_index, "seq", APR_HASH_KEY_STRING);
+
+  for (int i = 0; i < 40000; i++) {
+    jp_TLV_record_t* record   = ((jp_TLV_record_t**) imported_records->record_list->elts)[i];
+    int32_t          producer = -1, seq = -1;
+    uint32_t         own_key  = 0;
+
+    for (int j = 0; j < record->kv_pairs_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[j];
+
+      if (producer_key == kv_pair->key_index)
+        jp_read_integer_from_kv_pair(kv_pair, & producer);
+      else if (seq_key == kv_pair->key_index)
+        jp_read_integer_from_kv_pair(kv_pair, & seq);
+      else
+        own_key = kv_pair->key_index;
+    }
+
+    ck_assert_msg(producer >= 0 && producer < 8, "record %d has no producer", i);
+
+    /* the segments are written whole, each in the order of its records */
+    ck_assert_msg(seq == seen[producer]++, "record %d is out of order", i);
+    ck_assert_msg(0 == i % 5000 || producer == last_producer, "record %d interleaves two segments", i);
+
+    last_producer = producer;
+
+    const char* expected_key = apr_psprintf(pool, "producer-%d", producer);
+
+    ck_assert_msg(own_key == (uint32_t) (size_t) apr_hash_get(imported_records->key_index, expected_key, APR_HASH_KEY_STRING),
+                  "record %d has the key of another producer", i);
+  }
+
+  fclose(kv_pair_file);
+  fclose(key_index_file);
+}
+END_TEST
+
+START_TEST(test_import_file_sets_in_order)
+{
+  /* arrange */
+  jp_TLV_records_t* parallel_records = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* serial_records   = jp_TLV_record_collection_make(pool);
+  FILE*             kv_pair_inputs[6];
+  FILE*             key_index_inputs[6];
+  FILE*             parallel_output  = tmpfile();
+  FILE*             serial_output    = tmpfile();
+
+  ck_assert_msg(NULL != parallel_output && NULL != serial_output, "unable to create temporary files");
+
+  jp_enable_string_interning(parallel_records, pool);
+
+  for (int i = 0; i < 6; i++) {
+    jp_TLV_records_t* records = jp_TLV_record_collection_make(pool);
+
+    kv_pair_inputs[i]   = tmpfile();
+    key_index_inputs[i] = tmpfile();
+
+    ck_assert_msg(NULL != kv_pair_inputs[i] && NULL != key_index_inputs[i], "unable to create temporary files");
+
+    /* every set numbers its keys in an order of its own */
+    for (int j = 0; j < 3000 * (i + 1); j++) {
+      jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+      jp_add_string_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, apr_psprintf(pool, "only-%d", i)), "x");
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "seq"), j);
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, "set"), i);
+      jp_add_record_to_TLV_collection(records, record);
+    }
+
+    ck_assert_msg(0 == jp_export_records_to_file_set(records, kv_pair_inputs[i], key_index_inputs[i]), "unable to export set %d", i);
+  }
+
+  /* act */
+  for (int i = 0; i < 6; i++) {
+    rewind(kv_pair_inputs[i]); rewind(key_index_inputs[i]);
+  }
+
+  int parallel_ret = jp_import_file_sets(parallel_records, kv_pair_inputs, key_index_inputs, 6, 3);
+
+  for (int i = 0; i < 6; i++) {
+    rewind(kv_pair_inputs[i]); rewind(key_index_inputs[i]);
+    ck_assert_msg(0 == jp_import_records_from_file_set(serial_records, kv_pair_inputs[i], key_index_inputs[i]), "unable to import set %d", i);
+  }
+
+  /* check */
+  ck_assert_msg(0 == parallel_ret, "unable to import the file sets");
+  ck_assert_msg(63000 == parallel_records->record_list->nelts, "%d records imported", parallel_records->record_list->nelts);
+
+  ck_assert_msg(apr_hash_get(serial_records->key_index, "seq", APR_HASH_KEY_STRING) ==
+                apr_hash_get(parallel_records->key_index, "seq", APR_HASH_KEY_STRING) &&
+                apr_hash_get(serial_records->key_index, "only-5", APR_HASH_KEY_STRING) ==
+                apr_hash_get(parallel_records->key_index, "only-5", APR_HASH_KEY_STRING), "the keys are numbered differently");
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(parallel_records, parallel_output, NULL), "unable to export the parallel import");
+  ck_assert_msg(0 == jp_export_records_to_file_set(serial_records, serial_output, NULL), "unable to export the serial import");
+
+  long parallel_size = ftell(parallel_output);
+  long serial_size   = ftell(serial_output);
+
+  ck_assert_msg(parallel_size == serial_size, "the imports differ in size: %ld and %ld bytes", parallel_size, serial_size);
+
+  char* parallel_bytes = apr_palloc(pool, parallel_size);
+  char* serial_bytes   = apr_palloc(pool, serial_size);
+
+  rewind(parallel_output); rewind(serial_output);
+
+  ck_assert_msg(1 == fread(parallel_bytes, parallel_size, 1, parallel_output) && 1 == fread(serial_bytes, serial_size, 1, serial_output),
+                "unable to read the exports back");
+  ck_assert_msg(0 == memcmp(parallel_bytes, serial_bytes, serial_size), "the records are not in the order of the inputs");
+
+  for (int i = 0; i < 6; i++) {
+    fclose(kv_pair_inputs[i]);
+    fclose(key_index_inputs[i]);
+  }
+
+  fclose(parallel_output);
+  fclose(serial_output);
+}
+END_TEST
+
+static
+jp_TLV_records_t* make_keyed_records(const char* const *keys, int nb_keys, int nb_records)
+{
+  jp_TLV_records_t* records = jp_TLV_record_collection_make(pool);
+
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    /* every key holds the position of its name in the list */
+    for (int k = 0; k < nb_keys; k++)
+      jp_add_integer_kv_pair_to_record(record, jp_find_or_add_key(records->key_index, keys[k]), keys[k][0] - 'a');
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  return records;
+}
+
+START_TEST(test_key_dictionary_concatenation)
+{
+  /* arrange */
+  char        dictionary[] = "/tmp/jp_key_dictionary_XXXXXX";
+  int         fd           = mkstemp(dictionary);
+  const char* first_keys[] = { "a", "b" };
+  const char* other_keys[] = { "c", "b", "a" };
+  FILE*       files[8];
+  uint32_t    version;
+
+  ck_assert_msg(fd >= 0, "unable to create the dictionary");
+  close(fd);
+
+  for (int i = 0; i < 8; i++) {
+    files[i] = tmpfile();
+    ck_assert_msg(NULL != files[i], "unable to create temporary files");
+  }
+
+  jp_TLV_records_t* first    = make_keyed_records(first_keys, 2, 3000);
+  jp_TLV_records_t* other    = make_keyed_records(other_keys, 3, 5000);
+  jp_TLV_records_t* unbound  = make_keyed_records(other_keys, 3, 10);
+  jp_TLV_records_t* imported = jp_TLV_record_collection_make(pool);
+
+  /* act */
+  ck_assert_msg(0 == jp_bind_key_dictionary(first, dictionary, & version) && 2 == version, "unable to bind the first collection");
+  ck_assert_msg(0 == jp_bind_key_dictionary(other, dictionary, & version) && 3 == version, "unable to bind the other collection");
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(first, files[0], files[1]) &&
+                0 == jp_export_records_to_file_set(other, files[2], files[3]) &&
+                0 == jp_export_records_to_file_set(unbound, files[4], files[5]), "unable to export the file sets");
+
+  for (int i = 0; i < 6; i++)
+    rewind(files[i]);
+
+  FILE* const bound_kv_pairs[]     = { files[0], files[2] };
+  FILE* const bound_key_indices[]  = { files[1], files[3] };
+  FILE* const mixed_kv_pairs[]     = { files[0], files[4] };
+  FILE* const mixed_key_indices[]  = { files[1], files[5] };
+
+  int mixed_ret = jp_concatenate_file_sets(pool, mixed_kv_pairs, mixed_key_indices, 2, files[6], files[7]);
+  int bound_ret = jp_concatenate_file_sets(pool, bound_kv_pairs, bound_key_indices, 2, files[6], files[7]);
+
+  /* check */
+  ck_assert_msg(3 == (size_t) apr_hash_get(other->key_index, "c", APR_HASH_KEY_STRING) &&
+                1 == (size_t) apr_hash_get(other->key_index, "a", APR_HASH_KEY_STRING), "the keys were not renumbered");
+
+  ck_assert_msg(1 == mixed_ret, "file sets numbered differently were concatenated");
+  ck_assert_msg(0 == bound_ret, "unable to concatenate the file sets of the dictionary");
+
+  rewind(files[6]); rewind(files[7]);
+  ck_assert_msg(0 == jp_import_records_from_file_set(imported, files[6], files[7]), "unable to import the concatenation");
+  ck_assert_msg(8000 == imported->record_list->nelts, "%d records imported", imported->record_list->nelts);
+
+  for (int i = 0; i < imported->record_list->nelts; i++) {
+    jp_TLV_record_t* record = ((jp_TLV_record_t**) imported->record_list->elts)[i];
+
+    ck_assert_msg((i < 3000 ? 2 : 3) == record->kv_pairs_array->nelts, "record %d has the wrong keys", i);
+
+    for (int j = 0; j < record->kv_pairs_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[j];
+      int32_t           value;
+
+      jp_read_integer_from_kv_pair(kv_pair, & value);
+
+      /* a, b and c are numbered 1, 2 and 3 in every file set */
+      ck_assert_msg(value == (int32_t) kv_pair->key_index - 1, "record %d has a wrong value", i);
+    }
+  }
+
+  /* an append cut short is overwritten by the next one */
+  FILE* torn = fopen(dictionary, "ab");
+
+  ck_assert_msg(NULL != torn && 5 == fwrite("\x09\0\0\0d", 1, 5, torn), "unable to tear the dictionary");
+  fclose(torn);
+
+  const char*       last_keys[] = { "d", "a" };
+  jp_TLV_records_t* last        = make_keyed_records(last_keys, 2, 1);
+  jp_TLV_records_t* loaded      = jp_TLV_record_collection_make(pool);
+
+  ck_assert_msg(0 == jp_bind_key_dictionary(last, dictionary, & version) && 4 == version, "unable to append after a torn entry");
+  ck_assert_msg(0 == jp_bind_key_dictionary(loaded, dictionary, & version) && 4 == version &&
+                4 == (size_t) apr_hash_get(loaded->key_index, "d", APR_HASH_KEY_STRING), "unable to load the dictionary");
+
+  for (int i = 0; i < 8; i++)
+    fclose(files[i]);
+
+  unlink(dictionary);
+}
+END_TEST
+
+static
+jp_TLV_records_t* make_mixed_records(const char* const *keys, int nb_keys, int nb_records)
+{
+  jp_TLV_records_t* records  = jp_TLV_record_collection_make(pool);
+  const char*       levels[] = { "info", "warn", "error" };
+  char              text[64];
+
+  for (int i = 0; i < nb_records; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    /* a delta, a dictionary, inline strings, doubles and booleans, depending on the name of the key */
+    for (int k = 0; k < nb_keys; k++) {
+      size_t key_index = jp_find_or_add_key(records->key_index, keys[k]);
+
+      snprintf(text, sizeof(text), "a message long enough not to fit in the descriptor %d", i);
+
+      if ('t' == keys[k][0])
+        jp_add_integer_kv_pair_to_record(record, key_index, 1000000 + i * 1000);
+      else if ('l' == keys[k][0])
+        jp_add_string_kv_pair_to_record(record, key_index, levels[i % 3]);
+      else if ('m' == keys[k][0])
+        jp_add_string_kv_pair_to_record(record, key_index, text);
+      else if ('d' == keys[k][0])
+        jp_add_double_kv_pair_to_record(record, key_index, 0.1 + i * 0.25);
+      else
+        jp_add_boolean_kv_pair_to_record(record, key_index, i % 2);
+    }
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  return records;
+}
+
+START_TEST(test_transcode_file_sets)
+{
+  /* arrange */
+  const char* first_keys[] = { "ts", "level", "msg", "duration" };
+  const char* other_keys[] = { "duration", "ok", "level", "ts" };
+  const char* bloom_keys[] = { "level" };
+  FILE*       files[8];
+
+  for (int i = 0; i < 8; i++) {
+    files[i] = tmpfile();
+    ck_assert_msg(NULL != files[i], "unable to create temporary files");
+  }
+
+  jp_TLV_records_t* first      = make_mixed_records(first_keys, 4, 3000);
+  jp_TLV_records_t* other      = make_mixed_records(other_keys, 4, 5000);
+  jp_TLV_records_t* ordered    = make_mixed_records(other_keys, 4, 10);
+  jp_TLV_records_t* transcoded = jp_TLV_record_collection_make(pool);
+  jp_TLV_records_t* decoded    = jp_TLV_record_collection_make(pool);
+
+  /* the filters cannot be renumbered, the arrival order of the records cannot be merged */
+  jp_enable_block_filters(other, bloom_keys, 1);
+  jp_enable_record_clustering(ordered, JP_CLUSTER_DEFAULT_WINDOW, NULL, 1);
+
+  ck_assert_msg(0 == jp_export_records_to_file_set(first, files[0], files[1]) &&
+                0 == jp_export_records_to_file_set(other, files[2], files[3]) &&
+                0 == jp_export_records_to_file_set(ordered, files[4], files[5]), "unable to export the file sets");
+
+  for (int i = 0; i < 6; i++)
+    rewind(files[i]);
+
+  FILE* const kv_pairs[]            = { files[0], files[2] };
+  FILE* const key_indices[]         = { files[1], files[3] };
+  FILE* const ordered_kv_pairs[]    = { files[0], files[4] };
+  FILE* const ordered_key_indices[] = { files[1], files[5] };
+
+  /* act */
+  int ordered_ret = jp_transcode_file_sets(pool, ordered_kv_pairs, ordered_key_indices, 2, files[6], files[7]);
+  int ret         = jp_transcode_file_sets(pool, kv_pairs, key_indices, 2, files[6], files[7]);
+
+  /* check */
+  ck_assert_msg(1 == ordered_ret, "file sets with the arrival order of their records were transcoded");
+  ck_assert_msg(0 == ret, "unable to transcode the file sets");
+
+  rewind(files[6]); rewind(files[7]);
+  ck_assert_msg(0 == jp_import_records_from_file_set(transcoded, files[6], files[7]), "unable to import the transcoded file set");
+
+  for (int i = 0; i < 4; i++)
+    rewind(files[i]);
+
+  ck_assert_msg(0 == jp_import_file_sets(decoded, kv_pairs, key_indices, 2, 1), "unable to decode the file sets");
+  ck_assert_msg(8000 == transcoded->record_list->nelts, "%d records transcoded", transcoded->record_list->nelts);
+  ck_assert_msg(5 == apr_hash_count(transcoded->key_index) &&
+                5 == (size_t) apr_hash_get(transcoded->key_index, "ok", APR_HASH_KEY_STRING), "the keys were not renumbered");
+
+  /* the keys are numbered alike by both, in the order they first appear */
+  for (int i = 0; i < transcoded->record_list->nelts; i++) {
+    jp_TLV_record_t* record   = ((jp_TLV_record_t**) transcoded->record_list->elts)[i];
+    jp_TLV_record_t* expected = ((jp_TLV_record_t**) decoded->record_list->elts)[i];
+
+    ck_assert_msg(expected->kv_pairs_array->nelts == record->kv_pairs_array->nelts, "record %d has the wrong keys", i);
+
+    for (int j = 0; j < record->kv_pairs_array->nelts; j++) {
+      jp_TLV_kv_pair_t* kv_pair       = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[j];
+      jp_TLV_kv_pair_t* expected_pair = & ((jp_TLV_kv_pair_t*) expected->kv_pairs_array->elts)[j];
+
+      ck_assert_msg(expected_pair->key_index == kv_pair->key_index && expected_pair->value_type == kv_pair->value_type,
+                    "record %d has a wrong key", i);
+
+      if (JP_TYPE_STRING == kv_pair->value_type)
+        ck_assert_str_eq(expected_pair->union_v.string_value.value_buffer, kv_pair->union_v.string_value.value_buffer);
+      else if (JP_TYPE_DOUBLE == kv_pair->value_type)
+        ck_assert_msg(expected_pair->union_v.double_value == kv_pair->union_v.double_value, "record %d has a wrong double", i);
+      else
+        ck_assert_msg(expected_pair->union_v.integer_value == kv_pair->union_v.integer_value, "record %d has a wrong value", i);
+    }
+  }
+
+  for (int i = 0; i < 8; i++)
+    fclose(files[i]);
+}
+END_TEST
+
+START_TEST(test_export_records_to_partitions)
+{
+  /* arrange */
+  const char*       tenants[] = { "acme", "globex", "initech", "umbrella", "hooli" };
+  jp_TLV_records_t* records   = jp_TLV_record_collection_make(pool);
+  size_t            tenant    = jp_find_or_add_key(records->key_index, "tenant");
+  size_t            sequence  = jp_find_or_add_key(records->key_index, "n");
+  FILE*             kv_pair_files[3];
+  FILE*             key_index_files[3];
+  int               partition_of[7];
+
+  for (int i = 0; i < 7; i++)
+    partition_of[i] = -1;
+
+  for (int i = 0; i < 3; i++) {
+    kv_pair_files[i]   = tmpfile();
+    key_index_files[i] = tmpfile();
+    ck_assert_msg(NULL != kv_pair_files[i] && NULL != key_index_files[i], "unable to create temporary files");
+  }
+
+  /* strings, integers, and records without the key */
+  for (int i = 0; i < 7000; i++) {
+    jp_TLV_record_t* record = jp_TLV_record_make(pool);
+
+    jp_add_integer_kv_pair_to_record(record, sequence, i);
+
+    if (i % 7 < 5)
+      jp_add_string_kv_pair_to_record(record, tenant, tenants[i % 7]);
+    else if (5 == i % 7)
+      jp_add_integer_kv_pair_to_record(record, tenant, 42);
+
+    jp_add_record_to_TLV_collection(records, record);
+  }
+
+  /* act */
+  int ret = jp_export_records_to_partitions(records, "tenant", kv_pair_files, key_index_files, 3, 2);
+
+  /* check */
+  ck_assert_msg(0 == ret, "unable to export the partitions");
+
+  int nb_records = 0;
+
+  for (int p = 0; p < 3; p++) {
+    jp_TLV_records_t* imported = jp_TLV_record_collection_make(pool);
+    int32_t           previous = -1;
+
+    rewind(kv_pair_files[p]); rewind(key_index_files[p]);
+    ck_assert_msg(0 == jp_import_records_from_file_set(imported, kv_pair_files[p], key_index_files[p]), "unable to import partition %d", p);
+
+    for (int i = 0; i < imported->record_list->nelts; i++) {
+      jp_TLV_record_t*  record = ((jp_TLV_record_t**) imported->record_list->elts)[i];
+      jp_TLV_kv_pair_t* first  = & ((jp_TLV_kv_pair_t*) record->kv_pairs_array->elts)[0];
+      int32_t           n;
+
+      jp_read_integer_from_kv_pair(first, & n);
+
+      /* the records keep their order, and all the records of a value are in the same partition */
+      ck_assert_msg(n > previous, "partition %d is out of order", p);
+      ck_assert_msg(-1 == partition_of[n % 7] || p == partition_of[n % 7], "the value of record %d is in two partitions", n);
+
+      partition_of[n % 7] = p;
+      previous            = n;
+    }
+
+    nb_records += imported->record_list->nelts;
+  }
+
+  ck_assert_msg(7000 == nb_records, "%d records in the partitions", nb_records);
+  ck_assert_msg(0 == partition_of[6], "the records without the key are not in the first partition");
+
+  for (int i = 0; i < 3; i++) {
+    fclose(kv_pair_files[i]);
+    fclose(key_index_files[i]);
+  }
+}
+END_TEST
+
+START_TEST(test_key_index_map_lookups)
+{
+  /* arrange */
+  apr_hash_t* key_index      = apr_hash_make(pool);
+  FILE*       key_index_file = tmpfile();
+  char        key[32];
+
+  ck_assert_msg(NULL != key_index_file, "unable to create a temporary file");
+
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key_%d", i);
+    jp_find_or_add_key(key_index, key);
+  }
+
+  ck_assert_msg(0 == jp_export_key_index_to_file(key_index, key_index_file), "unable to export the key index");
+  rewind(key_index_file);
+
+  /* act */
+  jp_key_index_map_t* map = jp_key_index_map_open(pool, key_index_file);
+
+  /* check */
+  ck_assert_msg(NULL != map, "unable to open the key index");
+  ck_assert_msg(1000 == jp_key_index_map_count(map), "key counts do not match");
+
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "key_%d", i);
+
+    uint32_t index = jp_key_index_map_find(map, key);
+
+    ck_assert_msg(i + 1 == index, "key lookup failed");
+    ck_assert_str_eq(key, jp_key_index_map_key(map, index, NULL));
+  }
+
+  ck_assert_msg(0 == jp_key_index_map_find(map, "missing"), "unknown key found");
+  ck_assert_msg(NULL == jp_key_index_map_key(map, 1001, NULL), "unknown index found");
+
+  jp_key_index_map_close(map);
+  fclose(key_index_file);
+}
+END_TEST
+
 
 Suite * kv_pair_encoding_suite()
 {
@@ -278,6 +2199,33 @@ Suite * kv_pair_encoding_suite()
     tcase_add_test(tc_core_kv_encoding, test_long_string_KV_Pair_Encoding);
     tcase_add_test(tc_core_kv_encoding, test_composite_KV_Pair_Encoding);
     tcase_add_test(tc_core_kv_encoding, test_TLV_record_export_import);
+    tcase_add_test(tc_core_kv_encoding, test_file_set_export_import);
+    tcase_add_test(tc_core_kv_encoding, test_file_set_large_string_export_import);
+    tcase_add_test(tc_core_kv_encoding, test_file_set_append);
+    tcase_add_test(tc_core_kv_encoding, test_single_file_container_export_import);
+    tcase_add_test(tc_core_kv_encoding, test_file_set_verify_detects_corruption);
+    tcase_add_test(tc_core_kv_encoding, test_block_filters_skip_blocks);
+    tcase_add_test(tc_core_kv_encoding, test_zone_maps_prune_ranges);
+    tcase_add_test(tc_core_kv_encoding, test_double_encodings_round_trip);
+    tcase_add_test(tc_core_kv_encoding, test_key_encodings_round_trip);
+    tcase_add_test(tc_core_kv_encoding, test_record_clustering_by_shape);
+    tcase_add_test(tc_core_kv_encoding, test_scan_keeps_arrival_order);
+    tcase_add_test(tc_core_kv_encoding, test_sort_file_sets_by_key);
+    tcase_add_test(tc_core_kv_encoding, test_value_index_lookups);
+    tcase_add_test(tc_core_kv_encoding, test_aggregate_file_sets_by_group);
+    tcase_add_test(tc_core_kv_encoding, test_json_line_writer_output);
+    tcase_add_test(tc_core_kv_encoding, test_direct_writer_records);
+    tcase_add_test(tc_core_kv_encoding, test_key_index_map_lookups);
+    tcase_add_test(tc_core_kv_encoding, test_json_line_reader_chunks);
+    tcase_add_test(tc_core_kv_encoding, test_string_interning_shares_values);
+    tcase_add_test(tc_core_kv_encoding, test_worker_pool_runs_every_task);
+    tcase_add_test(tc_core_kv_encoding, test_concurrent_records_segments);
+    tcase_add_test(tc_core_kv_encoding, test_import_file_sets_in_order);
+    tcase_add_test(tc_core_kv_encoding, test_key_dictionary_concatenation);
+    tcase_add_test(tc_core_kv_encoding, test_transcode_file_sets);
+    tcase_add_test(tc_core_kv_encoding, test_export_records_to_partitions);
+    tcase_add_test(tc_core_kv_encoding, test_block_trailer_grows_buffer);
+    tcase_add_test(tc_core_kv_encoding, test_aggregate_duplicated_keys);
 
     suite_add_tcase(s, tc_core_kv_encoding);
 
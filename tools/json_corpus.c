@@ -0,0 +1,391 @@
+
+#include <apr.h>
+#include <apr_getopt.h>
+#include <apr_strings.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "jp_tlv_encoder.h"
+
+/*
+ *  Writes a reproducible corpus of JSON lines shaped like the logs the packer is meant for: web
+ *  access logs, host metrics and trace spans. Every record is drawn from a splitmix64 generator
+ *  seeded on the command line, so a seed gives the same bytes on every platform. The lines are
+ *  written the way `tlv_unpacker --format jsonl` writes them back (no blanks, integers within 32
+ *  bits, doubles with the fewest digits), which lets a round trip be checked with cmp.
+ */
+
+
+/* file utils */
+
+FILE *open_filename(const char *filename, const char *opt, int is_input)
+{
+	FILE *input;
+	if (strcmp(filename, "-") == 0)
+		input = (is_input) ? stdin : stdout;
+	else {
+		input = fopen(filename, opt);
+		if (!input) {
+			fprintf(stderr, "error: cannot open %s: %s", filename, strerror(errno));
+			return NULL;
+		}
+	}
+	return input;
+}
+
+
+void close_filename(const char *filename, FILE *file)
+{
+	if (file != NULL && strcmp(filename, "-") != 0)
+		fclose(file);
+}
+
+
+/* random draws */
+
+typedef struct corpus_random
+{
+  uint64_t state;
+} corpus_random_t;
+
+
+uint64_t next_random(corpus_random_t *random)
+{
+  uint64_t z = (random->state += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+  return z ^ (z >> 31);
+}
+
+
+uint32_t uniform(corpus_random_t *random, uint32_t n)
+{
+  return (uint32_t) ((next_random(random) >> 32) * n >> 32);
+}
+
+
+/* the first values come up far more often than the last ones, as hosts, paths and users do */
+uint32_t skewed(corpus_random_t *random, uint32_t n)
+{
+  double u = (next_random(random) >> 11) * 0x1.0p-53;
+
+  return (uint32_t) (u * u * u * n);
+}
+
+
+/* line assembly */
+
+#define CORPUS_LINE_SIZE  1024
+
+typedef struct corpus_line
+{
+  char   text[CORPUS_LINE_SIZE];
+  size_t length;
+  int    nb_fields;
+} corpus_line_t;
+
+
+void add_key(corpus_line_t *line, const char *key)
+{
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "%s\"%s\":",
+                           line->nb_fields++ ? "," : "{", key);
+}
+
+
+void add_string(corpus_line_t *line, const char *key, const char *value)
+{
+  add_key(line, key);
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "\"%s\"", value);
+}
+
+
+void add_integer(corpus_line_t *line, const char *key, int32_t value)
+{
+  add_key(line, key);
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "%" PRId32, value);
+}
+
+
+void add_boolean(corpus_line_t *line, const char *key, int value)
+{
+  add_key(line, key);
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "%s", value ? "true" : "false");
+}
+
+
+/*
+ *  Adds scaled / 10^decimals without trailing zeros. The value is never integral, as integral
+ *  doubles would read back as integers, and 15 digits at most always read back the same
+ */
+void add_decimal(corpus_line_t *line, const char *key, uint64_t scaled, int decimals)
+{
+  uint64_t unit = 1;
+
+  for (int i = 0; i < decimals; i++)
+    unit *= 10;
+
+  if (0 == scaled % unit)
+    scaled++;
+
+  uint64_t fraction = scaled % unit;
+
+  while (0 == fraction % 10) {
+    fraction /= 10;
+    decimals--;
+  }
+
+  add_key(line, key);
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "%" PRIu64 ".%0*" PRIu64,
+                           scaled / unit, decimals, fraction);
+}
+
+
+void add_hex(corpus_line_t *line, const char *key, corpus_random_t *random, int nb_words)
+{
+  char text[33];
+
+  for (int i = 0; i < nb_words; i++)
+    snprintf(text + 16 * i, 17, "%016" PRIx64, next_random(random));
+
+  add_string(line, key, text);
+}
+
+
+void end_line(corpus_line_t *line)
+{
+  line->length += snprintf(line->text + line->length, CORPUS_LINE_SIZE - line->length, "}\n");
+}
+
+
+/* record shapes */
+
+static const char* const methods[]     = { "GET", "GET", "GET", "GET", "POST", "POST", "PUT", "DELETE" };
+static const char* const resources[]   = { "users", "orders", "items", "carts", "sessions", "search", "reviews", "invoices" };
+static const char* const user_agents[] = {
+  "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36",
+  "Mozilla/5.0 (Macintosh; Intel Mac OS X 14_2) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.2 Safari/605.1.15",
+  "Mozilla/5.0 (X11; Linux x86_64; rv:121.0) Gecko/20100101 Firefox/121.0",
+  "Mozilla/5.0 (iPhone; CPU iPhone OS 17_2 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Mobile/15E148",
+  "curl/8.5.0",
+  "python-requests/2.31.0",
+  "Go-http-client/1.1"
+};
+static const char* const metrics[]     = { "cpu.user", "cpu.system", "mem.used", "disk.read", "disk.write", "net.rx", "net.tx", "load.1m" };
+static const char* const regions[]     = { "us-east-1", "us-west-2", "eu-west-1", "ap-south-1" };
+static const char* const services[]    = { "gateway", "auth", "catalog", "checkout", "payments", "inventory" };
+static const char* const operations[]  = { "http.request", "db.query", "cache.get", "cache.set", "rpc.call", "queue.publish" };
+
+#define COUNT_OF(array)  (sizeof(array) / sizeof(array[0]))
+
+typedef struct corpus
+{
+  corpus_random_t random;
+  int32_t         timestamp;
+  int32_t         counters[COUNT_OF(metrics)];
+} corpus_t;
+
+
+void access_record(corpus_t *corpus, corpus_line_t *line)
+{
+  corpus_random_t* random = & corpus->random;
+  uint32_t         draw   = uniform(random, 1000);
+  int32_t          status = (draw < 900) ? 200 : (draw < 940) ? 304 : (draw < 980) ? 404 : (draw < 995) ? 500 : 503;
+  char             text[64];
+
+  add_integer(line, "ts", corpus->timestamp);
+  snprintf(text, sizeof(text), "web-%02" PRIu32, skewed(random, 24));
+  add_string(line, "host", text);
+  snprintf(text, sizeof(text), "10.%" PRIu32 ".%" PRIu32 ".%" PRIu32, uniform(random, 4), skewed(random, 256), uniform(random, 256));
+  add_string(line, "client_ip", text);
+  add_string(line, "method", methods[uniform(random, COUNT_OF(methods))]);
+  snprintf(text, sizeof(text), "/api/v1/%s/%" PRIu32, resources[skewed(random, COUNT_OF(resources))], skewed(random, 100000));
+  add_string(line, "path", text);
+  add_integer(line, "status", status);
+  add_integer(line, "bytes", (200 == status) ? 200 + (int32_t) skewed(random, 64000) : 0);
+  add_decimal(line, "latency_ms", 200 + skewed(random, 2000000), 3);
+  add_string(line, "user_agent", user_agents[skewed(random, COUNT_OF(user_agents))]);
+  add_hex(line, "request_id", random, 1);
+}
+
+
+void metrics_record(corpus_t *corpus, corpus_line_t *line)
+{
+  corpus_random_t* random = & corpus->random;
+  uint32_t         metric = uniform(random, COUNT_OF(metrics));
+  uint32_t         host   = uniform(random, 64);
+  char             text[32];
+
+  add_integer(line, "ts", corpus->timestamp);
+  snprintf(text, sizeof(text), "node-%03" PRIu32, host);
+  add_string(line, "host", text);
+  add_string(line, "region", regions[host % COUNT_OF(regions)]);
+  add_string(line, "metric", metrics[metric]);
+
+  /* the disk and network metrics are counters, the others gauges */
+  if (metric >= 3 && metric <= 6) {
+    corpus->counters[metric] += (int32_t) uniform(random, 4096);
+    add_integer(line, "value", corpus->counters[metric]);
+  } else {
+    add_decimal(line, "value", skewed(random, 10000), 2);
+  }
+
+  add_boolean(line, "alert", 0 == uniform(random, 200));
+}
+
+
+void traces_record(corpus_t *corpus, corpus_line_t *line)
+{
+  corpus_random_t* random  = & corpus->random;
+  uint32_t         service = skewed(random, COUNT_OF(services));
+
+  add_integer(line, "ts", corpus->timestamp);
+  add_hex(line, "trace_id", random, 2);
+  add_hex(line, "span_id", random, 1);
+
+  /* one span in four starts a trace */
+  if (uniform(random, 4))
+    add_hex(line, "parent_id", random, 1);
+
+  add_string(line, "service", services[service]);
+  add_string(line, "operation", operations[uniform(random, COUNT_OF(operations))]);
+  add_integer(line, "duration_us", 50 + (int32_t) skewed(random, 5000000));
+
+  if (0 == uniform(random, 50)) {
+    add_boolean(line, "error", 1);
+    add_string(line, "error_kind", (service & 1) ? "timeout" : "unavailable");
+  }
+}
+
+
+/*
+ *  the shapes
+ */
+
+typedef void (*corpus_shape_fn)(corpus_t *corpus, corpus_line_t *line);
+
+typedef struct corpus_shape
+{
+  const char      *name;
+  corpus_shape_fn  record;
+} corpus_shape_t;
+
+static const corpus_shape_t shapes[] = {
+  { "access",  access_record  },
+  { "metrics", metrics_record },
+  { "traces",  traces_record  },
+  { "mixed",   NULL           }
+};
+
+
+int main(int                argc,
+         const char* const *argv)
+{
+  apr_status_t rv;
+  apr_pool_t  *p = NULL;
+  int          ret = EXIT_FAILURE;
+
+  apr_app_initialize(&argc, &argv, NULL);
+  atexit(apr_terminate);
+
+  apr_pool_create(&p, NULL);
+
+  static const apr_getopt_option_t options[] = {
+    { "shape",   'S', 1, "the kind of records: access, metrics, traces or mixed (access)" },
+    { "records", 'r', 1, "the number of records to write (100000 unless --bytes is given)" },
+    { "bytes",   'b', 1, "stop once this many bytes of JSON are written" },
+    { "seed",    's', 1, "the seed of the random draws (1)" },
+    { NULL,      0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  const char   *shape_name = "access";
+  apr_int64_t   nb_records = 0, nb_bytes = 0;
+  uint64_t      seed       = 1;
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 'S':
+      shape_name = optarg;
+      break;
+
+      case 'r':
+      nb_records = apr_atoi64(optarg);
+      break;
+
+      case 'b':
+      nb_bytes = apr_atoi64(optarg);
+      break;
+
+      case 's':
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    }
+  }
+
+  const corpus_shape_t* shape = NULL;
+
+  for (size_t i = 0; i < COUNT_OF(shapes) && NULL == shape; i++)
+    if (0 == strcmp(shapes[i].name, shape_name))
+      shape = & shapes[i];
+
+  if (APR_EOF != rv || NULL == shape || nb_records < 0 || nb_bytes < 0 || argc - opt->ind > 1) {
+    fprintf(stderr, "Usage: json_corpus [--shape access|metrics|traces|mixed] [--records N] [--bytes N] [--seed S] [output.json]\n");
+    goto terminate;
+  }
+
+  if (0 == nb_records && 0 == nb_bytes)
+    nb_records = 100000;
+
+  const char* output_name = (argc > opt->ind) ? argv[opt->ind] : "-";
+  FILE*       output      = open_filename(output_name, "wb", 0);
+
+  if (NULL == output)
+    goto terminate;
+
+  corpus_t      corpus  = { .random = { seed }, .timestamp = 1700000000 };
+  corpus_line_t line;
+  apr_int64_t   written = 0, records = 0;
+
+  while ((0 == nb_records || records < nb_records) && (0 == nb_bytes || written < nb_bytes)) {
+    corpus_shape_fn record = shape->record ? shape->record : shapes[uniform(& corpus.random, COUNT_OF(shapes) - 1)].record;
+
+    line.length    = 0;
+    line.nb_fields = 0;
+
+    /* about a record every 10 ms */
+    corpus.timestamp += (0 == uniform(& corpus.random, 100));
+
+    record(& corpus, & line);
+    end_line(& line);
+
+    if (1 != fwrite(line.text, line.length, 1, output)) {
+      fprintf(stderr, "error: cannot write %s: %s\n", output_name, strerror(errno));
+      close_filename(output_name, output);
+      goto terminate;
+    }
+
+    written += line.length;
+    records++;
+  }
+
+  close_filename(output_name, output);
+
+  fprintf(stderr, "%" APR_INT64_T_FMT " %s records, %" APR_INT64_T_FMT " bytes, seed %" PRIu64 ". Success\n",
+          records, shape->name, written, seed);
+
+  ret = EXIT_SUCCESS;
+
+  terminate:
+  apr_pool_destroy(p);
+  apr_terminate();
+  return ret;
+};
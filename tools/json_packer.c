@@ -1,9 +1,17 @@
 
 #include <apr.h>
+#include <apr_getopt.h>
 #include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_time.h>
 
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "jp_tlv_encoder.h"
 
@@ -26,6 +34,20 @@ FILE *open_filename(const char *filename, const char *opt, int is_input)
 }
 
 
+FILE *open_filename_for_update(const char *filename)
+{
+	FILE *file = fopen(filename, "r+b");
+
+	if (!file && errno == ENOENT)
+		file = fopen(filename, "w+b");
+
+	if (!file)
+		fprintf(stderr, "error: cannot open %s: %s", filename, strerror(errno));
+
+	return file;
+}
+
+
 void close_filename(const char *filename, FILE *file)
 {
 	if (file != NULL && strcmp(filename, "-") != 0)
@@ -33,6 +55,382 @@ void close_filename(const char *filename, FILE *file)
 }
 
 
+/* follow mode */
+
+#define FOLLOW_READ_BUFFER_SIZE (64 * 1024)
+
+static volatile sig_atomic_t follow_stop = 0;
+
+static void follow_stop_handler(int signum)
+{
+	(void) signum;
+
+	follow_stop = 1;
+}
+
+typedef struct follow_state
+{
+	apr_pool_t         *rotation_pool;
+	jp_TLV_records_t   *records;
+	const char         *prefix;
+	int                 single;
+	apr_array_header_t *index_keys;
+	const char         *dictionary;
+	apr_int64_t         started;
+	unsigned int        sequence;
+} follow_state_t;
+
+
+int sync_and_close(FILE *file)
+{
+	int ret = (0 == fflush(file) && 0 == fsync(fileno(file))) ? 0 : -1;
+
+	if (0 != fclose(file))
+		ret = -1;
+
+	return ret;
+}
+
+
+void sync_parent_directory(apr_pool_t *pool, const char *path)
+{
+	char *directory = apr_pstrdup(pool, path);
+	char *separator = strrchr(directory, '/');
+
+	if (separator == directory)
+		separator[1] = '\0';
+	else if (separator)
+		separator[0] = '\0';
+	else
+		directory = ".";
+
+	int fd = open(directory, O_RDONLY);
+
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+
+/* the value index is written next to the kv-pair file, and renamed into place once complete */
+int write_value_index(apr_pool_t         *p,
+                      const char         *kv_pair_name,
+                      const char         *key_index_name,
+                      const char         *index_name,
+                      apr_array_header_t *index_keys)
+{
+	apr_pool_t* pool;
+	int         rv = -1;
+
+	apr_pool_create(& pool, p);
+
+	const char* index_tmp = apr_pstrcat(pool, index_name, ".tmp", NULL);
+
+	FILE* kvpairin = fopen(kv_pair_name, "rb");
+	FILE* kindexin = key_index_name ? fopen(key_index_name, "rb") : NULL;
+	FILE* indexout = fopen(index_tmp, "wb");
+
+	if (kvpairin && (!key_index_name || kindexin) && indexout)
+		rv = jp_build_value_index(pool, kvpairin, kindexin, (const char* const*) index_keys->elts, index_keys->nelts, indexout);
+
+	if (indexout && 0 != sync_and_close(indexout))
+		rv = -1;
+
+	if (kindexin)
+		fclose(kindexin);
+
+	if (kvpairin)
+		fclose(kvpairin);
+
+	if (0 == rv && 0 != rename(index_tmp, index_name))
+		rv = -1;
+
+	if (0 != rv) {
+		fprintf(stderr, "error: cannot index %s\n", kv_pair_name);
+		unlink(index_tmp);
+	}
+
+	apr_pool_destroy(pool);
+
+	return rv;
+}
+
+
+/*
+ *  the records are written to temporary files which are renamed once synced, so readers
+ *  only ever see complete file sets; the kv-pair file is renamed last as it marks the set.
+ *  When the set cannot be sealed, its files are removed and the records kept for another try
+ */
+int seal_file_set(follow_state_t *state)
+{
+	apr_pool_t* pool = state->rotation_pool;
+	int         rv   = 0;
+
+	if (0 < state->records->record_list->nelts) {
+		const char* base           = apr_psprintf(pool, "%s-%" APR_INT64_T_FMT "-%06u", state->prefix, state->started, state->sequence + 1);
+		const char* kv_pair_name   = apr_pstrcat(pool, base, state->single ? ".tlv" : ".kv_pair.tlv", NULL);
+		const char* key_index_name = apr_pstrcat(pool, base, ".key_index.tlv", NULL);
+		const char* index_name     = apr_pstrcat(pool, kv_pair_name, ".idx", NULL);
+		const char* kv_pair_tmp    = apr_pstrcat(pool, kv_pair_name, ".tmp", NULL);
+		const char* key_index_tmp  = apr_pstrcat(pool, key_index_name, ".tmp", NULL);
+
+		FILE* kvpairout = fopen(kv_pair_tmp, "wb");
+		FILE* kindexout = state->single ? NULL : fopen(key_index_tmp, "wb");
+
+		/* the keys seen since the last set go to the shared dictionary first */
+		if (!kvpairout || (!state->single && !kindexout))
+			rv = -1;
+		else if (state->dictionary && 0 != jp_bind_key_dictionary(state->records, state->dictionary, NULL))
+			rv = -1;
+		else
+			rv = jp_export_records_to_file_set(state->records, kvpairout, kindexout);
+
+		if (kvpairout && 0 != sync_and_close(kvpairout))
+			rv = -1;
+
+		if (kindexout && 0 != sync_and_close(kindexout))
+			rv = -1;
+
+		if (0 == rv && state->index_keys->nelts > 0)
+			rv = write_value_index(pool, kv_pair_tmp, state->single ? NULL : key_index_tmp, index_name, state->index_keys);
+
+		if (0 == rv && !state->single && 0 != rename(key_index_tmp, key_index_name))
+			rv = -1;
+
+		if (0 == rv && 0 != rename(kv_pair_tmp, kv_pair_name))
+			rv = -1;
+
+		if (0 != rv) {
+			fprintf(stderr, "error: cannot seal %s: %s\n", kv_pair_name, strerror(errno));
+
+			unlink(kv_pair_tmp);
+			unlink(index_name);
+
+			if (!state->single) {
+				unlink(key_index_tmp);
+				unlink(key_index_name);
+			}
+
+			return -1;
+		}
+
+		sync_parent_directory(pool, kv_pair_name);
+		fprintf(stderr, "sealed %s (%d records)\n", kv_pair_name, state->records->record_list->nelts);
+		state->sequence++;
+	}
+
+	/* the key index stays warm, only the records of the sealed set are released */
+	apr_pool_clear(state->rotation_pool);
+	state->records->record_list = apr_array_make(state->rotation_pool, 1024, sizeof(jp_TLV_record_t*));
+	jp_enable_string_interning(state->records, state->rotation_pool);
+
+	return rv;
+}
+
+
+int follow_input(apr_pool_t          *p,
+                 const char          *inputfile,
+                 const char          *prefix,
+                 int                  single,
+                 size_t               rotate_records,
+                 apr_int64_t          rotate_bytes,
+                 apr_int64_t          rotate_seconds,
+                 apr_array_header_t  *index_keys,
+                 const char          *dictionary,
+                 jp_TLV_records_t    *records)
+{
+	int         from_stdin = (strcmp(inputfile, "-") == 0);
+	int         fd         = from_stdin ? STDIN_FILENO : open(inputfile, O_RDONLY);
+	struct stat input_stat;
+
+	if (fd < 0) {
+		fprintf(stderr, "error: cannot open %s: %s\n", inputfile, strerror(errno));
+		return -1;
+	}
+
+	int is_fifo = !from_stdin && 0 == fstat(fd, & input_stat) && S_ISFIFO(input_stat.st_mode);
+
+	struct sigaction stop_action;
+
+	memset(& stop_action, 0, sizeof(stop_action));
+	stop_action.sa_handler = follow_stop_handler;
+	sigemptyset(& stop_action.sa_mask);
+
+	sigaction(SIGINT, & stop_action, NULL);
+	sigaction(SIGTERM, & stop_action, NULL);
+
+	follow_state_t state;
+
+	state.records            = records;
+	state.prefix             = prefix;
+	state.single             = single;
+	state.index_keys         = index_keys;
+	state.dictionary         = dictionary;
+	state.started            = apr_time_sec(apr_time_now());
+	state.sequence           = 0;
+
+	apr_pool_create(& state.rotation_pool, p);
+	state.records->record_list = apr_array_make(state.rotation_pool, 1024, sizeof(jp_TLV_record_t*));
+	jp_enable_string_interning(state.records, state.rotation_pool);
+
+	jp_json_line_reader_t* reader   = jp_json_line_reader_make(p);
+	char*                  buffer   = apr_palloc(p, FOLLOW_READ_BUFFER_SIZE);
+	apr_int64_t            bytes    = 0;
+	apr_time_t             deadline = apr_time_now() + rotate_seconds * APR_USEC_PER_SEC;
+	int                    rv       = 0;
+
+	while (!follow_stop) {
+		int timeout = -1;
+
+		if (rotate_seconds > 0) {
+			apr_time_t remaining = deadline - apr_time_now();
+			timeout = (remaining > 0) ? (int) ((remaining + 999) / 1000) : 0;
+		}
+
+		struct pollfd input_poll = { fd, POLLIN, 0 };
+		int           ready      = poll(& input_poll, 1, timeout);
+
+		if (ready < 0 && errno != EINTR) {
+			fprintf(stderr, "error: cannot poll %s: %s\n", inputfile, strerror(errno));
+			rv = -1;
+			break;
+		}
+
+		if (ready > 0) {
+			ssize_t got = read(fd, buffer, FOLLOW_READ_BUFFER_SIZE);
+
+			if (got < 0 && errno != EINTR && errno != EAGAIN) {
+				fprintf(stderr, "error: cannot read %s: %s\n", inputfile, strerror(errno));
+				rv = -1;
+				break;
+			}
+
+			if (got == 0) {
+				if (!is_fifo)
+					break;
+
+				/* the writer went away, wait for the next one */
+				close(fd);
+
+				if ((fd = open(inputfile, O_RDONLY)) < 0)
+					break;
+
+				continue;
+			}
+
+			for (size_t offset = 0; got > 0 && offset < (size_t) got; ) {
+				size_t consumed;
+
+				/* once a seal failed, the rest of the chunk is kept along with the records not sealed */
+				if (0 != jp_json_line_reader_feed(reader, state.rotation_pool, state.records, buffer + offset, got - offset,
+				                                  rv ? 0 : rotate_records, & consumed))
+					fprintf(stderr, "skipping an unparsable line\n");
+
+				offset += consumed;
+				bytes  += consumed;
+
+				if (0 == rv && ((rotate_records > 0 && state.records->record_list->nelts >= rotate_records) ||
+				                (rotate_bytes > 0 && bytes >= rotate_bytes))) {
+					if (0 != seal_file_set(& state))
+						rv = -1;
+
+					bytes = 0;
+				}
+			}
+		}
+
+		if (0 == rv && rotate_seconds > 0 && apr_time_now() >= deadline) {
+			if (0 != seal_file_set(& state))
+				rv = -1;
+
+			bytes    = 0;
+			deadline = apr_time_now() + rotate_seconds * APR_USEC_PER_SEC;
+		}
+
+		/* a set that cannot be sealed (a full disk...) stops the input, the last seal tries once more */
+		if (0 != rv)
+			break;
+	}
+
+	jp_json_line_reader_finish(reader, state.rotation_pool, state.records);
+
+	if (0 != seal_file_set(& state))
+		rv = -1;
+
+	if (fd >= 0 && !from_stdin)
+		close(fd);
+
+	return rv;
+}
+
+
+/* partitions */
+
+/* the files of a partition are named after the output files, with the number of the partition before their extension */
+const char* partition_filename(apr_pool_t *p, const char *filename, uint32_t partition)
+{
+	const char* extension = strrchr(filename, '.');
+	const char* separator = strrchr(filename, '/');
+
+	if (NULL == extension || extension == filename || (separator && separator > extension))
+		return apr_psprintf(p, "%s-%04u", filename, partition);
+
+	return apr_psprintf(p, "%.*s-%04u%s", (int) (extension - filename), filename, partition, extension);
+}
+
+
+int write_partitions(apr_pool_t         *p,
+                     jp_TLV_records_t   *tlv_records,
+                     const char         *partition_key,
+                     uint32_t            nb_partitions,
+                     unsigned int        nb_jobs,
+                     const char         *kv_pair_name,
+                     const char         *key_index_name,
+                     apr_array_header_t *index_keys)
+{
+	const char** kv_pair_names   = apr_pcalloc(p, nb_partitions * sizeof(const char*));
+	const char** key_index_names = apr_pcalloc(p, nb_partitions * sizeof(const char*));
+	FILE**       kv_pair_files   = apr_pcalloc(p, nb_partitions * sizeof(FILE*));
+	FILE**       key_index_files = key_index_name ? apr_pcalloc(p, nb_partitions * sizeof(FILE*)) : NULL;
+	int          rv              = 0;
+
+	for (uint32_t i = 0; i < nb_partitions; i++) {
+		kv_pair_names[i] = partition_filename(p, kv_pair_name, i);
+		kv_pair_files[i] = open_filename(kv_pair_names[i], "wb", 0);
+
+		if (key_index_name) {
+			key_index_names[i] = partition_filename(p, key_index_name, i);
+			key_index_files[i] = open_filename(key_index_names[i], "wb", 0);
+		}
+
+		if (NULL == kv_pair_files[i] || (key_index_name && NULL == key_index_files[i]))
+			rv = -1;
+	}
+
+	if (0 == rv)
+		rv = jp_export_records_to_partitions(tlv_records, partition_key, kv_pair_files, key_index_files, nb_partitions, nb_jobs);
+
+	for (uint32_t i = 0; i < nb_partitions; i++) {
+		if (kv_pair_files[i])
+			fclose(kv_pair_files[i]);
+
+		if (key_index_name && key_index_files[i])
+			fclose(key_index_files[i]);
+	}
+
+	for (uint32_t i = 0; 0 == rv && index_keys->nelts > 0 && i < nb_partitions; i++)
+		rv = write_value_index(p, kv_pair_names[i], key_index_names[i], apr_pstrcat(p, kv_pair_names[i], ".idx", NULL), index_keys);
+
+	if (0 == rv)
+		printf("%u partitions by %s: %s - %s. Success\n", nb_partitions, partition_key, kv_pair_names[0], kv_pair_names[nb_partitions - 1]);
+	else
+		fprintf(stderr, "error: cannot write the partitions by %s\n", partition_key);
+
+	return rv;
+}
+
+
 int main(int                argc,
          const char* const *argv)
 {
@@ -42,14 +440,156 @@ int main(int                argc,
   apr_app_initialize(&argc, &argv, NULL);
   atexit(apr_terminate);
 
-  const char* inputfile       = (argc > 1) ? argv[1] : NULL;
-  const char* kvpairoutfile   = (argc > 2) ? argv[2] : "kv_pair.tlv";
-  const char* keyarrayoutfile = (argc > 3) ? argv[3] : "key_index.tlv";
-
   apr_pool_create(&p, NULL);
 
+  static const apr_getopt_option_t options[] = {
+    { "append",      'a', 0, "append the records to the output file set, creating it if it does not exist" },
+    { "single-file",    's', 0, "write the key index and the kv-pairs to a single container file" },
+    { "follow",         'f', 0, "keep reading JSON lines from stdin or a FIFO, sealing a new file set at every rotation" },
+    { "rotate-records", 'r', 1, "in follow mode, seal a file set every N records" },
+    { "rotate-bytes",   'b', 1, "in follow mode, seal a file set every N bytes of JSON input" },
+    { "rotate-seconds", 't', 1, "in follow mode, seal a file set every N seconds (one hour if no rotation is given)" },
+    { "bloom",          'B', 0, "attach a Bloom filter of the keys to every block, so that scans skip the blocks without the key" },
+    { "bloom-value",    'V', 1, "also add the string values of a key to the Bloom filters (repeatable, implies --bloom)" },
+    { "cluster",        'C', 0, "group the records by shape (their keys) before writing them, for denser blocks and faster scans" },
+    { "cluster-window", 'W', 1, "with --cluster, the number of consecutive records regrouped at a time (16384)" },
+    { "cluster-key",    'K', 1, "within a shape, sort the records by the value of this key (implies --cluster)" },
+    { "keep-order",     'O', 0, "with --cluster, write the arrival order of the records so that imports restore it" },
+    { "dictionary",     'D', 1, "number the keys as in this shared key dictionary, appending the new ones, so that consolidations copy blocks" },
+    { "index",          'I', 1, "write a value index of a key next to the kv-pair output, for lookups with tlv_unpacker --index (repeatable)" },
+    { "partition-by",   'P', 1, "route every record by the hash of the value of this key to one of --partitions file sets" },
+    { "partitions",     'N', 1, "with --partition-by, the number of file sets written side by side" },
+    { NULL,             0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  int           append = 0;
+  int           single = 0;
+  int           follow = 0;
+  apr_int64_t   rotate_records = 0, rotate_bytes = 0, rotate_seconds = 0;
+  int           bloom  = 0;
+  apr_int64_t   cluster_window = 0;
+  const char   *cluster_key    = NULL;
+  int           keep_order     = 0;
+  const char   *dictionary     = NULL;
+  const char   *partition_key  = NULL;
+  apr_int64_t   nb_partitions  = 0;
+
+  apr_array_header_t* bloom_values = apr_array_make(p, 4, sizeof(const char*));
+  apr_array_header_t* index_keys   = apr_array_make(p, 4, sizeof(const char*));
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 'a':
+      append = 1;
+      break;
+
+      case 's':
+      single = 1;
+      break;
+
+      case 'f':
+      follow = 1;
+      break;
+
+      case 'r':
+      rotate_records = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'b':
+      rotate_bytes = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 't':
+      rotate_seconds = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'V':
+      *(const char**) apr_array_push(bloom_values) = optarg;
+      /* fall through */
+
+      case 'B':
+      bloom = 1;
+      break;
+
+      case 'K':
+      cluster_key = optarg;
+      /* fall through */
+
+      case 'C':
+      if (0 == cluster_window)
+        cluster_window = JP_CLUSTER_DEFAULT_WINDOW;
+      break;
+
+      case 'W':
+      cluster_window = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'O':
+      keep_order = 1;
+      break;
+
+      case 'I':
+      *(const char**) apr_array_push(index_keys) = optarg;
+      break;
+
+      case 'D':
+      dictionary = optarg;
+      break;
+
+      case 'P':
+      partition_key = optarg;
+      break;
+
+      case 'N':
+      nb_partitions = apr_strtoi64(optarg, NULL, 10);
+      break;
+    }
+  }
+
+  if (APR_EOF != rv || (append && (single || follow || dictionary)) || cluster_window < 0 || cluster_window > JP_CLUSTER_MAX_WINDOW ||
+      (NULL != partition_key) != (nb_partitions > 0) || nb_partitions < 0 || nb_partitions > UINT16_MAX || (partition_key && (append || follow))) {
+    fprintf(stderr, "Usage: json_packer [--append | --single-file] [--bloom] [--bloom-value key ...] [--cluster [--cluster-window N] [--cluster-key key] [--keep-order]] [--index key ...] [--dictionary keys.dict] [--partition-by key --partitions N] input.json [kv_pair.tlv] [key_index.tlv]\n"
+                    "       json_packer --follow [--single-file] [--bloom] [--bloom-value key ...] [--cluster ...] [--index key ...] [--dictionary keys.dict] [--rotate-records N] [--rotate-bytes N] [--rotate-seconds N] input.json|- [prefix]\n");
+    rv = -1;
+    goto terminate;
+  }
+
+  int         nb_args         = argc - opt->ind;
+
   jp_TLV_records_t* tlv_records = jp_TLV_record_collection_make(p);
 
+  if (bloom)
+    jp_enable_block_filters(tlv_records, (const char* const*) bloom_values->elts, bloom_values->nelts);
+
+  if (cluster_window > 0)
+    jp_enable_record_clustering(tlv_records, (uint32_t) cluster_window, cluster_key, keep_order);
+
+  /* the keys already in the dictionary are numbered by it from the start, which spares renumbering the records */
+  if (dictionary && 0 != jp_bind_key_dictionary(tlv_records, dictionary, NULL)) {
+    rv = -1;
+    goto terminate;
+  }
+
+  if (follow) {
+    if (0 == rotate_records && 0 == rotate_bytes && 0 == rotate_seconds)
+      rotate_seconds = 3600;
+
+    rv = follow_input(p, (nb_args > 0) ? argv[opt->ind] : "-", (nb_args > 1) ? argv[opt->ind + 1] : "packed",
+                      single, (size_t) rotate_records, rotate_bytes, rotate_seconds, index_keys, dictionary, tlv_records);
+    goto terminate;
+  }
+
+  const char* inputfile       = (nb_args > 0) ? argv[opt->ind] : NULL;
+  const char* kvpairoutfile   = (nb_args > 1) ? argv[opt->ind + 1] : (single ? "records.tlv" : "kv_pair.tlv");
+  const char* keyarrayoutfile = (nb_args > 2) ? argv[opt->ind + 2] : "key_index.tlv";
+
+  jp_enable_string_interning(tlv_records, p);
+
   if (NULL == inputfile) {
     fprintf(stderr, "No input JSON file\n");
 
@@ -63,7 +603,37 @@ int main(int                argc,
   apr_hash_t* key_index = tlv_records->key_index;
   close_filename(inputfile, input);
 
-  if (kvpairoutfile) {
+  if (dictionary && 0 != jp_bind_key_dictionary(tlv_records, dictionary, NULL)) {
+    rv = -1;
+    goto terminate;
+  }
+
+  /* every partition is named after the output files */
+  if (partition_key) {
+    long nb_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+    rv = write_partitions(p, tlv_records, partition_key, (uint32_t) nb_partitions, (nb_jobs > 0) ? (unsigned int) nb_jobs : 1,
+                          kvpairoutfile, single ? NULL : keyarrayoutfile, index_keys);
+    goto terminate;
+  }
+
+  if (kvpairoutfile && append) {
+    FILE* kvpairout = open_filename_for_update(kvpairoutfile);
+    FILE* kindexout = open_filename_for_update(keyarrayoutfile);
+
+    rv = (kvpairout && kindexout) ? jp_append_records_to_file_set(tlv_records, kvpairout, kindexout) : -1;
+
+    close_filename(keyarrayoutfile, kindexout);
+    close_filename(kvpairoutfile, kvpairout);
+  }
+  else if (kvpairoutfile && single) {
+    FILE* kvpairout = open_filename(kvpairoutfile, "wb", 0);
+
+    rv = kvpairout ? jp_export_records_to_file_set(tlv_records, kvpairout, NULL) : -1;
+
+    close_filename(kvpairoutfile, kvpairout);
+  }
+  else if (kvpairoutfile) {
     FILE* kvpairout = open_filename(kvpairoutfile, "wb", 0);
     FILE* kindexout = open_filename(keyarrayoutfile, "wb", 0);
 
@@ -75,6 +645,9 @@ int main(int                argc,
     rv = 0;
   }
 
+  if (0 == rv && index_keys->nelts > 0)
+    rv = write_value_index(p, kvpairoutfile, single ? NULL : keyarrayoutfile, apr_pstrcat(p, kvpairoutfile, ".idx", NULL), index_keys);
+
   terminate:
   apr_terminate();
   return rv;
@@ -0,0 +1,225 @@
+
+#include <apr.h>
+#include <apr_getopt.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "jp_tlv_encoder.h"
+
+
+/* file utils */
+
+FILE *open_filename(const char *filename, const char *opt, int is_input)
+{
+	FILE *input;
+	if (strcmp(filename, "-") == 0)
+		input = (is_input) ? stdin : stdout;
+	else {
+		input = fopen(filename, opt);
+		if (!input) {
+			fprintf(stderr, "error: cannot open %s: %s", filename, strerror(errno));
+			return NULL;
+		}
+	}
+	return input;
+}
+
+
+void close_filename(const char *filename, FILE *file)
+{
+	if (file != NULL && strcmp(filename, "-") != 0)
+		fclose(file);
+}
+
+
+/* output columns */
+
+typedef struct agg_column
+{
+  const char *function;
+  int         key;
+} agg_column_t;
+
+
+void add_column(apr_array_header_t *columns, apr_array_header_t *keys, const char *function, const char *key)
+{
+  agg_column_t* column = apr_array_push(columns);
+
+  column->function = function;
+  column->key      = -1;
+
+  /* every key is aggregated once, whatever the functions asked of it */
+  for (int i = 0; i < keys->nelts && column->key < 0; i++)
+    if (0 == strcmp(((const char**) keys->elts)[i], key))
+      column->key = i;
+
+  if (column->key < 0) {
+    column->key = keys->nelts;
+    *(const char**) apr_array_push(keys) = key;
+  }
+}
+
+
+void print_value(const agg_column_t *column, const jp_aggregate_t *aggregate)
+{
+  if (0 == aggregate->count)
+    printf("\tnull");
+  else if (0 == strcmp(column->function, "sum"))
+    printf("\t%.15g", aggregate->sum);
+  else if (0 == strcmp(column->function, "min"))
+    printf("\t%.15g", aggregate->min);
+  else if (0 == strcmp(column->function, "max"))
+    printf("\t%.15g", aggregate->max);
+  else
+    printf("\t%.15g", aggregate->sum / aggregate->count);
+}
+
+
+int main(int                argc,
+         const char* const *argv)
+{
+  apr_status_t rv;
+  apr_pool_t  *p = NULL;
+  int          ret = EXIT_FAILURE;
+
+  apr_app_initialize(&argc, &argv, NULL);
+  atexit(apr_terminate);
+
+  apr_pool_create(&p, NULL);
+
+  static const apr_getopt_option_t options[] = {
+    { "single-file", 's', 0, "aggregate single container files holding both the key index and the kv-pairs" },
+    { "group-by",    'g', 1, "aggregate the records by the value of this key, one line per value" },
+    { "sum",         'S', 1, "the sum of the numeric values of a key (repeatable)" },
+    { "min",         'm', 1, "the smallest numeric value of a key (repeatable)" },
+    { "max",         'M', 1, "the largest numeric value of a key (repeatable)" },
+    { "avg",         'a', 1, "the average of the numeric values of a key (repeatable)" },
+    { "jobs",        'j', 1, "the number of threads decoding blocks (the number of processors)" },
+    { NULL,          0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  int           single    = 0;
+  const char   *group_key = NULL;
+  long          nb_jobs   = sysconf(_SC_NPROCESSORS_ONLN);
+
+  apr_array_header_t* columns = apr_array_make(p, 4, sizeof(agg_column_t));
+  apr_array_header_t* keys    = apr_array_make(p, 4, sizeof(const char*));
+
+  if (nb_jobs < 1)
+    nb_jobs = JP_AGGREGATE_DEFAULT_WORKERS;
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 's':
+      single = 1;
+      break;
+
+      case 'g':
+      group_key = optarg;
+      break;
+
+      case 'S':
+      add_column(columns, keys, "sum", optarg);
+      break;
+
+      case 'm':
+      add_column(columns, keys, "min", optarg);
+      break;
+
+      case 'M':
+      add_column(columns, keys, "max", optarg);
+      break;
+
+      case 'a':
+      add_column(columns, keys, "avg", optarg);
+      break;
+
+      case 'j':
+      nb_jobs = strtol(optarg, NULL, 10);
+      break;
+    }
+  }
+
+  int nb_args       = argc - opt->ind;
+  int files_per_set = single ? 1 : 2;
+
+  if (APR_EOF != rv || nb_jobs < 1 || 0 == nb_args || 0 != nb_args % files_per_set) {
+    fprintf(stderr, "Usage: tlv_agg [--single-file] [--group-by key] [--sum key] [--min key] [--max key] [--avg key] [--jobs N] kv_pair_1.tlv key_index_1.tlv ...\n");
+    goto terminate;
+  }
+
+  int    nb_sets          = nb_args / files_per_set;
+  FILE** kv_pair_inputs   = apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  FILE** key_index_inputs = single ? NULL : apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  int    opened           = 1;
+
+  for (int i = 0; i < nb_sets; i++) {
+    kv_pair_inputs[i] = open_filename(argv[opt->ind + i * files_per_set], "rb", 1);
+
+    if (!single)
+      key_index_inputs[i] = open_filename(argv[opt->ind + i * files_per_set + 1], "rb", 1);
+
+    if (NULL == kv_pair_inputs[i] || (!single && NULL == key_index_inputs[i]))
+      opened = 0;
+  }
+
+  jp_aggregation_t* aggregation = jp_aggregation_make(p, group_key, (const char* const*) keys->elts, keys->nelts);
+
+  if (opened && 0 == jp_aggregate_file_sets(aggregation, kv_pair_inputs, key_index_inputs, nb_sets, (unsigned int) nb_jobs)) {
+    printf("%s%scount", group_key ? group_key : "", group_key ? "\t" : "");
+
+    for (int i = 0; i < columns->nelts; i++) {
+      const agg_column_t* column = & ((agg_column_t*) columns->elts)[i];
+
+      printf("\t%s(%s)", column->function, ((const char**) keys->elts)[column->key]);
+    }
+
+    printf("\n");
+
+    for (uint32_t group = 0; group < jp_aggregation_count_groups(aggregation); group++) {
+      uint64_t              nb_records;
+      const char*           text       = jp_aggregation_group(aggregation, group, & nb_records);
+      const jp_aggregate_t* aggregates = jp_aggregation_values(aggregation, group);
+
+      if (group_key)
+        printf("%s\t", text ? text : "null");
+
+      printf("%" PRIu64, nb_records);
+
+      for (int i = 0; i < columns->nelts; i++) {
+        const agg_column_t* column = & ((agg_column_t*) columns->elts)[i];
+
+        print_value(column, & aggregates[column->key]);
+      }
+
+      printf("\n");
+    }
+
+    ret = EXIT_SUCCESS;
+  } else {
+    fprintf(stderr, "error: cannot aggregate the file sets\n");
+  }
+
+  for (int i = 0; i < nb_sets; i++) {
+    if (kv_pair_inputs[i])
+      close_filename(argv[opt->ind + i * files_per_set], kv_pair_inputs[i]);
+
+    if (!single && key_index_inputs[i])
+      close_filename(argv[opt->ind + i * files_per_set + 1], key_index_inputs[i]);
+  }
+
+  terminate:
+  apr_pool_destroy(p);
+  apr_terminate();
+  return ret;
+};
@@ -1,9 +1,16 @@
 
 #include <apr.h>
+#include <apr_getopt.h>
 #include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_time.h>
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "jp_tlv_encoder.h"
 
@@ -33,6 +40,667 @@ void close_filename(const char *filename, FILE *file)
 }
 
 
+int sync_and_close(FILE *file)
+{
+  int ret = (0 == fflush(file) && 0 == fsync(fileno(file))) ? 0 : -1;
+
+  if (0 != fclose(file))
+    ret = -1;
+
+  return ret;
+}
+
+
+int has_suffix(const char *name, const char *suffix)
+{
+  size_t name_length   = strlen(name);
+  size_t suffix_length = strlen(suffix);
+
+  return name_length > suffix_length && 0 == strcmp(name + name_length - suffix_length, suffix);
+}
+
+
+/* value index */
+
+/* the value index is written next to the kv-pair file, and renamed into place once complete */
+int write_value_index(apr_pool_t         *p,
+                      const char         *kv_pair_name,
+                      const char         *key_index_name,
+                      const char         *index_name,
+                      apr_array_header_t *index_keys)
+{
+  apr_pool_t* pool;
+  int         rv = -1;
+
+  apr_pool_create(& pool, p);
+
+  const char* index_tmp = apr_pstrcat(pool, index_name, ".tmp", NULL);
+
+  FILE* kvpairin = fopen(kv_pair_name, "rb");
+  FILE* kindexin = key_index_name ? fopen(key_index_name, "rb") : NULL;
+  FILE* indexout = fopen(index_tmp, "wb");
+
+  if (kvpairin && (!key_index_name || kindexin) && indexout)
+    rv = jp_build_value_index(pool, kvpairin, kindexin, (const char* const*) index_keys->elts, index_keys->nelts, indexout);
+
+  if (indexout && 0 != sync_and_close(indexout))
+    rv = -1;
+
+  if (kindexin)
+    fclose(kindexin);
+
+  if (kvpairin)
+    fclose(kvpairin);
+
+  if (0 == rv && 0 != rename(index_tmp, index_name))
+    rv = -1;
+
+  if (0 != rv) {
+    fprintf(stderr, "error: cannot index %s\n", kv_pair_name);
+    unlink(index_tmp);
+  }
+
+  apr_pool_destroy(pool);
+
+  return rv;
+}
+
+
+/* compaction */
+
+#define COMPACT_CONTAINER_MAGIC 0x5443504A /* "JPCT", the first word of a single-file container */
+
+typedef struct compact_set
+{
+  const char   *kv_pair_path;
+  const char   *key_index_path;  /* NULL for a single-file container */
+  apr_off_t     size;
+  unsigned int  tier;
+} compact_set_t;
+
+typedef struct compact_merge
+{
+  compact_set_t **inputs;
+  int             nb_inputs;
+  const char     *output;
+} compact_merge_t;
+
+typedef struct compact_round
+{
+  compact_merge_t    *merges;
+  const char         *directory;
+  int                 single;
+  apr_array_header_t *bloom_values;  /* NULL without Bloom filters */
+} compact_round_t;
+
+
+apr_off_t file_size(const char *path)
+{
+  struct stat file_stat;
+
+  return (0 == stat(path, & file_stat) && S_ISREG(file_stat.st_mode)) ? file_stat.st_size : -1;
+}
+
+
+int is_container(const char *path)
+{
+  FILE*    file  = fopen(path, "rb");
+  uint32_t magic = 0;
+
+  if (file) {
+    if (1 != fread(& magic, sizeof(uint32_t), 1, file))
+      magic = 0;
+
+    fclose(file);
+  }
+
+  return COMPACT_CONTAINER_MAGIC == magic;
+}
+
+
+void sync_directory(const char *directory)
+{
+  int fd = open(directory, O_RDONLY);
+
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+
+const char* base_name(const char *path)
+{
+  const char* separator = strrchr(path, '/');
+
+  return separator ? separator + 1 : path;
+}
+
+
+/*
+ *  a merge commits a manifest, <output>.consumed, naming its kv-pair output and then its inputs,
+ *  before its output is renamed into place. A manifest left by an interrupted merge is resolved
+ *  before the sets are listed: if the output made it, the inputs are removed with their value
+ *  indices, otherwise the output is. Either way no record is left in two sets
+ */
+void recover_merges(apr_pool_t *pool, const char *directory)
+{
+  DIR*           dir = opendir(directory);
+  struct dirent* entry;
+  int            recovered = 0;
+
+  if (NULL == dir)
+    return;
+
+  while (NULL != (entry = readdir(dir))) {
+    const char* name = entry->d_name;
+
+    if (has_suffix(name, ".consumed.tmp")) {
+      unlink(apr_pstrcat(pool, directory, "/", name, NULL));
+      continue;
+    }
+
+    if (!has_suffix(name, ".consumed"))
+      continue;
+
+    const char* manifest = apr_pstrcat(pool, directory, "/", name, NULL);
+    const char* base     = apr_pstrndup(pool, manifest, strlen(manifest) - strlen(".consumed"));
+    FILE*       file     = fopen(manifest, "r");
+    char        line[4096];
+
+    if (NULL == file)
+      continue;
+
+    if (NULL != fgets(line, sizeof(line), file)) {
+      line[strcspn(line, "\n")] = '\0';
+
+      int completed = (file_size(apr_pstrcat(pool, directory, "/", line, NULL)) >= 0);
+
+      while (completed && NULL != fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        unlink(apr_pstrcat(pool, directory, "/", line, NULL));
+        unlink(apr_pstrcat(pool, directory, "/", line, ".idx", NULL));
+      }
+
+      if (!completed) {
+        unlink(apr_pstrcat(pool, base, ".kv_pair.tlv.tmp", NULL));
+        unlink(apr_pstrcat(pool, base, ".key_index.tlv.tmp", NULL));
+        unlink(apr_pstrcat(pool, base, ".key_index.tlv", NULL));
+        unlink(apr_pstrcat(pool, base, ".tlv.tmp", NULL));
+      }
+
+      fprintf(stderr, "recovered the interrupted merge into %s: %s\n", base, completed ? "its inputs are removed" : "its output is removed");
+    }
+
+    fclose(file);
+
+    /* the manifest goes once the files it names are gone for good */
+    sync_directory(directory);
+    unlink(manifest);
+    recovered = 1;
+  }
+
+  closedir(dir);
+
+  if (recovered)
+    sync_directory(directory);
+}
+
+
+int compare_sets(const void *A, const void *B)
+{
+  return strcmp((*(compact_set_t* const*) A)->kv_pair_path, (*(compact_set_t* const*) B)->kv_pair_path);
+}
+
+
+/* complete file sets only: temporary files and key indices without their kv-pairs are left alone */
+apr_array_header_t* scan_file_sets(apr_pool_t *pool, const char *directory)
+{
+  recover_merges(pool, directory);
+
+  apr_array_header_t* sets = apr_array_make(pool, 64, sizeof(compact_set_t*));
+  DIR*                dir  = opendir(directory);
+  struct dirent*      entry;
+
+  if (NULL == dir) {
+    fprintf(stderr, "error: cannot open %s: %s\n", directory, strerror(errno));
+    return NULL;
+  }
+
+  while (NULL != (entry = readdir(dir))) {
+    const char* name = entry->d_name;
+
+    if (name[0] == '.' || !has_suffix(name, ".tlv") || has_suffix(name, ".key_index.tlv"))
+      continue;
+
+    compact_set_t* set = apr_pcalloc(pool, sizeof(compact_set_t));
+    set->kv_pair_path  = apr_pstrcat(pool, directory, "/", name, NULL);
+
+    if (has_suffix(name, ".kv_pair.tlv")) {
+      set->key_index_path = apr_pstrcat(pool, directory, "/", apr_pstrndup(pool, name, strlen(name) - strlen(".kv_pair.tlv")), ".key_index.tlv", NULL);
+
+      if (file_size(set->key_index_path) < 0)
+        continue;
+
+      set->size = file_size(set->key_index_path);
+    }
+    else if (!is_container(set->kv_pair_path))
+      continue;
+
+    if (file_size(set->kv_pair_path) < 0)
+      continue;
+
+    set->size += file_size(set->kv_pair_path);
+
+    *(compact_set_t**) apr_array_push(sets) = set;
+  }
+
+  closedir(dir);
+
+  qsort(sets->elts, sets->nelts, sizeof(compact_set_t*), compare_sets);
+
+  return sets;
+}
+
+
+/* the manifest is synced and renamed into place, and the directory synced, before the output may appear */
+int write_merge_manifest(apr_pool_t *pool, const compact_merge_t *merge, const char *kv_pair_out, const char *directory)
+{
+  const char* manifest     = apr_pstrcat(pool, merge->output, ".consumed", NULL);
+  const char* manifest_tmp = apr_pstrcat(pool, manifest, ".tmp", NULL);
+  FILE*       file         = fopen(manifest_tmp, "w");
+  int         rv           = 0;
+
+  if (NULL == file)
+    return -1;
+
+  if (0 > fprintf(file, "%s\n", base_name(kv_pair_out)))
+    rv = -1;
+
+  for (int i = 0; i < merge->nb_inputs && 0 == rv; i++) {
+    if (0 > fprintf(file, "%s\n", base_name(merge->inputs[i]->kv_pair_path)) ||
+        (merge->inputs[i]->key_index_path && 0 > fprintf(file, "%s\n", base_name(merge->inputs[i]->key_index_path))))
+      rv = -1;
+  }
+
+  if (0 != sync_and_close(file))
+    rv = -1;
+
+  if (0 == rv && 0 != rename(manifest_tmp, manifest))
+    rv = -1;
+
+  if (0 != rv) {
+    unlink(manifest_tmp);
+    return -1;
+  }
+
+  sync_directory(directory);
+
+  return 0;
+}
+
+
+int compact_merge_task(void *context, size_t task)
+{
+  compact_round_t* round = context;
+  compact_merge_t* merge = & round->merges[task];
+  apr_pool_t*      pool;
+  int              rv    = 0;
+
+  /* every merge runs on its own thread, with its own pool */
+  if (APR_SUCCESS != apr_pool_create(& pool, NULL))
+    return -1;
+
+  FILE** kv_pair_inputs   = apr_pcalloc(pool, merge->nb_inputs * sizeof(FILE*));
+  FILE** key_index_inputs = apr_pcalloc(pool, merge->nb_inputs * sizeof(FILE*));
+
+  for (int i = 0; i < merge->nb_inputs; i++) {
+    compact_set_t* set = merge->inputs[i];
+
+    kv_pair_inputs[i]   = fopen(set->kv_pair_path, "rb");
+    key_index_inputs[i] = set->key_index_path ? fopen(set->key_index_path, "rb") : NULL;
+
+    if (!kv_pair_inputs[i] || (set->key_index_path && !key_index_inputs[i]))
+      rv = -1;
+  }
+
+  const char* kv_pair_out   = apr_pstrcat(pool, merge->output, round->single ? ".tlv" : ".kv_pair.tlv", NULL);
+  const char* key_index_out = apr_pstrcat(pool, merge->output, ".key_index.tlv", NULL);
+  const char* kv_pair_tmp   = apr_pstrcat(pool, kv_pair_out, ".tmp", NULL);
+  const char* key_index_tmp = apr_pstrcat(pool, key_index_out, ".tmp", NULL);
+
+  if (0 == rv) {
+    FILE* kv_pair_file   = fopen(kv_pair_tmp, "wb");
+    FILE* key_index_file = round->single ? NULL : fopen(key_index_tmp, "wb");
+
+    if (!kv_pair_file || (!round->single && !key_index_file))
+      rv = -1;
+
+    /*
+     *  the blocks are copied with their keys renumbered, a few blocks in memory at a time; the sets
+     *  which cannot be copied, or whose blocks get new Bloom filters, are decoded in memory whole
+     */
+    if (0 == rv && !round->bloom_values)
+      rv = jp_transcode_file_sets(pool, kv_pair_inputs, round->single ? NULL : key_index_inputs, merge->nb_inputs,
+                                  kv_pair_file, key_index_file);
+    else if (0 == rv)
+      rv = 1;
+
+    if (1 == rv) {
+      jp_TLV_records_t* tlv_records = jp_TLV_record_collection_make(pool);
+
+      jp_enable_string_interning(tlv_records, pool);
+
+      if (round->bloom_values)
+        jp_enable_block_filters(tlv_records, (const char* const*) round->bloom_values->elts, round->bloom_values->nelts);
+
+      rv = 0;
+
+      for (int i = 0; i < merge->nb_inputs && 0 == rv; i++) {
+        rewind(kv_pair_inputs[i]);
+
+        if (key_index_inputs[i])
+          rewind(key_index_inputs[i]);
+
+        rv = jp_import_records_from_file_set(tlv_records, kv_pair_inputs[i], key_index_inputs[i]);
+      }
+
+      if (0 == rv)
+        rv = jp_export_records_to_file_set(tlv_records, kv_pair_file, key_index_file);
+    }
+
+    if (kv_pair_file && 0 != sync_and_close(kv_pair_file))
+      rv = -1;
+
+    if (key_index_file && 0 != sync_and_close(key_index_file))
+      rv = -1;
+  }
+
+  for (int i = 0; i < merge->nb_inputs; i++) {
+    if (kv_pair_inputs[i])
+      fclose(kv_pair_inputs[i]);
+
+    if (key_index_inputs[i])
+      fclose(key_index_inputs[i]);
+  }
+
+  /* the manifest makes the merge recoverable once committed: the output then replaces its inputs */
+  if (0 == rv && 0 != write_merge_manifest(pool, merge, kv_pair_out, round->directory))
+    rv = -1;
+
+  /* a kv-pair file is what makes a set visible, it is renamed last */
+  if (0 == rv && !round->single && 0 != rename(key_index_tmp, key_index_out))
+    rv = -1;
+
+  if (0 == rv && 0 != rename(kv_pair_tmp, kv_pair_out))
+    rv = -1;
+
+  if (0 == rv) {
+    sync_directory(round->directory);
+
+    /* with the value index json_packer --index wrote of the kv-pairs, which no longer exist */
+    for (int i = 0; i < merge->nb_inputs; i++) {
+      unlink(merge->inputs[i]->kv_pair_path);
+      unlink(apr_pstrcat(pool, merge->inputs[i]->kv_pair_path, ".idx", NULL));
+
+      if (merge->inputs[i]->key_index_path)
+        unlink(merge->inputs[i]->key_index_path);
+    }
+
+    sync_directory(round->directory);
+    unlink(apr_pstrcat(pool, merge->output, ".consumed", NULL));
+
+    printf("merged %d file sets of tier %u into %s\n", merge->nb_inputs, merge->inputs[0]->tier, kv_pair_out);
+  }
+  else {
+    fprintf(stderr, "error: cannot merge into %s, its inputs are kept\n", kv_pair_out);
+    unlink(apr_pstrcat(pool, merge->output, ".consumed", NULL));
+    unlink(kv_pair_tmp);
+    unlink(key_index_tmp);
+
+    if (!round->single)
+      unlink(key_index_out);
+  }
+
+  apr_pool_destroy(pool);
+
+  return rv;
+}
+
+
+/*
+ *  size tiered compaction: tier 0 holds the sets smaller than base_size, and every next tier
+ *  sets fanout times larger. Only fanout sets of the same tier are merged together, so a record
+ *  is rewritten about once per tier, log_fanout(total size / base_size) times at most
+ */
+int compact_directory(apr_pool_t         *p,
+                      const char         *directory,
+                      int                 single,
+                      unsigned int        fanout,
+                      unsigned int        nb_jobs,
+                      apr_off_t           base_size,
+                      apr_array_header_t *bloom_values)
+{
+  unsigned int sequence = 0;
+
+  while (1) {
+    apr_pool_t* round_pool;
+    apr_pool_create(& round_pool, p);
+
+    apr_array_header_t* sets = scan_file_sets(round_pool, directory);
+
+    if (NULL == sets) {
+      apr_pool_destroy(round_pool);
+      return -1;
+    }
+
+    unsigned int max_tier = 0;
+
+    for (int i = 0; i < sets->nelts; i++) {
+      compact_set_t* set   = ((compact_set_t**) sets->elts)[i];
+      apr_off_t      bound = base_size;
+
+      for (set->tier = 0; set->size >= bound; set->tier++)
+        bound *= fanout;
+
+      if (set->tier > max_tier)
+        max_tier = set->tier;
+    }
+
+    apr_array_header_t* merges = apr_array_make(round_pool, 16, sizeof(compact_merge_t));
+
+    for (unsigned int tier = 0; tier <= max_tier; tier++) {
+      compact_merge_t* merge = NULL;
+
+      for (int i = 0; i < sets->nelts; i++) {
+        compact_set_t* set = ((compact_set_t**) sets->elts)[i];
+
+        if (set->tier != tier)
+          continue;
+
+        if (NULL == merge) {
+          merge            = apr_array_push(merges);
+          merge->inputs    = apr_pcalloc(round_pool, fanout * sizeof(compact_set_t*));
+          merge->nb_inputs = 0;
+          merge->output    = apr_psprintf(round_pool, "%s/compact-%" APR_INT64_T_FMT "-%ld-%06u", directory,
+                                          (apr_int64_t) apr_time_sec(apr_time_now()), (long) getpid(), ++sequence);
+        }
+
+        merge->inputs[merge->nb_inputs++] = set;
+
+        if (merge->nb_inputs == fanout)
+          merge = NULL;
+      }
+
+      /* a tier with less than fanout sets left waits for more */
+      if (merge)
+        merges->nelts--;
+    }
+
+    if (0 == merges->nelts) {
+      apr_pool_destroy(round_pool);
+      return 0;
+    }
+
+    compact_round_t round;
+
+    round.merges       = (compact_merge_t*) merges->elts;
+    round.directory    = directory;
+    round.single       = single;
+    round.bloom_values = bloom_values;
+
+    size_t nb_failures = jp_worker_pool_run(round_pool, nb_jobs, merges->nelts, compact_merge_task, & round);
+
+    apr_pool_destroy(round_pool);
+
+    /* failed merges would be retried forever */
+    if (nb_failures > 0)
+      return -1;
+  }
+}
+
+
+/* sorting */
+
+int sort_file_sets(apr_pool_t         *p,
+                   const char* const  *paths,
+                   int                 nb_sets,
+                   int                 single,
+                   const char         *sort_key,
+                   size_t              memory_budget,
+                   const char         *directory,
+                   apr_array_header_t *bloom_values)
+{
+  FILE** kv_pair_inputs   = apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  FILE** key_index_inputs = single ? NULL : apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  int    rv               = 0;
+
+  for (int i = 0; i < nb_sets && 0 == rv; i++) {
+    const char* kv_pair_input   = single ? paths[i] : paths[2 * i];
+    const char* key_index_input = single ? NULL : paths[2 * i + 1];
+
+    if (single)
+      printf("processing file: %s \n", kv_pair_input);
+    else
+      printf("processing file set: %s - %s \n", kv_pair_input, key_index_input);
+
+    kv_pair_inputs[i] = open_filename(kv_pair_input, "rb", 0);
+
+    if (!single)
+      key_index_inputs[i] = open_filename(key_index_input, "rb", 0);
+
+    if (NULL == kv_pair_inputs[i] || (!single && NULL == key_index_inputs[i]))
+      rv = -1;
+  }
+
+  const char* key_index_out = "consolidated_key_index.tlv";
+  const char* kv_pair_out   = single ? "consolidated.tlv" : "consolidated_kv_pair.tlv";
+
+  jp_TLV_records_t* tlv_records = jp_TLV_record_collection_make(p);
+
+  if (bloom_values)
+    jp_enable_block_filters(tlv_records, (const char* const*) bloom_values->elts, bloom_values->nelts);
+
+  FILE* kv_pair_file   = (0 == rv) ? open_filename(kv_pair_out, "wb", 0) : NULL;
+  FILE* key_index_file = (0 == rv && !single) ? open_filename(key_index_out, "wb", 0) : NULL;
+
+  if (NULL == kv_pair_file || (!single && NULL == key_index_file))
+    rv = -1;
+  else
+    rv = jp_sort_file_sets(tlv_records, kv_pair_inputs, key_index_inputs, nb_sets, sort_key, memory_budget, directory,
+                           kv_pair_file, key_index_file);
+
+  if (kv_pair_file)
+    close_filename(kv_pair_out, kv_pair_file);
+
+  if (key_index_file)
+    close_filename(key_index_out, key_index_file);
+
+  for (int i = 0; i < nb_sets; i++) {
+    if (kv_pair_inputs[i])
+      fclose(kv_pair_inputs[i]);
+
+    if (!single && key_index_inputs[i])
+      fclose(key_index_inputs[i]);
+  }
+
+  if (0 == rv && single)
+    printf("consolidated file sorted by %s: %s. Success\n", sort_key, kv_pair_out);
+  else if (0 == rv)
+    printf("consolidated file set sorted by %s: %s - %s. Success\n", sort_key, kv_pair_out, key_index_out);
+  else
+    fprintf(stderr, "error: cannot sort the file sets by %s\n", sort_key);
+
+  return rv;
+}
+
+
+/* partitions */
+
+/* the files of a partition are named after the output files, with the number of the partition before their extension */
+const char* partition_filename(apr_pool_t *p, const char *filename, uint32_t partition)
+{
+  const char* extension = strrchr(filename, '.');
+  const char* separator = strrchr(filename, '/');
+
+  if (NULL == extension || extension == filename || (separator && separator > extension))
+    return apr_psprintf(p, "%s-%04u", filename, partition);
+
+  return apr_psprintf(p, "%.*s-%04u%s", (int) (extension - filename), filename, partition, extension);
+}
+
+
+int write_partitions(apr_pool_t         *p,
+                     jp_TLV_records_t   *tlv_records,
+                     const char         *partition_key,
+                     uint32_t            nb_partitions,
+                     unsigned int        nb_jobs,
+                     const char         *kv_pair_name,
+                     const char         *key_index_name,
+                     apr_array_header_t *index_keys)
+{
+  const char** kv_pair_names   = apr_pcalloc(p, nb_partitions * sizeof(const char*));
+  const char** key_index_names = apr_pcalloc(p, nb_partitions * sizeof(const char*));
+  FILE**       kv_pair_files   = apr_pcalloc(p, nb_partitions * sizeof(FILE*));
+  FILE**       key_index_files = key_index_name ? apr_pcalloc(p, nb_partitions * sizeof(FILE*)) : NULL;
+  int          rv              = 0;
+
+  for (uint32_t i = 0; i < nb_partitions; i++) {
+    kv_pair_names[i] = partition_filename(p, kv_pair_name, i);
+    kv_pair_files[i] = open_filename(kv_pair_names[i], "wb", 0);
+
+    if (key_index_name) {
+      key_index_names[i] = partition_filename(p, key_index_name, i);
+      key_index_files[i] = open_filename(key_index_names[i], "wb", 0);
+    }
+
+    if (NULL == kv_pair_files[i] || (key_index_name && NULL == key_index_files[i]))
+      rv = -1;
+  }
+
+  if (0 == rv)
+    rv = jp_export_records_to_partitions(tlv_records, partition_key, kv_pair_files, key_index_files, nb_partitions, nb_jobs);
+
+  for (uint32_t i = 0; i < nb_partitions; i++) {
+    if (kv_pair_files[i])
+      fclose(kv_pair_files[i]);
+
+    if (key_index_name && key_index_files[i])
+      fclose(key_index_files[i]);
+  }
+
+  for (uint32_t i = 0; 0 == rv && index_keys->nelts > 0 && i < nb_partitions; i++)
+    rv = write_value_index(p, kv_pair_names[i], key_index_names[i], apr_pstrcat(p, kv_pair_names[i], ".idx", NULL), index_keys);
+
+  if (0 == rv)
+    printf("%u partitions by %s: %s - %s. Success\n", nb_partitions, partition_key, kv_pair_names[0], kv_pair_names[nb_partitions - 1]);
+  else
+    fprintf(stderr, "error: cannot write the partitions by %s\n", partition_key);
+
+  return rv;
+}
+
+
 int main(int                argc,
          const char* const *argv)
 {
@@ -42,14 +710,150 @@ int main(int                argc,
   apr_app_initialize(&argc, &argv, NULL);
   atexit(apr_terminate);
 
-  if (argc % 2 != 1) {
-    fprintf(stderr, "Expecting two input files per set to consolidate (a kv-pair TLV file and a key index TLV file, in that order), received %d. Exiting \n", argc - 1);
+  apr_pool_create(&p, NULL);
+
+  static const apr_getopt_option_t options[] = {
+    { "single-file",  's', 0, "consolidate single container files into a single container file" },
+    { "compact",      'c', 1, "compact the file sets of a directory in size tiers, merging sets of the same tier" },
+    { "fanout",       'f', 1, "with --compact, the number of sets merged together and the size ratio between tiers (4)" },
+    { "jobs",         'j', 1, "the number of file sets decoded in parallel, or with --compact of merges running in parallel (4)" },
+    { "base-size",    'b', 1, "with --compact, the size in bytes under which sets are in the first tier (1048576)" },
+    { "bloom",        'B', 0, "attach a Bloom filter of the keys to every block written" },
+    { "bloom-value",  'V', 1, "also add the string values of a key to the Bloom filters (repeatable, implies --bloom)" },
+    { "cluster",      'C', 0, "group the records by shape (their keys) before writing them" },
+    { "cluster-key",  'K', 1, "within a shape, sort the records by the value of this key (implies --cluster)" },
+    { "keep-order",   'O', 0, "with --cluster, write the arrival order of the records so that imports restore it" },
+    { "sort-by",      'S', 1, "sort the records by the value of this key, with an external merge sort" },
+    { "sort-memory",  'M', 1, "with --sort-by, the bytes of records held in memory at once (268435456)" },
+    { "sort-dir",     'T', 1, "with --sort-by, the directory of the temporary sorted runs (.)" },
+    { "dictionary",   'D', 1, "number the keys of the output as in this shared key dictionary, copying the blocks of file sets numbered by it" },
+    { "index",        'I', 1, "write a value index of a key next to the consolidated kv-pairs, for tlv_unpacker --index (repeatable)" },
+    { "partition-by", 'P', 1, "route every record by the hash of the value of this key to one of --partitions file sets" },
+    { "partitions",   'N', 1, "with --partition-by, the number of file sets written side by side (--jobs at a time)" },
+    { NULL,            0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  int           single = 0;
+  const char   *compact_dir = NULL;
+  apr_int64_t   fanout = 4, nb_jobs = 4, base_size = 1024 * 1024;
+  int           bloom  = 0;
+  int           cluster     = 0;
+  const char   *cluster_key = NULL;
+  int           keep_order  = 0;
+  const char   *sort_key    = NULL;
+  apr_int64_t   sort_memory = JP_SORT_DEFAULT_MEMORY;
+  const char   *sort_dir    = ".";
+  const char   *dictionary  = NULL;
+  const char   *partition_key = NULL;
+  apr_int64_t   nb_partitions = 0;
+
+  apr_array_header_t* bloom_values = apr_array_make(p, 4, sizeof(const char*));
+  apr_array_header_t* index_keys   = apr_array_make(p, 4, sizeof(const char*));
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 's':
+      single = 1;
+      break;
+
+      case 'c':
+      compact_dir = optarg;
+      break;
+
+      case 'f':
+      fanout = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'j':
+      nb_jobs = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'b':
+      base_size = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'V':
+      *(const char**) apr_array_push(bloom_values) = optarg;
+      /* fall through */
+
+      case 'B':
+      bloom = 1;
+      break;
+
+      case 'K':
+      cluster_key = optarg;
+      /* fall through */
+
+      case 'C':
+      cluster = 1;
+      break;
+
+      case 'O':
+      keep_order = 1;
+      break;
+
+      case 'S':
+      sort_key = optarg;
+      break;
+
+      case 'M':
+      sort_memory = apr_strtoi64(optarg, NULL, 10);
+      break;
+
+      case 'T':
+      sort_dir = optarg;
+      break;
+
+      case 'D':
+      dictionary = optarg;
+      break;
+
+      case 'I':
+      *(const char**) apr_array_push(index_keys) = optarg;
+      break;
+
+      case 'P':
+      partition_key = optarg;
+      break;
+
+      case 'N':
+      nb_partitions = apr_strtoi64(optarg, NULL, 10);
+      break;
+    }
+  }
+
+  if (APR_EOF != rv || fanout < 2 || nb_jobs < 1 || base_size < 1 || sort_memory < 1 || (compact_dir && (cluster || sort_key || index_keys->nelts > 0 || dictionary)) || (cluster && sort_key) || (sort_key && dictionary) ||
+      (NULL != partition_key) != (nb_partitions > 0) || nb_partitions < 0 || nb_partitions > UINT16_MAX || (partition_key && (compact_dir || sort_key))) {
+    fprintf(stderr, "Usage: tlv_consolidator [--single-file] [--bloom] [--bloom-value key ...] [--cluster [--cluster-key key] [--keep-order]] [--index key ...] [--dictionary keys.dict] [--partition-by key --partitions N] [--jobs N] kv_pair_1.tlv key_index_1.tlv kv_pair_2.tlv key_index_2.tlv ...\n"
+                    "       tlv_consolidator --sort-by key [--sort-memory N] [--sort-dir directory] [--single-file] [--bloom] [--bloom-value key ...] [--index key ...] kv_pair_1.tlv key_index_1.tlv ...\n"
+                    "       tlv_consolidator --compact directory [--single-file] [--bloom] [--bloom-value key ...] [--fanout N] [--jobs N] [--base-size N]\n");
+
+    rv = -1;
+    goto terminate;
+  }
+
+  if (compact_dir) {
+    rv = compact_directory(p, compact_dir, single, fanout, nb_jobs, base_size, bloom ? bloom_values : NULL);
+    goto terminate;
+  }
+
+  int nb_args       = argc - opt->ind;
+  int files_per_set = single ? 1 : 2;
+
+  if (nb_args % files_per_set != 0) {
+    fprintf(stderr, "Expecting two input files per set to consolidate (a kv-pair TLV file and a key index TLV file, in that order), received %d. Exiting \n", nb_args);
 
     rv = -1;
     goto terminate;
   }
 
-  if (argc < 5) {
+  /* a single file set can still be sorted */
+  if (nb_args < (sort_key ? 1 : 2) * files_per_set) {
     fprintf(stderr, "Received a single file set, nothing to consolidate, exiting \n");
 
     rv = -1;
@@ -57,30 +861,133 @@ int main(int                argc,
   }
 
   const char* consolidated_key_index_out = "consolidated_key_index.tlv";
-  const char* consolidated_kv_pair_out   = "consolidated_kv_pair.tlv";
+  const char* consolidated_kv_pair_out   = single ? "consolidated.tlv" : "consolidated_kv_pair.tlv";
+  const char* consolidated_index_out     = apr_pstrcat(p, consolidated_kv_pair_out, ".idx", NULL);
 
-  apr_pool_create(&p, NULL);
+  if (sort_key) {
+    rv = sort_file_sets(p, argv + opt->ind, nb_args / files_per_set, single, sort_key, sort_memory, sort_dir, bloom ? bloom_values : NULL);
+
+    if (0 == rv && index_keys->nelts > 0)
+      rv = write_value_index(p, consolidated_kv_pair_out, single ? NULL : consolidated_key_index_out, consolidated_index_out, index_keys);
+
+    goto terminate;
+  }
 
   jp_TLV_records_t* tlv_records = jp_TLV_record_collection_make(p);
 
+  jp_enable_string_interning(tlv_records, p);
+
+  if (bloom)
+    jp_enable_block_filters(tlv_records, (const char* const*) bloom_values->elts, bloom_values->nelts);
+
+  if (cluster)
+    jp_enable_record_clustering(tlv_records, JP_CLUSTER_DEFAULT_WINDOW, cluster_key, keep_order);
 
-  for(int i = 1; i < argc; i += 2)
+  /* the file sets are decoded side by side, and their records added in the order of the arguments */
+  int    nb_sets          = nb_args / files_per_set;
+  FILE** kv_pair_inputs   = apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  FILE** key_index_inputs = single ? NULL : apr_pcalloc(p, nb_sets * sizeof(FILE*));
+  int    opened           = 1;
+
+  for (int i = 0; i < nb_sets; i++)
   {
-    const char* kv_pair_input   = argv[i];
-    const char* key_index_input = argv[i+1];
+    const char* kv_pair_input   = argv[opt->ind + i * files_per_set];
+    const char* key_index_input = single ? NULL : argv[opt->ind + i * files_per_set + 1];
 
-    printf("processing file set: %s - %s \n", kv_pair_input, key_index_input);
+    if (single)
+      printf("processing file: %s \n", kv_pair_input);
+    else
+      printf("processing file set: %s - %s \n", kv_pair_input, key_index_input);
 
-    FILE* kv_pair_file   = open_filename(kv_pair_input, "rb", 0);
-    FILE* key_index_file = open_filename(key_index_input, "rb", 0);
+    kv_pair_inputs[i] = open_filename(kv_pair_input, "rb", 0);
 
-    jp_import_records_from_file_set(tlv_records, kv_pair_file, key_index_file);
+    if (!single)
+      key_index_inputs[i] = open_filename(key_index_input, "rb", 0);
 
-    close_filename(kv_pair_input, kv_pair_file);
-    close_filename(key_index_input, key_index_file);
+    if (NULL == kv_pair_inputs[i] || (!single && NULL == key_index_inputs[i]))
+      opened = 0;
   }
 
-  {
+  /* the blocks are copied without decoding them: as they are if the file sets are numbered by the same key
+     dictionary, with their keys renumbered otherwise */
+  int copied = 0;
+
+  if (opened && !bloom && !cluster && !partition_key) {
+    FILE* kv_pair_out   = open_filename(consolidated_kv_pair_out, "wb", 0);
+    FILE* key_index_out = single ? NULL : open_filename(consolidated_key_index_out, "wb", 0);
+
+    int copy_rv = -1;
+
+    if (kv_pair_out && (single || key_index_out) && dictionary)
+      copy_rv = jp_concatenate_file_sets(p, kv_pair_inputs, key_index_inputs, nb_sets, kv_pair_out, key_index_out);
+    else if (kv_pair_out && (single || key_index_out))
+      copy_rv = jp_transcode_file_sets(p, kv_pair_inputs, key_index_inputs, nb_sets, kv_pair_out, key_index_out);
+
+    if (kv_pair_out)
+      close_filename(consolidated_kv_pair_out, kv_pair_out);
+
+    if (key_index_out)
+      close_filename(consolidated_key_index_out, key_index_out);
+
+    if (0 == copy_rv) {
+      copied = 1;
+    } else if (1 == copy_rv) {
+      printf("the blocks of the file sets cannot be copied, decoding them \n");
+
+      for (int i = 0; i < nb_sets; i++) {
+        rewind(kv_pair_inputs[i]);
+
+        if (!single)
+          rewind(key_index_inputs[i]);
+      }
+    } else {
+      opened = 0;
+    }
+  }
+
+  int imported = copied || (opened && 0 == jp_import_file_sets(tlv_records, kv_pair_inputs, key_index_inputs, nb_sets, (unsigned int) nb_jobs));
+
+  for (int i = 0; i < nb_sets; i++) {
+    if (kv_pair_inputs[i])
+      close_filename(argv[opt->ind + i * files_per_set], kv_pair_inputs[i]);
+
+    if (!single && key_index_inputs[i])
+      close_filename(argv[opt->ind + i * files_per_set + 1], key_index_inputs[i]);
+  }
+
+  if (!imported) {
+    fprintf(stderr, "error: cannot import the file sets to consolidate \n");
+
+    rv = -1;
+    goto terminate;
+  }
+
+  if (!copied && dictionary && 0 != jp_bind_key_dictionary(tlv_records, dictionary, NULL)) {
+    rv = -1;
+    goto terminate;
+  }
+
+  if (partition_key) {
+    rv = write_partitions(p, tlv_records, partition_key, (uint32_t) nb_partitions, (unsigned int) nb_jobs,
+                          consolidated_kv_pair_out, single ? NULL : consolidated_key_index_out, index_keys);
+    goto terminate;
+  }
+
+  if (copied) {
+    printf("consolidated %d file sets by copying their blocks: %s. Success\n", nb_sets, consolidated_kv_pair_out);
+    rv = 0;
+  }
+  else if (single) {
+    FILE* consolidated_file = open_filename(consolidated_kv_pair_out, "wb", 0);
+
+    rv = consolidated_file ? jp_export_records_to_file_set(tlv_records, consolidated_file, NULL) : -1;
+
+    close_filename(consolidated_kv_pair_out, consolidated_file);
+
+    if (0 == rv)
+      printf("consolidated file: %s. Success\n", consolidated_kv_pair_out);
+  }
+  else {
     FILE* consolidated_kv_pair_file   = open_filename(consolidated_kv_pair_out, "wb", 0);
     FILE* consolidated_key_index_file = open_filename(consolidated_key_index_out, "wb", 0);
 
@@ -93,6 +1000,10 @@ int main(int                argc,
     rv = -1;
   }
 
+  if (index_keys->nelts > 0 &&
+      0 != write_value_index(p, consolidated_kv_pair_out, single ? NULL : consolidated_key_index_out, consolidated_index_out, index_keys))
+    rv = -1;
+
   terminate:
   apr_terminate();
   return rv;
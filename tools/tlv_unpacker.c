@@ -1,7 +1,9 @@
 
 #include <apr.h>
+#include <apr_getopt.h>
 #include <apr_hash.h>
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -33,32 +35,235 @@ void close_filename(const char *filename, FILE *file)
 }
 
 
+void print_kv_pair(uint64_t record_number, const char *key, const jp_TLV_kv_pair_t *elem)
+{
+  printf(" record[ %d ]: key=%s, ", (int) record_number, key);
+
+  switch(elem->value_type) {
+    case JP_TYPE_BOOLEAN:
+    {
+      int value;
+      jp_read_boolean_from_kv_pair(elem, & value);
+
+      printf(" value=%s \n", value ? "true" : "false");
+    }
+    break;
+
+    case JP_TYPE_INTEGER:
+    {
+      uint32_t value;
+      jp_read_integer_from_kv_pair(elem, & value);
+
+      printf(" value=%d \n", value);
+    }
+    break;
+
+    case JP_TYPE_DOUBLE:
+    {
+      double value;
+      jp_read_double_from_kv_pair(elem, & value);
+
+      printf(" value=%f \n", value);
+    }
+    break;
+
+    case JP_TYPE_STRING:
+    {
+      char *value;
+      jp_read_string_from_kv_pair(elem, & value);
+
+      printf(" value=%s \n", value);
+    }
+    break;
+
+    default:
+    break;
+  }
+}
+
+
+int print_scanned_record(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index)
+{
+  apr_array_header_t* kv_pairs_array = record->kv_pairs_array;
+
+  for (int j = 0; j < kv_pairs_array->nelts; j++) {
+    jp_TLV_kv_pair_t* elem = & ((jp_TLV_kv_pair_t*)kv_pairs_array->elts)[j];
+
+    print_kv_pair(record_number, jp_key_index_map_key(key_index, elem->key_index, NULL), elem);
+  }
+
+  return 0;
+}
+
+
+/* a record the writer fails on stops the scan, which then succeeds */
+static int write_failed = 0;
+
+int write_scanned_record(void *context, uint64_t record_number, const jp_TLV_record_t *record, const jp_key_index_map_t *key_index)
+{
+  if (0 != jp_json_line_writer_add_record(context, record, key_index)) {
+    fprintf(stderr, "error: cannot write record %d \n", (int) record_number);
+    write_failed = 1;
+    return 1;
+  }
+
+  return 0;
+}
+
+
 int main(int                argc,
          const char* const *argv)
 {
   apr_status_t rv;
   apr_pool_t  *p = NULL;
+  int          ret = EXIT_FAILURE;
 
   apr_app_initialize(&argc, &argv, NULL);
   atexit(apr_terminate);
 
-  const char* kvpairinfile   = (argc > 1) ? argv[1] : "kv_pair.tlv";
-  const char* keyarrayinfile = (argc > 2) ? argv[2] : "key_index.tlv";
-
   apr_pool_create(&p, NULL);
 
+  static const apr_getopt_option_t options[] = {
+    { "single-file", 's', 0, "read a single container file holding both the key index and the kv-pairs" },
+    { "key",         'k', 1, "only print the records holding a key, skipping the blocks whose Bloom filter rules it out" },
+    { "value",       'v', 1, "with --key, only print the records where the key has this string value" },
+    { "min",         'm', 1, "with --key, only print the records where the key has a numeric value of at least this" },
+    { "max",         'M', 1, "with --key, only print the records where the key has a numeric value of at most this" },
+    { "format",      'f', 1, "output format: text (the default) or jsonl, one JSON object per record" },
+    { "index",       'i', 1, "with --key and --value, only decode the blocks this value index of the file set lists for the value" },
+    { NULL,          0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  int           single = 0;
+  const char   *key    = NULL;
+  const char   *value  = NULL;
+  int           range  = 0;
+  double        min    = -INFINITY;
+  double        max    = INFINITY;
+  int           jsonl  = 0;
+  const char   *index_file = NULL;
+  int           usage  = 0;
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 's':
+      single = 1;
+      break;
+
+      case 'k':
+      key = optarg;
+      break;
+
+      case 'v':
+      value = optarg;
+      break;
+
+      case 'm':
+      min   = strtod(optarg, NULL);
+      range = 1;
+      break;
+
+      case 'M':
+      max   = strtod(optarg, NULL);
+      range = 1;
+      break;
+
+      case 'i':
+      index_file = optarg;
+      break;
+
+      case 'f':
+      if (0 == strcmp(optarg, "jsonl"))
+        jsonl = 1;
+      else if (0 != strcmp(optarg, "text"))
+        usage = 1;
+      break;
+    }
+  }
+
+  if (APR_EOF != rv || usage || ((value || range) && !key) || (value && range) || (index_file && !value)) {
+    fprintf(stderr, "Usage: tlv_unpacker [--single-file] [--format text|jsonl] [--key key [--value value [--index kv_pair.tlv.idx] | --min min --max max]] [kv_pair.tlv] [key_index.tlv]\n");
+    goto terminate;
+  }
+
+  int         nb_args        = argc - opt->ind;
+  const char* kvpairinfile   = (nb_args > 0) ? argv[opt->ind] : (single ? "records.tlv" : "kv_pair.tlv");
+  const char* keyarrayinfile = (nb_args > 1) ? argv[opt->ind + 1] : "key_index.tlv";
+
+  /* queries, and JSON lines, stream the records block by block from the mapped files */
+  if (key || jsonl) {
+    FILE* kvpairin = open_filename(kvpairinfile, "rb", 1);
+    FILE* kindexin = single ? NULL : open_filename(keyarrayinfile, "rb", 1);
+    FILE* indexin  = index_file ? open_filename(index_file, "rb", 1) : NULL;
+
+    jp_value_index_t* index = indexin ? jp_value_index_open(p, indexin) : NULL;
+
+    jp_json_line_writer_t* writer    = jsonl ? jp_json_line_writer_make(p, stdout) : NULL;
+    jp_scan_record_fn      record_fn = jsonl ? write_scanned_record : print_scanned_record;
+
+    jp_scan_report_t report;
+
+    int scan_ret = -1;
+
+    if (kvpairin && (single || kindexin) && index)
+      scan_ret = jp_lookup_file_set(p, index, kvpairin, kindexin, key, value, record_fn, writer, & report);
+    else if (kvpairin && (single || kindexin) && !index_file)
+      scan_ret = range ? jp_scan_file_set_range(p, kvpairin, kindexin, key, min, max, record_fn, writer, & report)
+                       : jp_scan_file_set(p, kvpairin, kindexin, key, value, record_fn, writer, & report);
+
+    if (writer)
+      jp_json_line_writer_flush(writer);
+
+    if (0 == scan_ret && !write_failed)
+      ret = EXIT_SUCCESS;
+
+    if (0 == scan_ret && key)
+      fprintf(stderr, "%" APR_UINT64_T_FMT " of %" APR_UINT64_T_FMT " blocks skipped, %" APR_UINT64_T_FMT " records matched \n",
+              report.nb_blocks_skipped, report.nb_blocks, report.nb_records_matched);
+
+    if (indexin)
+      close_filename(index_file, indexin);
+
+    if (kindexin)
+      close_filename(keyarrayinfile, kindexin);
+
+    close_filename(kvpairinfile, kvpairin);
+
+    goto terminate;
+  }
+
   jp_TLV_records_t* tlv_records = jp_TLV_record_collection_make(p);
 
-  {
+  int import_ret = -1;
+
+  if (single) {
+    FILE* kvpairin = open_filename(kvpairinfile, "rb", 0);
+
+    if (kvpairin)
+      import_ret = jp_import_records_from_file_set(tlv_records, kvpairin, NULL);
+
+    close_filename(kvpairinfile, kvpairin);
+  }
+  else {
     FILE* kvpairin = open_filename(kvpairinfile, "rb", 0);
     FILE* kindexin = open_filename(keyarrayinfile, "rb", 0);
 
-    jp_import_records_from_file_set(tlv_records, kvpairin, kindexin);
+    if (kvpairin && kindexin)
+      import_ret = jp_import_records_from_file_set(tlv_records, kvpairin, kindexin);
 
     close_filename(keyarrayinfile, kindexin);
     close_filename(kvpairinfile, kvpairin);
   }
 
+  /* the records imported before a corrupted block are still printed */
+  if (0 == import_ret)
+    ret = EXIT_SUCCESS;
+
   apr_array_header_t* key_array    = jp_build_key_array_from_key_index(tlv_records->key_index);
   apr_array_header_t* record_array = tlv_records->record_list;
 
@@ -70,53 +275,11 @@ int main(int                argc,
     for (int j = 0; j < kv_pairs_array->nelts; j++) {
       jp_TLV_kv_pair_t* elem = & ((jp_TLV_kv_pair_t*)kv_pairs_array->elts)[j];
 
-      const char* key = ((const char**) key_array->elts)[elem->key_index - 1];
-      printf(" record[ %d ]: key=%s, ", i, key);
-
-      switch(elem->value_type) {
-        case JP_TYPE_BOOLEAN:
-        {
-          int value;
-          jp_read_boolean_from_kv_pair(elem, & value);
-
-          printf(" value=%s \n", value ? "true" : "false");
-        }
-        break;
-
-        case JP_TYPE_INTEGER:
-        {
-          uint32_t value;
-          jp_read_integer_from_kv_pair(elem, & value);
-
-          printf(" value=%d \n", value);
-        }
-        break;
-
-        case JP_TYPE_DOUBLE:
-        {
-          double value;
-          jp_read_double_from_kv_pair(elem, & value);
-
-          printf(" value=%f \n", value);
-        }
-        break;
-
-        case JP_TYPE_STRING:
-        {
-          char *value;
-          jp_read_string_from_kv_pair(elem, & value);
-
-          printf(" value=%s \n", value);
-        }
-        break;
-
-        default:
-        break;
-      }
+      print_kv_pair(i, ((const char**) key_array->elts)[elem->key_index - 1], elem);
     }
   }
 
   terminate:
   apr_terminate();
-  return 0;
+  return ret;
 };
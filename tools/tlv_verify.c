@@ -0,0 +1,108 @@
+
+#include <apr.h>
+#include <apr_getopt.h>
+#include <apr_hash.h>
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jp_tlv_encoder.h"
+
+
+/* file utils */
+
+FILE *open_filename(const char *filename, const char *opt, int is_input)
+{
+	FILE *input;
+	if (strcmp(filename, "-") == 0)
+		input = (is_input) ? stdin : stdout;
+	else {
+		input = fopen(filename, opt);
+		if (!input) {
+			fprintf(stderr, "error: cannot open %s: %s", filename, strerror(errno));
+			return NULL;
+		}
+	}
+	return input;
+}
+
+
+void close_filename(const char *filename, FILE *file)
+{
+	if (file != NULL && strcmp(filename, "-") != 0)
+		fclose(file);
+}
+
+
+int main(int                argc,
+         const char* const *argv)
+{
+  apr_status_t rv;
+  apr_pool_t  *p = NULL;
+  int          ret = EXIT_FAILURE;
+
+  apr_app_initialize(&argc, &argv, NULL);
+  atexit(apr_terminate);
+
+  apr_pool_create(&p, NULL);
+
+  static const apr_getopt_option_t options[] = {
+    { "single-file", 's', 0, "verify a single container file holding both the key index and the kv-pairs" },
+    { NULL,          0,   0, NULL }
+  };
+
+  apr_getopt_t *opt;
+  int           optch;
+  const char   *optarg;
+  int           single = 0;
+
+  apr_getopt_init(&opt, p, argc, argv);
+
+  while (APR_SUCCESS == (rv = apr_getopt_long(opt, options, &optch, &optarg))) {
+    switch (optch) {
+      case 's':
+      single = 1;
+      break;
+    }
+  }
+
+  if (APR_EOF != rv) {
+    fprintf(stderr, "Usage: tlv_verify [--single-file] [kv_pair.tlv] [key_index.tlv]\n");
+    goto terminate;
+  }
+
+  int         nb_args        = argc - opt->ind;
+  const char* kvpairinfile   = (nb_args > 0) ? argv[opt->ind] : (single ? "records.tlv" : "kv_pair.tlv");
+  const char* keyarrayinfile = (nb_args > 1) ? argv[opt->ind + 1] : "key_index.tlv";
+
+  FILE* kvpairin = open_filename(kvpairinfile, "rb", 1);
+  FILE* kindexin = single ? NULL : open_filename(keyarrayinfile, "rb", 1);
+
+  if (NULL == kvpairin || (!single && NULL == kindexin))
+    goto terminate;
+
+  jp_verify_report_t report;
+
+  if (0 == jp_verify_file_set(p, kvpairin, kindexin, & report)) {
+    if (report.legacy)
+      printf("%s: OK, %u keys, written before the block framing: records not checked \n", kvpairinfile, report.nb_keys);
+    else
+      printf("%s: OK, %" PRIu64 " records in %u blocks (%u without checksum), %u keys \n",
+             kvpairinfile, report.nb_records, report.nb_blocks, report.nb_unchecked_blocks, report.nb_keys);
+
+    ret = EXIT_SUCCESS;
+  } else {
+    printf("%s: CORRUPTED \n", kvpairinfile);
+  }
+
+  if (kindexin)
+    close_filename(keyarrayinfile, kindexin);
+
+  close_filename(kvpairinfile, kvpairin);
+
+  terminate:
+  apr_pool_destroy(p);
+  apr_terminate();
+  return ret;
+};